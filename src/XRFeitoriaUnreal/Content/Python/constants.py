@@ -184,6 +184,10 @@ class RenderJobUnreal:
     anti_aliasing: AntiAliasSetting = AntiAliasSetting()
     export_vertices: bool = False
     export_skeleton: bool = False
+    shared_memory_name: Optional[str] = None
+    resume: bool = False
+    shard_index: int = 0
+    shard_count: int = 1
 
     def __post_init__(self):
         self.render_passes = [RenderPass(**rp) for rp in self.render_passes]
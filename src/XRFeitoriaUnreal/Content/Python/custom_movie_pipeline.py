@@ -1,4 +1,7 @@
+import json
 import os
+import re
+from pathlib import Path
 from typing import Callable, Dict, List, Optional, Tuple
 
 import unreal
@@ -114,6 +117,117 @@ class CustomMoviePipeline:
         )
         export_setting.skeletal_mesh_operator_option.save_skeleton_position = enable
 
+    @staticmethod
+    def set_shared_memory_output(movie_preset: unreal.MoviePipelineMasterConfig, name: Optional[str] = None) -> None:
+        """Stream the frames into the shared memory region `name` while rendering, nothing when None."""
+        if name is None:
+            return
+        shared_memory_setting: unreal.MoviePipelineSharedMemoryOutput = movie_preset.find_or_add_setting_by_class(
+            unreal.MoviePipelineSharedMemoryOutput
+        )
+        shared_memory_setting.shared_memory_name = name
+
+    @staticmethod
+    def set_shard(
+        movie_preset: unreal.MoviePipelineMasterConfig, sequence_path: str, shard_index: int = 0, shard_count: int = 1
+    ) -> bool:
+        """Render the slice `shard_index` of the playback range of the sequence split in
+        `shard_count` contiguous slices, through the custom playback range. The outputs
+        write one container per shard, see ``MoviePipelineRenderShardSetting.h``.
+
+        Args:
+            movie_preset (unreal.MoviePipelineMasterConfig): The movie preset of the job.
+            sequence_path (str): Path of the sequence of the job.
+            shard_index (int, optional): Index of the slice to render. Defaults to 0.
+            shard_count (int, optional): Number of slices, 1 to render the whole sequence. Defaults to 1.
+
+        Returns:
+            bool: False when the slice is empty, the sequence having fewer frames than shards.
+        """
+        if shard_count <= 1:
+            return True
+        if not 0 <= shard_index < shard_count:
+            raise ValueError(f'shard_index ({shard_index}) must be in [0, {shard_count})')
+
+        sequence: unreal.LevelSequence = unreal.load_asset(sequence_path)
+        playback_start = sequence.get_playback_start()
+        num_frames = sequence.get_playback_end() - playback_start
+        start_frame = playback_start + num_frames * shard_index // shard_count
+        end_frame = playback_start + num_frames * (shard_index + 1) // shard_count
+        if start_frame >= end_frame:
+            return False
+
+        output_config: unreal.MoviePipelineOutputSetting = movie_preset.find_or_add_setting_by_class(
+            unreal.MoviePipelineOutputSetting
+        )
+        output_config.use_custom_playback_range = True
+        output_config.custom_start_frame = start_frame
+        output_config.custom_end_frame = end_frame
+        shard_setting: unreal.MoviePipelineRenderShardSetting = movie_preset.find_or_add_setting_by_class(
+            unreal.MoviePipelineRenderShardSetting
+        )
+        shard_setting.shard_index = shard_index
+        shard_setting.shard_count = shard_count
+        unreal.log(
+            f'Rendering shard {shard_index + 1}/{shard_count} of {sequence.get_name()}, frames [{start_frame}, {end_frame})'
+        )
+        return True
+
+    @staticmethod
+    def set_resume(movie_preset: unreal.MoviePipelineMasterConfig, sequence_path: str, output_path: str) -> bool:
+        """Resume a render from the manifests written by the outputs, see
+        ``XF_ResumeManifest.h``. The frames before the first incomplete one aren't
+        rendered again, the complete frames after it are rendered but not written.
+
+        Args:
+            movie_preset (unreal.MoviePipelineMasterConfig): The movie preset of the job.
+            sequence_path (str): Path of the sequence of the job.
+            output_path (str): Output path of the job.
+
+        Returns:
+            bool: False when every frame of the job is complete.
+        """
+        movie_preset.find_or_add_setting_by_class(unreal.CustomMoviePipelineOutput).skip_completed_frames = True
+        movie_preset.find_or_add_setting_by_class(unreal.MoviePipelineMeshOperator).skip_completed_frames = True
+
+        # the manifests of this shard, see set_shard
+        shard_setting = movie_preset.find_setting_by_class(unreal.MoviePipelineRenderShardSetting)
+        shard_suffix = ''
+        if shard_setting and shard_setting.shard_count > 1:
+            shard_suffix = f'_shard{shard_setting.shard_index:03d}of{shard_setting.shard_count:03d}'
+
+        sequence: unreal.LevelSequence = unreal.load_asset(sequence_path)
+        manifests = [
+            manifest
+            for manifest in sorted((Path(output_path) / '.xf_resume' / sequence.get_name()).glob('*.json'))
+            if ''.join(re.findall(r'_shard\d{3}of\d{3}$', manifest.stem)) == shard_suffix
+        ]
+        if len(manifests) != 1:
+            # the frame numbers of the manifests of several shots are local to each shot
+            return True
+        with open(manifests[0]) as f:
+            complete_frames = set(json.load(f)['frames'])
+
+        output_config: unreal.MoviePipelineOutputSetting = movie_preset.find_or_add_setting_by_class(
+            unreal.MoviePipelineOutputSetting
+        )
+        if output_config.use_custom_playback_range:
+            # the slice of a shard
+            start_frame = output_config.custom_start_frame
+            end_frame = output_config.custom_end_frame
+        else:
+            start_frame = sequence.get_playback_start()
+            end_frame = sequence.get_playback_end()
+        while start_frame < end_frame and start_frame in complete_frames:
+            start_frame += 1
+        if start_frame >= end_frame:
+            return False
+        output_config.use_custom_playback_range = True
+        output_config.custom_start_frame = start_frame
+        output_config.custom_end_frame = end_frame
+        unreal.log(f'Resuming {sequence.get_name()} from frame {start_frame}')
+        return True
+
     @staticmethod
     def add_render_passes(movie_preset: unreal.MoviePipelineMasterConfig, render_passes: List[RenderPass]) -> None:
         """Add render passes to a movie preset.
@@ -141,11 +255,11 @@ class CustomMoviePipeline:
                 render_pass_config.render_pass_name_rgb = pass_name
                 render_pass_config.extension_rgb = ext
             elif pass_name.lower() in material_path_keys:
-                # material = unreal.SoftObjectPath(material_map[pass_name])
-                material = unreal.load_asset(material_paths[pass_name.lower()])
-                _pass = unreal.CustomMoviePipelineRenderPass(
-                    enabled=enable, material=material, render_pass_name=pass_name, extension=ext
+                # the material is set by path and preloaded in the background, not loaded here
+                _pass = unreal.CustomMoviePipelineDeferredPass.make_render_pass(
+                    material_paths[pass_name.lower()], pass_name, ext
                 )
+                _pass.enabled = enable
                 additional_render_passes.append(_pass)
 
         render_pass_config.additional_render_passes = additional_render_passes
@@ -273,6 +387,7 @@ class CustomMoviePipeline:
         console_variables: Dict[str, float] = {'r.MotionBlurQuality': 0.0},
         export_vertices: bool = False,
         export_skeleton: bool = False,
+        shared_memory_name: Optional[str] = None,
     ) -> unreal.MoviePipelineMasterConfig:
         """
         Create a movie preset from args.
@@ -303,6 +418,7 @@ class CustomMoviePipeline:
         cls.set_render_all_cameras(movie_preset, enable=True)
         cls.set_export_vertices(movie_preset, enable=export_vertices)
         cls.set_export_skeleton(movie_preset, enable=export_skeleton)
+        cls.set_shared_memory_output(movie_preset, name=shared_memory_name)
 
         return movie_preset
 
@@ -389,7 +505,16 @@ class CustomMoviePipeline:
             console_variables=job.console_variables,
             export_vertices=job.export_vertices,
             export_skeleton=job.export_skeleton,
+            shared_memory_name=job.shared_memory_name,
         )
+        if not cls.set_shard(movie_preset, job.sequence_path, job.shard_index, job.shard_count):
+            unreal.log_warning(f'Skipped job ({new_job.job_name}), shard {job.shard_index} has no frames')
+            cls.pipeline_queue.delete_job(new_job)
+            return True
+        if job.resume and not cls.set_resume(movie_preset, job.sequence_path, job.output_path):
+            unreal.log(f'Skipped job ({new_job.job_name}), every frame is already rendered')
+            cls.pipeline_queue.delete_job(new_job)
+            return True
         new_job.set_configuration(movie_preset)
         unreal.log(f'Added new job ({new_job.job_name}) to queue')
         return True
@@ -1,6 +1,6 @@
 import json
 from pathlib import Path
-from typing import Dict, List, Tuple, TypedDict, Union
+from typing import Dict, List, Optional, Tuple, TypedDict, Union
 
 import unreal
 from constants import SubSystem
@@ -42,6 +42,26 @@ def set_stencil_value(actor: unreal.Actor, stencil_value: int, receives_decals:
         static_mesh_component.set_editor_property('receives_decals', receives_decals)
 
 
+def set_stencil_values(
+    actors: Optional[List[unreal.Actor]] = None, first_stencil_value: int = 1, receives_decals: bool = False
+) -> Dict[int, unreal.Actor]:
+    """Set the stencil values of the actors in one call, the first actor gets ``first_stencil_value``, then one more
+    for each (up to 255).
+
+    Args:
+        actors (List[unreal.Actor], optional): Actors to segment, every actor with a mesh in the level when None.
+        first_stencil_value (int, optional): Stencil value of the first actor. Defaults to 1.
+        receives_decals (bool, optional): Whether the meshes receive decals. Defaults to False.
+
+    Returns:
+        Dict[int, unreal.Actor]: the actor of each stencil value.
+    """
+    stencil_actors = unreal.Annotator.assign_stencil_values(
+        get_world(), actors or [], first_stencil_value, receives_decals
+    )
+    return {stencil_value: actor for stencil_value, actor in stencil_actors.items()}
+
+
 def get_mask_color(stencil_value: int) -> Tuple[int, int, int]:
     return mask_colors[stencil_value]['rgb']
 
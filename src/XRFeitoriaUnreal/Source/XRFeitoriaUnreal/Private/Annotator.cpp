@@ -2,13 +2,44 @@
 
 
 #include "Annotator.h"
+#include "XF_BlueprintFunctionLibrary.h"
+#include "Components/MeshComponent.h"
+#include "Components/PostProcessComponent.h"
+#include "Engine/World.h"
+#include "EngineUtils.h"
+#include "Materials/MaterialInterface.h"
+
+/** Post process material previewing each annotation type in the viewport. */
+static const TCHAR* GetPreviewMaterialPath(ECustomPPMType Type)
+{
+	switch (Type)
+	{
+	case ECustomPPMType::SemanticSegmentation: return TEXT("/XRFeitoriaUnreal/Materials/PPM_mask_linear.PPM_mask_linear");
+	case ECustomPPMType::DepthMap: return TEXT("/XRFeitoriaUnreal/Materials/PPM_depth.PPM_depth");
+	case ECustomPPMType::NormalMap: return TEXT("/XRFeitoriaUnreal/Materials/PPM_normal_map.PPM_normal_map");
+	case ECustomPPMType::Roughtness: return TEXT("/XRFeitoriaUnreal/Materials/PPM_roughness.PPM_roughness");
+	case ECustomPPMType::Specular: return TEXT("/XRFeitoriaUnreal/Materials/PPM_specular.PPM_specular");
+	case ECustomPPMType::Tangent: return TEXT("/XRFeitoriaUnreal/Materials/PPM_tangent.PPM_tangent");
+	case ECustomPPMType::OpticaFlow: return TEXT("/XRFeitoriaUnreal/Materials/PPM_velocity.PPM_velocity");
+	case ECustomPPMType::Metallic: return TEXT("/XRFeitoriaUnreal/Materials/PPM_metallic.PPM_metallic");
+	case ECustomPPMType::Diffuse: return TEXT("/XRFeitoriaUnreal/Materials/PPM_diffusecolor.PPM_diffusecolor");
+	case ECustomPPMType::Basecolor: return TEXT("/XRFeitoriaUnreal/Materials/PPM_basecolor.PPM_basecolor");
+	default: return nullptr;
+	}
+}
 
 // Sets default values
 AAnnotator::AAnnotator()
 {
- 	// Set this actor to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
-	PrimaryActorTick.bCanEverTick = true;
+	// Event driven, nothing to do every frame
+	PrimaryActorTick.bCanEverTick = false;
 
+	RootComponent = CreateDefaultSubobject<USceneComponent>(TEXT("Root"));
+	// stripped from cooked builds, not the root
+	PreviewPostProcess = CreateDefaultSubobject<UPostProcessComponent>(TEXT("PreviewPostProcess"));
+	PreviewPostProcess->bUnbound = true;
+	PreviewPostProcess->bIsEditorOnly = true;
+	PreviewPostProcess->SetupAttachment(RootComponent);
 }
 
 // Called when the game starts or when spawned
@@ -16,11 +47,118 @@ void AAnnotator::BeginPlay()
 {
 	Super::BeginPlay();
 
+	// the preview would be rendered into the images of the renders
+	if (PreviewPostProcess && GetWorld() && GetWorld()->IsGameWorld())
+	{
+		PreviewPostProcess->bEnabled = false;
+	}
+
+	if (bSignStencilValue && bSignStencilValueOnBeginPlay)
+	{
+		SignStencilValues();
+	}
+}
+
+#if WITH_EDITOR
+void AAnnotator::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+
+	const FName PropertyName = PropertyChangedEvent.GetPropertyName();
+	if (PropertyName == GET_MEMBER_NAME_CHECKED(AAnnotator, PreviewAnnotationType)
+		|| PropertyName == GET_MEMBER_NAME_CHECKED(AAnnotator, CustomPostprocessMaterial))
+	{
+		UpdatePreviewAnnotation();
+	}
+	else if (bSignStencilValue && (PropertyName == GET_MEMBER_NAME_CHECKED(AAnnotator, bSignStencilValue)
+		|| PropertyName == GET_MEMBER_NAME_CHECKED(AAnnotator, bManualSignStencilValue)
+		|| PropertyName == GET_MEMBER_NAME_CHECKED(AAnnotator, SegmentObjects)))
+	{
+		SignStencilValues();
+	}
+}
+#endif
+
+TMap<int32, AActor*> AAnnotator::AssignStencilValues(
+	const UObject* WorldContext,
+	const TArray<AActor*>& Actors,
+	int32 FirstStencilValue,
+	bool bReceivesDecals)
+{
+	TMap<int32, AActor*> StencilActors;
+
+	TArray<AActor*> SegmentActors;
+	if (Actors.Num() > 0)
+	{
+		SegmentActors = Actors;
+	}
+	else if (UWorld* World = WorldContext ? WorldContext->GetWorld() : nullptr)
+	{
+		for (TActorIterator<AActor> It(World); It; ++It)
+		{
+			if (!It->IsA<AAnnotator>() && It->FindComponentByClass<UMeshComponent>())
+			{
+				SegmentActors.Add(*It);
+			}
+		}
+		// same values for the same level
+		SegmentActors.Sort([](const AActor& A, const AActor& B) { return A.GetName() < B.GetName(); });
+	}
+
+	constexpr int32 MaxStencilValue = 255;
+	int32 StencilValue = FMath::Max(FirstStencilValue, 0);
+	TArray<UMeshComponent*> MeshComponents;
+	for (int32 Idx = 0; Idx < SegmentActors.Num(); Idx++)
+	{
+		AActor* Actor = SegmentActors[Idx];
+		if (!IsValid(Actor)) continue;
+		if (StencilValue > MaxStencilValue)
+		{
+			UE_LOG(LogXF, Warning, TEXT("AssignStencilValues: stencil values are 8 bit, %d actors left without a stencil value"),
+				SegmentActors.Num() - Idx);
+			break;
+		}
+
+		Actor->GetComponents<UMeshComponent>(MeshComponents);
+		if (MeshComponents.Num() == 0) continue;
+		for (UMeshComponent* MeshComponent : MeshComponents)
+		{
+			MeshComponent->Modify();
+			if (MeshComponent->bReceivesDecals != bReceivesDecals)
+			{
+				MeshComponent->bReceivesDecals = bReceivesDecals;
+				MeshComponent->MarkRenderStateDirty();
+			}
+			MeshComponent->SetRenderCustomDepth(true);
+			MeshComponent->SetCustomDepthStencilValue(StencilValue);
+		}
+		StencilActors.Add(StencilValue, Actor);
+		StencilValue++;
+	}
+	return StencilActors;
+}
+
+TMap<int32, AActor*> AAnnotator::SignStencilValues()
+{
+	if (bManualSignStencilValue)
+	{
+		return SegmentObjects.Num() > 0 ? AssignStencilValues(this, SegmentObjects) : TMap<int32, AActor*>();
+	}
+	return AssignStencilValues(this, TArray<AActor*>());
 }
 
-// Called every frame
-void AAnnotator::Tick(float DeltaTime)
+void AAnnotator::UpdatePreviewAnnotation()
 {
-	Super::Tick(DeltaTime);
+	if (!PreviewPostProcess) return;
 
+	UMaterialInterface* Material = nullptr;
+	if (PreviewAnnotationType == ECustomPPMType::Custom)
+	{
+		Material = CustomPostprocessMaterial;
+	}
+	else if (const TCHAR* MaterialPath = GetPreviewMaterialPath(PreviewAnnotationType))
+	{
+		Material = LoadObject<UMaterialInterface>(nullptr, MaterialPath);
+	}
+	UXF_BlueprintFunctionLibrary::ModifyPostProcessMaterial(Material, PreviewPostProcess);
 }
@@ -3,6 +3,26 @@
 
 #include "CustomMoviePipelineDeferredPass.h"
 #include "CustomMoviePipelineOutput.h"
+#include "XF_MaterialPreloader.h"
+#include "Misc/PackageName.h"
+
+FCustomMoviePipelineRenderPass UCustomMoviePipelineDeferredPass::MakeRenderPass(const FString& MaterialPath, const FString& RenderPassName, ECustomImageFormat Extension)
+{
+	FString ObjectPath = MaterialPath;
+	if (!FPackageName::IsValidObjectPath(ObjectPath))
+	{
+		// the asset of the package, its name is the pass identifier
+		ObjectPath += TEXT(".") + FPackageName::GetShortName(MaterialPath);
+	}
+
+	FCustomMoviePipelineRenderPass Pass;
+	Pass.bEnabled = true;
+	Pass.RenderPassName = RenderPassName;
+	Pass.Material = TSoftObjectPtr<UMaterialInterface>(FSoftObjectPath(ObjectPath));
+	Pass.Extension = Extension;
+	FXFMaterialPreloader::Preload({ Pass.Material.ToSoftObjectPath() });
+	return Pass;
+}
 
 void UCustomMoviePipelineDeferredPass::SetupImpl(const MoviePipeline::FMoviePipelineRenderPassInitSettings& InPassInitSettings)
 {
@@ -12,6 +32,7 @@ void UCustomMoviePipelineDeferredPass::SetupImpl(const MoviePipeline::FMoviePipe
 	check(OutputSettings);
 
 	AdditionalPostProcessMaterials.Empty();
+	TArray<FSoftObjectPath> MaterialPaths;
 	for (FCustomMoviePipelineRenderPass& Pass : OutputSettings->AdditionalRenderPasses)
 	{
 		if (Pass.Material.IsNull() || Pass.bEnabled == false)
@@ -23,7 +44,10 @@ void UCustomMoviePipelineDeferredPass::SetupImpl(const MoviePipeline::FMoviePipe
 		NewPass.Material = Pass.Material;
 		AdditionalPostProcessMaterials.Add(NewPass);
 
-		FString PassName = Pass.Material.LoadSynchronous()->GetName();
+		MaterialPaths.Add(Pass.Material.ToSoftObjectPath());
+
+		// the asset name of the path is the name of the material, no need to load it
+		FString PassName = Pass.Material.ToSoftObjectPath().GetAssetName();
 		Pass.SPassName = PassIdentifier.Name + PassName;  // set identifier pass name
 		if (Pass.RenderPassName.IsEmpty())
 		{
@@ -31,6 +55,11 @@ void UCustomMoviePipelineDeferredPass::SetupImpl(const MoviePipeline::FMoviePipe
 		}
 	}
 
+	// the materials are preloaded when the job is queued, requested here for the jobs queued otherwise,
+	// so Super::SetupImpl finds them loaded
+	FXFMaterialPreloader::Preload(MaterialPaths);
+	FXFMaterialPreloader::WaitFor(MaterialPaths);
+
 	UE_LOG(LogMovieRenderPipeline, Log, TEXT("Custom Movie Pipeline Finished, %d ppm materials."), AdditionalPostProcessMaterials.Num());
 
 	Super::SetupImpl(InPassInitSettings);
@@ -16,6 +16,8 @@
 #include "HAL/PlatformFilemanager.h"
 #include "HAL/PlatformTime.h"
 #include "Misc/Paths.h"
+#include "IImageWrapper.h"
+#include "IImageWrapperModule.h"
 
 #include "Camera/CameraActor.h"
 #include "Camera/CameraComponent.h"
@@ -26,6 +28,7 @@
 #include "MoviePipelineOutputSetting.h"
 #include "MoviePipelineBurnInSetting.h"
 #include "MoviePipelineOutputBase.h"
+#include "MoviePipelineQueue.h"
 #include "MoviePipelineImageQuantization.h"
 #include "MoviePipelineWidgetRenderSetting.h"
 #include "MoviePipelineUtils.h"
@@ -34,6 +37,13 @@
 #include "MovieRenderPipelineCoreModule.h"
 
 #include "XF_BlueprintFunctionLibrary.h"
+#include "XF_AsyncWriteQueue.h"
+#include "XF_ChunkedFile.h"
+#include "XF_SceneBindings.h"
+#include "XF_OutputPathCache.h"
+#include "XF_ResumeManifest.h"
+#include "XF_Stats.h"
+#include "MoviePipelineRenderShardSetting.h"
 
 #if ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION == 0
 	#include "MoviePipelineMasterConfig.h"
@@ -48,84 +58,63 @@ void UCustomMoviePipelineOutput::SetupForPipelineImpl(UMoviePipeline* InPipeline
 		InPipeline->SetFlushDiskWritesPerShot(true);
 	}
 
-	ULevelSequence* LevelSequence = GetPipeline()->GetTargetSequence();
-	UMovieSceneSequence* MovieSceneSequence = GetPipeline()->GetTargetSequence();
-	UMovieScene* MovieScene = LevelSequence->GetMovieScene();
-	TArray<FMovieSceneBinding> bindings = MovieScene->GetBindings();
+	// Outputs receive each frame in order, only the last one can move the pixel data out of it
+	TArray<UMoviePipelineOutputBase*> OutputContainers = GetPipeline()->GetPipelineMasterConfig()->GetOutputContainers();
+	bMovePixelData = OutputContainers.Num() > 0 && OutputContainers.Last() == this;
 
-	TArray<FMovieSceneBindingProxy> bindingProxies;
-	for (FMovieSceneBinding binding : bindings)
+	for (const FCustomMoviePipelineRenderPass& RenderPass : AdditionalRenderPasses)
 	{
-		FGuid guid = binding.GetObjectGuid();
-		bindingProxies.Add(FSequencerBindingProxy(guid, MovieSceneSequence));
-	}
+		if (RenderPass.Encoding != ECustomPassEncoding::Stencil8 && RenderPass.Encoding != ECustomPassEncoding::Stencil16) continue;
 
-	boundObjects = USequencerToolsFunctionLibrary::GetBoundObjects(
-		GetPipeline()->GetWorld(),
-		LevelSequence,
-		bindingProxies,
-		FSequencerScriptingRange::FromNative(
-			MovieScene->GetPlaybackRange(),
-			MovieScene->GetDisplayRate()
-		)
-	);
-
-	for (FSequencerBoundObjects boundObject : boundObjects)
-	{
-		// loop over bound objects
-		UObject* BoundObject = boundObject.BoundObjects[0];  // only have one item
-		if (BoundObject->IsA(ACameraActor::StaticClass()))
-		{
-			ACameraActor* Camera = Cast<ACameraActor>(BoundObject);
-			Cameras.Add(Camera);
-		}
-		else if (BoundObject->IsA(ASkeletalMeshActor::StaticClass()))
-		{
-			ASkeletalMeshActor* SkeletalMeshActor = Cast<ASkeletalMeshActor>(BoundObject);
-			SkeletalMeshComponents.Add(SkeletalMeshActor->GetSkeletalMeshComponent());
-		}
-		else if (BoundObject->IsA(AStaticMeshActor::StaticClass()))
-		{
-			AStaticMeshActor* StaticMeshActor = Cast<AStaticMeshActor>(BoundObject);
-			StaticMeshComponents.Add(StaticMeshActor->GetStaticMeshComponent());
-		}
-		else if (BoundObject->IsA(USkeletalMeshComponent::StaticClass()))
+		// stencil value is the index of the mask color, same as utils_actor.get_mask_color
+		TArray<FColor> MaskColors;
+		TSharedPtr<TMap<FColor, uint8>, ESPMode::ThreadSafe> ColorToStencil = MakeShared<TMap<FColor, uint8>, ESPMode::ThreadSafe>();
+		if (!UXF_BlueprintFunctionLibrary::LoadMaskColors(MaskColors))
 		{
-			USkeletalMeshComponent* SkeletalMeshComponent = Cast<USkeletalMeshComponent>(BoundObject);
-			// check if it's already in the list
-			bool bFound = false;
-			for (USkeletalMeshComponent* SkeletalMeshComponentInList : SkeletalMeshComponents)
-			{
-				if (SkeletalMeshComponentInList == SkeletalMeshComponent)
-				{
-					bFound = true;
-					break;
-				}
-			}
-			if (!bFound) SkeletalMeshComponents.Add(SkeletalMeshComponent);
+			UE_LOG(LogMovieRenderPipeline, Error, TEXT("Failed to load mask colors, stencil encoded masks will be empty"));
 		}
-		else if (BoundObject->IsA(UStaticMeshComponent::StaticClass()))
+		for (int32 Idx = 0; Idx < MaskColors.Num(); Idx++)
 		{
-			UStaticMeshComponent* StaticMeshComponent = Cast<UStaticMeshComponent>(BoundObject);
-			// check if it's already in the list
-			bool bFound = false;
-			for (UStaticMeshComponent* StaticMeshComponentInList : StaticMeshComponents)
-			{
-				if (StaticMeshComponentInList == StaticMeshComponent)
-				{
-					bFound = true;
-					break;
-				}
-			}
-			if (!bFound)
-				StaticMeshComponents.Add(StaticMeshComponent);
+			ColorToStencil->Add(MaskColors[Idx], (uint8)Idx);
 		}
+		MaskColorToStencil = ColorToStencil;
+		break;
+	}
+
+	// resolved once per pipeline, shared with the other outputs
+	SceneBindings = FXFSceneBindingRegistry::Get(GetPipeline());
+
+	// The format is resolved once per shot by the path cache, see GetOutputPath
+	UMoviePipelineOutputSetting* OutputSettings = GetPipeline()->GetPipelineMasterConfig()->FindSetting<UMoviePipelineOutputSetting>();
+	check(OutputSettings);
+	OutputFormatString = OutputSettings->OutputDirectory.Path / OutputSettings->FileNameFormat;
+	PathCache = MakeShared<FXFOutputPathCache>(GetPipeline());
+	// tracked only when resuming, the manifest costs a write every few frames
+	if (bSkipCompletedFrames)
+	{
+		ResumeManifest = FXFResumeManifest::Get(GetPipeline());
+		ResumeManifest->RegisterOutput(this);
 	}
+	ShotStats = FXFShotStatsRecorder::Get(GetPipeline());
+	ShotStats->RegisterOutput(this);
+	// a shard of the sequence writes its own camera records, numbered like the frames of a whole render
+	ContainerSuffix = UMoviePipelineRenderShardSetting::GetContainerSuffix(GetPipeline());
+	OutputFrameOffset = UMoviePipelineRenderShardSetting::GetOutputFrameOffset(GetPipeline());
+	// the directories of a previous render may have been deleted
+	UXF_BlueprintFunctionLibrary::ResetDirectoryCache();
 }
 
 
 void UCustomMoviePipelineOutput::OnReceiveImageDataImpl(FMoviePipelineMergerOutputFrame* InMergedOutputFrame)
 {
+	if (ResumeManifest.IsValid()) ResumeManifest->BeginFrame(this, InMergedOutputFrame->FrameOutputState);
+	ShotStats->BeginFrame(InMergedOutputFrame->FrameOutputState);
+	if (ResumeManifest.IsValid() && ResumeManifest->IsFrameComplete(InMergedOutputFrame->FrameOutputState))
+	{
+		// written by a previous render
+		return;
+	}
+
 	if (bIsFirstFrame)
 	{
 		// Get Output Setting
@@ -135,57 +124,34 @@ void UCustomMoviePipelineOutput::OnReceiveImageDataImpl(FMoviePipelineMergerOutp
 		int ResolutionX = OutputSettings->OutputResolution.X;
 		int ResolutionY = OutputSettings->OutputResolution.Y;
 
-		// Save Camera Transform (KRT)
-		for (ACameraActor* Camera : Cameras)
-		{
-			FVector CamLocation = Camera->GetActorLocation();
-			FRotator CamRotation = Camera->GetActorRotation();
-			float FOV = Camera->GetCameraComponent()->FieldOfView;
-
-			TArray<float> CamInfo;
-			CamInfo.Add(CamLocation.X);
-			CamInfo.Add(CamLocation.Y);
-			CamInfo.Add(CamLocation.Z);
-			CamInfo.Add(CamRotation.Roll);
-			CamInfo.Add(CamRotation.Pitch);
-			CamInfo.Add(CamRotation.Yaw);
-			CamInfo.Add(FOV);
-			CamInfo.Add(ResolutionX);
-			CamInfo.Add(ResolutionY);
-
-			// Actor in level
-			FString CameraNameFromLabel = Camera->GetActorNameOrLabel();
-			// Actor spawned from sequence
-			FString CameraNameFromName = Camera->GetFName().GetPlainNameString();
-			// XXX: Hardcode way to Judge which name is correct, need to be improved
-			// Should ref to
-			// GetPipeline()->ResolveFilenameFormatArguments(FileNameFormatString, FormatOverrides, OutputData.FilePath, FinalFormatArgs, &Payload->SampleState.OutputState);
-			// using {camera_name}
-
-			bool bIsCameraInLevel = CameraNameFromName.StartsWith("CameraActor") || CameraNameFromName.StartsWith("CineCameraActor");
-			FString CameraName = bIsCameraInLevel ? CameraNameFromLabel : CameraNameFromName;
-
-			FString CameraTransformPath = GetOutputPath(
-				DirectoryCameraInfo / CameraName,
-				"dat",
-				&InMergedOutputFrame->FrameOutputState
-			);  // DirectoryCameraInfo/{camera_name}/{frame_idx}.dat
-			CameraTransformPath = FPaths::SetExtension(
-				FPaths::GetPath(CameraTransformPath),
-				FPaths::GetExtension(CameraTransformPath)
-			);  // get rid of the frame index
-			UXF_BlueprintFunctionLibrary::SaveFloatArrayToByteFile(CamInfo, CameraTransformPath);
+		PrecreateOutputDirectories(&InMergedOutputFrame->FrameOutputState);
+
+		// Save Camera Transform (KRT), at the first frame of the sequence: rendered by the first shard, not by a resumed render
+		if (OutputFrameOffset == 0)
+		{
+			for (ACameraActor* Camera : SceneBindings->GetCameras())
+			{
+				TArray<float> CamInfo = GetCameraInfo(Camera, FIntPoint(ResolutionX, ResolutionY));
+				FString CameraName = SceneBindings->GetExportName(Camera);
+
+				FString CameraTransformPath = GetOutputPath(
+					DirectoryCameraInfo / CameraName,
+					"dat",
+					&InMergedOutputFrame->FrameOutputState
+				);  // DirectoryCameraInfo/{camera_name}/{frame_idx}.dat
+				CameraTransformPath = FPaths::SetExtension(
+					FPaths::GetPath(CameraTransformPath),
+					FPaths::GetExtension(CameraTransformPath)
+				);  // get rid of the frame index
+				SaveInfoAsync(FXFAsyncWriteQueue::Get().EnqueueFloatArray(MoveTemp(CamInfo), CameraTransformPath),
+					DirectoryCameraInfo, CameraTransformPath, &InMergedOutputFrame->FrameOutputState);
+			}
 		}
 
 		// Save Actor Info (stencil value)
-		for (USkeletalMeshComponent* SkeletalMeshComponent : SkeletalMeshComponents)
+		for (USkeletalMeshComponent* SkeletalMeshComponent : SceneBindings->GetSkeletalMeshComponents())
 		{
-			// Actor in level
-			FString MeshNameFromLabel = SkeletalMeshComponent->GetOwner()->GetActorNameOrLabel();
-			// Actor spawned from sequence
-			FString MeshNameFromName = SkeletalMeshComponent->GetOwner()->GetFName().GetPlainNameString();
-			// Judge which name is correct
-			FString MeshName = MeshNameFromName.StartsWith("SkeletalMesh") ? MeshNameFromLabel : MeshNameFromName;
+			const FString& MeshName = SceneBindings->GetExportName(SkeletalMeshComponent);
 
 			int StencilValue = SkeletalMeshComponent->CustomDepthStencilValue;
 
@@ -198,17 +164,13 @@ void UCustomMoviePipelineOutput::OnReceiveImageDataImpl(FMoviePipelineMergerOutp
 				FPaths::GetPath(ActorInfoPath),
 				FPaths::GetExtension(ActorInfoPath)
 			);  // get rid of the frame index
-			UXF_BlueprintFunctionLibrary::SaveFloatToByteFile(StencilValue, ActorInfoPath);
+			SaveInfoAsync(EnqueueActorInfo(StencilValue, ActorInfoPath),
+				DirectoryActorInfo, ActorInfoPath, &InMergedOutputFrame->FrameOutputState);
 		}
 
-		for (UStaticMeshComponent* StaticMeshComponent : StaticMeshComponents)
+		for (UStaticMeshComponent* StaticMeshComponent : SceneBindings->GetStaticMeshComponents())
 		{
-			// Actor in level
-			FString MeshNameFromLabel = StaticMeshComponent->GetOwner()->GetActorNameOrLabel();
-			// Actor spawned from sequence
-			FString MeshNameFromName = StaticMeshComponent->GetOwner()->GetFName().GetPlainNameString();
-			// Judge which name is correct
-			FString MeshName = MeshNameFromName.StartsWith("StaticMesh") ? MeshNameFromLabel : MeshNameFromName;
+			const FString& MeshName = SceneBindings->GetExportName(StaticMeshComponent);
 
 			int StencilValue = StaticMeshComponent->CustomDepthStencilValue;
 
@@ -221,12 +183,20 @@ void UCustomMoviePipelineOutput::OnReceiveImageDataImpl(FMoviePipelineMergerOutp
 				FPaths::GetPath(ActorInfoPath),
 				FPaths::GetExtension(ActorInfoPath)
 			);  // get rid of the frame index
-			UXF_BlueprintFunctionLibrary::SaveFloatToByteFile(StencilValue, ActorInfoPath);
+			SaveInfoAsync(EnqueueActorInfo(StencilValue, ActorInfoPath),
+				DirectoryActorInfo, ActorInfoPath, &InMergedOutputFrame->FrameOutputState);
 		}
 
 		bIsFirstFrame = false;
 	}
 
+	if (bSaveCameraInfoPerFrame)
+	{
+		UMoviePipelineOutputSetting* OutputSettings = GetPipeline()->GetPipelineMasterConfig()->FindSetting<UMoviePipelineOutputSetting>();
+		check(OutputSettings);
+		RecordCameraInfo(OutputSettings->OutputResolution, &InMergedOutputFrame->FrameOutputState);
+	}
+
 	SCOPE_CYCLE_COUNTER(STAT_ImgSeqRecieveImageData);
 
 	check(InMergedOutputFrame);
@@ -244,6 +214,11 @@ void UCustomMoviePipelineOutput::OnReceiveImageDataImpl(FMoviePipelineMergerOutp
 
 	FString OutputDirectory = OutputSettings->OutputDirectory.Path;
 
+#if WITH_UNREALEXR
+	// Passes in MultiLayerEXR format are gathered into one file per frame
+	TUniquePtr<FCustomMultiLayerEXRWriteTask> MultiLayerTask;
+#endif
+
 	for (TPair<FMoviePipelinePassIdentifier, TUniquePtr<FImagePixelData>>& RenderPassData : InMergedOutputFrame->ImageOutputData)
 	{
 		// Don't write out a composited pass in this loop, as it will be merged with the Final Image and not written separately.
@@ -265,6 +240,10 @@ void UCustomMoviePipelineOutput::OnReceiveImageDataImpl(FMoviePipelineMergerOutp
 		// Get the output file extension via the output setting
 		EImageFormat PreferredOutputFormat = OutputFormat;
 		FString RenderPassName;
+		bool bMultiLayerEXR = false;
+		int32 CompressionQuality = 100;
+		ECustomPassEncoding Encoding = ECustomPassEncoding::Default;
+		ECustomEXRPrecision EXRPrecision = ECustomEXRPrecision::Half;
 		if (RenderPassData.Key.Name == FString("FinalImage"))
 		{
 			if (!bEnableRenderPass_RGB)
@@ -277,6 +256,7 @@ void UCustomMoviePipelineOutput::OnReceiveImageDataImpl(FMoviePipelineMergerOutp
 			case ECustomImageFormat::JPEG: PreferredOutputFormat = EImageFormat::JPEG; break;
 			case ECustomImageFormat::BMP: PreferredOutputFormat = EImageFormat::BMP; break;
 			case ECustomImageFormat::EXR: PreferredOutputFormat = EImageFormat::EXR; break;
+			case ECustomImageFormat::MultiLayerEXR: bMultiLayerEXR = true; EXRPrecision = EXRPrecision_RGB; break;
 			}
 
 			if (RenderPassName_RGB.IsEmpty())
@@ -285,6 +265,7 @@ void UCustomMoviePipelineOutput::OnReceiveImageDataImpl(FMoviePipelineMergerOutp
 			}
 
 			RenderPassName = RenderPassName_RGB;
+			CompressionQuality = CompressionQuality_RGB;
 		}
 
 		for (FCustomMoviePipelineRenderPass DefinedRenderPass: AdditionalRenderPasses)
@@ -301,12 +282,43 @@ void UCustomMoviePipelineOutput::OnReceiveImageDataImpl(FMoviePipelineMergerOutp
 				case ECustomImageFormat::JPEG: PreferredOutputFormat = EImageFormat::JPEG; break;
 				case ECustomImageFormat::BMP: PreferredOutputFormat = EImageFormat::BMP; break;
 				case ECustomImageFormat::EXR: PreferredOutputFormat = EImageFormat::EXR; break;
+				case ECustomImageFormat::MultiLayerEXR: bMultiLayerEXR = true; EXRPrecision = DefinedRenderPass.EXRPrecision; break;
 				}
 
 				RenderPassName = DefinedRenderPass.RenderPassName;
+				CompressionQuality = DefinedRenderPass.CompressionQuality;
+				Encoding = DefinedRenderPass.Encoding;
+				switch (Encoding)
+				{
+				case ECustomPassEncoding::Stencil8:
+				case ECustomPassEncoding::Stencil16:
+					PreferredOutputFormat = EImageFormat::PNG; bMultiLayerEXR = false; break;
+				case ECustomPassEncoding::DepthHalf:
+					PreferredOutputFormat = EImageFormat::EXR; bMultiLayerEXR = false; break;
+				default: break;
+				}
 			}
 		}
 
+		if (bMultiLayerEXR)
+		{
+#if WITH_UNREALEXR
+			if (!MultiLayerTask)
+			{
+				MultiLayerTask = MakeUnique<FCustomMultiLayerEXRWriteTask>();
+				MultiLayerTask->Compression = MultiLayerEXRCompression;
+			}
+			// Copied when other outputs (e.g. MeshOperator) may still read the pixel data of this frame
+			FCustomMultiLayerEXRWriteTask::FLayer& Layer = MultiLayerTask->Layers.AddDefaulted_GetRef();
+			Layer.Name = RenderPassName;
+			Layer.PixelData = bMovePixelData ? MoveTemp(RenderPassData.Value) : RenderPassData.Value->CopyImageData();
+			Layer.Precision = EXRPrecision;
+#else
+			UE_LOG(LogMovieRenderPipeline, Error, TEXT("MultiLayerEXR is not supported on this platform, skipping render pass %s"), *RenderPassName);
+#endif
+			continue;
+		}
+
 		FImagePixelDataPayload* Payload = RenderPassData.Value->GetPayload<FImagePixelDataPayload>();
 
 		// If the output requires a transparent output (to be useful) then we'll on a per-case basis override their intended
@@ -330,25 +342,48 @@ void UCustomMoviePipelineOutput::OnReceiveImageDataImpl(FMoviePipelineMergerOutp
 		}
 
 		TUniquePtr<FImagePixelData> QuantizedPixelData = nullptr;
+		// Moved out of the frame, quantized on the image write thread
+		TUniquePtr<FImagePixelData> SourcePixelData = nullptr;
+		const bool bQuantize = PreferredOutputFormat != EImageFormat::EXR;
+		const bool bConvertToSrgb = !(ColorSetting && ColorSetting->OCIOConfiguration.bIsEnabled);
 
-
-		switch (PreferredOutputFormat)
+		if (Encoding != ECustomPassEncoding::Default)
 		{
-		case EImageFormat::PNG:
-		case EImageFormat::JPEG:
-		case EImageFormat::BMP:
+			// Encoded on the image write thread
+			SourcePixelData = bMovePixelData ? MoveTemp(RenderPassData.Value) : RenderPassData.Value->CopyImageData();
+		}
+		else if (bMovePixelData)
 		{
-			// All three of these formats only support 8 bit data, so we need to take the incoming buffer type,
-			// copy it into a new 8-bit array and optionally apply a little noise to the data to help hide gradient banding.
-			QuantizedPixelData = UE::MoviePipeline::QuantizeImagePixelDataToBitDepth(RenderPassData.Value.Get(), 8, nullptr, !(ColorSetting && ColorSetting->OCIOConfiguration.bIsEnabled));
-			break;
+			// Nothing reads the frame after the last output, so the write task takes ownership of the pixel data
+			if (bQuantize)
+			{
+				SourcePixelData = MoveTemp(RenderPassData.Value);
+			}
+			else
+			{
+				QuantizedPixelData = MoveTemp(RenderPassData.Value);
+			}
 		}
-		case EImageFormat::EXR:
-			// No quantization required, just copy the data as we will move it into the image write task.
-			QuantizedPixelData = RenderPassData.Value->CopyImageData();
-			break;
-		default:
-			check(false);
+		else
+		{
+			switch (PreferredOutputFormat)
+			{
+			case EImageFormat::PNG:
+			case EImageFormat::JPEG:
+			case EImageFormat::BMP:
+			{
+				// All three of these formats only support 8 bit data, so we need to take the incoming buffer type,
+				// copy it into a new 8-bit array and optionally apply a little noise to the data to help hide gradient banding.
+				QuantizedPixelData = UE::MoviePipeline::QuantizeImagePixelDataToBitDepth(RenderPassData.Value.Get(), 8, nullptr, bConvertToSrgb);
+				break;
+			}
+			case EImageFormat::EXR:
+				// No quantization required, just copy the data as we will move it into the image write task.
+				QuantizedPixelData = RenderPassData.Value->CopyImageData();
+				break;
+			default:
+				check(false);
+			}
 		}
 
 		// We need to resolve the filename format string. We combine the folder and file name into one long string first
@@ -374,31 +409,23 @@ void UCustomMoviePipelineOutput::OnReceiveImageDataImpl(FMoviePipelineMergerOutp
 
 			UE::MoviePipeline::ValidateOutputFormatString(FileNameFormatString, bIncludeRenderPass, bTestFrameNumber, bIncludeCameraName);
 
-			// Create specific data that needs to override
-			TMap<FString, FString> FormatOverrides;
-			// FormatOverrides.Add(TEXT("render_pass"), RenderPassData.Key.Name);
-			FormatOverrides.Add(TEXT("render_pass"), RenderPassName);
-			FormatOverrides.Add(TEXT("ext"), Extension);
-			FMoviePipelineFormatArgs FinalFormatArgs;
+			// Resolved from the path templates of the shot, only the render pass, extension and frame numbers change per file
+			const FMoviePipelineFrameOutputState& OutputState = Payload->SampleState.OutputState;
 			// Resolve for XMLs
 			{
-				GetPipeline()->ResolveFilenameFormatArguments(/*In*/ FileNameFormatString, FormatOverrides, /*Out*/ XMLData.ImageSequenceFileName, FinalFormatArgs, &Payload->SampleState.OutputState, -Payload->SampleState.OutputState.ShotOutputFrameNumber);
+				XMLData.ImageSequenceFileName = PathCache->Resolve(
+					FileNameFormatString, RenderPassName, Extension, &OutputState, -OutputState.ShotOutputFrameNumber, EXFOutputPathFlags::KeepRelative);
 			}
 
 			// Resolve the final absolute file path to write this to
 			{
-				GetPipeline()->ResolveFilenameFormatArguments(FileNameFormatString, FormatOverrides, OutputData.FilePath, FinalFormatArgs, &Payload->SampleState.OutputState);
-
-				if (FPaths::IsRelative(OutputData.FilePath))
-				{
-					OutputData.FilePath = FPaths::ConvertRelativePathToFull(OutputData.FilePath);
-				}
+				OutputData.FilePath = PathCache->Resolve(FileNameFormatString, RenderPassName, Extension, &OutputState);
 			}
 
 			// More XML resolving. Create a deterministic clipname by removing frame numbers, file extension, and any trailing .'s
 			{
 				UE::MoviePipeline::RemoveFrameNumberFormatStrings(FileNameFormatString, true);
-				GetPipeline()->ResolveFilenameFormatArguments(FileNameFormatString, FormatOverrides, XMLData.ClipName, FinalFormatArgs, &Payload->SampleState.OutputState);
+				XMLData.ClipName = PathCache->Resolve(FileNameFormatString, RenderPassName, Extension, &OutputState, 0, EXFOutputPathFlags::KeepRelative);
 				XMLData.ClipName.RemoveFromEnd(Extension);
 				XMLData.ClipName.RemoveFromEnd(".");
 			}
@@ -406,17 +433,19 @@ void UCustomMoviePipelineOutput::OnReceiveImageDataImpl(FMoviePipelineMergerOutp
 
 		TUniquePtr<FImageWriteTask> TileImageTask = MakeUnique<FImageWriteTask>();
 		TileImageTask->Format = PreferredOutputFormat;
-		TileImageTask->CompressionQuality = 100;
+		TileImageTask->CompressionQuality = CompressionQuality;
 		TileImageTask->Filename = OutputData.FilePath;
 
 		// We composite before flipping the alpha so that it is consistent for all formats.
-		if (RenderPassData.Key == FMoviePipelinePassIdentifier(TEXT("FinalImage")))
+		// The encoded passes are written by their own tasks from SourcePixelData, QuantizedPixelData is null for them.
+		const bool bComposite = Encoding == ECustomPassEncoding::Default && (bQuantize || QuantizedPixelData.IsValid());
+		if (RenderPassData.Key == FMoviePipelinePassIdentifier(TEXT("FinalImage")) && bComposite)
 		{
 			for (const MoviePipeline::FCompositePassInfo& CompositePass : CompositedPasses)
 			{
 				// We don't need to copy the data here (even though it's being passed to a async system) because we already made a unique copy of the
 				// burn in/widget data when we decided to composite it.
-				switch (QuantizedPixelData->GetType())
+				switch (bQuantize ? EImagePixelType::Color : QuantizedPixelData->GetType())
 				{
 				case EImagePixelType::Color:
 					TileImageTask->PixelPreProcessors.Add(TAsyncCompositeImage<FColor>(CompositePass.PixelData->MoveImageDataToNew()));
@@ -432,40 +461,476 @@ void UCustomMoviePipelineOutput::OnReceiveImageDataImpl(FMoviePipelineMergerOutp
 		}
 
 
-		TileImageTask->PixelData = MoveTemp(QuantizedPixelData);
-
 #if WITH_EDITOR
 		GetPipeline()->AddFrameToOutputMetadata(XMLData.ClipName, XMLData.ImageSequenceFileName, InMergedOutputFrame->FrameOutputState, Extension, Payload->bRequireTransparentOutput);
 #endif
 
-		GetPipeline()->AddOutputFuture(ImageWriteQueue->Enqueue(MoveTemp(TileImageTask)), OutputData);
+		// Payload is owned by the pixel data, don't use it after this point
+		TUniquePtr<IImageWriteTaskBase> WriteTask;
+		if (Encoding == ECustomPassEncoding::Stencil8 || Encoding == ECustomPassEncoding::Stencil16)
+		{
+			TUniquePtr<FCustomStencilImageWriteTask> StencilTask = MakeUnique<FCustomStencilImageWriteTask>();
+			StencilTask->Filename = OutputData.FilePath;
+			StencilTask->PixelData = MoveTemp(SourcePixelData);
+			StencilTask->MaskColorToStencil = MaskColorToStencil;
+			StencilTask->BitDepth = Encoding == ECustomPassEncoding::Stencil16 ? 16 : 8;
+			StencilTask->CompressionQuality = CompressionQuality;
+			StencilTask->bConvertToSrgb = bConvertToSrgb;
+			WriteTask = MoveTemp(StencilTask);
+		}
+		else if (Encoding == ECustomPassEncoding::DepthHalf)
+		{
+#if WITH_UNREALEXR
+			TUniquePtr<FCustomMultiLayerEXRWriteTask> DepthTask = MakeUnique<FCustomMultiLayerEXRWriteTask>();
+			DepthTask->Filename = OutputData.FilePath;
+			DepthTask->Compression = ECustomEXRCompression::ZIP;
+			FCustomMultiLayerEXRWriteTask::FLayer& Layer = DepthTask->Layers.AddDefaulted_GetRef();
+			Layer.PixelData = MoveTemp(SourcePixelData);
+			Layer.Precision = ECustomEXRPrecision::Half;
+			Layer.NumChannels = 1;
+			WriteTask = MoveTemp(DepthTask);
+#else
+			UE_LOG(LogMovieRenderPipeline, Error, TEXT("DepthHalf is not supported on this platform, skipping render pass %s"), *RenderPassName);
+			continue;
+#endif
+		}
+		else if (SourcePixelData)
+		{
+			WriteTask = MakeUnique<FCustomQuantizeImageWriteTask>(MoveTemp(TileImageTask), MoveTemp(SourcePixelData), bConvertToSrgb);
+		}
+		else
+		{
+			TileImageTask->PixelData = MoveTemp(QuantizedPixelData);
+			WriteTask = MoveTemp(TileImageTask);
+		}
+		AddFrameOutputFuture(ImageWriteQueue->Enqueue(
+			MakeUnique<FCustomTimedImageWriteTask>(MoveTemp(WriteTask), RenderPassName, OutputData.FilePath, EncodeStats)), OutputData, &InMergedOutputFrame->FrameOutputState);
+	}
+
+#if WITH_UNREALEXR
+	if (MultiLayerTask)
+	{
+		MoviePipeline::FMoviePipelineOutputFutureData OutputData;
+		OutputData.Shot = GetPipeline()->GetActiveShotList()[InMergedOutputFrame->FrameOutputState.ShotIndex];
+		OutputData.PassIdentifier = FMoviePipelinePassIdentifier(RenderPassName_MultiLayerEXR);
+
+		OutputData.FilePath = PathCache->Resolve(
+			OutputDirectory / OutputSettings->FileNameFormat, RenderPassName_MultiLayerEXR, TEXT("exr"), &InMergedOutputFrame->FrameOutputState);
+
+		MultiLayerTask->Filename = OutputData.FilePath;
+		AddFrameOutputFuture(ImageWriteQueue->Enqueue(
+			MakeUnique<FCustomTimedImageWriteTask>(MoveTemp(MultiLayerTask), RenderPassName_MultiLayerEXR, OutputData.FilePath, EncodeStats)), OutputData, &InMergedOutputFrame->FrameOutputState);
+	}
+#endif
+}
+
+void UCustomMoviePipelineOutput::BeginFinalizeImpl()
+{
+	// before the write queue is flushed by the base class
+	CloseCameraRecords();
+	Super::BeginFinalizeImpl();
+}
+
+void UCustomMoviePipelineOutput::TeardownForPipelineImpl(UMoviePipeline* InPipeline)
+{
+	// every write has finished by now
+	TMap<FString, FCustomEncodeStats::FPassStats> Stats = EncodeStats->GetStats();
+	for (const TPair<FString, FCustomEncodeStats::FPassStats>& PassStats : Stats)
+	{
+		const FCustomEncodeStats::FPassStats& Each = PassStats.Value;
+		UE_LOG(LogMovieRenderPipelineIO, Log, TEXT("Render pass %s: %d files, %.2f ms and %.1f KB per file on average"),
+			*PassStats.Key,
+			Each.NumFiles,
+			Each.EncodeSeconds * 1000.0 / FMath::Max(Each.NumFiles, 1),
+			Each.NumBytes / 1024.0 / FMath::Max(Each.NumFiles, 1));
+	}
+	EncodeStats->Reset();
+	if (ResumeManifest.IsValid())
+	{
+		// the frames completed by the last writes
+		ResumeManifest->Flush();
+		ResumeManifest.Reset();
+	}
+	ShotStats.Reset();
+	Super::TeardownForPipelineImpl(InPipeline);
+}
+
+#if ENGINE_MAJOR_VERSION == 5
+void UCustomMoviePipelineOutput::OnShotFinishedImpl(const UMoviePipelineExecutorShot* InShot, const bool bFlushToDisk)
+{
+	CloseCameraRecords();
+	Super::OnShotFinishedImpl(InShot, bFlushToDisk);
+	if (ResumeManifest.IsValid()) ResumeManifest->FinishShot(GetPipeline()->GetActiveShotList().IndexOfByKey(InShot));
+	ShotStats->FinishShot(this, GetPipeline()->GetActiveShotList().IndexOfByKey(InShot));
+}
+#else
+void UCustomMoviePipelineOutput::OnShotFinishedImpl(const UMoviePipelineExecutorShot* InShot)
+{
+	CloseCameraRecords();
+	Super::OnShotFinishedImpl(InShot);
+	if (ResumeManifest.IsValid()) ResumeManifest->FinishShot(GetPipeline()->GetActiveShotList().IndexOfByKey(InShot));
+	ShotStats->FinishShot(this, GetPipeline()->GetActiveShotList().IndexOfByKey(InShot));
+}
+#endif
+
+TArray<float> UCustomMoviePipelineOutput::GetCameraInfo(ACameraActor* Camera, const FIntPoint& Resolution)
+{
+	FVector CamLocation = Camera->GetActorLocation();
+	FRotator CamRotation = Camera->GetActorRotation();
+	float FOV = Camera->GetCameraComponent()->FieldOfView;
+
+	TArray<float> CamInfo;
+	CamInfo.Add(CamLocation.X);
+	CamInfo.Add(CamLocation.Y);
+	CamInfo.Add(CamLocation.Z);
+	CamInfo.Add(CamRotation.Roll);
+	CamInfo.Add(CamRotation.Pitch);
+	CamInfo.Add(CamRotation.Yaw);
+	CamInfo.Add(FOV);
+	CamInfo.Add(Resolution.X);
+	CamInfo.Add(Resolution.Y);
+	return CamInfo;
+}
+
+void UCustomMoviePipelineOutput::PrecreateOutputDirectories(const FMoviePipelineFrameOutputState* InOutputState)
+{
+	TSet<FString> Directories;
+	auto AddDirectory = [&](const FString& Directory, const FString& Name)
+	{
+		// Directory/{name}/{frame_idx}.dat, the files are Directory/{name}.dat or Directory/{name}.xfc
+		Directories.Add(FPaths::GetPath(FPaths::GetPath(GetOutputPath(Directory / Name, "dat", InOutputState))));
+	};
+
+	if (OutputFrameOffset == 0 || bSaveCameraInfoPerFrame)
+	{
+		for (ACameraActor* Camera : SceneBindings->GetCameras())
+		{
+			AddDirectory(DirectoryCameraInfo, SceneBindings->GetExportName(Camera));
+		}
+	}
+	for (USkeletalMeshComponent* SkeletalMeshComponent : SceneBindings->GetSkeletalMeshComponents())
+	{
+		AddDirectory(DirectoryActorInfo, SceneBindings->GetExportName(SkeletalMeshComponent));
+	}
+	for (UStaticMeshComponent* StaticMeshComponent : SceneBindings->GetStaticMeshComponents())
+	{
+		AddDirectory(DirectoryActorInfo, SceneBindings->GetExportName(StaticMeshComponent));
+	}
+
+	// created on the write queue, ahead of the writes of the first frame
+	UXF_BlueprintFunctionLibrary::PrecreateDirectoryTrees(MoveTemp(Directories));
+}
+
+void UCustomMoviePipelineOutput::RecordCameraInfo(const FIntPoint& Resolution, const FMoviePipelineFrameOutputState* InOutputState)
+{
+	const TArray<UMoviePipelineExecutorShot*>& ActiveShots = GetPipeline()->GetActiveShotList();
+	for (ACameraActor* Camera : SceneBindings->GetCameras())
+	{
+		FString CameraRecordsPath = GetOutputPath(
+			DirectoryCameraInfo / SceneBindings->GetExportName(Camera),
+			"xfc",
+			InOutputState
+		);  // DirectoryCameraInfo/{camera_name}/{frame_idx}.xfc
+		CameraRecordsPath = FPaths::GetPath(CameraRecordsPath);  // get rid of the frame index
+		if (ActiveShots.Num() > 1)
+		{
+			CameraRecordsPath += FString::Printf(TEXT("_shot%03d"), InOutputState->ShotIndex);
+		}
+		CameraRecordsPath += ContainerSuffix;
+		CameraRecordsPath = FPaths::SetExtension(CameraRecordsPath, "xfc");
+
+		TSharedPtr<FXFChunkedFileWriter>* Records = CameraRecords.Find(CameraRecordsPath);
+		if (!Records)
+		{
+			const int32 FrameCapacity = ActiveShots[InOutputState->ShotIndex]->ShotInfo.WorkMetrics.TotalOutputFrameCount;
+			// a resumed render keeps the records of the frames the previous renders completed
+			const bool bKeepExisting = ResumeManifest.IsValid() && ResumeManifest->IsResumingShot(InOutputState->ShotIndex);
+			Records = &CameraRecords.Add(CameraRecordsPath, MakeShared<FXFChunkedFileWriter>(CameraRecordsPath, FrameCapacity, 9, bKeepExisting));
+		}
+
+		// a write of the frame, the frame isn't complete in the resume manifest before its camera records are
+		const int32 Slot = InOutputState->ShotOutputFrameNumber;
+		const int32 FrameNumber = InOutputState->OutputFrameNumber + OutputFrameOffset;
+		TFuture<bool> Future = FXFAsyncWriteQueue::Get().Enqueue([Writer = *Records, Slot, FrameNumber, CamInfo = GetCameraInfo(Camera, Resolution)]()
+		{
+			return Writer->WriteRecord(Slot, FrameNumber, CamInfo.GetData(), CamInfo.Num());
+		});
+		SaveInfoAsync(MoveTemp(Future), DirectoryCameraInfo, CameraRecordsPath, InOutputState);
+	}
+}
+
+void UCustomMoviePipelineOutput::CloseCameraRecords()
+{
+	for (TPair<FString, TSharedPtr<FXFChunkedFileWriter>>& Pair : CameraRecords)
+	{
+		// closed on the writer thread, after all the records queued for it
+		FXFAsyncWriteQueue::Get().Enqueue([Writer = Pair.Value]()
+		{
+			Writer->Close();
+			return true;
+		});
 	}
+	CameraRecords.Empty();
+}
+
+TFuture<bool> UCustomMoviePipelineOutput::EnqueueActorInfo(float StencilValue, const FString& Path)
+{
+	// written by every shard, renamed over the file of the others
+	return FXFAsyncWriteQueue::Get().Enqueue([StencilValue, Path]()
+	{
+		return UXF_BlueprintFunctionLibrary::SaveBytesToFileAtomic(&StencilValue, sizeof(float), Path);
+	});
+}
+
+void UCustomMoviePipelineOutput::SaveInfoAsync(TFuture<bool>&& Future, const FString& PassName, const FString& FilePath, const FMoviePipelineFrameOutputState* InOutputState)
+{
+	MoviePipeline::FMoviePipelineOutputFutureData OutputData;
+	OutputData.Shot = GetPipeline()->GetActiveShotList()[InOutputState->ShotIndex];
+	OutputData.PassIdentifier = FMoviePipelinePassIdentifier(PassName);
+	OutputData.FilePath = FilePath;
+	AddFrameOutputFuture(MoveTemp(Future), OutputData, InOutputState);
+}
+
+void UCustomMoviePipelineOutput::AddFrameOutputFuture(
+	TFuture<bool>&& Future,
+	const MoviePipeline::FMoviePipelineOutputFutureData& OutputData,
+	const FMoviePipelineFrameOutputState* InOutputState)
+{
+	GetPipeline()->AddOutputFuture(ResumeManifest.IsValid() ? ResumeManifest->Track(MoveTemp(Future), *InOutputState) : MoveTemp(Future), OutputData);
 }
 
 FString UCustomMoviePipelineOutput::GetOutputPath(FString PassName, FString Ext, const FMoviePipelineFrameOutputState* InOutputState)
 {
-	UMoviePipelineOutputSetting* OutputSettings = GetPipeline()->GetPipelineMasterConfig()->FindSetting<UMoviePipelineOutputSetting>();
-	//UMoviePipelineOutputSetting* OutputSettings = GetPipeline()->GetPipelinePrimaryConfig()->FindSetting<UMoviePipelineOutputSetting>();
-	check(OutputSettings);
-	FString OutputDirectory = OutputSettings->OutputDirectory.Path;
-	FString FileNameFormatString = OutputSettings->FileNameFormat;
-
-	FString OutputPath;
-	FMoviePipelineFormatArgs Args;
-	TMap<FString, FString> FormatOverrides;
-	FormatOverrides.Add(TEXT("camera_name"), "");
-	FormatOverrides.Add(TEXT("render_pass"), PassName);
-	FormatOverrides.Add(TEXT("ext"), Ext);
-	GetPipeline()->ResolveFilenameFormatArguments(
-		OutputDirectory / FileNameFormatString, FormatOverrides, OutputPath, Args, InOutputState);
-
-	if (FPaths::IsRelative(OutputPath))
+	return PathCache->Resolve(OutputFormatString, PassName, Ext, InOutputState, 0,
+		EXFOutputPathFlags::ClearCameraName | EXFOutputPathFlags::CollapseSlashes);
+}
+
+void FCustomEncodeStats::Add(const FString& PassName, double EncodeSeconds, int64 NumBytes)
+{
+	FScopeLock Lock(&CriticalSection);
+	FPassStats& PassStats = Stats.FindOrAdd(PassName);
+	PassStats.NumFiles++;
+	PassStats.EncodeSeconds += EncodeSeconds;
+	PassStats.NumBytes += NumBytes;
+}
+
+TMap<FString, FCustomEncodeStats::FPassStats> FCustomEncodeStats::GetStats() const
+{
+	FScopeLock Lock(&CriticalSection);
+	return Stats;
+}
+
+void FCustomEncodeStats::Reset()
+{
+	FScopeLock Lock(&CriticalSection);
+	Stats.Empty();
+}
+
+bool FCustomStencilImageWriteTask::RunTask()
+{
+	const FIntPoint Size = PixelData->GetSize();
+	const int64 NumPixels = (int64)Size.X * Size.Y;
+	const void* RawData = nullptr;
+	int64 SizeInBytes = 0;
+	PixelData->GetRawData(RawData, SizeInBytes);
+
+	TArray64<uint8> Stencil;
+	Stencil.SetNumZeroed(NumPixels * (BitDepth / 8));
+	uint8* Stencil8 = Stencil.GetData();
+	uint16* Stencil16 = (uint16*)Stencil.GetData();
+
+	// masks are made of few colors, remember the last one
+	FColor LastColor(0, 0, 0, 0);
+	uint8 LastStencil = 0;
+	bool bHasLast = false;
+	for (int64 Idx = 0; Idx < NumPixels; Idx++)
+	{
+		FColor Color;
+		switch (PixelData->GetType())
+		{
+		case EImagePixelType::Color: Color = ((const FColor*)RawData)[Idx]; break;
+		case EImagePixelType::Float16: Color = FLinearColor(((const FFloat16Color*)RawData)[Idx]).ToFColor(bConvertToSrgb); break;
+		case EImagePixelType::Float32: Color = ((const FLinearColor*)RawData)[Idx].ToFColor(bConvertToSrgb); break;
+		}
+		Color.A = 255;
+
+		if (!bHasLast || Color != LastColor)
+		{
+			const uint8* Found = MaskColorToStencil.IsValid() ? MaskColorToStencil->Find(Color) : nullptr;
+			LastColor = Color;
+			LastStencil = Found ? *Found : 0;
+			bHasLast = true;
+		}
+		if (BitDepth == 16) Stencil16[Idx] = LastStencil;
+		else Stencil8[Idx] = LastStencil;
+	}
+
+	IImageWrapperModule& ImageWrapperModule = FModuleManager::LoadModuleChecked<IImageWrapperModule>(FName("ImageWrapper"));
+	TSharedPtr<IImageWrapper> ImageWrapper = ImageWrapperModule.CreateImageWrapper(EImageFormat::PNG);
+	if (!ImageWrapper.IsValid() || !ImageWrapper->SetRaw(Stencil.GetData(), Stencil.Num(), Size.X, Size.Y, ERGBFormat::Gray, BitDepth))
+	{
+		UE_LOG(LogMovieRenderPipelineIO, Error, TEXT("Failed to encode the stencil mask %s"), *Filename);
+		return false;
+	}
+
+	const TArray64<uint8> Compressed = ImageWrapper->GetCompressed(CompressionQuality);
+	return UXF_BlueprintFunctionLibrary::SaveBytesToFile(Compressed.GetData(), Compressed.Num(), Filename);
+}
+
+bool FCustomQuantizeImageWriteTask::RunTask()
+{
+	Task->PixelData = UE::MoviePipeline::QuantizeImagePixelDataToBitDepth(SourcePixelData.Get(), 8, nullptr, bConvertToSrgb);
+	SourcePixelData.Reset();
+	return Task->RunTask();
+}
+
+bool FCustomTimedImageWriteTask::RunTask()
+{
+	XF_SCOPE_STAGE(ImageWrite);
+	const bool bCreated = !IFileManager::Get().FileExists(*Filename);
+	const double StartTime = FPlatformTime::Seconds();
+	const bool bSuccess = Task->RunTask();
+	const double EncodeSeconds = FPlatformTime::Seconds() - StartTime;
+	const int64 NumBytes = bSuccess ? IFileManager::Get().FileSize(*Filename) : 0;
+	Stats->Add(PassName, EncodeSeconds, NumBytes);
+	if (bSuccess) FXFStats::AddFileWrite(NumBytes, bCreated);
+	return bSuccess;
+}
+
+#if WITH_UNREALEXR
+/** Imf::OStream into memory, the file is written in one go at the end. */
+class FCustomEXRMemoryOStream : public Imf::OStream
+{
+public:
+#if ENGINE_MAJOR_VERSION == 5
+	typedef uint64_t FPosition;
+#else
+	typedef Imf::Int64 FPosition;
+#endif
+
+	FCustomEXRMemoryOStream() : Imf::OStream("") {}
+
+	virtual void write(const char c[], int n) override
+	{
+		const int64 End = (int64)Pos + n;
+		if (End > Data.Num())
+		{
+			Data.SetNumUninitialized(End, false);
+		}
+		FMemory::Memcpy(Data.GetData() + Pos, c, n);
+		Pos = End;
+	}
+	virtual FPosition tellp() override { return Pos; }
+	virtual void seekp(FPosition InPos) override { Pos = InPos; }
+
+	TArray<uint8> Data;
+
+private:
+	FPosition Pos = 0;
+};
+
+/** Copy one channel of the pixel data into a planar buffer of the precision. */
+template<typename ChannelType>
+static void CopyEXRChannel(const FImagePixelData* PixelData, int32 Channel, TArray<uint8>& OutBuffer)
+{
+	const int64 NumPixels = (int64)PixelData->GetSize().X * PixelData->GetSize().Y;
+	OutBuffer.SetNumUninitialized(NumPixels * sizeof(ChannelType));
+	ChannelType* Dst = (ChannelType*)OutBuffer.GetData();
+
+	const void* RawData = nullptr;
+	int64 SizeInBytes = 0;
+	PixelData->GetRawData(RawData, SizeInBytes);
+	switch (PixelData->GetType())
+	{
+	case EImagePixelType::Color:
+	{
+		// FColor is stored as BGRA
+		static const int32 ColorOffsets[] = { 2, 1, 0, 3 };
+		const uint8* Src = (const uint8*)RawData + ColorOffsets[Channel];
+		for (int64 Idx = 0; Idx < NumPixels; Idx++) Dst[Idx] = ChannelType(Src[Idx * 4] / 255.f);
+		break;
+	}
+	case EImagePixelType::Float16:
 	{
-		OutputPath = FPaths::ConvertRelativePathToFull(OutputPath);
+		const FFloat16* Src = (const FFloat16*)RawData + Channel;
+		for (int64 Idx = 0; Idx < NumPixels; Idx++) Dst[Idx] = ChannelType(Src[Idx * 4].GetFloat());
+		break;
 	}
+	case EImagePixelType::Float32:
+	{
+		const float* Src = (const float*)RawData + Channel;
+		for (int64 Idx = 0; Idx < NumPixels; Idx++) Dst[Idx] = ChannelType(Src[Idx * 4]);
+		break;
+	}
+	}
+}
+
+bool FCustomMultiLayerEXRWriteTask::RunTask()
+{
+	if (Layers.Num() == 0)
+	{
+		return true;
+	}
+
+	const FIntPoint Size = Layers[0].PixelData->GetSize();
+	for (const FLayer& Layer : Layers)
+	{
+		if (Layer.PixelData->GetSize() != Size)
+		{
+			UE_LOG(LogMovieRenderPipelineIO, Error, TEXT("Layer %s of %s has a different size, all the layers of a MultiLayerEXR must have the same size."), *Layer.Name, *Filename);
+			return false;
+		}
+	}
+
+	Imf::Header Header(Size.X, Size.Y);
+	switch (Compression)
+	{
+	case ECustomEXRCompression::None: Header.compression() = Imf::NO_COMPRESSION; break;
+	case ECustomEXRCompression::ZIP: Header.compression() = Imf::ZIP_COMPRESSION; break;
+	case ECustomEXRCompression::PIZ: Header.compression() = Imf::PIZ_COMPRESSION; break;
+	case ECustomEXRCompression::DWAA: Header.compression() = Imf::DWAA_COMPRESSION; break;
+	}
+
+	static const TCHAR* ChannelNames[] = { TEXT("R"), TEXT("G"), TEXT("B"), TEXT("A") };
+	// the planar buffers must outlive writePixels
+	TArray<TArray<uint8>> Buffers;
+	Buffers.SetNum(Layers.Num() * 4);
+	Imf::FrameBuffer FrameBuffer;
+	for (int32 LayerIdx = 0; LayerIdx < Layers.Num(); LayerIdx++)
+	{
+		const FLayer& Layer = Layers[LayerIdx];
+		const bool bHalf = Layer.Precision == ECustomEXRPrecision::Half;
+		const Imf::PixelType PixelType = bHalf ? Imf::HALF : Imf::FLOAT;
+		const int32 ChannelSize = bHalf ? sizeof(FFloat16) : sizeof(float);
+		for (int32 Channel = 0; Channel < Layer.NumChannels; Channel++)
+		{
+			TArray<uint8>& Buffer = Buffers[LayerIdx * 4 + Channel];
+			if (bHalf)
+			{
+				CopyEXRChannel<FFloat16>(Layer.PixelData.Get(), Channel, Buffer);
+			}
+			else
+			{
+				CopyEXRChannel<float>(Layer.PixelData.Get(), Channel, Buffer);
+			}
 
-	// Replace any double slashes with single slashes.
-	OutputPath.ReplaceInline(TEXT("//"), TEXT("/"));
+			// a single channel is Y, as read by most tools as grayscale
+			const TCHAR* ChannelSuffix = Layer.NumChannels == 1 ? TEXT("Y") : ChannelNames[Channel];
+			const FString ChannelName = Layer.Name.IsEmpty() ? FString(ChannelSuffix) : FString::Printf(TEXT("%s.%s"), *Layer.Name, ChannelSuffix);
+			Header.channels().insert(TCHAR_TO_ANSI(*ChannelName), Imf::Channel(PixelType));
+			FrameBuffer.insert(
+				TCHAR_TO_ANSI(*ChannelName),
+				Imf::Slice(PixelType, (char*)Buffer.GetData(), ChannelSize, (size_t)ChannelSize * Size.X));
+		}
+	}
+
+	FCustomEXRMemoryOStream Stream;
+	{
+		Imf::OutputFile File(Stream, Header);
+		File.setFrameBuffer(FrameBuffer);
+		File.writePixels(Size.Y);
+	}
 
-	return OutputPath;
+	return UXF_BlueprintFunctionLibrary::SaveBytesToFile(Stream.Data.GetData(), Stream.Data.Num(), Filename);
 }
+#endif // WITH_UNREALEXR
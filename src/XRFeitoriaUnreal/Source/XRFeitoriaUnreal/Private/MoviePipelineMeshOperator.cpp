@@ -3,12 +3,25 @@
 
 #include "MoviePipelineMeshOperator.h"
 #include "XF_BlueprintFunctionLibrary.h"
+#include "XF_ChunkedFile.h"
+#include "XF_AsyncWriteQueue.h"
+#include "XF_SkinnedVertexReadback.h"
+#include "XF_OcclusionQuery.h"
+#include "XF_SceneBindings.h"
+#include "XF_OutputPathCache.h"
+#include "XF_ResumeManifest.h"
+#include "XF_Stats.h"
+#include "MoviePipelineRenderShardSetting.h"
+#include "CustomMoviePipelineOutput.h"
 #include "Engine/StaticMeshActor.h"
 #include "Animation/SkeletalMeshActor.h"
 #include "Camera/CameraActor.h"
 #include "Camera/CameraComponent.h"
+#include "Camera/PlayerCameraManager.h"
+#include "GameFramework/PlayerController.h"
 #include "Misc/FileHelper.h"
 #include "MovieRenderPipelineCoreModule.h"  // For logs
+#include "MoviePipelineQueue.h"
 
 
 void UMoviePipelineMeshOperator::SetupForPipelineImpl(UMoviePipeline* InPipeline)
@@ -17,92 +30,190 @@ void UMoviePipelineMeshOperator::SetupForPipelineImpl(UMoviePipeline* InPipeline
 	{
 		InPipeline->SetFlushDiskWritesPerShot(true);
 	}
+	if (SkeletalMeshOperatorOption.bUseGPUSkinCache)
+	{
+		SkinnedVertexReadback = MakeShared<FXFSkinnedVertexReadback>();
+	}
+	if (SkeletalMeshOperatorOption.bSaveOcclusionResult || SkeletalMeshOperatorOption.bSaveOcclusionRate ||
+		StaticMeshOperatorOption.bSaveOcclusionResult || StaticMeshOperatorOption.bSaveOcclusionRate)
+	{
+		OcclusionQuery = MakeShared<FXFAsyncOcclusionQuery>();
 
-	ULevelSequence* LevelSequence = GetPipeline()->GetTargetSequence();
-	UMovieSceneSequence* MovieSceneSequence = GetPipeline()->GetTargetSequence();
-	UMovieScene* MovieScene = LevelSequence->GetMovieScene();
-	TArray<FMovieSceneBinding> bindings = MovieScene->GetBindings();
+		if (OcclusionMethod == EMeshOcclusionMethod::DepthBuffer)
+		{
+			// mask colors are assigned in the order of the stencil values, see actor_infos of the python side
+			TArray<FColor> MaskColors;
+			if (UXF_BlueprintFunctionLibrary::LoadMaskColors(MaskColors))
+			{
+				for (int32 Idx = 0; Idx < MaskColors.Num(); Idx++)
+				{
+					MaskColorToStencil.Add(MaskColors[Idx], (uint8)Idx);
+				}
+			}
+			else
+			{
+				UE_LOG(LogMovieRenderPipeline, Error, TEXT("Failed to load mask colors, falling back to line trace occlusion"));
+				OcclusionMethod = EMeshOcclusionMethod::LineTrace;
+			}
+		}
+	}
+
+	// a shard of the sequence writes its own containers, numbered like the frames of a whole render
+	ContainerSuffix = UMoviePipelineRenderShardSetting::GetContainerSuffix(GetPipeline());
+	OutputFrameOffset = UMoviePipelineRenderShardSetting::GetOutputFrameOffset(GetPipeline());
 
-	TArray<FMovieSceneBindingProxy> bindingProxies;
-	for (FMovieSceneBinding binding : bindings)
+	// resolved once per pipeline, shared with the other outputs
+	SceneBindings = FXFSceneBindingRegistry::Get(GetPipeline());
+
+	// The format is resolved once per shot by the path cache, see GetOutputPath
+	UMoviePipelineOutputSetting* OutputSettings = GetPipeline()->GetPipelineMasterConfig()->FindSetting<UMoviePipelineOutputSetting>();
+	check(OutputSettings);
+	OutputFormatString = OutputSettings->OutputDirectory.Path / OutputSettings->FileNameFormat;
+	OutputResolution = OutputSettings->OutputResolution;
+	PathCache = MakeShared<FXFOutputPathCache>(GetPipeline());
+	// tracked only when resuming, the manifest costs a write every few frames
+	if (bSkipCompletedFrames)
 	{
-		FGuid guid = binding.GetObjectGuid();
-		bindingProxies.Add(FSequencerBindingProxy(guid, MovieSceneSequence));
+		ResumeManifest = FXFResumeManifest::Get(GetPipeline());
+		ResumeManifest->RegisterOutput(this);
 	}
+	ShotStats = FXFShotStatsRecorder::Get(GetPipeline());
+	ShotStats->RegisterOutput(this);
+	// the directories of a previous render may have been deleted
+	UXF_BlueprintFunctionLibrary::ResetDirectoryCache();
+	PrecreatedShotIndex = INDEX_NONE;
 
-	boundObjects = USequencerToolsFunctionLibrary::GetBoundObjects(
-		GetPipeline()->GetWorld(),
-		LevelSequence,
-		bindingProxies,
-		FSequencerScriptingRange::FromNative(
-			MovieScene->GetPlaybackRange(),
-			MovieScene->GetDisplayRate()
-		)
-	);
-
-	for (FSequencerBoundObjects boundObject : boundObjects)
+	// Bone indices only change with the mesh, the poses are read from the component space transforms every frame
+	if (SkeletalMeshOperatorOption.bEnabled && (SkeletalMeshOperatorOption.bSaveSkeletonPosition || SkeletalMeshOperatorOption.bSaveSkeletonRotation ||
+		SkeletalMeshOperatorOption.bSaveOcclusionResult || SkeletalMeshOperatorOption.bSaveOcclusionRate || ProjectionOption.bEnabled))
 	{
-		// loop over bound objects
-		UObject* BoundObject = boundObject.BoundObjects[0];  // only have one item
-		if (BoundObject->IsA(ASkeletalMeshActor::StaticClass()))
+		for (USkeletalMeshComponent* SkeletalMeshComponent : SceneBindings->GetSkeletalMeshComponents())
 		{
-			ASkeletalMeshActor* SkeletalMeshActor = Cast<ASkeletalMeshActor>(BoundObject);
-			SkeletalMeshComponents.Add(SkeletalMeshActor->GetSkeletalMeshComponent());
+			FXFSkeletonBones& Bones = SkeletonBones.Add(SkeletalMeshComponent);
+			UXF_BlueprintFunctionLibrary::GetSkeletalMeshBoneIndices(SkeletalMeshComponent, Bones.BoneIndices, Bones.BoneNames);
 		}
-		else if (BoundObject->IsA(AStaticMeshActor::StaticClass()))
-		{
-			AStaticMeshActor* StaticMeshActor = Cast<AStaticMeshActor>(BoundObject);
-			StaticMeshComponents.Add(StaticMeshActor->GetStaticMeshComponent());
-		}
-		else if (BoundObject->IsA(USkeletalMeshComponent::StaticClass()))
+	}
+
+	// Local vertices of static meshes don't change during the render, only the component transform does
+	if (StaticMeshOperatorOption.bEnabled && (StaticMeshOperatorOption.bSaveVerticesPosition ||
+		StaticMeshOperatorOption.bSaveOcclusionResult || StaticMeshOperatorOption.bSaveOcclusionRate || ProjectionOption.NeedsBoundingBox()))
+	{
+		for (UStaticMeshComponent* StaticMeshComponent : SceneBindings->GetStaticMeshComponents())
 		{
-			USkeletalMeshComponent* SkeletalMeshComponent = Cast<USkeletalMeshComponent>(BoundObject);
-			// check if it's already in the list
-			bool bFound = false;
-			for (USkeletalMeshComponent* SkeletalMeshComponentInList : SkeletalMeshComponents)
+			TArray<FXFVector3f> LocalVertices;
+			bool isSuccess = UXF_BlueprintFunctionLibrary::GetStaticMeshLocalVertexLocations(
+				StaticMeshComponent,
+				StaticMeshOperatorOption.LODIndex,
+				LocalVertices
+			);
+			if (!isSuccess)
 			{
-				if (SkeletalMeshComponentInList == SkeletalMeshComponent)
-				{
-					bFound = true;
-					break;
-				}
+				UE_LOG(LogMovieRenderPipeline, Error, TEXT("Failed to get vertex positions of %s"), *StaticMeshComponent->GetOwner()->GetName());
+				continue;
 			}
-			if (!bFound) SkeletalMeshComponents.Add(SkeletalMeshComponent);
-		}
-		else if (BoundObject->IsA(UStaticMeshComponent::StaticClass()))
-		{
-			UStaticMeshComponent* StaticMeshComponent = Cast<UStaticMeshComponent>(BoundObject);
-			// check if it's already in the list
-			bool bFound = false;
-			for (UStaticMeshComponent* StaticMeshComponentInList : StaticMeshComponents)
+			if (StaticMeshOperatorOption.VertexExport.IsSubset())
 			{
-				if (StaticMeshComponentInList == StaticMeshComponent)
-				{
-					bFound = true;
-					break;
-				}
+				TArray<FXFVector3f> ExportVertices = LocalVertices;
+				StaticMeshOperatorOption.VertexExport.SelectVertices(ExportVertices);
+				StaticMeshExportVertices.Add(StaticMeshComponent, MoveTemp(ExportVertices));
 			}
-			if (!bFound)
-				StaticMeshComponents.Add(StaticMeshComponent);
+			StaticMeshLocalVertices.Add(StaticMeshComponent, MoveTemp(LocalVertices));
 		}
 	}
 }
 
 void UMoviePipelineMeshOperator::OnReceiveImageDataImpl(FMoviePipelineMergerOutputFrame* InMergedOutputFrame)
 {
-	for (USkeletalMeshComponent* SkeletalMeshComponent : SkeletalMeshComponents)
+	// save the vertices read back from the skin cache and the occlusion traced since the last frame
+	if (SkinnedVertexReadback.IsValid()) SkinnedVertexReadback->Poll();
+	if (OcclusionQuery.IsValid()) OcclusionQuery->Poll();
+
+	if (ResumeManifest.IsValid()) ResumeManifest->BeginFrame(this, InMergedOutputFrame->FrameOutputState);
+	ShotStats->BeginFrame(InMergedOutputFrame->FrameOutputState);
+	if (ResumeManifest.IsValid() && ResumeManifest->IsFrameComplete(InMergedOutputFrame->FrameOutputState))
+	{
+		// written by a previous render, the next frame starts with keyframes as the deltas would miss this one
+		VertexEncoders.Empty();
+		return;
+	}
+
+	if (InMergedOutputFrame->FrameOutputState.ShotIndex != PrecreatedShotIndex)
+	{
+		PrecreateOutputDirectories(&InMergedOutputFrame->FrameOutputState);
+		PrecreatedShotIndex = InMergedOutputFrame->FrameOutputState.ShotIndex;
+	}
+
+	// the depth and mask passes of this frame, valid until the end of this function
+	if (OcclusionMethod == EMeshOcclusionMethod::DepthBuffer && OcclusionQuery.IsValid())
+	{
+		SetupDepthOcclusionView(InMergedOutputFrame);
+	}
+
+	// the cameras are projected once per frame, for every mesh
+	CameraProjections.Reset();
+	if (ProjectionOption.bEnabled)
+	{
+		for (ACameraActor* Camera : SceneBindings->GetCameras())
+		{
+			CameraProjections.Emplace(Camera, OutputResolution);
+		}
+	}
+
+	for (USkeletalMeshComponent* SkeletalMeshComponent : SceneBindings->GetSkeletalMeshComponents())
 	{
 		// loop over Skeletal mesh components
 		if (!SkeletalMeshOperatorOption.bEnabled) continue;
 
-		// Actor in level
-		FString MeshNameFromLabel = SkeletalMeshComponent->GetOwner()->GetActorNameOrLabel();
-		// Actor spawned from sequence
-		FString MeshNameFromName = SkeletalMeshComponent->GetOwner()->GetFName().GetPlainNameString();
-		// Judge which name is correct
-		FString MeshName = MeshNameFromName.StartsWith("SkeletalMesh") ? MeshNameFromLabel : MeshNameFromName;
+		const FString& MeshName = SceneBindings->GetExportName(SkeletalMeshComponent);
 
-		if (SkeletalMeshOperatorOption.bSaveVerticesPosition)
+		// the vertices of this frame, for the export and the bounding boxes
+		const bool bSaveVertices = SkeletalMeshOperatorOption.bSaveVerticesPosition;
+		const bool bProjectVertices = ProjectionOption.NeedsBoundingBox() && ProjectionOption.bUseVerticesForBoundingBox;
+		TArray<FVector> ProjectedVertices;
+		bool bHasProjectedVertices = false;
+		bool bIsReadbackRequested = false;
+
+		if (SkinnedVertexReadback.IsValid() && (bSaveVertices || bProjectVertices))
+		{
+			// Read Vertex Positions back from the GPU skin cache, saved with their bounding boxes by a later Poll()
+			const FString Directory = SkeletalMeshOperatorOption.DirectoryVertices;
+			const FMoviePipelineFrameOutputState OutputState = InMergedOutputFrame->FrameOutputState;
+			// CameraProjections only lasts for this frame
+			TArray<FXFCameraProjection> Projections;
+			if (bProjectVertices) Projections = CameraProjections;
+			// the frame isn't complete before the vertices are saved
+			if (ResumeManifest.IsValid()) ResumeManifest->BeginWrite(OutputState);
+			bIsReadbackRequested = SkinnedVertexReadback->Request(
+				SkeletalMeshComponent,
+				SkeletalMeshOperatorOption.LODIndex,
+				[this, Directory, MeshName, OutputState, bSaveVertices, bProjectVertices, Projections = MoveTemp(Projections)](TArray<FVector>&& VertexPositions)
+				{
+					if (VertexPositions.Num() == 0)
+					{
+						// the readback failed, the frame isn't complete so a resumed render writes it again
+						if (ResumeManifest.IsValid()) ResumeManifest->EndWrite(OutputState.OutputFrameNumber, false);
+						return;
+					}
+					if (bProjectVertices)
+					{
+						SaveProjection(Projections, TArrayView<const FVector>(), VertexPositions, true, MeshName, &OutputState);
+					}
+					if (bSaveVertices)
+					{
+						SkeletalMeshOperatorOption.VertexExport.SelectVertices(VertexPositions);
+						SaveMeshData(MoveTemp(VertexPositions), SkeletalMeshOperatorOption.VertexExport.GetEncodingSettings(), Directory, MeshName, &OutputState);
+					}
+					if (ResumeManifest.IsValid()) ResumeManifest->EndWrite(OutputState.OutputFrameNumber, true);
+				}
+			);
+			if (!bIsReadbackRequested)
+			{
+				if (ResumeManifest.IsValid()) ResumeManifest->EndWrite(OutputState.OutputFrameNumber, true);
+				UE_LOG(LogMovieRenderPipeline, Verbose, TEXT("%s is not in the GPU skin cache, skinning on the CPU"), *MeshName);
+			}
+		}
+
+		if (!bIsReadbackRequested && (bSaveVertices || bProjectVertices))
 		{
 			// Get Vertex Positions (with LOD)
 			TArray<FVector> VertexPositions;
@@ -114,30 +225,52 @@ void UMoviePipelineMeshOperator::OnReceiveImageDataImpl(FMoviePipelineMergerOutp
 			if (!isSuccess)
 			{
 				UE_LOG(LogMovieRenderPipeline, Error, TEXT("Failed to get vertex positions"));
-				continue;
+				if (bSaveVertices) continue;
+			}
+			else if (bSaveVertices)
+			{
+				if (bProjectVertices)
+				{
+					ProjectedVertices = VertexPositions;
+					bHasProjectedVertices = true;
+				}
+				SkeletalMeshOperatorOption.VertexExport.SelectVertices(VertexPositions);
+				SaveMeshData(MoveTemp(VertexPositions), SkeletalMeshOperatorOption.VertexExport.GetEncodingSettings(),
+					SkeletalMeshOperatorOption.DirectoryVertices, MeshName, &InMergedOutputFrame->FrameOutputState);
 			}
-			TArray<float> VertexPositionsFloat;
-			for (FVector position : VertexPositions)
+			else
 			{
-				VertexPositionsFloat.Add(position.X);
-				VertexPositionsFloat.Add(position.Y);
-				VertexPositionsFloat.Add(position.Z);
+				ProjectedVertices = MoveTemp(VertexPositions);
+				bHasProjectedVertices = true;
 			}
-			UXF_BlueprintFunctionLibrary::SaveFloatArrayToByteFile(
-				VertexPositionsFloat, GetOutputPath(
-					SkeletalMeshOperatorOption.DirectoryVertices / MeshName, "dat", &InMergedOutputFrame->FrameOutputState));
 		}
 
-		if (SkeletalMeshOperatorOption.bSaveSkeletonPosition)
+		const FXFSkeletonBones* Bones = SkeletonBones.Find(SkeletalMeshComponent);
+		if (!Bones) continue;
+
+		// Skeleton Positions and Rotations, in one pass over the component space transforms
+		const bool bSaveOcclusion = SkeletalMeshOperatorOption.bSaveOcclusionResult || SkeletalMeshOperatorOption.bSaveOcclusionRate;
+		TArray<FVector> SkeletonPositions;
+		TArray<FQuat> SkeletonRotations;
+		if (SkeletalMeshOperatorOption.bSaveSkeletonPosition || SkeletalMeshOperatorOption.bSaveSkeletonRotation || bSaveOcclusion || ProjectionOption.bEnabled)
 		{
-			TArray<FVector> SkeletonPositions;
-			TArray<FName> SkeletonNames;
-			bool isSuccess = UXF_BlueprintFunctionLibrary::GetSkeletalMeshBoneLocations(
-				SkeletalMeshComponent, SkeletonPositions, SkeletonNames);
+			UXF_BlueprintFunctionLibrary::GetSkeletalMeshBoneTransforms(
+				SkeletalMeshComponent,
+				Bones->BoneIndices,
+				SkeletonPositions,
+				SkeletalMeshOperatorOption.bSaveSkeletonRotation ? &SkeletonRotations : nullptr
+			);
+		}
 
+		if (bIsFirstFrame && (SkeletalMeshOperatorOption.bSaveSkeletonPosition || SkeletalMeshOperatorOption.bSaveSkeletonRotation))
+		{
 			// Skeleton Names (only save on the first frame)
-			TArray<FString> SkeletonNamesString;
-			for (FName name : SkeletonNames) SkeletonNamesString.Add(name.ToString());
+			FString SkeletonNamesString;
+			for (const FName& name : Bones->BoneNames)
+			{
+				SkeletonNamesString += name.ToString();
+				SkeletonNamesString += LINE_TERMINATOR;
+			}
 			FString BoneNamePath = GetOutputPath(
 				SkeletalMeshOperatorOption.DirectorySkeleton / MeshName, "txt", &InMergedOutputFrame->FrameOutputState);
 			// save to DirectorySkeleton / BoneName.txt
@@ -145,98 +278,231 @@ void UMoviePipelineMeshOperator::OnReceiveImageDataImpl(FMoviePipelineMergerOutp
 				FPaths::GetPath(BoneNamePath),
 				FPaths::SetExtension("BoneName", FPaths::GetExtension(BoneNamePath))
 			);
-			if (bIsFirstFrame) FFileHelper::SaveStringArrayToFile(SkeletonNamesString, *BoneNamePath);
+			MoviePipeline::FMoviePipelineOutputFutureData OutputData;
+			OutputData.Shot = GetPipeline()->GetActiveShotList()[InMergedOutputFrame->FrameOutputState.ShotIndex];
+			OutputData.PassIdentifier = FMoviePipelinePassIdentifier(SkeletalMeshOperatorOption.DirectorySkeleton);
+			OutputData.FilePath = BoneNamePath;
+			// every shard writes it, renamed over the file of the others
+			AddFrameOutputFuture(
+				FXFAsyncWriteQueue::Get().Enqueue([SkeletonNamesString = MoveTemp(SkeletonNamesString), BoneNamePath]()
+				{
+					const FTCHARToUTF8 SkeletonNamesUtf8(*SkeletonNamesString);
+					return UXF_BlueprintFunctionLibrary::SaveBytesToFileAtomic(SkeletonNamesUtf8.Get(), SkeletonNamesUtf8.Length(), BoneNamePath);
+				}),
+				OutputData, &InMergedOutputFrame->FrameOutputState);
+		}
 
-			// Skeleton Positions
-			TArray<float> SkeletonPositionsFloat;
-			for (FVector position : SkeletonPositions)
+		if (ProjectionOption.bEnabled)
+		{
+			// the boxes of the vertices read back from the GPU are saved along with them
+			const bool bSaveBoundingBoxes = !(bIsReadbackRequested && bProjectVertices);
+			SaveProjection(CameraProjections, SkeletonPositions, bHasProjectedVertices ? ProjectedVertices : SkeletonPositions,
+				bSaveBoundingBoxes, MeshName, &InMergedOutputFrame->FrameOutputState);
+		}
+
+		if (SkeletalMeshOperatorOption.bSaveSkeletonRotation)
+		{
+			// DirectorySkeletonRotation/{actor_name}/{frame_idx}.dat, quaternion (x, y, z, w) per bone
+			TArray<float> RotationFloat;
+			RotationFloat.SetNumUninitialized(SkeletonRotations.Num() * 4);
+			for (int32 Idx = 0; Idx < SkeletonRotations.Num(); Idx++)
 			{
-				SkeletonPositionsFloat.Add(position.X);
-				SkeletonPositionsFloat.Add(position.Y);
-				SkeletonPositionsFloat.Add(position.Z);
+				RotationFloat[Idx * 4 + 0] = SkeletonRotations[Idx].X;
+				RotationFloat[Idx * 4 + 1] = SkeletonRotations[Idx].Y;
+				RotationFloat[Idx * 4 + 2] = SkeletonRotations[Idx].Z;
+				RotationFloat[Idx * 4 + 3] = SkeletonRotations[Idx].W;
 			}
-			UXF_BlueprintFunctionLibrary::SaveFloatArrayToByteFile(
-				SkeletonPositionsFloat, GetOutputPath(
-					SkeletalMeshOperatorOption.DirectorySkeleton / MeshName, "dat", &InMergedOutputFrame->FrameOutputState));
+			SaveMeshData(MoveTemp(RotationFloat), 4, SkeletalMeshOperatorOption.DirectorySkeletonRotation, MeshName, &InMergedOutputFrame->FrameOutputState);
+		}
+
+		if (SkeletalMeshOperatorOption.bSaveSkeletonPosition)
+		{
+			// the occlusion below needs the positions too
+			TArray<FVector> Positions = bSaveOcclusion ? TArray<FVector>(SkeletonPositions) : MoveTemp(SkeletonPositions);
+			SaveMeshData(MoveTemp(Positions), SkeletalMeshOperatorOption.DirectorySkeleton, MeshName, &InMergedOutputFrame->FrameOutputState);
 		}
 
-		//if (SkeletalMeshOperatorOption.bSaveOcclusionRate || SkeletalMeshOperatorOption.bSaveOcclusionResult)
-		//{
-		//
-		//	float non_occlusion_rate;
-		//	float self_occlusion_rate;
-		//	float inter_occlusion_rate;
-		//	TArray<FVector> SkeletonPositions;
-		//	TArray<FName> SkeletonNames;
-		//	TArray<EOcclusion> SkeletonOcclusion;
-		//	float MeshThickness = 5.0f;
-		//	bool isSuccess = UXF_BlueprintFunctionLibrary::DetectInterOcclusionSkeleton(
-		//		SkeletalMeshComponent,
-		//		Camera,
-		//		non_occlusion_rate,
-		//		self_occlusion_rate,
-		//		inter_occlusion_rate,
-		//		SkeletonPositions,
-		//		SkeletonNames,
-		//		SkeletonOcclusion,
-		//		MeshThickness,
-		//		false
-		//	);
-		//	// Occlusion Int
-		//	TArray<uint8> SkeletonOcclusionInt;
-		//	for (EOcclusion occlusion : SkeletonOcclusion) SkeletonOcclusionInt.Add((uint8)occlusion);
-		//	FFileHelper::SaveArrayToFile(
-		//		SkeletonOcclusionInt, *GetOutputPath("Occlusion" / MeshName, "dat", &InMergedOutputFrame->FrameOutputState));
-		//
-		//	// Occlusion rate
-		//	TArray<float> OcclusionRate;
-		//	OcclusionRate.Add(non_occlusion_rate);
-		//	OcclusionRate.Add(self_occlusion_rate);
-		//	OcclusionRate.Add(inter_occlusion_rate);
-		//	UXF_BlueprintFunctionLibrary::SaveFloatArrayToByteFile(
-		//		OcclusionRate, *GetOutputPath("OcclusionRate" / MeshName, "dat", &InMergedOutputFrame->FrameOutputState));
-		//	// TODO: export to npz
-		//}
-	}
-	for (UStaticMeshComponent* StaticMeshComponent : StaticMeshComponents)
+		if (bSaveOcclusion)
+		{
+			// Occlusion of the bones from every camera
+			RequestOcclusion(
+				MoveTemp(SkeletonPositions),
+				SkeletalMeshOperatorOption.bSaveOcclusionResult,
+				SkeletalMeshOperatorOption.bSaveOcclusionRate,
+				SkeletalMeshOperatorOption.DirectoryOcclusion,
+				SkeletalMeshOperatorOption.DirectoryOcclusionRate,
+				SkeletalMeshComponent,
+				MeshName,
+				&InMergedOutputFrame->FrameOutputState
+			);
+		}
+	}
+	for (UStaticMeshComponent* StaticMeshComponent : SceneBindings->GetStaticMeshComponents())
 	{
 		// loop over static mesh components
 		if (!StaticMeshOperatorOption.bEnabled) continue;
 
-		// Actor in level
-		FString MeshNameFromLabel = StaticMeshComponent->GetOwner()->GetActorNameOrLabel();
-		// Actor spawned from sequence
-		FString MeshNameFromName = StaticMeshComponent->GetOwner()->GetFName().GetPlainNameString();
-		// Judge which name is correct
-		FString MeshName = MeshNameFromName.StartsWith("StaticMesh") ? MeshNameFromLabel : MeshNameFromName;
+		const FString& MeshName = SceneBindings->GetExportName(StaticMeshComponent);
 
-		if (StaticMeshOperatorOption.bSaveVerticesPosition)
+		// Local Vertex Positions (cached in SetupForPipelineImpl)
+		const TArray<FXFVector3f>* LocalVertices = StaticMeshLocalVertices.Find(StaticMeshComponent);
+		const TArray<FXFVector3f>* ExportVertices = StaticMeshExportVertices.Find(StaticMeshComponent);
+		if (!ExportVertices) ExportVertices = LocalVertices;
+		const FTransform ComponentTransform = StaticMeshComponent->GetComponentTransform();
+
+		// the world positions are transformed once, for the bounding boxes, the occlusion and the export
+		const bool bSaveOcclusion = LocalVertices && (StaticMeshOperatorOption.bSaveOcclusionResult || StaticMeshOperatorOption.bSaveOcclusionRate);
+		const bool bSaveBoundingBoxes = LocalVertices && ProjectionOption.NeedsBoundingBox();
+		const bool bExportVertexPositions = LocalVertices && ExportVertices == LocalVertices
+			&& StaticMeshOperatorOption.bSaveVerticesPosition && !StaticMeshOperatorOption.bSaveRigidTransform;
+		TArray<FVector> VertexPositions;
+		if (bSaveOcclusion || bSaveBoundingBoxes || bExportVertexPositions)
 		{
-			// Get Vertex Positions (with LOD)
-			TArray<FVector> VertexPositions;
-			bool isSuccess = UXF_BlueprintFunctionLibrary::GetStaticMeshVertexLocations(
+			UXF_BlueprintFunctionLibrary::TransformPositions(ComponentTransform, *LocalVertices, VertexPositions);
+		}
+
+		if (bSaveBoundingBoxes)
+		{
+			// no keypoints for the static meshes, only the boxes of their vertices
+			SaveProjection(CameraProjections, TArrayView<const FVector>(), VertexPositions, true, MeshName, &InMergedOutputFrame->FrameOutputState);
+		}
+
+		if (bSaveOcclusion)
+		{
+			// Occlusion of the vertices from every camera
+			RequestOcclusion(
+				bExportVertexPositions ? TArray<FVector>(VertexPositions) : MoveTemp(VertexPositions),
+				StaticMeshOperatorOption.bSaveOcclusionResult,
+				StaticMeshOperatorOption.bSaveOcclusionRate,
+				StaticMeshOperatorOption.DirectoryOcclusion,
+				StaticMeshOperatorOption.DirectoryOcclusionRate,
 				StaticMeshComponent,
-				StaticMeshOperatorOption.LODIndex,
-				VertexPositions
+				MeshName,
+				&InMergedOutputFrame->FrameOutputState
 			);
-			if (!isSuccess)
+		}
+
+		if (StaticMeshOperatorOption.bSaveVerticesPosition)
+		{
+			if (!LocalVertices)
 			{
 				UE_LOG(LogMovieRenderPipeline, Error, TEXT("Failed to get vertex positions"));
 				continue;
 			}
-			TArray<float> VertexPositionsFloat;
-			for (FVector position : VertexPositions)
+
+			if (StaticMeshOperatorOption.bSaveRigidTransform)
+			{
+				// Local Vertices (only save on the first frame)
+				if (bIsFirstFrame)
+				{
+					FString LocalVerticesPath = GetOutputPath(
+						StaticMeshOperatorOption.DirectoryVertices / MeshName, "bin", &InMergedOutputFrame->FrameOutputState);
+					// save to DirectoryVertices / {actor_name} / local.bin
+					LocalVerticesPath = FPaths::Combine(FPaths::GetPath(LocalVerticesPath), TEXT("local.bin"));
+
+					MoviePipeline::FMoviePipelineOutputFutureData OutputData;
+					OutputData.Shot = GetPipeline()->GetActiveShotList()[InMergedOutputFrame->FrameOutputState.ShotIndex];
+					OutputData.PassIdentifier = FMoviePipelinePassIdentifier(StaticMeshOperatorOption.DirectoryVertices);
+					OutputData.FilePath = LocalVerticesPath;
+					// raw float32, the first frame isn't complete before it's saved
+					AddFrameOutputFuture(
+						FXFAsyncWriteQueue::Get().Enqueue([LocalVertices = *ExportVertices, LocalVerticesPath]()
+						{
+							return UXF_BlueprintFunctionLibrary::SaveBytesToFileAtomic(
+								LocalVertices.GetData(), (int64)LocalVertices.Num() * sizeof(FXFVector3f), LocalVerticesPath);
+						}),
+						OutputData, &InMergedOutputFrame->FrameOutputState);
+				}
+
+				// Local to World Matrix, row-major
+				const FMatrix Matrix = ComponentTransform.ToMatrixWithScale();
+				TArray<float> MatrixFloat;
+				MatrixFloat.SetNumUninitialized(16);
+				for (int32 Row = 0; Row < 4; Row++)
+				{
+					for (int32 Col = 0; Col < 4; Col++)
+					{
+						MatrixFloat[Row * 4 + Col] = Matrix.M[Row][Col];
+					}
+				}
+				SaveMeshData(MoveTemp(MatrixFloat), 16, StaticMeshOperatorOption.DirectoryVertices, MeshName, &InMergedOutputFrame->FrameOutputState);
+				continue;
+			}
+
+			if (!bExportVertexPositions)
 			{
-				VertexPositionsFloat.Add(position.X);
-				VertexPositionsFloat.Add(position.Y);
-				VertexPositionsFloat.Add(position.Z);
+				// a selection of the vertices
+				VertexPositions.Reset();
+				UXF_BlueprintFunctionLibrary::TransformPositions(ComponentTransform, *ExportVertices, VertexPositions);
 			}
-			UXF_BlueprintFunctionLibrary::SaveFloatArrayToByteFile(
-				VertexPositionsFloat, GetOutputPath(
-					StaticMeshOperatorOption.DirectoryVertices / MeshName, "dat", &InMergedOutputFrame->FrameOutputState));
+			SaveMeshData(MoveTemp(VertexPositions), StaticMeshOperatorOption.VertexExport.GetEncodingSettings(),
+				StaticMeshOperatorOption.DirectoryVertices, MeshName, &InMergedOutputFrame->FrameOutputState);
 		}
 	}
 	if (bIsFirstFrame) bIsFirstFrame = false;
+	CameraProjections.Reset();
+	DepthOcclusionView = FXFDepthOcclusionView();
+	DepthOcclusionCamera = nullptr;
+}
+
+bool UMoviePipelineMeshOperator::SetupDepthOcclusionView(FMoviePipelineMergerOutputFrame* InMergedOutputFrame)
+{
+	DepthOcclusionView = FXFDepthOcclusionView();
+	DepthOcclusionCamera = nullptr;
+
+	// SPassName of the depth and mask passes, as the pixel data of the frame is keyed by it
+	FString DepthSPassName;
+	FString MaskSPassName;
+	UCustomMoviePipelineOutput* CustomOutput = GetPipeline()->GetPipelineMasterConfig()->FindSetting<UCustomMoviePipelineOutput>();
+	if (CustomOutput)
+	{
+		for (const FCustomMoviePipelineRenderPass& RenderPass : CustomOutput->AdditionalRenderPasses)
+		{
+			if (!RenderPass.bEnabled) continue;
+			if (RenderPass.RenderPassName == DepthPassName) DepthSPassName = RenderPass.SPassName;
+			if (RenderPass.RenderPassName == MaskPassName) MaskSPassName = RenderPass.SPassName;
+		}
+	}
+	for (TPair<FMoviePipelinePassIdentifier, TUniquePtr<FImagePixelData>>& RenderPassData : InMergedOutputFrame->ImageOutputData)
+	{
+		if (RenderPassData.Key.Name == DepthSPassName) DepthOcclusionView.Depth = RenderPassData.Value.Get();
+		if (RenderPassData.Key.Name == MaskSPassName) DepthOcclusionView.Mask = RenderPassData.Value.Get();
+	}
+
+	// the camera rendering this frame: the view target, or the only camera of the sequence
+	AActor* ViewTarget = nullptr;
+	APlayerController* PlayerController = GetPipeline()->GetWorld()->GetFirstPlayerController();
+	if (PlayerController && PlayerController->PlayerCameraManager)
+	{
+		ViewTarget = PlayerController->PlayerCameraManager->GetViewTarget();
+	}
+	for (ACameraActor* Camera : SceneBindings->GetCameras())
+	{
+		if (Camera == ViewTarget) DepthOcclusionCamera = Camera;
+	}
+	if (!DepthOcclusionCamera && SceneBindings->GetCameras().Num() == 1) DepthOcclusionCamera = SceneBindings->GetCameras()[0];
+
+	if (!DepthOcclusionView.Depth || !DepthOcclusionView.Mask || !DepthOcclusionCamera)
+	{
+		if (!bWarnedDepthOcclusion)
+		{
+			UE_LOG(LogMovieRenderPipeline, Warning,
+				TEXT("Depth buffer occlusion needs the '%s' and '%s' passes and a camera, falling back to line trace occlusion"),
+				*DepthPassName, *MaskPassName);
+			bWarnedDepthOcclusion = true;
+		}
+		DepthOcclusionView = FXFDepthOcclusionView();
+		DepthOcclusionCamera = nullptr;
+		return false;
+	}
+
+	DepthOcclusionView.CameraLocation = DepthOcclusionCamera->GetActorLocation();
+	DepthOcclusionView.CameraRotation = DepthOcclusionCamera->GetActorRotation();
+	DepthOcclusionView.FOV = DepthOcclusionCamera->GetCameraComponent()->FieldOfView;
+	DepthOcclusionView.MaskColorToStencil = &MaskColorToStencil;
+	DepthOcclusionView.DepthUnitInCm = DepthUnitInCm;
+	DepthOcclusionView.DepthTolerance = DepthTolerance;
+	return true;
 }
 
 
@@ -246,30 +512,412 @@ void UMoviePipelineMeshOperator::BeginExportImpl()
 	UE_LOG(LogMovieRenderPipelineIO, Log, TEXT("Mesh Operator Ended."));
 }
 
-FString UMoviePipelineMeshOperator::GetOutputPath(FString PassName, FString Ext, const FMoviePipelineFrameOutputState* InOutputState)
+void UMoviePipelineMeshOperator::BeginFinalizeImpl()
 {
-	//UMoviePipelineOutputSetting* OutputSettings = GetPipeline()->GetPipelinePrimaryConfig()->FindSetting<UMoviePipelineOutputSetting>();
-	UMoviePipelineOutputSetting* OutputSettings = GetPipeline()->GetPipelineMasterConfig()->FindSetting<UMoviePipelineOutputSetting>();
-	check(OutputSettings);
-	FString OutputDirectory = OutputSettings->OutputDirectory.Path;
-	FString FileNameFormatString = OutputSettings->FileNameFormat;
+	CloseShotContainers();
+}
+
+bool UMoviePipelineMeshOperator::HasFinishedProcessingImpl()
+{
+	if (SkinnedVertexReadback.IsValid() && SkinnedVertexReadback->Poll() > 0) return false;
+	if (OcclusionQuery.IsValid() && OcclusionQuery->Poll() > 0) return false;
+	// the frames completed by the last writes
+	if (ResumeManifest.IsValid()) ResumeManifest->Flush();
+	return FXFAsyncWriteQueue::Get().GetQueueDepth() == 0;
+}
+
+#if ENGINE_MAJOR_VERSION == 5
+void UMoviePipelineMeshOperator::OnShotFinishedImpl(const UMoviePipelineExecutorShot* InShot, const bool bFlushToDisk)
+#else
+void UMoviePipelineMeshOperator::OnShotFinishedImpl(const UMoviePipelineExecutorShot* InShot)
+#endif
+{
+	CloseShotContainers();
+	if (ResumeManifest.IsValid()) ResumeManifest->FinishShot(GetPipeline()->GetActiveShotList().IndexOfByKey(InShot));
+	ShotStats->FinishShot(this, GetPipeline()->GetActiveShotList().IndexOfByKey(InShot));
+#if ENGINE_MAJOR_VERSION == 5
+	if (bFlushToDisk)
+	{
+		FXFAsyncWriteQueue::Get().Flush();
+	}
+#endif
+}
+
+int32 UMoviePipelineMeshOperator::GetWriteQueueDepth() const
+{
+	return FXFAsyncWriteQueue::Get().GetQueueDepth();
+}
+
+void UMoviePipelineMeshOperator::CloseShotContainers()
+{
+	// the pending readbacks still write into the containers of this shot
+	if (SkinnedVertexReadback.IsValid()) SkinnedVertexReadback->Drain();
+	if (OcclusionQuery.IsValid()) OcclusionQuery->Drain();
+
+	for (TPair<FString, TSharedPtr<FXFChunkedFileWriter>>& Container : ShotContainers)
+	{
+		// closed on the writer thread, after all the records queued for it
+		FXFAsyncWriteQueue::Get().Enqueue([Writer = Container.Value]()
+		{
+			Writer->Close();
+			return true;
+		});
+	}
+	ShotContainers.Empty();
+	// the next shot starts with keyframes
+	VertexEncoders.Empty();
+}
+
+void UMoviePipelineMeshOperator::RequestOcclusion(
+	TArray<FVector>&& Points,
+	bool bSaveOcclusionResult,
+	bool bSaveOcclusionRate,
+	const FString& DirectoryOcclusion,
+	const FString& DirectoryOcclusionRate,
+	UPrimitiveComponent* Comp,
+	const FString& MeshName,
+	const FMoviePipelineFrameOutputState* InOutputState)
+{
+	if (DepthOcclusionView.IsValid())
+	{
+		// only the camera of this frame has rendered the depth and mask passes
+		FXFOcclusionResult Result;
+		Result.Occlusion.SetNumUninitialized(Points.Num());
+		DepthOcclusionView.ComputeOcclusion(Points, Comp->CustomDepthStencilValue, Result.Occlusion);
+		UXF_BlueprintFunctionLibrary::ComputeOcclusionRates(
+			Result.Occlusion, Result.NonOcclusionRate, Result.SelfOcclusionRate, Result.InterOcclusionRate);
+		SaveOcclusion(MoveTemp(Result), bSaveOcclusionResult, bSaveOcclusionRate, DirectoryOcclusion, DirectoryOcclusionRate,
+			SceneBindings->GetExportName(DepthOcclusionCamera), MeshName, InOutputState);
+		return;
+	}
+
+	for (ACameraActor* Camera : SceneBindings->GetCameras())
+	{
+		FString CameraName = SceneBindings->GetExportName(Camera);
+		const FMoviePipelineFrameOutputState OutputState = *InOutputState;
+		if (ResumeManifest.IsValid()) ResumeManifest->BeginWrite(OutputState);
+		OcclusionQuery->Request(
+			GetPipeline()->GetWorld(),
+			Camera->GetActorLocation(),
+			TArray<FVector>(Points),
+			Comp->GetOwner()->GetFName(),
+			5.f,  // MeshThickness, same as DetectInterOcclusionVertices
+			[this, bSaveOcclusionResult, bSaveOcclusionRate, DirectoryOcclusion, DirectoryOcclusionRate, CameraName, MeshName, OutputState](FXFOcclusionResult&& Result)
+			{
+				SaveOcclusion(MoveTemp(Result), bSaveOcclusionResult, bSaveOcclusionRate, DirectoryOcclusion, DirectoryOcclusionRate,
+					CameraName, MeshName, &OutputState);
+				if (ResumeManifest.IsValid()) ResumeManifest->EndWrite(OutputState.OutputFrameNumber, true);
+			}
+		);
+	}
+}
 
-	FString OutputPath;
-	FMoviePipelineFormatArgs Args;
-	TMap<FString, FString> FormatOverrides;
-	FormatOverrides.Add(TEXT("camera_name"), "");
-	FormatOverrides.Add(TEXT("render_pass"), PassName);
-	FormatOverrides.Add(TEXT("ext"), Ext);
-	GetPipeline()->ResolveFilenameFormatArguments(
-		OutputDirectory / FileNameFormatString, FormatOverrides, OutputPath, Args, InOutputState);
+void UMoviePipelineMeshOperator::SaveOcclusion(
+	FXFOcclusionResult&& Result,
+	bool bSaveOcclusionResult,
+	bool bSaveOcclusionRate,
+	const FString& DirectoryOcclusion,
+	const FString& DirectoryOcclusionRate,
+	const FString& CameraName,
+	const FString& MeshName,
+	const FMoviePipelineFrameOutputState* InOutputState)
+{
+	MoviePipeline::FMoviePipelineOutputFutureData OutputData;
+	OutputData.Shot = GetPipeline()->GetActiveShotList()[InOutputState->ShotIndex];
 
-	if (FPaths::IsRelative(OutputPath))
+	if (bSaveOcclusionResult)
 	{
-		OutputPath = FPaths::ConvertRelativePathToFull(OutputPath);
+		// DirectoryOcclusion/{camera_name}/{actor_name}/{frame_idx}.dat, uint8 per point
+		OutputData.PassIdentifier = FMoviePipelinePassIdentifier(DirectoryOcclusion);
+		OutputData.FilePath = GetOutputPath(DirectoryOcclusion / CameraName / MeshName, "dat", InOutputState);
+		AddFrameOutputFuture(
+			FXFAsyncWriteQueue::Get().Enqueue([Occlusion = MoveTemp(Result.Occlusion), FilePath = OutputData.FilePath]()
+			{
+				return UXF_BlueprintFunctionLibrary::SaveBytesToFile(Occlusion.GetData(), Occlusion.Num(), FilePath);
+			}),
+			OutputData, InOutputState);
 	}
 
-	// Replace any double slashes with single slashes.
-	OutputPath.ReplaceInline(TEXT("//"), TEXT("/"));
+	if (bSaveOcclusionRate)
+	{
+		// DirectoryOcclusionRate/{camera_name}/{actor_name}/{frame_idx}.dat, [non, self, inter]
+		TArray<float> OcclusionRate;
+		OcclusionRate.Add(Result.NonOcclusionRate);
+		OcclusionRate.Add(Result.SelfOcclusionRate);
+		OcclusionRate.Add(Result.InterOcclusionRate);
+		OutputData.PassIdentifier = FMoviePipelinePassIdentifier(DirectoryOcclusionRate);
+		OutputData.FilePath = GetOutputPath(DirectoryOcclusionRate / CameraName / MeshName, "dat", InOutputState);
+		AddFrameOutputFuture(
+			FXFAsyncWriteQueue::Get().EnqueueFloatArray(MoveTemp(OcclusionRate), OutputData.FilePath), OutputData, InOutputState);
+	}
+}
+
+void UMoviePipelineMeshOperator::SaveProjection(
+	TArrayView<const FXFCameraProjection> Projections,
+	TArrayView<const FVector> Keypoints,
+	TArrayView<const FVector> BoxPoints,
+	bool bSaveBoundingBoxes,
+	const FString& MeshName,
+	const FMoviePipelineFrameOutputState* InOutputState)
+{
+	const TArray<ACameraActor*>& Cameras = SceneBindings->GetCameras();
+	check(Projections.Num() == Cameras.Num());
+
+	for (int32 CameraIdx = 0; CameraIdx < Cameras.Num(); CameraIdx++)
+	{
+		const FXFCameraProjection& Projection = Projections[CameraIdx];
+		const FString& CameraName = SceneBindings->GetExportName(Cameras[CameraIdx]);
+
+		if (ProjectionOption.bSaveKeypoints2D && Keypoints.Num() > 0)
+		{
+			TArray<float> Records;
+			Projection.ProjectKeypoints(Keypoints, Records);
+			SaveMeshData(MoveTemp(Records), FXFCameraProjection::KeypointComponents, ProjectionOption.DirectoryKeypoints2D / CameraName, MeshName, InOutputState);
+		}
+		if (bSaveBoundingBoxes && ProjectionOption.bSaveBoundingBox2D)
+		{
+			TArray<float> Record;
+			Projection.ComputeBoundingBox2D(BoxPoints, Record);
+			SaveMeshData(MoveTemp(Record), FXFCameraProjection::BoundingBox2DComponents, ProjectionOption.DirectoryBoundingBox2D / CameraName, MeshName, InOutputState);
+		}
+	}
+
+	if (bSaveBoundingBoxes && ProjectionOption.bSaveBoundingBox3D)
+	{
+		TArray<float> Record;
+		FXFCameraProjection::ComputeBoundingBox3D(BoxPoints, Record);
+		SaveMeshData(MoveTemp(Record), FXFCameraProjection::BoundingBox3DComponents, ProjectionOption.DirectoryBoundingBox3D, MeshName, InOutputState);
+	}
+}
+
+void UMoviePipelineMeshOperator::PrecreateOutputDirectories(const FMoviePipelineFrameOutputState* InOutputState)
+{
+	TSet<FString> Directories;
+	auto AddMeshDirectory = [&](const FString& Directory, const FString& MeshName)
+	{
+		// Directory/{actor_name}/{frame_idx}.dat, or Directory/{actor_name}.xfc for the shot containers
+		const FString FrameDirectory = FPaths::GetPath(GetOutputPath(Directory / MeshName, "dat", InOutputState));
+		Directories.Add(OutputMode == EMeshOperatorOutputMode::PerFrameFile ? FrameDirectory : FPaths::GetPath(FrameDirectory));
+	};
+	auto AddOcclusionDirectories = [&](const auto& Option, const FString& MeshName)
+	{
+		// with the depth buffer only the camera of the frame is known, its directories are created on write
+		if (OcclusionMethod != EMeshOcclusionMethod::LineTrace) return;
+		for (ACameraActor* Camera : SceneBindings->GetCameras())
+		{
+			const FString& CameraName = SceneBindings->GetExportName(Camera);
+			if (Option.bSaveOcclusionResult)
+			{
+				Directories.Add(FPaths::GetPath(GetOutputPath(Option.DirectoryOcclusion / CameraName / MeshName, "dat", InOutputState)));
+			}
+			if (Option.bSaveOcclusionRate)
+			{
+				Directories.Add(FPaths::GetPath(GetOutputPath(Option.DirectoryOcclusionRate / CameraName / MeshName, "dat", InOutputState)));
+			}
+		}
+	};
 
-	return OutputPath;
+	auto AddProjectionDirectories = [&](const FString& MeshName, bool bHasKeypoints)
+	{
+		if (!ProjectionOption.bEnabled) return;
+		for (ACameraActor* Camera : SceneBindings->GetCameras())
+		{
+			const FString& CameraName = SceneBindings->GetExportName(Camera);
+			if (ProjectionOption.bSaveKeypoints2D && bHasKeypoints) AddMeshDirectory(ProjectionOption.DirectoryKeypoints2D / CameraName, MeshName);
+			if (ProjectionOption.bSaveBoundingBox2D) AddMeshDirectory(ProjectionOption.DirectoryBoundingBox2D / CameraName, MeshName);
+		}
+		if (ProjectionOption.bSaveBoundingBox3D) AddMeshDirectory(ProjectionOption.DirectoryBoundingBox3D, MeshName);
+	};
+
+	if (SkeletalMeshOperatorOption.bEnabled)
+	{
+		for (USkeletalMeshComponent* SkeletalMeshComponent : SceneBindings->GetSkeletalMeshComponents())
+		{
+			const FString& MeshName = SceneBindings->GetExportName(SkeletalMeshComponent);
+			AddProjectionDirectories(MeshName, true);
+			if (SkeletalMeshOperatorOption.bSaveVerticesPosition) AddMeshDirectory(SkeletalMeshOperatorOption.DirectoryVertices, MeshName);
+			if (SkeletalMeshOperatorOption.bSaveSkeletonPosition) AddMeshDirectory(SkeletalMeshOperatorOption.DirectorySkeleton, MeshName);
+			if (SkeletalMeshOperatorOption.bSaveSkeletonRotation) AddMeshDirectory(SkeletalMeshOperatorOption.DirectorySkeletonRotation, MeshName);
+			AddOcclusionDirectories(SkeletalMeshOperatorOption, MeshName);
+		}
+	}
+	if (StaticMeshOperatorOption.bEnabled)
+	{
+		for (UStaticMeshComponent* StaticMeshComponent : SceneBindings->GetStaticMeshComponents())
+		{
+			const FString& MeshName = SceneBindings->GetExportName(StaticMeshComponent);
+			AddProjectionDirectories(MeshName, false);
+			if (StaticMeshOperatorOption.bSaveVerticesPosition) AddMeshDirectory(StaticMeshOperatorOption.DirectoryVertices, MeshName);
+			AddOcclusionDirectories(StaticMeshOperatorOption, MeshName);
+		}
+	}
+
+	// created on the write queue, ahead of the writes of the shot
+	UXF_BlueprintFunctionLibrary::PrecreateDirectoryTrees(MoveTemp(Directories));
+}
+
+TSharedPtr<FXFChunkedFileWriter> UMoviePipelineMeshOperator::GetShotContainer(
+	const FString& FramePath,
+	int32 ElementComponents,
+	const FMoviePipelineFrameOutputState* InOutputState)
+{
+	const TArray<UMoviePipelineExecutorShot*>& ActiveShots = GetPipeline()->GetActiveShotList();
+
+	// Directory/{actor_name}[_shot{index}][_shard{index}of{count}].xfc, one file per actor per shot
+	FString ContainerPath = FPaths::GetPath(FramePath);
+	if (ActiveShots.Num() > 1)
+	{
+		ContainerPath += FString::Printf(TEXT("_shot%03d"), InOutputState->ShotIndex);
+	}
+	ContainerPath += ContainerSuffix;
+	ContainerPath = FPaths::SetExtension(ContainerPath, "xfc");
+
+	TSharedPtr<FXFChunkedFileWriter>* Container = ShotContainers.Find(ContainerPath);
+	if (!Container)
+	{
+		const int32 FrameCapacity = ActiveShots[InOutputState->ShotIndex]->ShotInfo.WorkMetrics.TotalOutputFrameCount;
+		// a resumed render keeps the records of the frames the previous renders completed
+		const bool bKeepExisting = ResumeManifest.IsValid() && ResumeManifest->IsResumingShot(InOutputState->ShotIndex);
+		Container = &ShotContainers.Add(ContainerPath, MakeShared<FXFChunkedFileWriter>(ContainerPath, FrameCapacity, ElementComponents, bKeepExisting));
+	}
+	return *Container;
+}
+
+void UMoviePipelineMeshOperator::SaveMeshData(
+	TArray<FVector>&& Positions,
+	const FString& Directory,
+	const FString& MeshName,
+	const FMoviePipelineFrameOutputState* InOutputState)
+{
+	FString FramePath = GetOutputPath(Directory / MeshName, "dat", InOutputState);  // Directory/{actor_name}/{frame_idx}.dat
+
+	MoviePipeline::FMoviePipelineOutputFutureData OutputData;
+	OutputData.Shot = GetPipeline()->GetActiveShotList()[InOutputState->ShotIndex];
+	OutputData.PassIdentifier = FMoviePipelinePassIdentifier(Directory);
+
+	if (OutputMode == EMeshOperatorOutputMode::PerFrameFile)
+	{
+		OutputData.FilePath = FramePath;
+		AddFrameOutputFuture(
+			FXFAsyncWriteQueue::Get().EnqueueVectorArray(MoveTemp(Positions), FramePath), OutputData, InOutputState);
+		return;
+	}
+
+	TSharedPtr<FXFChunkedFileWriter> Container = GetShotContainer(FramePath, 3, InOutputState);
+	OutputData.FilePath = Container->GetPath();
+	const int32 Slot = InOutputState->ShotOutputFrameNumber;
+	const int32 FrameNumber = InOutputState->OutputFrameNumber + OutputFrameOffset;
+	AddFrameOutputFuture(
+		FXFAsyncWriteQueue::Get().Enqueue([Writer = Container, Slot, FrameNumber, Positions = MoveTemp(Positions)]()
+		{
+			return Writer->WriteRecord(Slot, FrameNumber, Positions);
+		}),
+		OutputData, InOutputState);
+}
+
+void UMoviePipelineMeshOperator::SaveMeshData(
+	TArray<FVector>&& Positions,
+	const FXFVertexEncodingSettings& Encoding,
+	const FString& Directory,
+	const FString& MeshName,
+	const FMoviePipelineFrameOutputState* InOutputState)
+{
+	if (Encoding.IsRaw())
+	{
+		SaveMeshData(MoveTemp(Positions), Directory, MeshName, InOutputState);
+		return;
+	}
+
+	FString FramePath = GetOutputPath(Directory / MeshName, "dat", InOutputState);  // Directory/{actor_name}/{frame_idx}.dat
+
+	MoviePipeline::FMoviePipelineOutputFutureData OutputData;
+	OutputData.Shot = GetPipeline()->GetActiveShotList()[InOutputState->ShotIndex];
+	OutputData.PassIdentifier = FMoviePipelinePassIdentifier(Directory);
+	const int32 FrameNumber = InOutputState->OutputFrameNumber + OutputFrameOffset;
+
+	// the deltas need the frames of a file sequence encoded in order, the write queue runs them in order
+	TSharedPtr<FXFChunkedFileWriter> Container;
+	if (OutputMode == EMeshOperatorOutputMode::ShotContainer)
+	{
+		Container = GetShotContainer(FramePath, 1, InOutputState);
+	}
+	const FString StreamKey = Container.IsValid() ? Container->GetPath() : FPaths::GetPath(FramePath);
+	TSharedPtr<FXFVertexEncoder>& Encoder = VertexEncoders.FindOrAdd(StreamKey);
+	if (!Encoder.IsValid())
+	{
+		Encoder = MakeShared<FXFVertexEncoder>(Encoding);
+	}
+
+	if (!Container.IsValid())
+	{
+		OutputData.FilePath = FramePath;
+		AddFrameOutputFuture(
+			FXFAsyncWriteQueue::Get().Enqueue([Encoder, FrameNumber, FramePath, Positions = MoveTemp(Positions)]()
+			{
+				TArray<uint8> Frame;
+				Encoder->Encode(Positions, FrameNumber, Frame);
+				return UXF_BlueprintFunctionLibrary::SaveBytesToFile(Frame.GetData(), Frame.Num(), FramePath);
+			}),
+			OutputData, InOutputState);
+		return;
+	}
+
+	OutputData.FilePath = Container->GetPath();
+	const int32 Slot = InOutputState->ShotOutputFrameNumber;
+	const int32 RecordStride = FXFVertexEncoder::GetMaxFrameSize(Positions.Num(), Encoding.Encoding);
+	AddFrameOutputFuture(
+		FXFAsyncWriteQueue::Get().Enqueue([Writer = Container, Encoder, Slot, FrameNumber, RecordStride, Positions = MoveTemp(Positions)]()
+		{
+			TArray<uint8> Frame;
+			Encoder->Encode(Positions, FrameNumber, Frame);
+			return Writer->WriteBytesRecord(Slot, FrameNumber, Frame, RecordStride);
+		}),
+		OutputData, InOutputState);
+}
+
+void UMoviePipelineMeshOperator::SaveMeshData(
+	TArray<float>&& FloatArray,
+	int32 ElementComponents,
+	const FString& Directory,
+	const FString& MeshName,
+	const FMoviePipelineFrameOutputState* InOutputState)
+{
+	FString FramePath = GetOutputPath(Directory / MeshName, "dat", InOutputState);  // Directory/{actor_name}/{frame_idx}.dat
+
+	MoviePipeline::FMoviePipelineOutputFutureData OutputData;
+	OutputData.Shot = GetPipeline()->GetActiveShotList()[InOutputState->ShotIndex];
+	OutputData.PassIdentifier = FMoviePipelinePassIdentifier(Directory);
+
+	if (OutputMode == EMeshOperatorOutputMode::PerFrameFile)
+	{
+		OutputData.FilePath = FramePath;
+		AddFrameOutputFuture(
+			FXFAsyncWriteQueue::Get().EnqueueFloatArray(MoveTemp(FloatArray), FramePath), OutputData, InOutputState);
+		return;
+	}
+
+	TSharedPtr<FXFChunkedFileWriter> Container = GetShotContainer(FramePath, ElementComponents, InOutputState);
+	OutputData.FilePath = Container->GetPath();
+	const int32 Slot = InOutputState->ShotOutputFrameNumber;
+	const int32 FrameNumber = InOutputState->OutputFrameNumber + OutputFrameOffset;
+	AddFrameOutputFuture(
+		FXFAsyncWriteQueue::Get().Enqueue([Writer = Container, Slot, FrameNumber, FloatArray = MoveTemp(FloatArray)]()
+		{
+			return Writer->WriteRecord(Slot, FrameNumber, FloatArray.GetData(), FloatArray.Num());
+		}),
+		OutputData, InOutputState);
+}
+
+void UMoviePipelineMeshOperator::AddFrameOutputFuture(
+	TFuture<bool>&& Future,
+	const MoviePipeline::FMoviePipelineOutputFutureData& OutputData,
+	const FMoviePipelineFrameOutputState* InOutputState)
+{
+	GetPipeline()->AddOutputFuture(ResumeManifest.IsValid() ? ResumeManifest->Track(MoveTemp(Future), *InOutputState) : MoveTemp(Future), OutputData);
+}
+
+FString UMoviePipelineMeshOperator::GetOutputPath(FString PassName, FString Ext, const FMoviePipelineFrameOutputState* InOutputState)
+{
+	return PathCache->Resolve(OutputFormatString, PassName, Ext, InOutputState, 0,
+		EXFOutputPathFlags::ClearCameraName | EXFOutputPathFlags::CollapseSlashes);
 }
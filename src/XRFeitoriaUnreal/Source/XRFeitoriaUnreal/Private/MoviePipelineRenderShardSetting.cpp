@@ -0,0 +1,42 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "MoviePipelineRenderShardSetting.h"
+#include "MoviePipeline.h"
+#include "MoviePipelineOutputSetting.h"
+#include "MoviePipelineMasterConfig.h"
+#include "MoviePipelineQueue.h"
+#include "LevelSequence.h"
+#include "MovieScene.h"
+
+
+const UMoviePipelineRenderShardSetting* UMoviePipelineRenderShardSetting::Find(UMoviePipeline* Pipeline)
+{
+	const UMoviePipelineRenderShardSetting* Setting = Pipeline->GetPipelineMasterConfig()->FindSetting<UMoviePipelineRenderShardSetting>();
+	return Setting && Setting->IsSharded() ? Setting : nullptr;
+}
+
+FString UMoviePipelineRenderShardSetting::GetContainerSuffix(UMoviePipeline* Pipeline)
+{
+	const UMoviePipelineRenderShardSetting* Setting = Find(Pipeline);
+	return Setting ? FString::Printf(TEXT("_shard%03dof%03d"), Setting->ShardIndex, Setting->ShardCount) : FString();
+}
+
+int32 UMoviePipelineRenderShardSetting::GetOutputFrameOffset(UMoviePipeline* Pipeline)
+{
+	const UMoviePipelineOutputSetting* OutputSettings = Pipeline->GetPipelineMasterConfig()->FindSetting<UMoviePipelineOutputSetting>();
+	if (!OutputSettings || !OutputSettings->bUseCustomPlaybackRange) return 0;
+
+	// the target sequence of the pipeline is a copy whose playback range is the custom one, the job has the original
+	const ULevelSequence* Sequence = Cast<ULevelSequence>(Pipeline->GetCurrentJob()->Sequence.TryLoad());
+	if (!Sequence) return 0;
+	const UMovieScene* MovieScene = Sequence->GetMovieScene();
+	const FFrameRate DisplayRate = MovieScene->GetDisplayRate();
+	const FFrameNumber PlaybackStart = FFrameRate::TransformTime(
+		MovieScene->GetPlaybackRange().GetLowerBoundValue(), MovieScene->GetTickResolution(), DisplayRate).FloorToFrame();
+
+	// CustomStartFrame is in display frames, the output frames may be at another frame rate
+	const FFrameTime Offset = FFrameRate::TransformTime(
+		FFrameTime(OutputSettings->CustomStartFrame - PlaybackStart.Value), DisplayRate, OutputSettings->GetEffectiveFrameRate(Sequence));
+	return FMath::Max(Offset.FloorToFrame().Value, 0);
+}
@@ -0,0 +1,154 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "MoviePipelineSharedMemoryOutput.h"
+#include "XF_BlueprintFunctionLibrary.h"
+#include "XF_SceneBindings.h"
+#include "CustomMoviePipelineOutput.h"
+#include "Camera/CameraActor.h"
+#include "Components/SkeletalMeshComponent.h"
+#include "ImagePixelData.h"
+#include "MoviePipeline.h"
+#include "MoviePipelineOutputSetting.h"
+#include "MoviePipelineMasterConfig.h"
+#include "MovieRenderPipelineCoreModule.h"  // For logs
+
+
+void UMoviePipelineSharedMemoryOutput::SetupForPipelineImpl(UMoviePipeline* InPipeline)
+{
+	// resolved once per pipeline, shared with the other outputs
+	SceneBindings = FXFSceneBindingRegistry::Get(GetPipeline());
+
+	UMoviePipelineOutputSetting* OutputSettings = GetPipeline()->GetPipelineMasterConfig()->FindSetting<UMoviePipelineOutputSetting>();
+	check(OutputSettings);
+	OutputResolution = OutputSettings->OutputResolution;
+
+	// the arrays are named like the files of CustomMoviePipelineOutput, when there's one
+	RenderPassNames.Reset();
+	UCustomMoviePipelineOutput* CustomOutput = GetPipeline()->GetPipelineMasterConfig()->FindSetting<UCustomMoviePipelineOutput>();
+	if (CustomOutput)
+	{
+		RenderPassNames.Add(TEXT("FinalImage"), CustomOutput->RenderPassName_RGB.IsEmpty() ? FString("rgb") : CustomOutput->RenderPassName_RGB);
+		for (const FCustomMoviePipelineRenderPass& RenderPass : CustomOutput->AdditionalRenderPasses)
+		{
+			if (RenderPass.bEnabled) RenderPassNames.Add(RenderPass.SPassName, RenderPass.RenderPassName);
+		}
+	}
+
+	SkeletonBoneIndices.Reset();
+	if (bPublishSkeletons)
+	{
+		for (USkeletalMeshComponent* SkeletalMeshComponent : SceneBindings->GetSkeletalMeshComponents())
+		{
+			TArray<int32> BoneIndices;
+			TArray<FName> BoneNames;
+			if (UXF_BlueprintFunctionLibrary::GetSkeletalMeshBoneIndices(SkeletalMeshComponent, BoneIndices, BoneNames))
+			{
+				SkeletonBoneIndices.Add(SkeletalMeshComponent, MoveTemp(BoneIndices));
+			}
+		}
+	}
+
+	if (!Ring.Open(SharedMemoryName, SlotCount, (int64)SlotSizeMB << 20))
+	{
+		UE_LOG(LogMovieRenderPipeline, Error, TEXT("Shared memory output is disabled, failed to open %s"), *SharedMemoryName);
+	}
+}
+
+void UMoviePipelineSharedMemoryOutput::OnReceiveImageDataImpl(FMoviePipelineMergerOutputFrame* InMergedOutputFrame)
+{
+	if (!Ring.IsOpen()) return;
+
+	const FMoviePipelineFrameOutputState& OutputState = InMergedOutputFrame->FrameOutputState;
+	if (!Ring.BeginFrame(OutputState.OutputFrameNumber, OutputState.ShotIndex, bDropWhenFull, MaxWaitSeconds)) return;
+
+	if (bPublishRenderPasses)
+	{
+		for (TPair<FMoviePipelinePassIdentifier, TUniquePtr<FImagePixelData>>& RenderPassData : InMergedOutputFrame->ImageOutputData)
+		{
+			const FString* RenderPassName = RenderPassNames.Find(RenderPassData.Key.Name);
+			AddPixelData(RenderPassName ? *RenderPassName : RenderPassData.Key.Name, RenderPassData.Value.Get());
+		}
+	}
+
+	if (bPublishCameras)
+	{
+		for (ACameraActor* Camera : SceneBindings->GetCameras())
+		{
+			const TArray<float> CameraInfo = UCustomMoviePipelineOutput::GetCameraInfo(Camera, OutputResolution);
+			const uint32 Shape[] = { (uint32)CameraInfo.Num() };
+			Ring.AddEntry(TEXT("camera/") + SceneBindings->GetExportName(Camera), EXFSharedDataType::Float32,
+				Shape, CameraInfo.GetData(), CameraInfo.Num() * sizeof(float));
+		}
+	}
+
+	for (USkeletalMeshComponent* SkeletalMeshComponent : SceneBindings->GetSkeletalMeshComponents())
+	{
+		const FString& MeshName = SceneBindings->GetExportName(SkeletalMeshComponent);
+		const TArray<int32>* BoneIndices = SkeletonBoneIndices.Find(SkeletalMeshComponent);
+		if (BoneIndices)
+		{
+			TArray<FVector> BoneLocations;
+			if (UXF_BlueprintFunctionLibrary::GetSkeletalMeshBoneTransforms(SkeletalMeshComponent, *BoneIndices, BoneLocations))
+			{
+				AddVectors(TEXT("skeleton/") + MeshName, BoneLocations);
+			}
+		}
+		if (bPublishVertices)
+		{
+			TArray<FVector> VertexPositions;
+			if (UXF_BlueprintFunctionLibrary::GetSkeletalMeshVertexLocationsByLODIndex(SkeletalMeshComponent, LODIndex, VertexPositions))
+			{
+				AddVectors(TEXT("vertices/") + MeshName, VertexPositions);
+			}
+		}
+	}
+
+	Ring.EndFrame();
+}
+
+void UMoviePipelineSharedMemoryOutput::AddPixelData(const FString& EntryName, const FImagePixelData* PixelData)
+{
+	EXFSharedDataType DataType;
+	switch (PixelData->GetType())
+	{
+	case EImagePixelType::Color: DataType = EXFSharedDataType::UInt8; break;
+	case EImagePixelType::Float16: DataType = EXFSharedDataType::Float16; break;
+	case EImagePixelType::Float32: DataType = EXFSharedDataType::Float32; break;
+	default: return;
+	}
+
+	const void* RawData = nullptr;
+	int64 SizeInBytes = 0;
+	PixelData->GetRawData(RawData, SizeInBytes);
+	const FIntPoint Size = PixelData->GetSize();
+	const uint32 Shape[] = { (uint32)Size.Y, (uint32)Size.X, 4 };
+	// copied once into the slot, the client maps it as is
+	Ring.AddEntry(EntryName, DataType, Shape, RawData, SizeInBytes);
+}
+
+void UMoviePipelineSharedMemoryOutput::AddVectors(const FString& EntryName, TArrayView<const FVector> Vectors)
+{
+	// FVector is double on UE5, the client gets float32 like the .dat files
+	FloatBuffer.SetNumUninitialized(Vectors.Num() * 3);
+	for (int32 Idx = 0; Idx < Vectors.Num(); Idx++)
+	{
+		FloatBuffer[Idx * 3 + 0] = Vectors[Idx].X;
+		FloatBuffer[Idx * 3 + 1] = Vectors[Idx].Y;
+		FloatBuffer[Idx * 3 + 2] = Vectors[Idx].Z;
+	}
+	const uint32 Shape[] = { (uint32)Vectors.Num(), 3 };
+	Ring.AddEntry(EntryName, EXFSharedDataType::Float32, Shape, FloatBuffer.GetData(), FloatBuffer.Num() * sizeof(float));
+}
+
+void UMoviePipelineSharedMemoryOutput::BeginFinalizeImpl()
+{
+	// the client sees the render as finished once it has read the last frame
+	Ring.Close();
+}
+
+void UMoviePipelineSharedMemoryOutput::TeardownForPipelineImpl(UMoviePipeline* InPipeline)
+{
+	Ring.Close();
+	SceneBindings.Reset();
+}
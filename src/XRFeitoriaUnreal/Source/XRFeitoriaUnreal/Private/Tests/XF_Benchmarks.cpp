@@ -0,0 +1,335 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "CoreMinimal.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+#include "XF_BlueprintFunctionLibrary.h"
+#include "XF_SceneCellCache.h"
+#include "Animation/SkeletalMeshActor.h"
+#include "Camera/CameraActor.h"
+#include "Components/SkeletalMeshComponent.h"
+#include "Components/StaticMeshComponent.h"
+#include "Engine/SkeletalMesh.h"
+#include "Engine/StaticMesh.h"
+#include "Engine/StaticMeshActor.h"
+#include "Engine/World.h"
+#include "Editor.h"
+#include "FileHelpers.h"
+#include "HAL/FileManager.h"
+#include "Interfaces/IPluginManager.h"
+#include "Misc/CommandLine.h"
+#include "Misc/DateTime.h"
+#include "Misc/EngineVersion.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Parse.h"
+#include "Misc/Paths.h"
+#include "Dom/JsonObject.h"
+#include "Serialization/JsonSerializer.h"
+#include "Serialization/JsonWriter.h"
+
+/**
+ * Benchmarks of the hot paths of the plugin, on a fixed reference level, run in the editor with
+ *
+ *   UnrealEditor-Cmd {project}.uproject -ExecCmds="Automation RunTests XRFeitoria.Benchmarks; Quit" -unattended -nosplash
+ *
+ * Command line options: -XFBenchmarkMap= (reference level), -XFBenchmarkSkeletalMesh=, -XFBenchmarkStaticMesh=,
+ * -XFBenchmarkActors= (number of actors of each kind), -XFBenchmarkIterations=.
+ * Each benchmark writes {ProjectSaved}/Automation/XRFeitoriaBenchmarks/{name}.json, the time per iteration
+ * (mean, median, p95, min, max in ms) with the parameters of the run and the plugin / engine versions.
+ * The full render benchmark is tests/unreal/benchmark.py, it drives a render job through the python API.
+ */
+namespace XFBenchmark
+{
+	static const TCHAR* DefaultMap = TEXT("/Engine/Maps/Templates/Template_Default");
+	static const TCHAR* DefaultSkeletalMesh = TEXT("/Engine/EngineMeshes/SkeletalCube.SkeletalCube");
+	static const TCHAR* DefaultStaticMesh = TEXT("/Engine/EngineMeshes/Sphere.Sphere");
+	static constexpr uint32 TestFlags = EAutomationTestFlags::EditorContext | EAutomationTestFlags::PerfFilter;
+
+	static FString GetOption(const TCHAR* Name, const TCHAR* Default)
+	{
+		FString Value;
+		return FParse::Value(FCommandLine::Get(), Name, Value) ? Value : FString(Default);
+	}
+
+	static int32 GetOption(const TCHAR* Name, int32 Default)
+	{
+		int32 Value = Default;
+		FParse::Value(FCommandLine::Get(), Name, Value);
+		return FMath::Max(Value, 1);
+	}
+
+	/** The reference level, loaded in the editor unless it's the current one. */
+	static UWorld* LoadReferenceWorld(FAutomationTestBase& Test)
+	{
+		const FString MapName = GetOption(TEXT("XFBenchmarkMap="), DefaultMap);
+		UWorld* World = GEditor ? GEditor->GetEditorWorldContext().World() : nullptr;
+		if (!World || World->GetOutermost()->GetName() != MapName)
+		{
+			World = UEditorLoadingAndSavingUtils::LoadMap(MapName);
+		}
+		if (!World)
+		{
+			Test.AddError(FString::Printf(TEXT("Failed to load the reference level %s"), *MapName));
+		}
+		return World;
+	}
+
+	/** Actors spawned in the reference level for a benchmark, destroyed after it so the level stays the same. */
+	struct FScopedActors
+	{
+		UWorld* World = nullptr;
+		TArray<AActor*> Actors;
+
+		explicit FScopedActors(UWorld* InWorld) : World(InWorld) {}
+		~FScopedActors()
+		{
+			for (AActor* Actor : Actors)
+			{
+				if (IsValid(Actor)) World->EditorDestroyActor(Actor, false);
+			}
+		}
+
+		/** Actors on a grid in front of the camera of SpawnCamera. */
+		FVector GetLocation(int32 Idx) const { return FVector(500.f + 200.f * (Idx / 8), 200.f * (Idx % 8 - 3.5f), 100.f); }
+
+		TArray<USkeletalMeshComponent*> SpawnSkeletalMeshes(FAutomationTestBase& Test, int32 Num)
+		{
+			TArray<USkeletalMeshComponent*> Components;
+			const FString MeshPath = GetOption(TEXT("XFBenchmarkSkeletalMesh="), DefaultSkeletalMesh);
+			USkeletalMesh* Mesh = LoadObject<USkeletalMesh>(nullptr, *MeshPath);
+			if (!Mesh)
+			{
+				Test.AddError(FString::Printf(TEXT("Failed to load the skeletal mesh %s"), *MeshPath));
+				return Components;
+			}
+			for (int32 Idx = 0; Idx < Num; Idx++)
+			{
+				ASkeletalMeshActor* Actor = World->SpawnActor<ASkeletalMeshActor>(GetLocation(Idx), FRotator::ZeroRotator);
+				if (!Actor) continue;
+				Actors.Add(Actor);
+#if ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION >= 1
+				Actor->GetSkeletalMeshComponent()->SetSkeletalMeshAsset(Mesh);
+#else
+				Actor->GetSkeletalMeshComponent()->SetSkeletalMesh(Mesh);
+#endif
+				Components.Add(Actor->GetSkeletalMeshComponent());
+			}
+			return Components;
+		}
+
+		TArray<UStaticMeshComponent*> SpawnStaticMeshes(FAutomationTestBase& Test, int32 Num)
+		{
+			TArray<UStaticMeshComponent*> Components;
+			const FString MeshPath = GetOption(TEXT("XFBenchmarkStaticMesh="), DefaultStaticMesh);
+			UStaticMesh* Mesh = LoadObject<UStaticMesh>(nullptr, *MeshPath);
+			if (!Mesh)
+			{
+				Test.AddError(FString::Printf(TEXT("Failed to load the static mesh %s"), *MeshPath));
+				return Components;
+			}
+			for (int32 Idx = 0; Idx < Num; Idx++)
+			{
+				AStaticMeshActor* Actor = World->SpawnActor<AStaticMeshActor>(GetLocation(Idx), FRotator::ZeroRotator);
+				if (!Actor) continue;
+				Actors.Add(Actor);
+				Actor->GetStaticMeshComponent()->SetStaticMesh(Mesh);
+				Components.Add(Actor->GetStaticMeshComponent());
+			}
+			return Components;
+		}
+
+		ACameraActor* SpawnCamera()
+		{
+			ACameraActor* Camera = World->SpawnActor<ACameraActor>(FVector(0.f, 0.f, 100.f), FRotator::ZeroRotator);
+			if (Camera) Actors.Add(Camera);
+			return Camera;
+		}
+	};
+
+	/**
+	 * Time Iterations runs of Body after a warm up run, log and save the results.
+	 * Params are saved along, e.g. the number of actors or vertices.
+	 */
+	static void Run(FAutomationTestBase& Test, const FString& Name, int32 Iterations, TFunctionRef<void()> Body,
+		const TMap<FString, double>& Params = TMap<FString, double>())
+	{
+		Body();
+
+		TArray<double> SamplesMs;
+		SamplesMs.Reserve(Iterations);
+		for (int32 Idx = 0; Idx < Iterations; Idx++)
+		{
+			const double StartTime = FPlatformTime::Seconds();
+			Body();
+			SamplesMs.Add((FPlatformTime::Seconds() - StartTime) * 1000.0);
+		}
+		SamplesMs.Sort();
+
+		double TotalMs = 0.0;
+		for (double Sample : SamplesMs) TotalMs += Sample;
+		const double MeanMs = TotalMs / SamplesMs.Num();
+		const double MedianMs = SamplesMs[SamplesMs.Num() / 2];
+		const double P95Ms = SamplesMs[FMath::Min(FMath::CeilToInt(SamplesMs.Num() * 0.95) - 1, SamplesMs.Num() - 1)];
+		Test.AddInfo(FString::Printf(TEXT("%s: %.3f ms mean, %.3f ms median, %.3f ms p95 over %d iterations"),
+			*Name, MeanMs, MedianMs, P95Ms, Iterations));
+
+		TSharedRef<FJsonObject> Root = MakeShared<FJsonObject>();
+		Root->SetStringField(TEXT("name"), Name);
+		TSharedPtr<IPlugin> Plugin = IPluginManager::Get().FindPlugin(TEXT("XRFeitoriaUnreal"));
+		Root->SetStringField(TEXT("plugin_version"), Plugin.IsValid() ? Plugin->GetDescriptor().VersionName : FString());
+		Root->SetStringField(TEXT("engine_version"), FEngineVersion::Current().ToString());
+		Root->SetStringField(TEXT("map"), GetOption(TEXT("XFBenchmarkMap="), DefaultMap));
+		Root->SetStringField(TEXT("date"), FDateTime::UtcNow().ToIso8601());
+		Root->SetNumberField(TEXT("iterations"), Iterations);
+		Root->SetNumberField(TEXT("mean_ms"), MeanMs);
+		Root->SetNumberField(TEXT("median_ms"), MedianMs);
+		Root->SetNumberField(TEXT("p95_ms"), P95Ms);
+		Root->SetNumberField(TEXT("min_ms"), SamplesMs[0]);
+		Root->SetNumberField(TEXT("max_ms"), SamplesMs.Last());
+		TSharedRef<FJsonObject> ParamsObject = MakeShared<FJsonObject>();
+		for (const TPair<FString, double>& Param : Params)
+		{
+			ParamsObject->SetNumberField(Param.Key, Param.Value);
+		}
+		Root->SetObjectField(TEXT("params"), ParamsObject);
+
+		FString Json;
+		const TSharedRef<TJsonWriter<>> Writer = TJsonWriterFactory<>::Create(&Json);
+		FJsonSerializer::Serialize(Root, Writer);
+		const FString Path = FPaths::ProjectSavedDir() / TEXT("Automation") / TEXT("XRFeitoriaBenchmarks") / Name + TEXT(".json");
+		if (!FFileHelper::SaveStringToFile(Json, *Path))
+		{
+			Test.AddWarning(FString::Printf(TEXT("Failed to save the results to %s"), *Path));
+		}
+	}
+}
+
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FXFBenchmarkSkeletalMeshVertices, "XRFeitoria.Benchmarks.GetSkeletalMeshVertexLocationsByLODIndex", XFBenchmark::TestFlags)
+bool FXFBenchmarkSkeletalMeshVertices::RunTest(const FString& Parameters)
+{
+	UWorld* World = XFBenchmark::LoadReferenceWorld(*this);
+	if (!World) return false;
+	XFBenchmark::FScopedActors Scene(World);
+	const TArray<USkeletalMeshComponent*> Components = Scene.SpawnSkeletalMeshes(*this, XFBenchmark::GetOption(TEXT("XFBenchmarkActors="), 8));
+	if (Components.Num() == 0) return false;
+
+	TArray<FVector> VertexPositions;
+	int32 NumVertices = 0;
+	auto GetVertices = [&]()
+	{
+		NumVertices = 0;
+		for (USkeletalMeshComponent* Component : Components)
+		{
+			UXF_BlueprintFunctionLibrary::GetSkeletalMeshVertexLocationsByLODIndex(Component, 0, VertexPositions);
+			NumVertices += VertexPositions.Num();
+		}
+	};
+	// the params are saved along, count the vertices before
+	GetVertices();
+	XFBenchmark::Run(*this, TEXT("GetSkeletalMeshVertexLocationsByLODIndex"), XFBenchmark::GetOption(TEXT("XFBenchmarkIterations="), 100), GetVertices,
+		{ { TEXT("actors"), (double)Components.Num() }, { TEXT("vertices"), (double)NumVertices } });
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FXFBenchmarkStaticMeshVertices, "XRFeitoria.Benchmarks.GetStaticMeshVertexLocations", XFBenchmark::TestFlags)
+bool FXFBenchmarkStaticMeshVertices::RunTest(const FString& Parameters)
+{
+	UWorld* World = XFBenchmark::LoadReferenceWorld(*this);
+	if (!World) return false;
+	XFBenchmark::FScopedActors Scene(World);
+	const TArray<UStaticMeshComponent*> Components = Scene.SpawnStaticMeshes(*this, XFBenchmark::GetOption(TEXT("XFBenchmarkActors="), 8));
+	if (Components.Num() == 0) return false;
+
+	TArray<FVector> VertexPositions;
+	int32 NumVertices = 0;
+	auto GetVertices = [&]()
+	{
+		NumVertices = 0;
+		for (UStaticMeshComponent* Component : Components)
+		{
+			UXF_BlueprintFunctionLibrary::GetStaticMeshVertexLocations(Component, 0, VertexPositions);
+			NumVertices += VertexPositions.Num();
+		}
+	};
+	// the params are saved along, count the vertices before
+	GetVertices();
+	XFBenchmark::Run(*this, TEXT("GetStaticMeshVertexLocations"), XFBenchmark::GetOption(TEXT("XFBenchmarkIterations="), 100), GetVertices,
+		{ { TEXT("actors"), (double)Components.Num() }, { TEXT("vertices"), (double)NumVertices } });
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FXFBenchmarkDetectOcclusionMesh, "XRFeitoria.Benchmarks.DetectOcclusionMesh", XFBenchmark::TestFlags)
+bool FXFBenchmarkDetectOcclusionMesh::RunTest(const FString& Parameters)
+{
+	UWorld* World = XFBenchmark::LoadReferenceWorld(*this);
+	if (!World) return false;
+	XFBenchmark::FScopedActors Scene(World);
+	const int32 NumActors = XFBenchmark::GetOption(TEXT("XFBenchmarkActors="), 8);
+	TArray<UMeshComponent*> Components;
+	Components.Append(Scene.SpawnSkeletalMeshes(*this, NumActors));
+	Components.Append(Scene.SpawnStaticMeshes(*this, NumActors));
+	ACameraActor* Camera = Scene.SpawnCamera();
+	if (Components.Num() == 0 || !Camera) return false;
+
+	// fewer iterations, a line trace per vertex
+	XFBenchmark::Run(*this, TEXT("DetectOcclusionMesh"), XFBenchmark::GetOption(TEXT("XFBenchmarkIterations="), 20),
+		[&]()
+		{
+			float NonOcclusionRate, SelfOcclusionRate, InterOcclusionRate;
+			for (UMeshComponent* Component : Components)
+			{
+				UXF_BlueprintFunctionLibrary::DetectOcclusionMesh(Component, Camera, NonOcclusionRate, SelfOcclusionRate, InterOcclusionRate);
+			}
+		},
+		{ { TEXT("actors"), (double)Components.Num() } });
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FXFBenchmarkDivideSceneViaBoxTrace, "XRFeitoria.Benchmarks.DivideSceneViaBoxTrace", XFBenchmark::TestFlags)
+bool FXFBenchmarkDivideSceneViaBoxTrace::RunTest(const FString& Parameters)
+{
+	UWorld* World = XFBenchmark::LoadReferenceWorld(*this);
+	if (!World) return false;
+
+	// the scene cell cache would skip the sweeps after the first run
+	const bool bWasSceneCellCacheEnabled = FXFSceneCellCache::IsEnabled();
+	UXF_BlueprintFunctionLibrary::EnableSceneCellCache(false);
+	const FString ResultsPath = FPaths::AutomationTransientDir() / TEXT("XFBenchmarkHitBoxes.txt");
+	const int32 BoxHalfSize = 50;
+	XFBenchmark::Run(*this, TEXT("DivideSceneViaBoxTrace"), XFBenchmark::GetOption(TEXT("XFBenchmarkIterations="), 5),
+		[&]()
+		{
+			UXF_BlueprintFunctionLibrary::DivideSceneViaBoxTrace(World, true, BoxHalfSize, FVector(0, 0, 2000), false,
+				1500, -1500, 1500, -1500, -2000, ResultsPath, false);
+		},
+		{ { TEXT("box_half_size"), (double)BoxHalfSize }, { TEXT("cells"), FMath::Square(3000.0 / (2 * BoxHalfSize)) } });
+	UXF_BlueprintFunctionLibrary::EnableSceneCellCache(bWasSceneCellCacheEnabled);
+	IFileManager::Get().Delete(*ResultsPath, false, false, true);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FXFBenchmarkSaveFloatArray, "XRFeitoria.Benchmarks.SaveFloatArrayToByteFile", XFBenchmark::TestFlags)
+bool FXFBenchmarkSaveFloatArray::RunTest(const FString& Parameters)
+{
+	// the vertices of a dense skinned mesh for one frame
+	TArray<float> FloatArray;
+	FloatArray.SetNumUninitialized(100000 * 3);
+	for (int32 Idx = 0; Idx < FloatArray.Num(); Idx++)
+	{
+		FloatArray[Idx] = Idx * 0.1f;
+	}
+	const FString Path = FPaths::AutomationTransientDir() / TEXT("XFBenchmarkFloats.bin");
+	XFBenchmark::Run(*this, TEXT("SaveFloatArrayToByteFile"), XFBenchmark::GetOption(TEXT("XFBenchmarkIterations="), 100),
+		[&]()
+		{
+			UXF_BlueprintFunctionLibrary::SaveFloatArrayToByteFile(FloatArray, Path);
+		},
+		{ { TEXT("bytes"), (double)FloatArray.Num() * sizeof(float) } });
+	IFileManager::Get().Delete(*Path, false, false, true);
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -0,0 +1,145 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "XF_AsyncWriteQueue.h"
+#include "XF_BlueprintFunctionLibrary.h"
+#include "XF_Stats.h"
+#include "HAL/RunnableThread.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/PlatformTime.h"
+#include "HAL/IConsoleManager.h"
+
+
+static TUniquePtr<FXFAsyncWriteQueue> GXFAsyncWriteQueue;
+
+/** Shared by every pipeline, set in [ConsoleVariables] of DefaultEngine.ini or with -ExecCmds. */
+static TAutoConsoleVariable<int32> CVarXFWriteQueueDepth(
+	TEXT("xf.WriteQueueDepth"),
+	64,
+	TEXT("Max number of pending writes in the background write queue of XRFeitoria. When it's full, the game thread waits for the writer."),
+	FConsoleVariableDelegate::CreateLambda([](IConsoleVariable* Variable)
+	{
+		if (GXFAsyncWriteQueue.IsValid())
+		{
+			GXFAsyncWriteQueue->SetMaxQueueDepth(Variable->GetInt());
+		}
+	}),
+	ECVF_Default
+);
+
+FXFAsyncWriteQueue& FXFAsyncWriteQueue::Get()
+{
+	check(IsInGameThread());
+	if (!GXFAsyncWriteQueue.IsValid())
+	{
+		GXFAsyncWriteQueue = MakeUnique<FXFAsyncWriteQueue>(CVarXFWriteQueueDepth.GetValueOnGameThread());
+	}
+	return *GXFAsyncWriteQueue;
+}
+
+void FXFAsyncWriteQueue::Shutdown()
+{
+	GXFAsyncWriteQueue.Reset();
+}
+
+FXFAsyncWriteQueue::FXFAsyncWriteQueue(int32 InMaxQueueDepth)
+	: MaxQueueDepth(FMath::Max(InMaxQueueDepth, 1))
+{
+	WorkEvent = FPlatformProcess::GetSynchEventFromPool(false);
+	DoneEvent = FPlatformProcess::GetSynchEventFromPool(false);
+	Thread = FRunnableThread::Create(this, TEXT("XFAsyncWriteQueue"), 0, TPri_BelowNormal);
+}
+
+FXFAsyncWriteQueue::~FXFAsyncWriteQueue()
+{
+	Flush();
+	if (Thread)
+	{
+		Thread->Kill(true);  // calls Stop() and waits for Run() to return
+		delete Thread;
+		Thread = nullptr;
+	}
+	FPlatformProcess::ReturnSynchEventToPool(WorkEvent);
+	FPlatformProcess::ReturnSynchEventToPool(DoneEvent);
+}
+
+TFuture<bool> FXFAsyncWriteQueue::Enqueue(TUniqueFunction<bool()>&& Task)
+{
+	// Backpressure: wait for the worker when the queue is full
+	if (PendingCount.GetValue() >= MaxQueueDepth)
+	{
+		XF_SCOPE_STAGE(QueueStall);
+		const double StartTime = FPlatformTime::Seconds();
+		while (PendingCount.GetValue() >= MaxQueueDepth)
+		{
+			DoneEvent->Wait(1);
+		}
+		const double Stall = FPlatformTime::Seconds() - StartTime;
+		StallSeconds += Stall;
+		UE_LOG(LogXF, Verbose, TEXT("Write queue full (%d), stalled %.2f ms."), MaxQueueDepth, Stall * 1000.0);
+	}
+
+	TUniquePtr<FWriteItem> Item = MakeUnique<FWriteItem>();
+	Item->Task = MoveTemp(Task);
+	TFuture<bool> Future = Item->Promise.GetFuture();
+
+	FXFStats::SetQueueDepth(PendingCount.Increment());
+	Items.Enqueue(MoveTemp(Item));
+	WorkEvent->Trigger();
+	return Future;
+}
+
+TFuture<bool> FXFAsyncWriteQueue::EnqueueFloatArray(TArray<float>&& FloatArray, const FString& Path)
+{
+	return Enqueue([FloatArray = MoveTemp(FloatArray), Path]()
+	{
+		return UXF_BlueprintFunctionLibrary::SaveFloatArrayToByteFile(FloatArray, Path);
+	});
+}
+
+TFuture<bool> FXFAsyncWriteQueue::EnqueueFloat(float Value, const FString& Path)
+{
+	return Enqueue([Value, Path]()
+	{
+		return UXF_BlueprintFunctionLibrary::SaveFloatToByteFile(Value, Path);
+	});
+}
+
+TFuture<bool> FXFAsyncWriteQueue::EnqueueVectorArray(TArray<FVector>&& Vectors, const FString& Path)
+{
+	return Enqueue([Vectors = MoveTemp(Vectors), Path]()
+	{
+		return UXF_BlueprintFunctionLibrary::SaveVectorArrayToByteFile(Vectors, Path);
+	});
+}
+
+void FXFAsyncWriteQueue::Flush()
+{
+	while (PendingCount.GetValue() > 0)
+	{
+		DoneEvent->Wait(1);
+	}
+}
+
+uint32 FXFAsyncWriteQueue::Run()
+{
+	while (!bStopping)
+	{
+		TUniquePtr<FWriteItem> Item;
+		while (Items.Dequeue(Item))
+		{
+			Item->Promise.SetValue(Item->Task());
+			Item.Reset();
+			FXFStats::SetQueueDepth(PendingCount.Decrement());
+			DoneEvent->Trigger();
+		}
+		WorkEvent->Wait(100);
+	}
+	return 0;
+}
+
+void FXFAsyncWriteQueue::Stop()
+{
+	bStopping = true;
+	WorkEvent->Trigger();
+}
@@ -2,17 +2,24 @@
 
 
 #include "XF_BlueprintFunctionLibrary.h"
+#include "XF_Stats.h"
+#include "XF_SceneCellCache.h"
+#include "XF_AsyncWriteQueue.h"
 
 
-#include "iostream"
-#include <fstream>
-#include <assert.h>
 #include "Misc/Paths.h"
 #include "Misc/FileHelper.h"
 #include "Misc/MessageDialog.h"
 #include "Engine/ObjectLibrary.h"
 #include "EditorFramework/AssetImportData.h"
 #include "GenericPlatform/GenericPlatformFile.h"
+#include "HAL/FileManager.h"
+#include "Async/ParallelFor.h"
+#include "Algo/BinarySearch.h"
+#include "Interfaces/IPluginManager.h"
+#include "Dom/JsonObject.h"
+#include "Serialization/JsonReader.h"
+#include "Serialization/JsonSerializer.h"
 #include "Rendering/SkeletalMeshRenderData.h"
 #include "Rendering/MultiSizeIndexContainer.h"
 #include "Rendering/SkeletalMeshLODRenderData.h"
@@ -55,42 +62,215 @@ bool UXF_BlueprintFunctionLibrary::FileExists(FString Path)
 
 bool UXF_BlueprintFunctionLibrary::SaveFloatToByteFile(float f, FString Path)
 {
-	if (!FPlatformFileManager::Get().GetPlatformFile().CreateDirectoryTree(*FPaths::GetPath(Path)))
+	return SaveFloatArrayViewToByteFile(TArrayView<const float>(&f, 1), Path);
+}
+
+bool UXF_BlueprintFunctionLibrary::SaveFloatArrayToByteFile(const TArray<float>& FloatArray, FString Path)
+{
+	return SaveFloatArrayViewToByteFile(FloatArray, Path);
+}
+
+static FRWLock GXFCreatedDirectoriesLock;
+static TSet<FString> GXFCreatedDirectories;
+
+bool UXF_BlueprintFunctionLibrary::EnsureDirectoryTree(const FString& Directory)
+{
+	if (Directory.IsEmpty())
+	{
+		return true;
+	}
+	{
+		FReadScopeLock Lock(GXFCreatedDirectoriesLock);
+		if (GXFCreatedDirectories.Contains(Directory))
+		{
+			return true;
+		}
+	}
+	// two threads may both create it, CreateDirectoryTree succeeds on an existing directory
+	if (!FPlatformFileManager::Get().GetPlatformFile().CreateDirectoryTree(*Directory))
 	{
+		UE_LOG(LogXF, Error, TEXT("Failed to create directory %s"), *Directory);
 		return false;
 	}
+	FWriteScopeLock Lock(GXFCreatedDirectoriesLock);
+	GXFCreatedDirectories.Add(Directory);
+	return true;
+}
 
-	std::string path = std::string(TCHAR_TO_UTF8(*Path));
-	std::ofstream file;
-	file.open(path, std::ios_base::binary);
-	assert(file.is_open());
+void UXF_BlueprintFunctionLibrary::ResetDirectoryCache()
+{
+	FWriteScopeLock Lock(GXFCreatedDirectoriesLock);
+	GXFCreatedDirectories.Empty();
+}
 
-	file.write((char*) &f, sizeof(f));
-	file.close();
-	return true;
+void UXF_BlueprintFunctionLibrary::PrecreateDirectoryTrees(TSet<FString>&& Directories)
+{
+	if (Directories.Num() == 0)
+	{
+		return;
+	}
+	FXFAsyncWriteQueue::Get().Enqueue([Directories = MoveTemp(Directories)]()
+	{
+		bool bSuccess = true;
+		for (const FString& Directory : Directories)
+		{
+			bSuccess &= EnsureDirectoryTree(Directory);
+		}
+		return bSuccess;
+	});
 }
 
-bool UXF_BlueprintFunctionLibrary::SaveFloatArrayToByteFile(TArray<float> FloatArray, FString Path)
+/** Write the file without counting it in the stats, the callers know whether it's a file created by the render. */
+static bool WriteBytesToFile(const void* Data, int64 NumBytes, const FString& Path)
 {
-	if (!FPlatformFileManager::Get().GetPlatformFile().CreateDirectoryTree(*FPaths::GetPath(Path)))
+	if (!UXF_BlueprintFunctionLibrary::EnsureDirectoryTree(FPaths::GetPath(Path)))
 	{
 		return false;
 	}
 
-	std::string path = std::string(TCHAR_TO_UTF8(*Path));
-	std::ofstream file;
-	file.open(path, std::ios_base::binary);
-	assert(file.is_open());
+	// IFileManager::CreateFileWriter would create the directory tree again
+	TUniquePtr<IFileHandle> FileHandle(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*Path));
+	if (!FileHandle.IsValid())
+	{
+		UE_LOG(LogXF, Error, TEXT("Failed to open %s for writing"), *Path);
+		return false;
+	}
+	return FileHandle->Write((const uint8*)Data, NumBytes) && FileHandle->Flush();
+}
 
-	for (int idx=0; idx!=FloatArray.Num(); idx++)
+bool UXF_BlueprintFunctionLibrary::SaveBytesToFile(const void* Data, int64 NumBytes, const FString& Path)
+{
+	XF_SCOPE_STAGE(FileWrite);
+	// overwrites, e.g. the frames of a resumed render, aren't new files
+	const bool bCreated = !FPlatformFileManager::Get().GetPlatformFile().FileExists(*Path);
+	if (!WriteBytesToFile(Data, NumBytes, Path))
 	{
-		file.write((char*) &FloatArray[idx], sizeof(float));
+		return false;
 	}
-	file.close();
+	FXFStats::AddFileWrite(NumBytes, bCreated);
+	return true;
+}
 
+bool UXF_BlueprintFunctionLibrary::SaveBytesToFileAtomic(const void* Data, int64 NumBytes, const FString& Path)
+{
+	XF_SCOPE_STAGE(FileWrite);
+	// unique, the same file may be written by several processes at once
+	const FString TempPath = Path + TEXT(".") + FGuid::NewGuid().ToString() + TEXT(".tmp");
+	if (!WriteBytesToFile(Data, NumBytes, TempPath))
+	{
+		IFileManager::Get().Delete(*TempPath, false, false, true);
+		return false;
+	}
+	// only the file the temporary file is renamed to is counted
+	const bool bCreated = !FPlatformFileManager::Get().GetPlatformFile().FileExists(*Path);
+	if (!IFileManager::Get().Move(*Path, *TempPath, true, true))
+	{
+		UE_LOG(LogXF, Error, TEXT("Failed to move %s to %s"), *TempPath, *Path);
+		IFileManager::Get().Delete(*TempPath, false, false, true);
+		return false;
+	}
+	FXFStats::AddFileWrite(NumBytes, bCreated);
 	return true;
 }
 
+bool UXF_BlueprintFunctionLibrary::SaveFloatArrayViewToByteFile(TArrayView<const float> FloatArray, const FString& Path)
+{
+	return SaveBytesToFile(FloatArray.GetData(), (int64)FloatArray.Num() * sizeof(float), Path);
+}
+
+bool UXF_BlueprintFunctionLibrary::SaveFloat3ArrayToByteFile(TArrayView<const FXFVector3f> Vectors, const FString& Path)
+{
+	static_assert(sizeof(FXFVector3f) == 3 * sizeof(float), "FXFVector3f must be 3 packed floats");
+	return SaveFloatArrayViewToByteFile(
+		TArrayView<const float>((const float*)Vectors.GetData(), Vectors.Num() * 3), Path);
+}
+
+bool UXF_BlueprintFunctionLibrary::SaveVectorArrayToByteFile(TArrayView<const FVector> Vectors, const FString& Path)
+{
+#if ENGINE_MAJOR_VERSION == 5
+	if (!EnsureDirectoryTree(FPaths::GetPath(Path)))
+	{
+		return false;
+	}
+
+	TUniquePtr<IFileHandle> FileHandle(FPlatformFileManager::Get().GetPlatformFile().OpenWrite(*Path));
+	if (!FileHandle.IsValid())
+	{
+		UE_LOG(LogXF, Error, TEXT("Failed to open %s for writing"), *Path);
+		return false;
+	}
+
+	// FVector is double in UE5, convert to float32 chunk by chunk
+	constexpr int32 ChunkSize = 1024;
+	FVector3f Chunk[ChunkSize];
+	for (int32 Start = 0; Start < Vectors.Num(); Start += ChunkSize)
+	{
+		const int32 Num = FMath::Min(ChunkSize, Vectors.Num() - Start);
+		for (int32 Idx = 0; Idx < Num; Idx++)
+		{
+			Chunk[Idx] = FVector3f(Vectors[Start + Idx]);
+		}
+		if (!FileHandle->Write((const uint8*)Chunk, Num * sizeof(FVector3f)))
+		{
+			return false;
+		}
+	}
+	return FileHandle->Flush();
+#else
+	return SaveFloat3ArrayToByteFile(Vectors, Path);
+#endif
+}
+
+template<typename OutVectorType>
+static void TransformPositionsImpl(const FTransform& Transform, TArrayView<const FXFVector3f> LocalPositions, TArray<OutVectorType>& WorldPositions)
+{
+	const int32 Num = LocalPositions.Num();
+	const int32 Offset = WorldPositions.Num();
+	WorldPositions.AddUninitialized(Num);
+
+	// row vectors: P' = P * M, the translation is in the last row
+	const FMatrix M = Transform.ToMatrixWithScale();
+#if ENGINE_MAJOR_VERSION == 5
+	using FReal = FMatrix::FReal;
+#else
+	using FReal = float;  // FMatrix is float32 in UE4
+#endif
+	const FReal M00 = M.M[0][0], M01 = M.M[0][1], M02 = M.M[0][2];
+	const FReal M10 = M.M[1][0], M11 = M.M[1][1], M12 = M.M[1][2];
+	const FReal M20 = M.M[2][0], M21 = M.M[2][1], M22 = M.M[2][2];
+	const FReal M30 = M.M[3][0], M31 = M.M[3][1], M32 = M.M[3][2];
+
+	const FXFVector3f* In = LocalPositions.GetData();
+	OutVectorType* Out = WorldPositions.GetData() + Offset;
+
+	constexpr int32 ChunkSize = 4096;
+	const int32 NumChunks = FMath::DivideAndRoundUp(Num, ChunkSize);
+	ParallelFor(NumChunks, [=](int32 ChunkIdx)
+	{
+		const int32 End = FMath::Min((ChunkIdx + 1) * ChunkSize, Num);
+		for (int32 Idx = ChunkIdx * ChunkSize; Idx < End; Idx++)
+		{
+			const FReal X = In[Idx].X, Y = In[Idx].Y, Z = In[Idx].Z;
+			Out[Idx] = OutVectorType(
+				X * M00 + Y * M10 + Z * M20 + M30,
+				X * M01 + Y * M11 + Z * M21 + M31,
+				X * M02 + Y * M12 + Z * M22 + M32
+			);
+		}
+	}, NumChunks > 1 ? EParallelForFlags::None : EParallelForFlags::ForceSingleThread);
+}
+
+void UXF_BlueprintFunctionLibrary::TransformPositions(const FTransform& Transform, TArrayView<const FXFVector3f> LocalPositions, TArray<FVector>& WorldPositions)
+{
+	TransformPositionsImpl(Transform, LocalPositions, WorldPositions);
+}
+
+#if ENGINE_MAJOR_VERSION == 5
+void UXF_BlueprintFunctionLibrary::TransformPositions(const FTransform& Transform, TArrayView<const FXFVector3f> LocalPositions, TArray<FXFVector3f>& WorldPositions)
+{
+	TransformPositionsImpl(Transform, LocalPositions, WorldPositions);
+}
+#endif
 
 void UXF_BlueprintFunctionLibrary::EmptyPostProcessMaterial(UPostProcessComponent* postprocessComponent)
 {
@@ -172,11 +352,28 @@ bool UXF_BlueprintFunctionLibrary::FileIO__GetFiles(TArray<FString>& Files, FStr
 	return true;
 }
 
-#if ENGINE_MAJOR_VERSION == 4
 bool UXF_BlueprintFunctionLibrary::GetStaticMeshVertexLocations(UStaticMeshComponent* Comp, int32 LodIndex, TArray<FVector>& VertexPositions)
 {
+	XF_SCOPE_STAGE(VertexExtraction);
 	VertexPositions.Empty();
 
+	TArray<FXFVector3f> LocalPositions;
+	if (!GetStaticMeshLocalVertexLocations(Comp, LodIndex, LocalPositions))
+	{
+		return false;
+	}
+
+	//Transform the positions to match the component Transform
+	TransformPositions(Comp->GetComponentTransform(), LocalPositions, VertexPositions);
+	return true;
+}
+
+#if ENGINE_MAJOR_VERSION == 4
+bool UXF_BlueprintFunctionLibrary::GetStaticMeshLocalVertexLocations(UStaticMeshComponent* Comp, int32 LodIndex, TArray<FXFVector3f>& LocalPositions)
+{
+	XF_SCOPE_STAGE(VertexExtraction);
+	LocalPositions.Empty();
+
 	if(!Comp)
 	{
 		return false;
@@ -188,9 +385,6 @@ bool UXF_BlueprintFunctionLibrary::GetStaticMeshVertexLocations(UStaticMeshCompo
 	}
 	//~~~~~~~~~~~~~~~~~~~~~~~
 
-	//Component Transform
-	FTransform RV_Transform = Comp->GetComponentTransform();
-
 	//Body Setup valid?
 	UBodySetup* BodySetup = Comp->GetBodySetup();
 
@@ -211,14 +405,9 @@ bool UXF_BlueprintFunctionLibrary::GetStaticMeshVertexLocations(UStaticMeshCompo
 		//Number of vertices
 		PxU32 VertexCount = EachTriMesh->getNbVertices();
 
-		//Vertex array
+		//Vertex array, PxVec3 has the same layout as FVector
 		const PxVec3* Vertices = EachTriMesh->getVertices();
-
-		//For each vertex, transform the position to match the component Transform
-		for (PxU32 v = 0; v < VertexCount; v++)
-		{
-			VertexPositions.Add(RV_Transform.TransformPosition(P2UVector(Vertices[v])));
-		}
+		LocalPositions.Append((const FVector*)Vertices, VertexCount);
 	}
 	return true;
 
@@ -229,8 +418,11 @@ bool UXF_BlueprintFunctionLibrary::GetStaticMeshVertexLocations(UStaticMeshCompo
 }
 
 #elif ENGINE_MAJOR_VERSION == 5
-bool UXF_BlueprintFunctionLibrary::GetStaticMeshVertexLocations(UStaticMeshComponent* Comp, int32 LodIndex, TArray<FVector>& VertexPositions)
+bool UXF_BlueprintFunctionLibrary::GetStaticMeshLocalVertexLocations(UStaticMeshComponent* Comp, int32 LodIndex, TArray<FXFVector3f>& LocalPositions)
 {
+	XF_SCOPE_STAGE(VertexExtraction);
+	LocalPositions.Empty();
+
 	if(!Comp)
 	{
 		return false;
@@ -248,13 +440,12 @@ bool UXF_BlueprintFunctionLibrary::GetStaticMeshVertexLocations(UStaticMeshCompo
 		return false;
 	}
 
-	FTransform WorldTransform = Comp->GetComponentTransform();
 	FVertexArray& Verts = Desc->Vertices();
+	TVertexAttributesRef<FVector3f> Positions = Desc->GetVertexPositions();
+	LocalPositions.Reserve(Verts.Num());
 	for (FVertexID EachVertId : Verts.GetElementIDs())
 	{
-		VertexPositions.Add(
-			WorldTransform.TransformPosition( Desc->GetVertexPosition(EachVertId) )
-		);
+		LocalPositions.Add(Positions[EachVertId]);
 	}
 
 	return true;
@@ -266,24 +457,76 @@ bool UXF_BlueprintFunctionLibrary::GetSkeletalMeshBoneLocations(USkeletalMeshCom
 {
 	if (!Comp) return false;
 
-	BoneLocations.Empty();
+	TArray<int32> BoneIndices;
+	GetSkeletalMeshBoneIndices(Comp, BoneIndices, BoneNames);
+	return GetSkeletalMeshBoneTransforms(Comp, BoneIndices, BoneLocations);
+}
+
+bool UXF_BlueprintFunctionLibrary::GetSkeletalMeshBoneIndices(USkeletalMeshComponent* Comp, TArray<int32>& BoneIndices, TArray<FName>& BoneNames)
+{
+	BoneIndices.Empty();
 	BoneNames.Empty();
+	if (!Comp) return false;
 
-	//Get Bone Names
 	Comp->GetBoneNames(BoneNames);
+	BoneIndices.Reserve(BoneNames.Num());
+	for (const FName& BoneName : BoneNames)
+	{
+		BoneIndices.Add(Comp->GetBoneIndex(BoneName));
+	}
+	return true;
+}
+
+bool UXF_BlueprintFunctionLibrary::GetSkeletalMeshBoneTransforms(USkeletalMeshComponent* Comp, TArrayView<const int32> BoneIndices, TArray<FVector>& OutBoneLocations, TArray<FQuat>* OutBoneRotations)
+{
+	XF_SCOPE_STAGE(Skeleton);
+	OutBoneLocations.Empty(BoneIndices.Num());
+	if (OutBoneRotations) OutBoneRotations->Empty(BoneIndices.Num());
+	if (!Comp) return false;
+
+	const FTransform& ComponentToWorld = Comp->GetComponentTransform();
+	const TArray<FTransform>& SpaceTransforms = Comp->GetComponentSpaceTransforms();
+#if ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION >= 1
+	const bool bFollowsLeaderPose = Comp->LeaderPoseComponent.IsValid();
+#else
+	const bool bFollowsLeaderPose = Comp->MasterPoseComponent.IsValid();
+#endif
 
-	//Get Bone Locations
-	for (int32 Itr = 0; Itr < BoneNames.Num(); Itr++ )
+	if (bFollowsLeaderPose)
 	{
-		BoneLocations.Add(Comp->GetBoneLocation(BoneNames[Itr]));
+		// the pose lives in the leader, GetBoneTransform maps the bones to it
+		for (const int32 BoneIdx : BoneIndices)
+		{
+			const FTransform BoneTransform = BoneIdx == INDEX_NONE ? ComponentToWorld : Comp->GetBoneTransform(BoneIdx);
+			OutBoneLocations.Add(BoneTransform.GetLocation());
+			if (OutBoneRotations) OutBoneRotations->Add(BoneTransform.GetRotation());
+		}
+		return true;
 	}
 
+	// the component to world transform is applied as a matrix to the locations, as a quaternion to the rotations
+	const FMatrix ComponentToWorldMatrix = ComponentToWorld.ToMatrixWithScale();
+	const FQuat ComponentRotation = ComponentToWorld.GetRotation();
+	for (const int32 BoneIdx : BoneIndices)
+	{
+		if (!SpaceTransforms.IsValidIndex(BoneIdx))
+		{
+			// same as GetBoneLocation for a missing bone
+			OutBoneLocations.Add(ComponentToWorld.GetLocation());
+			if (OutBoneRotations) OutBoneRotations->Add(ComponentRotation);
+			continue;
+		}
+		const FTransform& SpaceTransform = SpaceTransforms[BoneIdx];
+		OutBoneLocations.Add(ComponentToWorldMatrix.TransformPosition(SpaceTransform.GetTranslation()));
+		if (OutBoneRotations) OutBoneRotations->Add(ComponentRotation * SpaceTransform.GetRotation());
+	}
 	return true;
 }
 
 #if ENGINE_MAJOR_VERSION == 4
 bool UXF_BlueprintFunctionLibrary::GetSkeletalMeshVertexLocationsByLODIndex(USkeletalMeshComponent* Comp, int32 LODIndex, TArray<FVector>& VertexPositions)
 {
+	XF_SCOPE_STAGE(VertexExtraction);
 	VertexPositions.Empty();
 
 	if(!Comp)
@@ -317,11 +560,8 @@ bool UXF_BlueprintFunctionLibrary::GetSkeletalMeshVertexLocationsByLODIndex(USke
 	TArray<FVector> Vertices;
 	Comp->ComputeSkinnedPositions(Comp, Vertices, OutRefToLocal, LODData, SkinWeightBuffer);
 
-	// convert each vertex to world space
-	for (FVector vertex: Vertices)
-	{
-		VertexPositions.Add(RV_Transform.TransformPosition(vertex));
-	}
+	// convert the vertices to world space
+	TransformPositions(RV_Transform, Vertices, VertexPositions);
 
 	return true;
 
@@ -330,6 +570,7 @@ bool UXF_BlueprintFunctionLibrary::GetSkeletalMeshVertexLocationsByLODIndex(USke
 #elif ENGINE_MAJOR_VERSION == 5
 bool UXF_BlueprintFunctionLibrary::GetSkeletalMeshVertexLocationsByLODIndex(USkeletalMeshComponent* Comp, int32 LODIndex, TArray<FVector>& VertexPositions)
 {
+	XF_SCOPE_STAGE(VertexExtraction);
 	VertexPositions.Empty();
 
 	if(!Comp)
@@ -363,15 +604,8 @@ bool UXF_BlueprintFunctionLibrary::GetSkeletalMeshVertexLocationsByLODIndex(USke
 	TArray<FVector3f> Vertices;
 	Comp->ComputeSkinnedPositions(Comp, Vertices, OutRefToLocal, LODData, SkinWeightBuffer);
 
-	// convert each vertex to world space
-	for (FVector3f vertex: Vertices)
-	{
-		FVector3d v;
-		v.X = vertex.X;
-		v.Y = vertex.Y;
-		v.Z = vertex.Z;
-		VertexPositions.Add(RV_Transform.TransformPosition(v));
-	}
+	// convert the vertices to world space
+	TransformPositions(RV_Transform, Vertices, VertexPositions);
 
 	return true;
 }
@@ -458,8 +692,93 @@ EOcclusion UXF_BlueprintFunctionLibrary::GetOcclusionFromHitResult(
 	return Occlusion;
 }
 
+void UXF_BlueprintFunctionLibrary::TraceOcclusion(
+	UWorld* World,
+	const FVector& CameraLocation,
+	TArrayView<const FVector> Points,
+	FName MeshName,
+	float MeshThickness,
+	TArrayView<EOcclusion> Occlusion
+)
+{
+	XF_SCOPE_STAGE(Occlusion);
+	check(Points.Num() == Occlusion.Num());
+
+	// same query as UKismetSystemLibrary::LineTraceSingle on the visibility channel, built once
+	const FCollisionQueryParams Params(SCENE_QUERY_STAT(XFTraceOcclusion), true /* bTraceComplex */);
+
+	// scene queries only take the read lock of the physics scene, so they can run in parallel
+	constexpr int32 ChunkSize = 256;
+	const int32 NumChunks = FMath::DivideAndRoundUp(Points.Num(), ChunkSize);
+	ParallelFor(NumChunks, [&](int32 ChunkIdx)
+	{
+		const int32 End = FMath::Min((ChunkIdx + 1) * ChunkSize, Points.Num());
+		for (int32 Idx = ChunkIdx * ChunkSize; Idx < End; Idx++)
+		{
+			FHitResult HitResult;
+			bool IsHit = World->LineTraceSingleByChannel(HitResult, CameraLocation, Points[Idx], ECC_Visibility, Params);
+			Occlusion[Idx] = GetOcclusionFromHitResult(HitResult, MeshName, (int)MeshThickness, IsHit);
+		}
+	});
+}
+
+bool UXF_BlueprintFunctionLibrary::LoadMaskColors(TArray<FColor>& MaskColors)
+{
+	MaskColors.Empty();
+
+	TSharedPtr<IPlugin> Plugin = IPluginManager::Get().FindPlugin(TEXT("XRFeitoriaUnreal"));
+	if (!Plugin.IsValid())
+	{
+		return false;
+	}
+	const FString Path = Plugin->GetContentDir() / TEXT("Python/data/mask_colors.json");
+
+	FString JsonString;
+	if (!FFileHelper::LoadFileToString(JsonString, *Path))
+	{
+		UE_LOG(LogXF, Error, TEXT("Failed to load mask colors from %s"), *Path);
+		return false;
+	}
+
+	// [{"name": ..., "hex": "#000000", "rgb": [0, 0, 0]}, ...], indexed by stencil value
+	TArray<TSharedPtr<FJsonValue>> JsonColors;
+	if (!FJsonSerializer::Deserialize(TJsonReaderFactory<>::Create(JsonString), JsonColors))
+	{
+		UE_LOG(LogXF, Error, TEXT("Failed to parse mask colors in %s"), *Path);
+		return false;
+	}
+	for (const TSharedPtr<FJsonValue>& JsonColor : JsonColors)
+	{
+		const TArray<TSharedPtr<FJsonValue>>& RGB = JsonColor->AsObject()->GetArrayField(TEXT("rgb"));
+		MaskColors.Add(FColor((uint8)RGB[0]->AsNumber(), (uint8)RGB[1]->AsNumber(), (uint8)RGB[2]->AsNumber()));
+	}
+	return true;
+}
+
+void UXF_BlueprintFunctionLibrary::ComputeOcclusionRates(
+	TArrayView<const EOcclusion> Occlusion,
+	float& non_occlusion_rate,
+	float& self_occlusion_rate,
+	float& inter_occlusion_rate
+)
+{
+	int32 non_occlussion_count = 0;
+	int32 self_occlusion_count = 0;
+	int32 inter_occlusion_count = 0;
+	for (int idx = 0; idx < Occlusion.Num(); idx++)
+	{
+		if (Occlusion[idx] == EOcclusion::NonOcclusion) non_occlussion_count++;
+		else if (Occlusion[idx] == EOcclusion::SelfOcclusion) self_occlusion_count++;
+		else if (Occlusion[idx] == EOcclusion::InterOcclusion) inter_occlusion_count++;
+	}
+	const float Num = FMath::Max(Occlusion.Num(), 1);
+	non_occlusion_rate = (float)non_occlussion_count / Num;
+	self_occlusion_rate = (float)self_occlusion_count / Num;
+	inter_occlusion_rate = (float)inter_occlusion_count / Num;
+}
+
 bool UXF_BlueprintFunctionLibrary::DetectInterOcclusionVertices(
-	TArray<FVector> Vertices,
+	const TArray<FVector>& Vertices,
 	ACameraActor* Camera,
 	FName MeshName,
 	TArray<EOcclusion>& VerticesOcclusion,
@@ -472,44 +791,35 @@ bool UXF_BlueprintFunctionLibrary::DetectInterOcclusionVertices(
 {
 	UWorld* World = Camera->GetWorld();
 	FVector CameraLocation = Camera->GetActorLocation();
-	EDrawDebugTrace::Type DrawDebug = EDrawDebugTrace::None;  // DrawDebugType
-	if (bDebug)
-		DrawDebug = EDrawDebugTrace::ForOneFrame;
-	for (int i = 0; i < Vertices.Num(); i++)
-	{
-		FHitResult HitResult;
-		FVector vertex = Vertices[i];
-
-		bool IsHit = UKismetSystemLibrary::LineTraceSingle(
-			World,
-			CameraLocation,
-			vertex,
-			UEngineTypes::ConvertToTraceType(ECollisionChannel::ECC_Visibility),
-			true,  // bTraceComplex
-			TArray<AActor*>(),  // ActorsToIgnore
-			DrawDebug,  // DrawDebugType
-			HitResult,
-			true  // bIgnoreSelf
-		);
-
-		EOcclusion Occlusion = GetOcclusionFromHitResult(HitResult, MeshName, 5, IsHit);
 
-		VerticesOcclusion.Add(Occlusion);
+	VerticesOcclusion.SetNumUninitialized(Vertices.Num());
+	if (bDebug)
+	{
+		// debug lines can only be drawn from the game thread
+		for (int i = 0; i < Vertices.Num(); i++)
+		{
+			FHitResult HitResult;
+			bool IsHit = UKismetSystemLibrary::LineTraceSingle(
+				World,
+				CameraLocation,
+				Vertices[i],
+				UEngineTypes::ConvertToTraceType(ECollisionChannel::ECC_Visibility),
+				true,  // bTraceComplex
+				TArray<AActor*>(),  // ActorsToIgnore
+				EDrawDebugTrace::ForOneFrame,  // DrawDebugType
+				HitResult,
+				true  // bIgnoreSelf
+			);
+			VerticesOcclusion[i] = GetOcclusionFromHitResult(HitResult, MeshName, 5, IsHit);
+		}
 	}
-
-	// calculate occlusion rate
-	int32 non_occlussion_count = 0;
-	int32 self_occlusion_count = 0;
-	int32 inter_occlusion_count = 0;
-	for (int idx = 0; idx < VerticesOcclusion.Num(); idx++)
+	else
 	{
-		if (VerticesOcclusion[idx] == EOcclusion::NonOcclusion) non_occlussion_count++;
-		else if (VerticesOcclusion[idx] == EOcclusion::SelfOcclusion) self_occlusion_count++;
-		else if (VerticesOcclusion[idx] == EOcclusion::InterOcclusion) inter_occlusion_count++;
+		TraceOcclusion(World, CameraLocation, Vertices, MeshName, 5, VerticesOcclusion);
 	}
-	non_occlusion_rate = (float)non_occlussion_count / (float)VerticesOcclusion.Num();
-	self_occlusion_rate = (float)self_occlusion_count / (float)VerticesOcclusion.Num();
-	inter_occlusion_rate = (float)inter_occlusion_count / (float)VerticesOcclusion.Num();
+
+	// calculate occlusion rate
+	ComputeOcclusionRates(VerticesOcclusion, non_occlusion_rate, self_occlusion_rate, inter_occlusion_rate);
 	if (bDebug)
 	{
 		UE_LOG(LogTemp, Log, TEXT("Skeletal: %s"), *MeshName.ToString());
@@ -718,6 +1028,56 @@ UPhysicsAsset* UXF_BlueprintFunctionLibrary::GeneratePhysicsAsset(USkeletalMesh*
 
 
 
+/** Buffered UTF-8 writer of the HitBoxes rows, so the file never has to be held in memory. */
+class FXFHitBoxesWriter
+{
+public:
+	explicit FXFHitBoxesWriter(const FString& Path)
+		: Archive(IFileManager::Get().CreateFileWriter(*Path))
+	{
+		Buffer.Reserve(BufferSize);
+	}
+	~FXFHitBoxesWriter() { Close(); }
+
+	bool IsValid() const { return Archive.IsValid(); }
+
+	void AddRow(const FString& Row)
+	{
+		const FTCHARToUTF8 Utf8(*Row);
+		Buffer.Append((const uint8*)Utf8.Get(), Utf8.Length());
+		if (Buffer.Num() >= BufferSize)
+		{
+			Flush();
+		}
+	}
+
+	/** Write the buffered rows, and flush the file. */
+	void Flush()
+	{
+		if (!Archive.IsValid()) return;
+		if (Buffer.Num() > 0)
+		{
+			Archive->Serialize(Buffer.GetData(), Buffer.Num());
+			Buffer.Reset();
+		}
+		Archive->Flush();
+	}
+
+	void Close()
+	{
+		Flush();
+		Archive.Reset();
+	}
+
+private:
+	static constexpr int32 BufferSize = 1024 * 1024;
+	TUniquePtr<FArchive> Archive;
+	TArray<uint8> Buffer;
+};
+
+static void WalkSceneQuadrantsBatched(const UObject* WorldContext, TFunctionRef<void(TArray<FXFGridScanCell>&& BatchCells)> OnBatch,
+	const FVector& Origin, int BoxHalfSize, float MaxXExtend, float MinXExtend, float MaxYExtend, float MinYExtend, float HitEndZ);
+
 // Use box shape to test
 void UXF_BlueprintFunctionLibrary::DivideSceneViaBoxTrace(
 	const UObject* WorldContext,
@@ -734,6 +1094,7 @@ void UXF_BlueprintFunctionLibrary::DivideSceneViaBoxTrace(
 	bool VisualizeBoxes
 )
 {
+	XF_SCOPE_STAGE(SceneSweep);
 	PathToSaveResults = PathToSaveResults.TrimStartAndEnd();
 	UWorld* World = WorldContext->GetWorld();
 	// Prepare ...
@@ -790,128 +1151,562 @@ void UXF_BlueprintFunctionLibrary::DivideSceneViaBoxTrace(
 		return;
 	}
 
-	// ...
-	// GEngine->AddOnScreenDebugMessage(
-	// 	-1, 5.0, FColor::Yellow,
-	// 	FString::Printf(
-	// 		TEXT("EnalbeTrace: %s"), EnableTrace ? TEXT("true") : TEXT("false")));
 	const float DeltaStep = BoxHalfSize;
 	const FVector HitBoxHalfExtend = FVector(BoxHalfSize, BoxHalfSize,
 	                                         BoxHalfSize);
-
 	const FVector Origin = StartLocation;
-	const auto MaxX = MaxXExtend + Origin.X;
-	const auto MinX = MinXExtend + Origin.X;
-	const auto MaxY = MaxYExtend + Origin.Y;
-	const auto MinY = MinYExtend + Origin.Y;
-
-	FString HitBoxesInfo = TEXT("actor_name,x,y,z,materials,visible\n");
-	HitBoxesInfo += TEXT("BoxHalfSize,DeltaStep,CenterX,CenterY,CenterZ,HitEndZ\n");
-	HitBoxesInfo += FString::Printf(
+
+	FXFHitBoxesWriter Writer(PathToSaveResults);
+	if (!Writer.IsValid())
+	{
+		UE_LOG(LogXF, Error, TEXT("Failed to open %s to save the hit boxes"), *PathToSaveResults);
+		return;
+	}
+	Writer.AddRow(TEXT("actor_name,x,y,z,materials,visible\n"));
+	Writer.AddRow(TEXT("BoxHalfSize,DeltaStep,CenterX,CenterY,CenterZ,HitEndZ\n"));
+	Writer.AddRow(FString::Printf(
 		TEXT("%d,%f,%f,%f,%f,%f\n"),
-		BoxHalfSize, DeltaStep, Origin.X, Origin.Y, Origin.Z, HitEndZ);
+		BoxHalfSize, DeltaStep, Origin.X, Origin.Y, Origin.Z, HitEndZ));
+
+	int32 NumHitBoxes = 0;
+	WalkSceneQuadrantsBatched(
+		WorldContext,
+		[&](TArray<FXFGridScanCell>&& Cells)
+		{
+			for (const FXFGridScanCell& Cell : Cells)
+			{
+				// const FString MatNames = GetActorMaterialNames(
+				// 	*HitRes.Actor);
+				FString MatNames = TEXT("");
+				Writer.AddRow(FString::Printf(
+					TEXT("%s,%f,%f,%f,%s,%d\n"),
+					*Cell.ActorName,
+					Cell.Location.X, Cell.Location.Y, Cell.Location.Z,
+					*MatNames,
+					Cell.bIsVisible ? 1 : 0));
+
+				if (VisualizeBoxes)
+				{
+					const FVector DebugHitBoxLoc = FVector(
+						Cell.Location.X, Cell.Location.Y,
+						Cell.Location.Z - HitBoxHalfExtend.Z);
+					DrawDebugBox(
+						World, DebugHitBoxLoc, HitBoxHalfExtend,
+						FColor::Green, true);
+
+					constexpr float DisplayTime = 2.0f;
+					GEngine->AddOnScreenDebugMessage(
+						-1, DisplayTime, FColor::Orange,
+						FString::Printf(
+							TEXT("Hit: %s At (%f, %f, %f)"),
+							*Cell.ActorName,
+							Cell.Location.X, Cell.Location.Y, Cell.Location.Z));
+				}
+			}
+			NumHitBoxes += Cells.Num();
+			// the rows of the finished batches are on disk, even if the scan is interrupted
+			Writer.Flush();
+		},
+		Origin, BoxHalfSize,
+		MaxXExtend, MinXExtend, MaxYExtend, MinYExtend, HitEndZ);
+
+	Writer.Close();
+	UE_LOG(LogXF, Log, TEXT("Saved %d hit boxes to %s"), NumHitBoxes, *PathToSaveResults);
+	GEngine->AddOnScreenDebugMessage(
+		-1, 100.0, FColor::Green,
+		FString::Printf(TEXT("Trace Done! %d hit boxes"), NumHitBoxes));
+}
+
+
+static constexpr int64 GridScanBatchSize = 64 * 1024;
+static constexpr int32 GridScanChunkSize = 256;
+/** Rows of a quadrant walked at once, the rows after the early stop are wasted. */
+static constexpr int32 GridWalkRowBatchSize = 8;
+
+/**
+ * Sweep a box down from Start to HitEndZ, and test whether Start is inside a model. Fills the cell if either hits.
+ * The scene cell cache, when given, is looked up first and gets the traced result.
+ */
+static bool TraceGridCell(const UObject* WorldContext, const FVector& Start, float HitEndZ, int BoxHalfSize, FXFGridScanCell& OutCell,
+	FXFSceneCellCache* Cache = nullptr)
+{
+	FXFSceneCellKey CacheKey;
+	if (Cache)
+	{
+		CacheKey = FXFSceneCellKey::Column(Start, HitEndZ, BoxHalfSize);
+		FXFSceneCellValue Cached;
+		if (Cache->Find(CacheKey, Cached))
+		{
+			OutCell.Location = Cached.Location;
+			OutCell.ActorName = Cached.ActorName;
+			OutCell.bIsInside = Cached.bIsInside;
+			return Cached.bIsHit;
+		}
+	}
+
+	UWorld* World = WorldContext->GetWorld();
+	const FVector TraceEnd = FVector(Start.X, Start.Y, HitEndZ);
+	const FCollisionShape ColShape = FCollisionShape::MakeBox(
+		FVector(BoxHalfSize, BoxHalfSize, BoxHalfSize));
 
 	FHitResult HitResult;
+	const bool bIsHit = World->SweepSingleByChannel(
+		HitResult, Start, TraceEnd, FQuat::Identity, ECC_Visibility,
+		ColShape);
+
+	constexpr float Extend = 1000.f;
 	FHitResult UpHitResult;
-	FHitResult VisTestHitResult;
-	const FCollisionShape ColShape = FCollisionShape::MakeBox(
-		HitBoxHalfExtend);
-	for (auto SignX : {1, -1})
+	const bool bIsInside = UXF_BlueprintFunctionLibrary::TestInside(
+		WorldContext, Start, Extend, UpHitResult);
+	if (!bIsHit && !bIsInside)
+	{
+		// the misses are cached too, most of the cells of a sweep are empty
+		if (Cache) Cache->Add(CacheKey, FXFSceneCellValue());
+		return false;
+	}
+
+	const FHitResult& HitRes = bIsInside ? UpHitResult : HitResult;
+	OutCell.Location = FVector(HitRes.Location.X, HitRes.Location.Y, HitRes.Location.Z - BoxHalfSize);
+	OutCell.ActorName = HitRes.GetActor() ? HitRes.GetActor()->GetName() : FString();
+	OutCell.bIsInside = bIsInside;
+	if (Cache)
+	{
+		FXFSceneCellValue Value;
+		Value.bIsHit = true;
+		Value.bIsInside = bIsInside;
+		Value.Location = OutCell.Location;
+		Value.ActorName = OutCell.ActorName;
+		Cache->Add(CacheKey, Value);
+	}
+	return true;
+}
+
+void UXF_BlueprintFunctionLibrary::ScanSceneGrid(
+	const UObject* WorldContext,
+	TArray<FXFGridScanCell>& Cells,
+	FVector Origin,
+	int BoxHalfSize,
+	float MaxXExtend,
+	float MinXExtend,
+	float MaxYExtend,
+	float MinYExtend,
+	float HitEndZ
+)
+{
+	Cells.Reset();
+	ScanSceneGridBatched(
+		WorldContext,
+		[&Cells](TArray<FXFGridScanCell>&& BatchCells) { Cells.Append(MoveTemp(BatchCells)); },
+		Origin, BoxHalfSize, MaxXExtend, MinXExtend, MaxYExtend, MinYExtend, HitEndZ);
+}
+
+
+void UXF_BlueprintFunctionLibrary::ScanSceneGridBatched(
+	const UObject* WorldContext,
+	TFunctionRef<void(TArray<FXFGridScanCell>&& BatchCells)> OnBatch,
+	FVector Origin,
+	int BoxHalfSize,
+	float MaxXExtend,
+	float MinXExtend,
+	float MaxYExtend,
+	float MinYExtend,
+	float HitEndZ
+)
+{
+	XF_SCOPE_STAGE(SceneSweep);
+	UWorld* World = WorldContext ? WorldContext->GetWorld() : nullptr;
+	if (!World || BoxHalfSize <= 0)
+	{
+		return;
+	}
+
+	const TSharedPtr<FXFSceneCellCache, ESPMode::ThreadSafe> Cache = FXFSceneCellCache::Get(World);
+
+	// Cells at Origin + DeltaStep * (i, j), strictly within the extents
+	const float DeltaStep = BoxHalfSize;
+	const int32 MinI = FMath::FloorToInt(MinXExtend / DeltaStep) + 1;
+	const int32 MaxI = FMath::CeilToInt(MaxXExtend / DeltaStep) - 1;
+	const int32 MinJ = FMath::FloorToInt(MinYExtend / DeltaStep) + 1;
+	const int32 MaxJ = FMath::CeilToInt(MaxYExtend / DeltaStep) - 1;
+	const int64 NumI = FMath::Max(MaxI - MinI + 1, 0);
+	const int64 NumJ = FMath::Max(MaxJ - MinJ + 1, 0);
+	const int64 NumCells = NumI * NumJ;
+
+	// The grid can have millions of cells, only a batch of them is kept in memory at once
+	constexpr int64 BatchSize = GridScanBatchSize;
+	constexpr int32 ChunkSize = GridScanChunkSize;
+	TArray<TOptional<FXFGridScanCell>> BatchCells;
+	for (int64 BatchStart = 0; BatchStart < NumCells; BatchStart += BatchSize)
 	{
-		for (auto SignY : {1, -1})
+		const int32 NumBatchCells = (int32)FMath::Min(BatchSize, NumCells - BatchStart);
+		BatchCells.Reset();
+		BatchCells.SetNum(NumBatchCells);
+
+		ParallelFor(FMath::DivideAndRoundUp(NumBatchCells, ChunkSize), [&](int32 ChunkIdx)
 		{
-			int i = 0;
-			int j = 0;
-			int NotHitRowCount = 0;
-			int NotHitCount = 0;
-			while (true)
+			// trace only, the stage is timed by the caller
+			TRACE_CPUPROFILER_EVENT_SCOPE(XF_SceneSweepChunk);
+			const int32 End = FMath::Min((ChunkIdx + 1) * ChunkSize, NumBatchCells);
+			for (int32 Idx = ChunkIdx * ChunkSize; Idx < End; Idx++)
 			{
-				FVector Start = FVector(Origin.X + DeltaStep * i * SignX,
-				                        Origin.Y + DeltaStep * j * SignY,
-				                        Origin.Z);
-				FVector End = FVector(Start.X, Start.Y, HitEndZ);
-				const bool bIsWithinBorder = MinX < Start.X && Start.X < MaxX && MinY < Start.Y && Start.Y < MaxY;
-				const bool bIsAroundOrigin = i < 10 && j < 10;
-
-				const bool bIsHit = World->SweepSingleByChannel(
-					HitResult, Start, End, FQuat::Identity, ECC_Visibility,
-					ColShape);
-
-				constexpr float Extend = 1000.f;
-				const bool bIsInside = TestInside(
-					WorldContext, Start, Extend, UpHitResult);
-
-				const bool bIsVisible = TestVisible(
+				const int64 CellIdx = BatchStart + Idx;
+				const int32 i = MinI + (int32)(CellIdx / NumJ);
+				const int32 j = MinJ + (int32)(CellIdx % NumJ);
+				const FVector Start = FVector(Origin.X + DeltaStep * i,
+				                              Origin.Y + DeltaStep * j,
+				                              Origin.Z);
+				FXFGridScanCell Cell;
+				if (!TraceGridCell(WorldContext, Start, HitEndZ, BoxHalfSize, Cell, Cache.Get()))
+				{
+					continue;
+				}
+
+				// Only the hit cells need the visibility
+				FHitResult VisTestHitResult;
+				Cell.bIsVisible = TestVisible(
 					WorldContext, Start, Origin, VisTestHitResult);
+				BatchCells[Idx] = MoveTemp(Cell);
+			}
+		});
 
-				if ((bIsHit || bIsInside) && bIsWithinBorder)
+		TArray<FXFGridScanCell> Cells;
+		for (TOptional<FXFGridScanCell>& Cell : BatchCells)
+		{
+			if (Cell.IsSet()) Cells.Add(MoveTemp(Cell.GetValue()));
+		}
+		OnBatch(MoveTemp(Cells));
+	}
+
+	if (Cache)
+	{
+		Cache->Save();
+	}
+}
+
+
+/**
+ * Row i of a quadrant of DivideSceneViaBoxTrace: the cells from j = 0 until three misses in a row,
+ * a miss being a cell out of the border or hitting nothing (except around the origin).
+ */
+static void WalkGridRow(const UObject* WorldContext, const FVector& Origin, int32 SignX, int32 SignY, int32 i, int BoxHalfSize,
+	const FBox2D& Border, float HitEndZ, FXFSceneCellCache* Cache, TArray<FXFGridScanCell>& OutCells)
+{
+	const float DeltaStep = BoxHalfSize;
+	int32 NotHitCount = 0;
+	for (int32 j = 0; ; j++)
+	{
+		const FVector Start = FVector(Origin.X + DeltaStep * i * SignX,
+		                              Origin.Y + DeltaStep * j * SignY,
+		                              Origin.Z);
+		const bool bIsWithinBorder = Border.Min.X < Start.X && Start.X < Border.Max.X && Border.Min.Y < Start.Y && Start.Y < Border.Max.Y;
+		const bool bIsAroundOrigin = i < 10 && j < 10;
+
+		// the cells out of the border are misses, whatever they hit
+		FXFGridScanCell Cell;
+		if (bIsWithinBorder && TraceGridCell(WorldContext, Start, HitEndZ, BoxHalfSize, Cell, Cache))
+		{
+			// Hit somewhere, and not exceed the border.
+			NotHitCount = 0;
+			FHitResult VisTestHitResult;
+			Cell.bIsVisible = UXF_BlueprintFunctionLibrary::TestVisible(
+				WorldContext, Start, Origin, VisTestHitResult);
+			OutCells.Add(MoveTemp(Cell));
+		}
+		else if (bIsAroundOrigin && bIsWithinBorder)
+		{
+			;	// pass
+		}
+		else if (++NotHitCount > 2)
+		{
+			// Hit nowhere, maybe outside the world or the border
+			return;
+		}
+	}
+}
+
+/**
+ * The walk of DivideSceneViaBoxTrace: the four quadrants around Origin, row by row,
+ * each quadrant stopping after two rows without hits (three from the start). The rows only depend on their index,
+ * so a batch of them is walked in parallel and the early stop is applied to the batch in order.
+ * The cells are handed to OnBatch in the order of the sequential walk.
+ */
+static void WalkSceneQuadrantsBatched(const UObject* WorldContext, TFunctionRef<void(TArray<FXFGridScanCell>&& BatchCells)> OnBatch,
+	const FVector& Origin, int BoxHalfSize, float MaxXExtend, float MinXExtend, float MaxYExtend, float MinYExtend, float HitEndZ)
+{
+	XF_SCOPE_STAGE(SceneSweep);
+	UWorld* World = WorldContext ? WorldContext->GetWorld() : nullptr;
+	if (!World || BoxHalfSize <= 0)
+	{
+		return;
+	}
+
+	const TSharedPtr<FXFSceneCellCache, ESPMode::ThreadSafe> Cache = FXFSceneCellCache::Get(World);
+	const FBox2D Border(
+		FVector2D(MinXExtend + Origin.X, MinYExtend + Origin.Y),
+		FVector2D(MaxXExtend + Origin.X, MaxYExtend + Origin.Y));
+
+	for (int32 SignX : {1, -1})
+	{
+		for (int32 SignY : {1, -1})
+		{
+			int32 NotHitRowCount = 0;
+			bool bIsDone = false;
+			for (int32 RowStart = 0; !bIsDone; RowStart += GridWalkRowBatchSize)
+			{
+				TArray<TArray<FXFGridScanCell>> Rows;
+				Rows.SetNum(GridWalkRowBatchSize);
+				ParallelFor(GridWalkRowBatchSize, [&](int32 RowIdx)
 				{
-					// Hit somewhere, and not exceed the border.
-					//
-					NotHitCount = 0;
-					NotHitRowCount = 0;
-
-					FHitResult& HitRes = bIsInside ? UpHitResult : HitResult;
-					FVector HitLoc = HitRes.Location;
-					// Save Hit info
-					const FString ActorName = HitRes.GetActor()->GetName();
-					// const FString MatNames = GetActorMaterialNames(
-					// 	*HitRes.Actor);
-					FString MatNames = TEXT("");
-					HitBoxesInfo += FString::Printf(
-						TEXT("%s,%f,%f,%f,%s,%d\n"),
-						*ActorName,
-						HitLoc.X, HitLoc.Y, HitLoc.Z - BoxHalfSize,
-						*MatNames,
-						bIsVisible ? 1 : 0);
+					// trace only, the stage is timed by the caller
+					TRACE_CPUPROFILER_EVENT_SCOPE(XF_SceneSweepRow);
+					WalkGridRow(WorldContext, Origin, SignX, SignY, RowStart + RowIdx, BoxHalfSize, Border, HitEndZ, Cache.Get(), Rows[RowIdx]);
+				});
 
-					if (VisualizeBoxes)
+				TArray<FXFGridScanCell> Cells;
+				for (TArray<FXFGridScanCell>& Row : Rows)
+				{
+					// a row with hits resets the count, and ends it like the others
+					NotHitRowCount = Row.Num() > 0 ? 1 : NotHitRowCount + 1;
+					Cells.Append(MoveTemp(Row));
+					if (NotHitRowCount > 2)
 					{
-						const FVector DebugHitBoxLoc = FVector(
-							HitLoc.X, HitLoc.Y,
-							HitLoc.Z - HitBoxHalfExtend.Z * 2.f);
-						DrawDebugBox(
-							World, DebugHitBoxLoc, HitBoxHalfExtend,
-							FColor::Green, true);
+						bIsDone = true;
+						break;
 					}
+				}
+				OnBatch(MoveTemp(Cells));
+			}
+		}
+	}
 
-					constexpr float DisplayTime = 2.0f;
-					GEngine->AddOnScreenDebugMessage(
-						-1, DisplayTime, FColor::Orange,
-						FString::Printf(
-							TEXT("Hit: %s At (%f, %f, %f)"),
-							*HitResult.GetActor()->GetName(),
-							HitLoc.X, HitLoc.Y, HitLoc.Z - BoxHalfSize));
+	if (Cache)
+	{
+		Cache->Save();
+	}
+}
+
+
+void UXF_BlueprintFunctionLibrary::ScanSceneGridMultiStart(
+	const UObject* WorldContext,
+	TArray<FXFGridScanCell>& Cells,
+	const TArray<FVector>& StartPoints,
+	int BoxHalfSize,
+	float MaxXExtend,
+	float MinXExtend,
+	float MaxYExtend,
+	float MinYExtend,
+	float ZExtend
+)
+{
+	Cells.Reset();
+	ScanSceneGridMultiStartBatched(
+		WorldContext,
+		[&Cells](TArray<FXFGridScanCell>&& BatchCells) { Cells.Append(MoveTemp(BatchCells)); },
+		StartPoints, BoxHalfSize, MaxXExtend, MinXExtend, MaxYExtend, MinYExtend, ZExtend);
+}
+
+
+void UXF_BlueprintFunctionLibrary::ScanSceneGridMultiStartBatched(
+	const UObject* WorldContext,
+	TFunctionRef<void(TArray<FXFGridScanCell>&& BatchCells)> OnBatch,
+	const TArray<FVector>& StartPoints,
+	int BoxHalfSize,
+	float MaxXExtend,
+	float MinXExtend,
+	float MaxYExtend,
+	float MinYExtend,
+	float ZExtend
+)
+{
+	XF_SCOPE_STAGE(SceneSweep);
+	UWorld* World = WorldContext ? WorldContext->GetWorld() : nullptr;
+	if (!World || BoxHalfSize <= 0)
+	{
+		return;
+	}
+
+	const TSharedPtr<FXFSceneCellCache, ESPMode::ThreadSafe> Cache = FXFSceneCellCache::Get(World);
+
+	// Region of each start, in cells of the world aligned grid (DeltaStep * (i, j))
+	struct FStartRegion
+	{
+		int32 StartIndex = 0;
+		FVector Origin;
+		float HitEndZ = 0.f;
+		FIntRect Cells;  // inclusive
+	};
+	const float DeltaStep = BoxHalfSize;
+	TArray<FStartRegion> Regions;
+	for (int32 StartIdx = 0; StartIdx < StartPoints.Num(); StartIdx++)
+	{
+		// same origin and end as DivideSceneViaBoxTraceBatch
+		FStartRegion& Region = Regions.AddDefaulted_GetRef();
+		Region.StartIndex = StartIdx;
+		Region.Origin = StartPoints[StartIdx] + FVector(0, 0, 2000.0);
+		Region.HitEndZ = StartPoints[StartIdx].Z - ZExtend;
+		Region.Cells.Min.X = FMath::FloorToInt((Region.Origin.X + MinXExtend) / DeltaStep) + 1;
+		Region.Cells.Max.X = FMath::CeilToInt((Region.Origin.X + MaxXExtend) / DeltaStep) - 1;
+		Region.Cells.Min.Y = FMath::FloorToInt((Region.Origin.Y + MinYExtend) / DeltaStep) + 1;
+		Region.Cells.Max.Y = FMath::CeilToInt((Region.Origin.Y + MaxYExtend) / DeltaStep) - 1;
+	}
+
+	// Only the starts sweeping the same Z range can share cells,
+	// and the overlapping regions among them are merged into components scanned together.
+	// Union-find of the regions, the root of a component is its first start
+	TArray<int32> Parents;
+	Parents.SetNumUninitialized(Regions.Num());
+	for (int32 RegionIdx = 0; RegionIdx < Regions.Num(); RegionIdx++) Parents[RegionIdx] = RegionIdx;
+	auto FindRoot = [&Parents](int32 RegionIdx)
+	{
+		while (Parents[RegionIdx] != RegionIdx)
+		{
+			Parents[RegionIdx] = Parents[Parents[RegionIdx]];
+			RegionIdx = Parents[RegionIdx];
+		}
+		return RegionIdx;
+	};
+
+	// Sweep the regions of each Z range by Min.X, only the ones starting before the end of a region can overlap it
+	TArray<int32> SweepOrder;
+	for (int32 RegionIdx = 0; RegionIdx < Regions.Num(); RegionIdx++) SweepOrder.Add(RegionIdx);
+	SweepOrder.Sort([&Regions](int32 A, int32 B)
+	{
+		const FStartRegion& RegionA = Regions[A];
+		const FStartRegion& RegionB = Regions[B];
+		if (RegionA.Origin.Z != RegionB.Origin.Z) return RegionA.Origin.Z < RegionB.Origin.Z;
+		if (RegionA.HitEndZ != RegionB.HitEndZ) return RegionA.HitEndZ < RegionB.HitEndZ;
+		return RegionA.Cells.Min.X < RegionB.Cells.Min.X;
+	});
+	for (int32 SweepIdx = 0; SweepIdx < SweepOrder.Num(); SweepIdx++)
+	{
+		const FStartRegion& A = Regions[SweepOrder[SweepIdx]];
+		for (int32 NextIdx = SweepIdx + 1; NextIdx < SweepOrder.Num(); NextIdx++)
+		{
+			const FStartRegion& B = Regions[SweepOrder[NextIdx]];
+			if (A.Origin.Z != B.Origin.Z || A.HitEndZ != B.HitEndZ || B.Cells.Min.X > A.Cells.Max.X) break;
+			if (A.Cells.Min.Y <= B.Cells.Max.Y && B.Cells.Min.Y <= A.Cells.Max.Y)
+			{
+				const int32 RootA = FindRoot(SweepOrder[SweepIdx]);
+				const int32 RootB = FindRoot(SweepOrder[NextIdx]);
+				Parents[FMath::Max(RootA, RootB)] = FMath::Min(RootA, RootB);
+			}
+		}
+	}
+
+	// The components are independent, their cells are laid end to end and traced in the same batches,
+	// so many small regions keep the workers as busy as one large region
+	struct FComponent
+	{
+		TArray<const FStartRegion*> Regions;
+		FIntRect Bounds;  // inclusive
+		int64 NumJ = 0;
+		int64 FirstCell = 0;
+	};
+	TArray<FComponent> Components;
+	TMap<int32, int32> RootToComponent;
+	for (int32 RegionIdx = 0; RegionIdx < Regions.Num(); RegionIdx++)
+	{
+		const FStartRegion& Region = Regions[RegionIdx];
+		const int32* Found = RootToComponent.Find(FindRoot(RegionIdx));
+		if (!Found)
+		{
+			// in the order of the first start of each component
+			RootToComponent.Add(FindRoot(RegionIdx), Components.Num());
+			FComponent& Component = Components.AddDefaulted_GetRef();
+			Component.Bounds = Region.Cells;
+			Component.Regions.Add(&Region);
+			continue;
+		}
+		FComponent& Component = Components[*Found];
+		Component.Bounds = FIntRect(
+			FIntPoint(FMath::Min(Component.Bounds.Min.X, Region.Cells.Min.X), FMath::Min(Component.Bounds.Min.Y, Region.Cells.Min.Y)),
+			FIntPoint(FMath::Max(Component.Bounds.Max.X, Region.Cells.Max.X), FMath::Max(Component.Bounds.Max.Y, Region.Cells.Max.Y)));
+		Component.Regions.Add(&Region);
+	}
+	int64 NumCells = 0;
+	TArray<int64> ComponentEnds;
+	for (FComponent& Component : Components)
+	{
+		const int64 NumI = FMath::Max(Component.Bounds.Max.X - Component.Bounds.Min.X + 1, 0);
+		Component.NumJ = FMath::Max(Component.Bounds.Max.Y - Component.Bounds.Min.Y + 1, 0);
+		Component.FirstCell = NumCells;
+		NumCells += NumI * Component.NumJ;
+		ComponentEnds.Add(NumCells);
+	}
+
+	TArray<TOptional<FXFGridScanCell>> BatchCells;
+	for (int64 BatchStart = 0; BatchStart < NumCells; BatchStart += GridScanBatchSize)
+	{
+		const int32 NumBatchCells = (int32)FMath::Min(GridScanBatchSize, NumCells - BatchStart);
+		BatchCells.Reset();
+		BatchCells.SetNum(NumBatchCells);
+
+		ParallelFor(FMath::DivideAndRoundUp(NumBatchCells, GridScanChunkSize), [&](int32 ChunkIdx)
+		{
+			TRACE_CPUPROFILER_EVENT_SCOPE(XF_SceneSweepChunk);
+			const int32 End = FMath::Min((ChunkIdx + 1) * GridScanChunkSize, NumBatchCells);
+			int32 ComponentIdx = Algo::UpperBound(ComponentEnds, BatchStart + ChunkIdx * GridScanChunkSize);
+			for (int32 Idx = ChunkIdx * GridScanChunkSize; Idx < End; Idx++)
+			{
+				const int64 GlobalCellIdx = BatchStart + Idx;
+				while (GlobalCellIdx >= ComponentEnds[ComponentIdx]) ComponentIdx++;
+				const FComponent& Component = Components[ComponentIdx];
+				const int64 CellIdx = GlobalCellIdx - Component.FirstCell;
+				const FIntPoint CellCoord(
+					Component.Bounds.Min.X + (int32)(CellIdx / Component.NumJ),
+					Component.Bounds.Min.Y + (int32)(CellIdx % Component.NumJ));
+
+				TArray<int32, TInlineAllocator<8>> CellRegions;
+				for (int32 RegionIdx = 0; RegionIdx < Component.Regions.Num(); RegionIdx++)
+				{
+					const FIntRect& RegionCells = Component.Regions[RegionIdx]->Cells;
+					if (RegionCells.Min.X <= CellCoord.X && CellCoord.X <= RegionCells.Max.X &&
+						RegionCells.Min.Y <= CellCoord.Y && CellCoord.Y <= RegionCells.Max.Y)
+					{
+						CellRegions.Add(RegionIdx);
+					}
 				}
-				else if (bIsAroundOrigin && bIsWithinBorder)
+				if (CellRegions.Num() == 0)
 				{
-					;	// pass
+					continue;
 				}
-				else
+
+				const FStartRegion* FirstRegion = Component.Regions[0];
+				const FVector Start = FVector(DeltaStep * CellCoord.X, DeltaStep * CellCoord.Y, FirstRegion->Origin.Z);
+				FXFGridScanCell Cell;
+				if (!TraceGridCell(WorldContext, Start, FirstRegion->HitEndZ, BoxHalfSize, Cell, Cache.Get()))
 				{
-					// Hit nowhere, maybe outside the world or the border
-					//
-					NotHitCount++;
-					if (NotHitCount > 2)
+					continue;
+				}
+
+				// The visibility depends on the origin of each start
+				for (const int32 RegionIdx : CellRegions)
+				{
+					const FStartRegion* Region = Component.Regions[RegionIdx];
+					Cell.StartIndices.Add(Region->StartIndex);
+					FHitResult VisTestHitResult;
+					if (TestVisible(WorldContext, Start, Region->Origin, VisTestHitResult))
 					{
-						NotHitCount = 0;
-						NotHitRowCount++;
-						if (NotHitRowCount > 2)
-							break;
-						// Next x location
-						i++;
-						j = 0;
-						continue;
+						Cell.VisibleStartIndices.Add(Region->StartIndex);
 					}
 				}
-				// Next y location
-				j++;
+				Cell.bIsVisible = Cell.VisibleStartIndices.Num() > 0;
+				BatchCells[Idx] = MoveTemp(Cell);
 			}
+		});
+
+		TArray<FXFGridScanCell> Cells;
+		for (TOptional<FXFGridScanCell>& Cell : BatchCells)
+		{
+			if (Cell.IsSet()) Cells.Add(MoveTemp(Cell.GetValue()));
 		}
+		OnBatch(MoveTemp(Cells));
+	}
+
+	if (Cache)
+	{
+		Cache->Save();
 	}
-	SaveTextToFile(HitBoxesInfo, PathToSaveResults);
-	GEngine->AddOnScreenDebugMessage(
-		-1, 100.0, FColor::Green, TEXT("Trace Done!"));
 }
 
 
@@ -926,9 +1721,11 @@ void UXF_BlueprintFunctionLibrary::DivideSceneViaBoxTraceBatch(
 	float MinYExtend,
 	float ZExtend,
 	FString PathToSaveResults,
-	bool VisualizeBoxes
+	bool VisualizeBoxes,
+	bool MergeOverlappingStarts
 )
 {
+	XF_SCOPE_STAGE(SceneSweep);
 	// Parse the save path
 	FString PathToSaveStem = PathToSaveResults.TrimStartAndEnd();
 	FString PathToSaveSuffix = TEXT("");
@@ -942,6 +1739,68 @@ void UXF_BlueprintFunctionLibrary::DivideSceneViaBoxTraceBatch(
 	{
 		PathToSaveSuffix = TEXT(".") + PathToSaveSuffix;
 	}
+
+	if (MergeOverlappingStarts)
+	{
+		if (!EnableTrace)
+		{
+			return;
+		}
+
+		// One file per start as before, the shared cells are written to the file of every start they belong to
+		TArray<TUniquePtr<FXFHitBoxesWriter>> Writers;
+		for (int i=0; i != StartPoints.Num(); i++)
+		{
+			const FVector Origin = StartPoints[i] + FVector(0, 0, 2000.0);
+			const float PointHitEndZ = StartPoints[i].Z - ZExtend;
+			const auto PathToSave = PathToSaveStem + FString::Printf(TEXT("%03d%s"), i+1, *PathToSaveSuffix);
+			TUniquePtr<FXFHitBoxesWriter>& Writer = Writers.Add_GetRef(MakeUnique<FXFHitBoxesWriter>(PathToSave));
+			if (!Writer->IsValid())
+			{
+				UE_LOG(LogXF, Error, TEXT("Failed to open %s to save the hit boxes"), *PathToSave);
+				return;
+			}
+			Writer->AddRow(TEXT("actor_name,x,y,z,materials,visible\n"));
+			Writer->AddRow(TEXT("BoxHalfSize,DeltaStep,CenterX,CenterY,CenterZ,HitEndZ\n"));
+			Writer->AddRow(FString::Printf(
+				TEXT("%d,%f,%f,%f,%f,%f\n"),
+				BoxHalfSize, (float)BoxHalfSize, Origin.X, Origin.Y, Origin.Z, PointHitEndZ));
+		}
+
+		UWorld* World = WorldContext->GetWorld();
+		const FVector HitBoxHalfExtend = FVector(BoxHalfSize, BoxHalfSize, BoxHalfSize);
+		int32 NumHitBoxes = 0;
+		ScanSceneGridMultiStartBatched(
+			WorldContext,
+			[&](TArray<FXFGridScanCell>&& Cells)
+			{
+				for (const FXFGridScanCell& Cell : Cells)
+				{
+					for (const int32 StartIndex : Cell.StartIndices)
+					{
+						Writers[StartIndex]->AddRow(FString::Printf(
+							TEXT("%s,%f,%f,%f,%s,%d\n"),
+							*Cell.ActorName,
+							Cell.Location.X, Cell.Location.Y, Cell.Location.Z,
+							TEXT(""),
+							Cell.VisibleStartIndices.Contains(StartIndex) ? 1 : 0));
+					}
+					if (VisualizeBoxes)
+					{
+						DrawDebugBox(
+							World, Cell.Location - FVector(0, 0, HitBoxHalfExtend.Z), HitBoxHalfExtend,
+							FColor::Green, true);
+					}
+				}
+				NumHitBoxes += Cells.Num();
+				for (TUniquePtr<FXFHitBoxesWriter>& Writer : Writers) Writer->Flush();
+			},
+			StartPoints, BoxHalfSize, MaxXExtend, MinXExtend, MaxYExtend, MinYExtend, ZExtend);
+
+		UE_LOG(LogXF, Log, TEXT("Traced %d hit boxes for %d starts"), NumHitBoxes, StartPoints.Num());
+		return;
+	}
+
 	for (int i=0; i != StartPoints.Num(); i++)
 	{
 		auto Point = StartPoints[i];
@@ -1003,6 +1862,57 @@ bool UXF_BlueprintFunctionLibrary::TestInside(const UObject* WorldContext, const
 }
 
 
+bool UXF_BlueprintFunctionLibrary::TestInsideCached(const UObject* WorldContext, const FVector LocStart,
+	const float Extend, FVector& HitLocation, FString& ActorName)
+{
+	const TSharedPtr<FXFSceneCellCache, ESPMode::ThreadSafe> Cache = FXFSceneCellCache::Get(WorldContext->GetWorld());
+	const FXFSceneCellKey CacheKey = FXFSceneCellKey::Inside(LocStart, Extend);
+	FXFSceneCellValue Value;
+	if (Cache && Cache->Find(CacheKey, Value))
+	{
+		HitLocation = Value.Location;
+		ActorName = Value.ActorName;
+		return Value.bIsHit;
+	}
+
+	FHitResult UpHitResult;
+	Value.bIsHit = TestInside(WorldContext, LocStart, Extend, UpHitResult);
+	if (Value.bIsHit)
+	{
+		Value.Location = UpHitResult.Location;
+		Value.ActorName = UpHitResult.GetActor() ? UpHitResult.GetActor()->GetName() : FString();
+	}
+	if (Cache)
+	{
+		Cache->Add(CacheKey, Value);
+	}
+	HitLocation = Value.Location;
+	ActorName = Value.ActorName;
+	return Value.bIsHit;
+}
+
+
+void UXF_BlueprintFunctionLibrary::EnableSceneCellCache(bool bEnable)
+{
+	FXFSceneCellCache::SetEnabled(bEnable);
+}
+
+
+void UXF_BlueprintFunctionLibrary::SaveSceneCellCache(const UObject* WorldContext)
+{
+	if (const TSharedPtr<FXFSceneCellCache, ESPMode::ThreadSafe> Cache = FXFSceneCellCache::Get(WorldContext->GetWorld()))
+	{
+		Cache->Save();
+	}
+}
+
+
+void UXF_BlueprintFunctionLibrary::ClearSceneCellCache(const UObject* WorldContext)
+{
+	FXFSceneCellCache::Clear(WorldContext->GetWorld());
+}
+
+
 // Check if a point is blocked
 bool UXF_BlueprintFunctionLibrary::TestVisible(const UObject* WorldContext, const FVector TestLoc,
 	const FVector CamLoc, FHitResult& OutHitResult)
@@ -1017,7 +1927,18 @@ bool UXF_BlueprintFunctionLibrary::TestVisible(const UObject* WorldContext, cons
 bool UXF_BlueprintFunctionLibrary::GetCameraVisualCenterLocation(const UObject* WorldContext,
 	const FVector CameraLoc, const FRotator CameraRot, FVector& CenterLoc, bool& bIsHit)
 {
+	XF_SCOPE_STAGE(SceneSweep);
 	UWorld* World = WorldContext->GetWorld();
+	const TSharedPtr<FXFSceneCellCache, ESPMode::ThreadSafe> Cache = FXFSceneCellCache::Get(World);
+	const FXFSceneCellKey CacheKey = FXFSceneCellKey::CameraRay(CameraLoc, CameraRot);
+	FXFSceneCellValue Cached;
+	if (Cache && Cache->Find(CacheKey, Cached))
+	{
+		bIsHit = Cached.bIsHit;
+		CenterLoc = Cached.Location;
+		return bIsHit;
+	}
+
 	FHitResult HitRes;
 	const FVector HitEnd = CameraRot.RotateVector(FVector(10000, 0, 0)) + CameraLoc;
 
@@ -1032,6 +1953,13 @@ bool UXF_BlueprintFunctionLibrary::GetCameraVisualCenterLocation(const UObject*
 	{
 		CenterLoc = FVector(0, 0, 0);
 	}
+	if (Cache)
+	{
+		Cached.bIsHit = bIsHit;
+		Cached.Location = CenterLoc;
+		Cached.ActorName = bIsHit && HitRes.GetActor() ? HitRes.GetActor()->GetName() : FString();
+		Cache->Add(CacheKey, Cached);
+	}
 	UE_LOG(LogTemp, Warning,
 		   TEXT("HitLoc: (%f, %f, %f) (%d)"),
 		   CenterLoc.X, CenterLoc.Y, CenterLoc.Z, bIsHit);
@@ -0,0 +1,216 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "XF_ChunkedFile.h"
+#include "XF_Stats.h"
+#include "XF_BlueprintFunctionLibrary.h"
+#include "Misc/Paths.h"
+
+
+FXFChunkedFileWriter::FXFChunkedFileWriter(const FString& InPath, int32 InFrameCapacity, int32 InElementComponents, bool bInKeepExisting)
+	: Path(InPath)
+	, bKeepExisting(bInKeepExisting)
+{
+	Header.FrameCapacity = FMath::Max(InFrameCapacity, 1);
+	Header.ElementComponents = FMath::Max(InElementComponents, 1);
+}
+
+FXFChunkedFileWriter::~FXFChunkedFileWriter()
+{
+	Close();
+}
+
+bool FXFChunkedFileWriter::OpenExisting(uint32 RecordStride, uint32 DataType, int32 FirstFrameNumber)
+{
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	if (!PlatformFile.FileExists(*Path)) return false;
+
+	// append without truncating, the records are written in place
+	FileHandle.Reset(PlatformFile.OpenWrite(*Path, true, true));
+	FXFChunkedFileHeader Existing;
+	if (!FileHandle.IsValid() || !FileHandle->Seek(0) || !FileHandle->Read((uint8*)&Existing, sizeof(FXFChunkedFileHeader)))
+	{
+		FileHandle.Reset();
+		return false;
+	}
+	if (Existing.Magic != FXFChunkedFileHeader::MagicValue || Existing.Version != FXFChunkedFileHeader::CurrentVersion
+		|| Existing.RecordStride != RecordStride || Existing.DataType != DataType || Existing.ElementComponents != Header.ElementComponents
+		|| FileHandle->Size() < (int64)(Existing.DataOffset + (uint64)Existing.FrameCapacity * Existing.RecordStride))
+	{
+		UE_LOG(LogXF, Warning, TEXT("%s has another layout than the records of this render, it's written again"), *Path);
+		FileHandle.Reset();
+		return false;
+	}
+
+	FrameIndex.SetNumUninitialized(Existing.FrameCapacity);
+	if (!FileHandle->Seek(Existing.IndexOffset) || !FileHandle->Read((uint8*)FrameIndex.GetData(), FrameIndex.Num() * sizeof(int32)))
+	{
+		UE_LOG(LogXF, Warning, TEXT("Failed to read the frame index of %s, it's written again"), *Path);
+		FileHandle.Reset();
+		return false;
+	}
+
+	SlotOffset = FirstFrameNumber - Existing.FirstFrameNumber;
+	Header = Existing;
+	// the frames of an interrupted render may be written without the header being updated
+	Header.FramesWritten = 0;
+	for (int32 Frame : FrameIndex)
+	{
+		if (Frame >= 0) Header.FramesWritten++;
+	}
+	UE_LOG(LogXF, Log, TEXT("Resuming %s, %u frames already written"), *Path, Header.FramesWritten);
+	return true;
+}
+
+bool FXFChunkedFileWriter::Open(uint32 RecordStride, uint32 DataType, int32 FirstFrameNumber)
+{
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+	if (!UXF_BlueprintFunctionLibrary::EnsureDirectoryTree(FPaths::GetPath(Path)))
+	{
+		UE_LOG(LogXF, Error, TEXT("Failed to create directory for %s"), *Path);
+		return false;
+	}
+
+	FileHandle.Reset(PlatformFile.OpenWrite(*Path, false, true));
+	if (!FileHandle.IsValid())
+	{
+		UE_LOG(LogXF, Error, TEXT("Failed to open %s for writing"), *Path);
+		return false;
+	}
+
+	const uint32 ValueSize = DataType == 0 ? sizeof(float) : sizeof(uint8);
+	Header.DataType = DataType;
+	Header.ElementCount = RecordStride / ValueSize / Header.ElementComponents;
+	Header.RecordStride = RecordStride;
+	Header.IndexOffset = sizeof(FXFChunkedFileHeader);
+	// align records to 64 bytes, so a memory-mapped view is aligned for any dtype
+	Header.DataOffset = Align(Header.IndexOffset + (uint64)Header.FrameCapacity * sizeof(int32), 64);
+	Header.FramesWritten = 0;
+	Header.FirstFrameNumber = FirstFrameNumber;
+	SlotOffset = 0;
+
+	// preallocate the whole file, then fill the index with empty slots
+	const int64 FileSize = Header.DataOffset + (uint64)Header.FrameCapacity * Header.RecordStride;
+	FileHandle->Truncate(FileSize);
+
+	FrameIndex.Init(-1, Header.FrameCapacity);
+	bool bSuccess = FileHandle->Seek(0);
+	bSuccess &= FileHandle->Write((const uint8*)&Header, sizeof(FXFChunkedFileHeader));
+	bSuccess &= FileHandle->Seek(Header.IndexOffset);
+	bSuccess &= FileHandle->Write((const uint8*)FrameIndex.GetData(), FrameIndex.Num() * sizeof(int32));
+	FXFStats::AddFileWrite(sizeof(FXFChunkedFileHeader) + FrameIndex.Num() * sizeof(int32), true);
+	if (!bSuccess)
+	{
+		UE_LOG(LogXF, Error, TEXT("Failed to preallocate %s"), *Path);
+		FileHandle.Reset();
+		return false;
+	}
+	return true;
+}
+
+bool FXFChunkedFileWriter::PrepareRecord(int32& Slot, int32 FrameNumber, uint32 RecordStride, uint32 DataType)
+{
+	if (bFailed) return false;
+
+	if (!FileHandle.IsValid())
+	{
+		const uint32 ValueSize = DataType == 0 ? sizeof(float) : sizeof(uint8);
+		if (RecordStride == 0 || RecordStride % (ValueSize * Header.ElementComponents) != 0)
+		{
+			UE_LOG(LogXF, Error, TEXT("Invalid record size %u bytes for %s"), RecordStride, *Path);
+			return false;
+		}
+		// the frame number of slot 0 of this render
+		const int32 FirstFrameNumber = FrameNumber - Slot;
+		if (!(bKeepExisting && OpenExisting(RecordStride, DataType, FirstFrameNumber)) && !Open(RecordStride, DataType, FirstFrameNumber))
+		{
+			bFailed = true;
+			return false;
+		}
+	}
+
+	Slot += SlotOffset;
+	if (Slot < 0 || Slot >= (int32)Header.FrameCapacity)
+	{
+		UE_LOG(LogXF, Error, TEXT("Frame slot %d out of range [0, %d) for %s"), Slot, Header.FrameCapacity, *Path);
+		return false;
+	}
+	if (RecordStride != Header.RecordStride || DataType != Header.DataType)
+	{
+		UE_LOG(LogXF, Error, TEXT("Record size changed from %u to %u bytes in %s"), Header.RecordStride, RecordStride, *Path);
+		return false;
+	}
+	return FileHandle->Seek(Header.DataOffset + (uint64)Slot * Header.RecordStride);
+}
+
+bool FXFChunkedFileWriter::WriteIndex(int32 Slot, int32 FrameNumber)
+{
+	bool bSuccess = FileHandle->Seek(Header.IndexOffset + (uint64)Slot * sizeof(int32));
+	bSuccess &= FileHandle->Write((const uint8*)&FrameNumber, sizeof(int32));
+	if (bSuccess)
+	{
+		// a frame rendered again overwrites its slot
+		if (FrameIndex[Slot] < 0)
+		{
+			Header.FramesWritten++;
+		}
+		FrameIndex[Slot] = FrameNumber;
+		FXFStats::AddFileWrite(Header.RecordStride + sizeof(int32), false);
+	}
+	return bSuccess;
+}
+
+bool FXFChunkedFileWriter::WriteRecord(int32 Slot, int32 FrameNumber, const float* Data, int32 NumFloats)
+{
+	XF_SCOPE_STAGE(FileWrite);
+	if (!PrepareRecord(Slot, FrameNumber, NumFloats * sizeof(float), 0)) return false;
+	if (!FileHandle->Write((const uint8*)Data, Header.RecordStride)) return false;
+	return WriteIndex(Slot, FrameNumber);
+}
+
+bool FXFChunkedFileWriter::WriteRecord(int32 Slot, int32 FrameNumber, TArrayView<const FVector> Vectors)
+{
+	XF_SCOPE_STAGE(FileWrite);
+#if ENGINE_MAJOR_VERSION == 5
+	if (!PrepareRecord(Slot, FrameNumber, Vectors.Num() * 3 * sizeof(float), 0)) return false;
+
+	constexpr int32 ChunkSize = 1024;
+	FVector3f Chunk[ChunkSize];
+	for (int32 Start = 0; Start < Vectors.Num(); Start += ChunkSize)
+	{
+		const int32 Num = FMath::Min(ChunkSize, Vectors.Num() - Start);
+		for (int32 Idx = 0; Idx < Num; Idx++)
+		{
+			Chunk[Idx] = FVector3f(Vectors[Start + Idx]);
+		}
+		if (!FileHandle->Write((const uint8*)Chunk, Num * sizeof(FVector3f))) return false;
+	}
+	return WriteIndex(Slot, FrameNumber);
+#else
+	return WriteRecord(Slot, FrameNumber, (const float*)Vectors.GetData(), Vectors.Num() * 3);
+#endif
+}
+
+bool FXFChunkedFileWriter::WriteBytesRecord(int32 Slot, int32 FrameNumber, TArrayView<const uint8> Bytes, int32 RecordStride)
+{
+	XF_SCOPE_STAGE(FileWrite);
+	if (Bytes.Num() > RecordStride)
+	{
+		UE_LOG(LogXF, Error, TEXT("Record of %d bytes doesn't fit the stride of %d bytes in %s"), Bytes.Num(), RecordStride, *Path);
+		return false;
+	}
+	if (!PrepareRecord(Slot, FrameNumber, RecordStride, 1)) return false;
+	// the rest of the stride is left as preallocated
+	if (!FileHandle->Write(Bytes.GetData(), Bytes.Num())) return false;
+	return WriteIndex(Slot, FrameNumber);
+}
+
+void FXFChunkedFileWriter::Close()
+{
+	if (!FileHandle.IsValid()) return;
+
+	FileHandle->Seek(0);
+	FileHandle->Write((const uint8*)&Header, sizeof(FXFChunkedFileHeader));
+	FileHandle->Flush();
+	FileHandle.Reset();
+}
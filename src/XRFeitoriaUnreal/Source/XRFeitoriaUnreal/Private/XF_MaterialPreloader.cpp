@@ -0,0 +1,70 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "XF_MaterialPreloader.h"
+#include "XF_BlueprintFunctionLibrary.h"
+#include "Engine/StreamableManager.h"
+#include "Materials/MaterialInterface.h"
+
+static TUniquePtr<FStreamableManager> GXFStreamableManager;
+static TMap<FSoftObjectPath, TSharedPtr<FStreamableHandle>> GXFMaterialHandles;
+
+/** Compile the shaders of the material in the background, before the first frame of the pass needs them. */
+static void WarmUpShaders(FSoftObjectPath MaterialPath)
+{
+	UMaterialInterface* Material = Cast<UMaterialInterface>(MaterialPath.ResolveObject());
+	if (!Material)
+	{
+		UE_LOG(LogXF, Warning, TEXT("Failed to preload the material %s"), *MaterialPath.ToString());
+		return;
+	}
+#if ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION >= 1
+	Material->CacheShaders(EMaterialShaderPrecompileMode::Background);
+#endif
+	// UE4 and UE5.0 cache the shaders for rendering when the material is loaded
+}
+
+void FXFMaterialPreloader::Preload(const TArray<FSoftObjectPath>& MaterialPaths)
+{
+	check(IsInGameThread());
+	if (!GXFStreamableManager.IsValid())
+	{
+		GXFStreamableManager = MakeUnique<FStreamableManager>();
+	}
+
+	for (const FSoftObjectPath& MaterialPath : MaterialPaths)
+	{
+		if (MaterialPath.IsNull() || GXFMaterialHandles.Contains(MaterialPath)) continue;
+
+		// the handle holds the material once loaded, already loaded ones complete immediately
+		TSharedPtr<FStreamableHandle> Handle = GXFStreamableManager->RequestAsyncLoad(
+			MaterialPath, FStreamableDelegate::CreateStatic(&WarmUpShaders, MaterialPath), FStreamableManager::AsyncLoadHighPriority);
+		if (Handle.IsValid())
+		{
+			GXFMaterialHandles.Add(MaterialPath, Handle);
+		}
+	}
+}
+
+void FXFMaterialPreloader::WaitFor(const TArray<FSoftObjectPath>& MaterialPaths)
+{
+	check(IsInGameThread());
+	for (const FSoftObjectPath& MaterialPath : MaterialPaths)
+	{
+		const TSharedPtr<FStreamableHandle>* Handle = GXFMaterialHandles.Find(MaterialPath);
+		if (Handle && (*Handle)->IsLoadingInProgress())
+		{
+			(*Handle)->WaitUntilComplete();
+		}
+	}
+}
+
+void FXFMaterialPreloader::Release()
+{
+	for (TPair<FSoftObjectPath, TSharedPtr<FStreamableHandle>>& Handle : GXFMaterialHandles)
+	{
+		Handle.Value->ReleaseHandle();
+	}
+	GXFMaterialHandles.Empty();
+	GXFStreamableManager.Reset();
+}
@@ -0,0 +1,104 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "XF_MeshProjection.h"
+#include "XF_Stats.h"
+#include "Camera/CameraActor.h"
+#include "Camera/CameraComponent.h"
+#include "Async/ParallelFor.h"
+
+
+FXFCameraProjection::FXFCameraProjection(const ACameraActor* Camera, const FIntPoint& InResolution)
+	: CameraLocation(Camera->GetActorLocation())
+	, WorldToCamera(Camera->GetActorRotation().Quaternion().Inverse())
+	, Resolution(InResolution)
+{
+	const float FOV = Camera->GetCameraComponent()->FieldOfView;
+	FocalLength = Resolution.X * 0.5 / FMath::Tan(FMath::DegreesToRadians(FOV) * 0.5);
+}
+
+void FXFCameraProjection::ProjectKeypoints(TArrayView<const FVector> Points, TArray<float>& OutRecords) const
+{
+	XF_SCOPE_STAGE(Projection);
+	const int32 Offset = OutRecords.Num();
+	OutRecords.AddUninitialized(Points.Num() * KeypointComponents);
+	float* Out = OutRecords.GetData() + Offset;
+
+	for (const FVector& Point : Points)
+	{
+		FVector2D Pixel;
+		EXFKeypointFlag Flag = EXFKeypointFlag::BehindCamera;
+		if (Project(Point, Pixel))
+		{
+			const bool bIsInside = Pixel.X >= 0 && Pixel.Y >= 0 && Pixel.X < Resolution.X && Pixel.Y < Resolution.Y;
+			Flag = bIsInside ? EXFKeypointFlag::InsideImage : EXFKeypointFlag::OutsideImage;
+		}
+		else
+		{
+			Pixel = FVector2D::ZeroVector;
+		}
+		*Out++ = Pixel.X;
+		*Out++ = Pixel.Y;
+		*Out++ = (float)Flag;
+	}
+}
+
+void FXFCameraProjection::ComputeBoundingBox2D(TArrayView<const FVector> Points, TArray<float>& OutRecord) const
+{
+	XF_SCOPE_STAGE(Projection);
+	struct FChunkBox
+	{
+		FVector2D Min = FVector2D(TNumericLimits<float>::Max(), TNumericLimits<float>::Max());
+		FVector2D Max = FVector2D(TNumericLimits<float>::Lowest(), TNumericLimits<float>::Lowest());
+		int32 NumInside = 0;
+	};
+
+	constexpr int32 ChunkSize = 4096;
+	const int32 NumChunks = FMath::DivideAndRoundUp(Points.Num(), ChunkSize);
+	TArray<FChunkBox> ChunkBoxes;
+	ChunkBoxes.SetNum(NumChunks);
+	ParallelFor(NumChunks, [&](int32 ChunkIdx)
+	{
+		FChunkBox& Box = ChunkBoxes[ChunkIdx];
+		const int32 End = FMath::Min((ChunkIdx + 1) * ChunkSize, Points.Num());
+		for (int32 Idx = ChunkIdx * ChunkSize; Idx < End; Idx++)
+		{
+			FVector2D Pixel;
+			if (!Project(Points[Idx], Pixel)) continue;
+			Box.Min = FVector2D::Min(Box.Min, Pixel);
+			Box.Max = FVector2D::Max(Box.Max, Pixel);
+			Box.NumInside += Pixel.X >= 0 && Pixel.Y >= 0 && Pixel.X < Resolution.X && Pixel.Y < Resolution.Y;
+		}
+	}, NumChunks > 1 ? EParallelForFlags::None : EParallelForFlags::ForceSingleThread);
+
+	FChunkBox Box;
+	for (const FChunkBox& Chunk : ChunkBoxes)
+	{
+		Box.Min = FVector2D::Min(Box.Min, Chunk.Min);
+		Box.Max = FVector2D::Max(Box.Max, Chunk.Max);
+		Box.NumInside += Chunk.NumInside;
+	}
+
+	if (Box.NumInside == 0)
+	{
+		OutRecord.AddZeroed(BoundingBox2DComponents);
+		return;
+	}
+	OutRecord.Add(FMath::Clamp<float>(Box.Min.X, 0.f, Resolution.X));
+	OutRecord.Add(FMath::Clamp<float>(Box.Min.Y, 0.f, Resolution.Y));
+	OutRecord.Add(FMath::Clamp<float>(Box.Max.X, 0.f, Resolution.X));
+	OutRecord.Add(FMath::Clamp<float>(Box.Max.Y, 0.f, Resolution.Y));
+	OutRecord.Add((float)Box.NumInside / Points.Num());
+}
+
+void FXFCameraProjection::ComputeBoundingBox3D(TArrayView<const FVector> Points, TArray<float>& OutRecord)
+{
+	XF_SCOPE_STAGE(Projection);
+	const FBox Box(Points.GetData(), Points.Num());
+	OutRecord.Add(Box.Min.X);
+	OutRecord.Add(Box.Min.Y);
+	OutRecord.Add(Box.Min.Z);
+	OutRecord.Add(Box.Max.X);
+	OutRecord.Add(Box.Max.Y);
+	OutRecord.Add(Box.Max.Z);
+}
@@ -0,0 +1,241 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "XF_OcclusionQuery.h"
+#include "XF_Stats.h"
+#include "Engine/World.h"
+#include "WorldCollision.h"
+#include "ImagePixelData.h"
+#include "Async/ParallelFor.h"
+
+
+struct FXFAsyncOcclusionQuery::FRequest
+{
+	TWeakObjectPtr<UWorld> World;
+	FVector CameraLocation;
+	TArray<FVector> Points;
+	FName MeshName;
+	float MeshThickness = 5.f;
+
+	TArray<EOcclusion> Occlusion;
+	TBitArray<> bTraced;
+	int32 NumTraced = 0;
+
+	/** Shared by all the traces of the request, a trace is identified by its UserData (the point index). */
+	FTraceDelegate TraceDelegate;
+	FOnOcclusionComplete OnComplete;
+
+	bool IsComplete() const { return NumTraced == Points.Num(); }
+};
+
+
+FXFAsyncOcclusionQuery::~FXFAsyncOcclusionQuery()
+{
+	// the traces still in flight hold weak pointers only, their results are dropped
+	Pending.Empty();
+}
+
+void FXFAsyncOcclusionQuery::Request(
+	UWorld* World,
+	const FVector& CameraLocation,
+	TArray<FVector>&& Points,
+	FName MeshName,
+	float MeshThickness,
+	FOnOcclusionComplete&& OnComplete)
+{
+	check(IsInGameThread());
+	check(World);
+
+	TSharedPtr<FRequest> Request = MakeShared<FRequest>();
+	Request->World = World;
+	Request->CameraLocation = CameraLocation;
+	Request->Points = MoveTemp(Points);
+	Request->MeshName = MeshName;
+	Request->MeshThickness = MeshThickness;
+	Request->Occlusion.Init(EOcclusion::NonOcclusion, Request->Points.Num());
+	Request->bTraced.Init(false, Request->Points.Num());
+	Request->OnComplete = MoveTemp(OnComplete);
+
+	TWeakPtr<FRequest> WeakRequest = Request;
+	Request->TraceDelegate.BindLambda([WeakRequest](const FTraceHandle& Handle, FTraceDatum& Datum)
+	{
+		TSharedPtr<FRequest> Request = WeakRequest.Pin();
+		const int32 Idx = (int32)Datum.UserData;
+		if (!Request.IsValid() || !Request->bTraced.IsValidIndex(Idx) || Request->bTraced[Idx])
+		{
+			return;
+		}
+		const bool IsHit = Datum.OutHits.Num() > 0 && Datum.OutHits[0].bBlockingHit;
+		Request->Occlusion[Idx] = UXF_BlueprintFunctionLibrary::GetOcclusionFromHitResult(
+			IsHit ? Datum.OutHits[0] : FHitResult(), Request->MeshName, (int)Request->MeshThickness, IsHit);
+		Request->bTraced[Idx] = true;
+		Request->NumTraced++;
+	});
+
+	// same query as UKismetSystemLibrary::LineTraceSingle on the visibility channel
+	const FCollisionQueryParams Params(SCENE_QUERY_STAT(XFAsyncOcclusion), true /* bTraceComplex */);
+	for (int32 Idx = 0; Idx < Request->Points.Num(); Idx++)
+	{
+		World->AsyncLineTraceByChannel(
+			EAsyncTraceType::Single,
+			CameraLocation,
+			Request->Points[Idx],
+			ECC_Visibility,
+			Params,
+			FCollisionResponseParams::DefaultResponseParam,
+			&Request->TraceDelegate,
+			(uint32)Idx
+		);
+	}
+
+	Pending.Add(MoveTemp(Request));
+}
+
+int32 FXFAsyncOcclusionQuery::Poll()
+{
+	XF_SCOPE_STAGE(Occlusion);
+	check(IsInGameThread());
+	for (int32 Idx = 0; Idx < Pending.Num();)
+	{
+		TSharedPtr<FRequest> Request = Pending[Idx];
+		if (!Request->IsComplete())
+		{
+			Idx++;
+			continue;
+		}
+
+		FXFOcclusionResult Result;
+		UXF_BlueprintFunctionLibrary::ComputeOcclusionRates(
+			Request->Occlusion, Result.NonOcclusionRate, Result.SelfOcclusionRate, Result.InterOcclusionRate);
+		Result.Occlusion = MoveTemp(Request->Occlusion);
+		Pending.RemoveAt(Idx);
+		Request->OnComplete(MoveTemp(Result));
+	}
+	return Pending.Num();
+}
+
+void FXFAsyncOcclusionQuery::Drain()
+{
+	check(IsInGameThread());
+	for (TSharedPtr<FRequest>& Request : Pending)
+	{
+		UWorld* World = Request->World.Get();
+		if (!World || Request->IsComplete())
+		{
+			continue;
+		}
+
+		// gather the points still waiting for the async traces, and trace them here
+		TArray<int32> Indices;
+		TArray<FVector> Points;
+		for (int32 Idx = 0; Idx < Request->Points.Num(); Idx++)
+		{
+			if (Request->bTraced[Idx]) continue;
+			Indices.Add(Idx);
+			Points.Add(Request->Points[Idx]);
+		}
+		TArray<EOcclusion> Occlusion;
+		Occlusion.SetNumUninitialized(Points.Num());
+		UXF_BlueprintFunctionLibrary::TraceOcclusion(
+			World, Request->CameraLocation, Points, Request->MeshName, Request->MeshThickness, Occlusion);
+
+		for (int32 Idx = 0; Idx < Indices.Num(); Idx++)
+		{
+			Request->Occlusion[Indices[Idx]] = Occlusion[Idx];
+			Request->bTraced[Indices[Idx]] = true;
+		}
+		Request->NumTraced = Request->Points.Num();
+	}
+
+	// requests of a destroyed world can't finish
+	Pending.RemoveAll([](const TSharedPtr<FRequest>& Request) { return !Request->World.IsValid(); });
+	Poll();
+}
+
+
+static FLinearColor ReadLinearPixel(const FImagePixelData* Data, int64 PixelIndex)
+{
+	const void* RawData = nullptr;
+	int64 SizeInBytes = 0;
+	Data->GetRawData(RawData, SizeInBytes);
+	switch (Data->GetType())
+	{
+	case EImagePixelType::Color: return ((const FColor*)RawData)[PixelIndex].ReinterpretAsLinear();
+	case EImagePixelType::Float16: return FLinearColor(((const FFloat16Color*)RawData)[PixelIndex]);
+	case EImagePixelType::Float32: return ((const FLinearColor*)RawData)[PixelIndex];
+	}
+	return FLinearColor::Black;
+}
+
+static FColor ReadColorPixel(const FImagePixelData* Data, int64 PixelIndex)
+{
+	if (Data->GetType() == EImagePixelType::Color)
+	{
+		const void* RawData = nullptr;
+		int64 SizeInBytes = 0;
+		Data->GetRawData(RawData, SizeInBytes);
+		FColor Color = ((const FColor*)RawData)[PixelIndex];
+		Color.A = 255;
+		return Color;
+	}
+	// the same sRGB conversion as the 8-bit mask images written by CustomMoviePipelineOutput
+	FColor Color = ReadLinearPixel(Data, PixelIndex).ToFColor(true);
+	Color.A = 255;
+	return Color;
+}
+
+void FXFDepthOcclusionView::ComputeOcclusion(TArrayView<const FVector> Points, int32 StencilValue, TArrayView<EOcclusion> Occlusion) const
+{
+	XF_SCOPE_STAGE(Occlusion);
+	check(IsValid());
+	check(Points.Num() == Occlusion.Num());
+
+	const FIntPoint Size = Depth->GetSize();
+	if (Mask->GetSize() != Size)
+	{
+		UE_LOG(LogXF, Error, TEXT("Depth (%dx%d) and mask (%dx%d) passes have different sizes."), Size.X, Size.Y, Mask->GetSize().X, Mask->GetSize().Y);
+		for (EOcclusion& Each : Occlusion) Each = EOcclusion::OutOfView;
+		return;
+	}
+
+	// camera space of unreal: x forward, y right, z up
+	const FQuat WorldToCamera = CameraRotation.Quaternion().Inverse();
+	const double FocalLength = Size.X * 0.5 / FMath::Tan(FMath::DegreesToRadians(FOV) * 0.5);
+	const double CenterX = Size.X * 0.5;
+	const double CenterY = Size.Y * 0.5;
+
+	constexpr int32 ChunkSize = 1024;
+	const int32 NumChunks = FMath::DivideAndRoundUp(Points.Num(), ChunkSize);
+	ParallelFor(NumChunks, [&](int32 ChunkIdx)
+	{
+		const int32 End = FMath::Min((ChunkIdx + 1) * ChunkSize, Points.Num());
+		for (int32 Idx = ChunkIdx * ChunkSize; Idx < End; Idx++)
+		{
+			const FVector Local = WorldToCamera.RotateVector(Points[Idx] - CameraLocation);
+			if (Local.X <= KINDA_SMALL_NUMBER)
+			{
+				Occlusion[Idx] = EOcclusion::OutOfView;
+				continue;
+			}
+			const int32 X = FMath::FloorToInt(CenterX + FocalLength * Local.Y / Local.X);
+			const int32 Y = FMath::FloorToInt(CenterY - FocalLength * Local.Z / Local.X);
+			if (X < 0 || Y < 0 || X >= Size.X || Y >= Size.Y)
+			{
+				Occlusion[Idx] = EOcclusion::OutOfView;
+				continue;
+			}
+
+			const int64 PixelIndex = (int64)Y * Size.X + X;
+			const float SceneDepth = ReadLinearPixel(Depth, PixelIndex).R * DepthUnitInCm;
+			if (Local.X <= SceneDepth + DepthTolerance)
+			{
+				Occlusion[Idx] = EOcclusion::NonOcclusion;
+				continue;
+			}
+
+			// something is in front of the point, find out who from the mask
+			const uint8* HitStencil = MaskColorToStencil->Find(ReadColorPixel(Mask, PixelIndex));
+			Occlusion[Idx] = (HitStencil && *HitStencil == StencilValue) ? EOcclusion::SelfOcclusion : EOcclusion::InterOcclusion;
+		}
+	});
+}
@@ -0,0 +1,153 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "XF_OutputPathCache.h"
+#include "XF_Stats.h"
+#include "MoviePipeline.h"
+#include "MovieRenderPipelineCoreModule.h"  // For logs
+#include "Misc/Paths.h"
+
+
+/** The arguments of ResolveFilenameFormatArguments that change every frame. */
+static const TCHAR* const FrameTokens[] = {
+	TEXT("frame_number"),
+	TEXT("frame_number_shot"),
+	TEXT("frame_number_rel"),
+	TEXT("frame_number_shot_rel"),
+};
+
+/** Only letters and underscores, so they go through the resolve untouched. */
+static FString GetPlaceholder(const TCHAR* Token)
+{
+	return FString::Printf(TEXT("__xf_%s__"), Token);
+}
+
+FString FXFOutputPathCache::Resolve(
+	const FString& FormatString,
+	const FString& RenderPass,
+	const FString& Ext,
+	const FMoviePipelineFrameOutputState* InOutputState,
+	int32 FrameNumberOffset,
+	EXFOutputPathFlags Flags)
+{
+	XF_SCOPE_STAGE(PathResolution);
+	check(Pipeline && InOutputState);
+
+	// the camera of a pass isn't known to the template
+	if (!EnumHasAnyFlags(Flags, EXFOutputPathFlags::ClearCameraName) && FormatString.Contains(TEXT("{camera_name}")))
+	{
+		return ResolveFull(FormatString, RenderPass, Ext, InOutputState, FrameNumberOffset, Flags);
+	}
+
+	if (InOutputState->ShotIndex != ShotIndex)
+	{
+		Reset();
+		ShotIndex = InOutputState->ShotIndex;
+	}
+
+	const FString Key = FString::Printf(TEXT("%s|%d"), *FormatString, (int32)Flags);
+	FTemplate* Template = Templates.Find(Key);
+	const bool bIsNew = Template == nullptr;
+	if (bIsNew)
+	{
+		FString TemplateFormat = FormatString;
+		for (const TCHAR* Token : FrameTokens)
+		{
+			TemplateFormat.ReplaceInline(*FString::Printf(TEXT("{%s}"), Token), *GetPlaceholder(Token));
+		}
+		Template = &Templates.Add(Key);
+		Template->Path = ResolveFull(TemplateFormat, GetPlaceholder(TEXT("render_pass")), GetPlaceholder(TEXT("ext")), InOutputState, 0, Flags);
+		Template->bIsValid = true;
+	}
+	if (!Template->bIsValid)
+	{
+		return ResolveFull(FormatString, RenderPass, Ext, InOutputState, FrameNumberOffset, Flags);
+	}
+
+	FString Path = Template->Path;
+	Path.ReplaceInline(*GetPlaceholder(TEXT("render_pass")), *RenderPass, ESearchCase::CaseSensitive);
+	Path.ReplaceInline(*GetPlaceholder(TEXT("ext")), *Ext, ESearchCase::CaseSensitive);
+	const TArray<FString>& FrameValues = GetFrameArguments(InOutputState, FrameNumberOffset);
+	for (int32 Idx = 0; Idx < UE_ARRAY_COUNT(FrameTokens); Idx++)
+	{
+		Path.ReplaceInline(*GetPlaceholder(FrameTokens[Idx]), *FrameValues[Idx], ESearchCase::CaseSensitive);
+	}
+	if (EnumHasAnyFlags(Flags, EXFOutputPathFlags::CollapseSlashes))
+	{
+		Path.ReplaceInline(TEXT("//"), TEXT("/"));
+	}
+
+	if (bIsNew)
+	{
+		// a format the template can't reproduce is resolved in full from now on
+		const FString FullPath = ResolveFull(FormatString, RenderPass, Ext, InOutputState, FrameNumberOffset, Flags);
+		if (FullPath != Path)
+		{
+			UE_LOG(LogMovieRenderPipelineIO, Verbose, TEXT("Output path template of '%s' gives '%s' instead of '%s', resolving it for every file."),
+				*FormatString, *Path, *FullPath);
+			Template->bIsValid = false;
+			return FullPath;
+		}
+	}
+	return Path;
+}
+
+void FXFOutputPathCache::Reset()
+{
+	ShotIndex = INDEX_NONE;
+	Templates.Empty();
+	OutputFrameNumber = INDEX_NONE;
+	FrameArguments.Empty();
+}
+
+FString FXFOutputPathCache::ResolveFull(const FString& FormatString, const FString& RenderPass, const FString& Ext,
+	const FMoviePipelineFrameOutputState* InOutputState, int32 FrameNumberOffset, EXFOutputPathFlags Flags) const
+{
+	FString OutputPath;
+	FMoviePipelineFormatArgs Args;
+	TMap<FString, FString> FormatOverrides;
+	if (EnumHasAnyFlags(Flags, EXFOutputPathFlags::ClearCameraName))
+	{
+		FormatOverrides.Add(TEXT("camera_name"), "");
+	}
+	FormatOverrides.Add(TEXT("render_pass"), RenderPass);
+	FormatOverrides.Add(TEXT("ext"), Ext);
+	Pipeline->ResolveFilenameFormatArguments(FormatString, FormatOverrides, OutputPath, Args, InOutputState, FrameNumberOffset);
+
+	if (!EnumHasAnyFlags(Flags, EXFOutputPathFlags::KeepRelative) && FPaths::IsRelative(OutputPath))
+	{
+		OutputPath = FPaths::ConvertRelativePathToFull(OutputPath);
+	}
+	if (EnumHasAnyFlags(Flags, EXFOutputPathFlags::CollapseSlashes))
+	{
+		// Replace any double slashes with single slashes.
+		OutputPath.ReplaceInline(TEXT("//"), TEXT("/"));
+	}
+	return OutputPath;
+}
+
+const TArray<FString>& FXFOutputPathCache::GetFrameArguments(const FMoviePipelineFrameOutputState* InOutputState, int32 FrameNumberOffset)
+{
+	if (InOutputState->OutputFrameNumber != OutputFrameNumber)
+	{
+		FrameArguments.Reset();
+		OutputFrameNumber = InOutputState->OutputFrameNumber;
+	}
+	if (const TArray<FString>* Values = FrameArguments.Find(FrameNumberOffset))
+	{
+		return *Values;
+	}
+
+	// an empty format only collects the arguments of the frame
+	FString Unused;
+	FMoviePipelineFormatArgs Args;
+	Pipeline->ResolveFilenameFormatArguments(FString(), TMap<FString, FString>(), Unused, Args, InOutputState, FrameNumberOffset);
+
+	TArray<FString>& Values = FrameArguments.Add(FrameNumberOffset);
+	for (const TCHAR* Token : FrameTokens)
+	{
+		const FString* Value = Args.FilenameArguments.Find(Token);
+		Values.Add(Value ? *Value : FString::Printf(TEXT("{%s}"), Token));
+	}
+	return Values;
+}
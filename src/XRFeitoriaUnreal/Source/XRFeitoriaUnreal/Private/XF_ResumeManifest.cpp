@@ -0,0 +1,262 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "XF_ResumeManifest.h"
+#include "XF_AsyncWriteQueue.h"
+#include "XF_BlueprintFunctionLibrary.h"
+#include "MoviePipelineRenderShardSetting.h"
+#include "MoviePipeline.h"
+#include "MoviePipelineOutputSetting.h"
+#include "MoviePipelineMasterConfig.h"
+#include "MoviePipelineQueue.h"
+#include "MovieRenderPipelineDataTypes.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Dom/JsonObject.h"
+#include "Serialization/JsonReader.h"
+#include "Serialization/JsonSerializer.h"
+
+
+static TMap<TWeakObjectPtr<UMoviePipeline>, TSharedRef<FXFResumeManifest, ESPMode::ThreadSafe>> GXFResumeManifests;
+
+TSharedRef<FXFResumeManifest, ESPMode::ThreadSafe> FXFResumeManifest::Get(UMoviePipeline* InPipeline)
+{
+	check(IsInGameThread());
+	check(InPipeline);
+
+	// drop the manifests of the finished pipelines
+	for (auto It = GXFResumeManifests.CreateIterator(); It; ++It)
+	{
+		if (!It->Key.IsValid()) It.RemoveCurrent();
+	}
+
+	if (const TSharedRef<FXFResumeManifest, ESPMode::ThreadSafe>* Manifest = GXFResumeManifests.Find(InPipeline))
+	{
+		return *Manifest;
+	}
+	TSharedRef<FXFResumeManifest, ESPMode::ThreadSafe> Manifest = MakeShared<FXFResumeManifest, ESPMode::ThreadSafe>();
+	Manifest->Pipeline = InPipeline;
+	GXFResumeManifests.Add(InPipeline, Manifest);
+	return Manifest;
+}
+
+void FXFResumeManifest::RegisterOutput(const UObject* Output)
+{
+	OutputFrames.Add(Output, INDEX_NONE);
+}
+
+void FXFResumeManifest::BeginFrame(const UObject* Output, const FMoviePipelineFrameOutputState& OutputState)
+{
+	check(IsInGameThread());
+	FindOrLoadShot(OutputState.ShotIndex);
+
+	OutputFrames.FindOrAdd(Output) = OutputState.OutputFrameNumber;
+	int32 SealedFrameNumber = MAX_int32;
+	for (const TPair<const UObject*, int32>& Pair : OutputFrames)
+	{
+		SealedFrameNumber = FMath::Min(SealedFrameNumber, Pair.Value);
+	}
+
+	{
+		FScopeLock ScopeLock(&Lock);
+		FFrameState& Frame = Frames.FindOrAdd(OutputState.OutputFrameNumber);
+		Frame.ShotIndex = OutputState.ShotIndex;
+		Frame.SourceFrameNumber = OutputState.SourceFrameNumber;
+
+		// every output has received the frames before SealedFrameNumber, and registered their writes
+		TArray<int32> Sealed;
+		for (TPair<int32, FFrameState>& Pair : Frames)
+		{
+			if (Pair.Key < SealedFrameNumber && !Pair.Value.bSealed)
+			{
+				Pair.Value.bSealed = true;
+				Sealed.Add(Pair.Key);
+			}
+		}
+		for (int32 OutputFrameNumber : Sealed)
+		{
+			TryComplete(OutputFrameNumber);
+		}
+	}
+	FlushIfDue();
+}
+
+bool FXFResumeManifest::IsFrameComplete(const FMoviePipelineFrameOutputState& OutputState)
+{
+	check(IsInGameThread());
+	const FShotState& Shot = FindOrLoadShot(OutputState.ShotIndex);
+	FScopeLock ScopeLock(&Lock);
+	return Shot.ResumedFrames.Contains(OutputState.SourceFrameNumber);
+}
+
+bool FXFResumeManifest::IsResumingShot(int32 ShotIndex)
+{
+	check(IsInGameThread());
+	const FShotState& Shot = FindOrLoadShot(ShotIndex);
+	FScopeLock ScopeLock(&Lock);
+	return Shot.ResumedFrames.Num() > 0;
+}
+
+TFuture<bool> FXFResumeManifest::Track(TFuture<bool>&& Future, const FMoviePipelineFrameOutputState& OutputState)
+{
+	BeginWrite(OutputState);
+	const int32 OutputFrameNumber = OutputState.OutputFrameNumber;
+	return Future.Next([Manifest = AsShared(), OutputFrameNumber](bool bSuccess)
+	{
+		Manifest->EndWrite(OutputFrameNumber, bSuccess);
+		return bSuccess;
+	});
+}
+
+void FXFResumeManifest::BeginWrite(const FMoviePipelineFrameOutputState& OutputState)
+{
+	FScopeLock ScopeLock(&Lock);
+	FFrameState& Frame = Frames.FindOrAdd(OutputState.OutputFrameNumber);
+	Frame.ShotIndex = OutputState.ShotIndex;
+	Frame.SourceFrameNumber = OutputState.SourceFrameNumber;
+	Frame.PendingWrites++;
+}
+
+void FXFResumeManifest::EndWrite(int32 OutputFrameNumber, bool bSuccess)
+{
+	FScopeLock ScopeLock(&Lock);
+	FFrameState* Frame = Frames.Find(OutputFrameNumber);
+	if (!Frame) return;
+	Frame->PendingWrites--;
+	Frame->bFailed |= !bSuccess;
+	TryComplete(OutputFrameNumber);
+}
+
+void FXFResumeManifest::TryComplete(int32 OutputFrameNumber)
+{
+	const FFrameState* Frame = Frames.Find(OutputFrameNumber);
+	if (!Frame || !Frame->bSealed || Frame->PendingWrites > 0) return;
+
+	if (!Frame->bFailed)
+	{
+		if (FShotState* Shot = Shots.Find(Frame->ShotIndex))
+		{
+			Shot->CompleteFrames.Add(Frame->SourceFrameNumber);
+			Shot->bDirty = true;
+			NumCompletedSinceFlush++;
+		}
+	}
+	Frames.Remove(OutputFrameNumber);
+}
+
+void FXFResumeManifest::FinishShot(int32 ShotIndex)
+{
+	check(IsInGameThread());
+	{
+		FScopeLock ScopeLock(&Lock);
+		TArray<int32> Sealed;
+		for (TPair<int32, FFrameState>& Pair : Frames)
+		{
+			if (Pair.Value.ShotIndex == ShotIndex && !Pair.Value.bSealed)
+			{
+				Pair.Value.bSealed = true;
+				Sealed.Add(Pair.Key);
+			}
+		}
+		for (int32 OutputFrameNumber : Sealed)
+		{
+			TryComplete(OutputFrameNumber);
+		}
+	}
+	Flush();
+}
+
+void FXFResumeManifest::FlushIfDue()
+{
+	{
+		FScopeLock ScopeLock(&Lock);
+		if (NumCompletedSinceFlush == 0) return;
+		if (NumCompletedSinceFlush < FlushFrameInterval && FPlatformTime::Seconds() - LastFlushTime < FlushIntervalSeconds) return;
+	}
+	Flush();
+}
+
+void FXFResumeManifest::Flush()
+{
+	check(IsInGameThread());
+	TArray<TPair<FString, FString>> Manifests;
+	{
+		FScopeLock ScopeLock(&Lock);
+		NumCompletedSinceFlush = 0;
+		LastFlushTime = FPlatformTime::Seconds();
+		for (TPair<int32, FShotState>& Pair : Shots)
+		{
+			FShotState& Shot = Pair.Value;
+			if (!Shot.bDirty || Shot.ManifestPath.IsEmpty()) continue;
+			Shot.bDirty = false;
+
+			TArray<int32> CompleteFrames = Shot.CompleteFrames.Array();
+			CompleteFrames.Sort();
+			FString Json = TEXT("{\"version\": 1, \"frames\": [");
+			for (int32 Idx = 0; Idx < CompleteFrames.Num(); Idx++)
+			{
+				Json += FString::Printf(Idx == 0 ? TEXT("%d") : TEXT(", %d"), CompleteFrames[Idx]);
+			}
+			Json += TEXT("]}\n");
+			Manifests.Emplace(Shot.ManifestPath, MoveTemp(Json));
+		}
+	}
+
+	// out of the lock, the writes of the queue take it as they finish
+	for (TPair<FString, FString>& Manifest : Manifests)
+	{
+		FXFAsyncWriteQueue::Get().Enqueue([Path = MoveTemp(Manifest.Key), Json = MoveTemp(Manifest.Value)]()
+		{
+			const FTCHARToUTF8 Utf8(*Json);
+			return UXF_BlueprintFunctionLibrary::SaveBytesToFileAtomic(Utf8.Get(), Utf8.Length(), Path);
+		});
+	}
+}
+
+FXFResumeManifest::FShotState& FXFResumeManifest::FindOrLoadShot(int32 ShotIndex)
+{
+	check(IsInGameThread());
+	FScopeLock ScopeLock(&Lock);
+	if (FShotState* Shot = Shots.Find(ShotIndex))
+	{
+		return *Shot;
+	}
+
+	FShotState& Shot = Shots.Add(ShotIndex);
+	UMoviePipeline* MoviePipeline = Pipeline.Get();
+	if (!MoviePipeline || !MoviePipeline->GetActiveShotList().IsValidIndex(ShotIndex)) return Shot;
+
+	const UMoviePipelineExecutorShot* ExecutorShot = MoviePipeline->GetActiveShotList()[ShotIndex];
+	FString ShotName = ExecutorShot->OuterName;
+	if (!ExecutorShot->InnerName.IsEmpty() && ExecutorShot->InnerName != ExecutorShot->OuterName)
+	{
+		ShotName += TEXT("_") + ExecutorShot->InnerName;
+	}
+	const UMoviePipelineOutputSetting* OutputSettings = MoviePipeline->GetPipelineMasterConfig()->FindSetting<UMoviePipelineOutputSetting>();
+	check(OutputSettings);
+	// the asset name of the job, the target sequence of the pipeline is a transient copy.
+	// The shards of the sequence rendered side by side have their own manifests.
+	Shot.ManifestPath = OutputSettings->OutputDirectory.Path / TEXT(".xf_resume")
+		/ FPaths::MakeValidFileName(MoviePipeline->GetCurrentJob()->Sequence.GetAssetName())
+		/ FPaths::MakeValidFileName(ShotName) + UMoviePipelineRenderShardSetting::GetContainerSuffix(MoviePipeline) + TEXT(".json");
+
+	// the frames completed by the previous renders of the shot
+	FString Json;
+	if (!FFileHelper::LoadFileToString(Json, *Shot.ManifestPath)) return Shot;
+	TSharedPtr<FJsonObject> Root;
+	const TSharedRef<TJsonReader<>> Reader = TJsonReaderFactory<>::Create(Json);
+	const TArray<TSharedPtr<FJsonValue>>* FrameValues = nullptr;
+	if (!FJsonSerializer::Deserialize(Reader, Root) || !Root.IsValid() || !Root->TryGetArrayField(TEXT("frames"), FrameValues))
+	{
+		UE_LOG(LogXF, Warning, TEXT("Ignoring the invalid resume manifest %s"), *Shot.ManifestPath);
+		return Shot;
+	}
+	for (const TSharedPtr<FJsonValue>& Value : *FrameValues)
+	{
+		Shot.ResumedFrames.Add((int32)Value->AsNumber());
+	}
+	Shot.CompleteFrames = Shot.ResumedFrames;
+	UE_LOG(LogXF, Log, TEXT("Resuming %s, %d frames already complete"), *ShotName, Shot.ResumedFrames.Num());
+	return Shot;
+}
@@ -0,0 +1,147 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "XF_SceneBindings.h"
+#include "XF_Stats.h"
+#include "MoviePipeline.h"
+#include "LevelSequence.h"
+#include "MovieScene.h"
+#include "SequencerTools.h"
+#include "SequencerBindingProxy.h"
+#include "SequencerScriptingRange.h"
+#include "Camera/CameraActor.h"
+#include "Engine/StaticMeshActor.h"
+#include "Animation/SkeletalMeshActor.h"
+#include "Components/StaticMeshComponent.h"
+#include "Components/SkeletalMeshComponent.h"
+
+
+static TMap<TWeakObjectPtr<UMoviePipeline>, TSharedRef<FXFSceneBindingRegistry>> GXFSceneBindingRegistries;
+
+TSharedRef<FXFSceneBindingRegistry> FXFSceneBindingRegistry::Get(UMoviePipeline* Pipeline)
+{
+	check(IsInGameThread());
+	check(Pipeline);
+
+	// drop the registries of the finished pipelines
+	for (auto It = GXFSceneBindingRegistries.CreateIterator(); It; ++It)
+	{
+		if (!It->Key.IsValid()) It.RemoveCurrent();
+	}
+
+	if (const TSharedRef<FXFSceneBindingRegistry>* Registry = GXFSceneBindingRegistries.Find(Pipeline))
+	{
+		return *Registry;
+	}
+	TSharedRef<FXFSceneBindingRegistry> Registry = MakeShared<FXFSceneBindingRegistry>();
+	Registry->Resolve(Pipeline);
+	GXFSceneBindingRegistries.Add(Pipeline, Registry);
+	return Registry;
+}
+
+const FString& FXFSceneBindingRegistry::GetExportName(const UObject* Object) const
+{
+	static const FString Unknown;
+	const FString* Name = ExportNames.Find(Object);
+	return Name ? *Name : Unknown;
+}
+
+FString FXFSceneBindingRegistry::MakeExportName(const ACameraActor* Camera)
+{
+	// Actor in level
+	FString CameraNameFromLabel = Camera->GetActorNameOrLabel();
+	// Actor spawned from sequence
+	FString CameraNameFromName = Camera->GetFName().GetPlainNameString();
+	// XXX: Hardcode way to Judge which name is correct, need to be improved
+	// Should ref to
+	// GetPipeline()->ResolveFilenameFormatArguments(FileNameFormatString, FormatOverrides, OutputData.FilePath, FinalFormatArgs, &Payload->SampleState.OutputState);
+	// using {camera_name}
+	bool bIsCameraInLevel = CameraNameFromName.StartsWith("CameraActor") || CameraNameFromName.StartsWith("CineCameraActor");
+	return bIsCameraInLevel ? CameraNameFromLabel : CameraNameFromName;
+}
+
+FString FXFSceneBindingRegistry::MakeExportName(const UPrimitiveComponent* Component)
+{
+	// Actor in level
+	FString MeshNameFromLabel = Component->GetOwner()->GetActorNameOrLabel();
+	// Actor spawned from sequence
+	FString MeshNameFromName = Component->GetOwner()->GetFName().GetPlainNameString();
+	// Judge which name is correct
+	const TCHAR* LevelActorPrefix = Component->IsA<USkeletalMeshComponent>() ? TEXT("SkeletalMesh") : TEXT("StaticMesh");
+	return MeshNameFromName.StartsWith(LevelActorPrefix) ? MeshNameFromLabel : MeshNameFromName;
+}
+
+void FXFSceneBindingRegistry::Resolve(UMoviePipeline* Pipeline)
+{
+	XF_SCOPE_STAGE(ResolveBindings);
+	ULevelSequence* LevelSequence = Pipeline->GetTargetSequence();
+	UMovieSceneSequence* MovieSceneSequence = Pipeline->GetTargetSequence();
+	UMovieScene* MovieScene = LevelSequence->GetMovieScene();
+	const TArray<FMovieSceneBinding>& Bindings = MovieScene->GetBindings();
+
+	TArray<FMovieSceneBindingProxy> BindingProxies;
+	BindingProxies.Reserve(Bindings.Num());
+	for (const FMovieSceneBinding& Binding : Bindings)
+	{
+		BindingProxies.Add(FSequencerBindingProxy(Binding.GetObjectGuid(), MovieSceneSequence));
+	}
+
+	const TArray<FSequencerBoundObjects> BoundObjects = USequencerToolsFunctionLibrary::GetBoundObjects(
+		Pipeline->GetWorld(),
+		LevelSequence,
+		BindingProxies,
+		FSequencerScriptingRange::FromNative(
+			MovieScene->GetPlaybackRange(),
+			MovieScene->GetDisplayRate()
+		)
+	);
+
+	ExportNames.Reserve(BoundObjects.Num());
+	for (const FSequencerBoundObjects& Bound : BoundObjects)
+	{
+		if (Bound.BoundObjects.Num() == 0) continue;
+		UObject* BoundObject = Bound.BoundObjects[0];  // only have one item
+		if (ACameraActor* Camera = Cast<ACameraActor>(BoundObject))
+		{
+			AddCamera(Camera);
+		}
+		else if (ASkeletalMeshActor* SkeletalMeshActor = Cast<ASkeletalMeshActor>(BoundObject))
+		{
+			AddComponent(SkeletalMeshActor->GetSkeletalMeshComponent());
+		}
+		else if (AStaticMeshActor* StaticMeshActor = Cast<AStaticMeshActor>(BoundObject))
+		{
+			AddComponent(StaticMeshActor->GetStaticMeshComponent());
+		}
+		else if (UPrimitiveComponent* Component = Cast<UPrimitiveComponent>(BoundObject))
+		{
+			// an actor and its component can both be bound
+			AddComponent(Component);
+		}
+	}
+}
+
+void FXFSceneBindingRegistry::AddCamera(ACameraActor* Camera)
+{
+	if (ExportNames.Contains(Camera)) return;
+	ExportNames.Add(Camera, MakeExportName(Camera));
+	Cameras.Add(Camera);
+}
+
+void FXFSceneBindingRegistry::AddComponent(UPrimitiveComponent* Component)
+{
+	if (!Component || ExportNames.Contains(Component)) return;
+	if (USkeletalMeshComponent* SkeletalMeshComponent = Cast<USkeletalMeshComponent>(Component))
+	{
+		SkeletalMeshComponents.Add(SkeletalMeshComponent);
+	}
+	else if (UStaticMeshComponent* StaticMeshComponent = Cast<UStaticMeshComponent>(Component))
+	{
+		StaticMeshComponents.Add(StaticMeshComponent);
+	}
+	else
+	{
+		return;
+	}
+	ExportNames.Add(Component, MakeExportName(Component));
+}
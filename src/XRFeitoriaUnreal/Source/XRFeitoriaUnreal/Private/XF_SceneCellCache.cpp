@@ -0,0 +1,420 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "XF_SceneCellCache.h"
+#include "XF_BlueprintFunctionLibrary.h"
+#include "Engine/World.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformFilemanager.h"
+#include "Async/MappedFileHandle.h"
+#include "Misc/FileHelper.h"
+#include "Misc/PackageName.h"
+#include "Misc/Paths.h"
+#include "Misc/ScopeLock.h"
+
+
+static bool GXFSceneCellCacheEnabled = false;
+static FCriticalSection GXFSceneCellCachesLock;
+static TMap<FString, TSharedPtr<FXFSceneCellCache, ESPMode::ThreadSafe>> GXFSceneCellCaches;
+
+
+uint64 FXFSceneCellKey::Hash64() const
+{
+	uint64 Hash = (uint64)Kind;
+	for (const int32 Value : { X, Y, Z, P0, P1 })
+	{
+		Hash ^= (uint64)(uint32)Value + 0x9e3779b97f4a7c15ull + (Hash << 6) + (Hash >> 2);
+	}
+	// finalizer of murmur3, the low bits index the table
+	Hash ^= Hash >> 33;
+	Hash *= 0xff51afd7ed558ccdull;
+	Hash ^= Hash >> 33;
+	return Hash;
+}
+
+FXFSceneCellKey FXFSceneCellKey::Column(const FVector& Start, float HitEndZ, int32 BoxHalfSize)
+{
+	FXFSceneCellKey Key;
+	Key.Kind = EXFSceneCellQuery::Column;
+	Key.X = FMath::RoundToInt(Start.X);
+	Key.Y = FMath::RoundToInt(Start.Y);
+	Key.Z = FMath::RoundToInt(Start.Z);
+	Key.P0 = FMath::RoundToInt(HitEndZ);
+	Key.P1 = BoxHalfSize;
+	return Key;
+}
+
+FXFSceneCellKey FXFSceneCellKey::Inside(const FVector& Location, float Extend)
+{
+	FXFSceneCellKey Key;
+	Key.Kind = EXFSceneCellQuery::Inside;
+	Key.X = FMath::RoundToInt(Location.X);
+	Key.Y = FMath::RoundToInt(Location.Y);
+	Key.Z = FMath::RoundToInt(Location.Z);
+	Key.P0 = FMath::RoundToInt(Extend);
+	return Key;
+}
+
+FXFSceneCellKey FXFSceneCellKey::CameraRay(const FVector& CameraLocation, const FRotator& CameraRotation)
+{
+	// the forward ray doesn't depend on the roll
+	const FRotator Rotation = CameraRotation.GetNormalized();
+	FXFSceneCellKey Key;
+	Key.Kind = EXFSceneCellQuery::CameraRay;
+	Key.X = FMath::RoundToInt(CameraLocation.X);
+	Key.Y = FMath::RoundToInt(CameraLocation.Y);
+	Key.Z = FMath::RoundToInt(CameraLocation.Z);
+	Key.P0 = FMath::RoundToInt(Rotation.Pitch * 100.f);
+	Key.P1 = FMath::RoundToInt(Rotation.Yaw * 100.f);
+	return Key;
+}
+
+
+void FXFSceneCellCache::SetEnabled(bool bInEnabled)
+{
+	GXFSceneCellCacheEnabled = bInEnabled;
+}
+
+bool FXFSceneCellCache::IsEnabled()
+{
+	return GXFSceneCellCacheEnabled;
+}
+
+/** Package name of the level, and the time stamp of its file (0 if it was never saved). */
+static FString GetLevelPackageName(const UWorld* World, int64& OutTimeStamp)
+{
+	const FString PackageName = UWorld::RemovePIEPrefix(World->GetOutermost()->GetName());
+	OutTimeStamp = 0;
+	FString LevelFile;
+	if (FPackageName::TryConvertLongPackageNameToFilename(PackageName, LevelFile, FPackageName::GetMapPackageExtension()))
+	{
+		const FDateTime TimeStamp = IFileManager::Get().GetTimeStamp(*LevelFile);
+		OutTimeStamp = TimeStamp == FDateTime::MinValue() ? 0 : TimeStamp.GetTicks();
+	}
+	return PackageName;
+}
+
+static FString GetCachePath(const FString& PackageName)
+{
+	FString FileName = PackageName;
+	FileName.RemoveFromStart(TEXT("/"));
+	FileName.ReplaceInline(TEXT("/"), TEXT("_"));
+	return FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("XRFeitoria"), TEXT("SceneCellCache"), FileName + TEXT(".xfcells"));
+}
+
+TSharedPtr<FXFSceneCellCache, ESPMode::ThreadSafe> FXFSceneCellCache::Get(const UWorld* World)
+{
+	if (!GXFSceneCellCacheEnabled || !World)
+	{
+		return nullptr;
+	}
+
+	int64 TimeStamp = 0;
+	const FString PackageName = GetLevelPackageName(World, TimeStamp);
+
+	FScopeLock Lock(&GXFSceneCellCachesLock);
+	TSharedPtr<FXFSceneCellCache, ESPMode::ThreadSafe>& Cache = GXFSceneCellCaches.FindOrAdd(PackageName);
+	if (!Cache.IsValid() || Cache->LevelTimeStamp != TimeStamp)
+	{
+		// the level was saved again since the cache was loaded, its results are stale
+		Cache = MakeShared<FXFSceneCellCache, ESPMode::ThreadSafe>(GetCachePath(PackageName), TimeStamp);
+	}
+	return Cache;
+}
+
+void FXFSceneCellCache::SaveAll()
+{
+	FScopeLock Lock(&GXFSceneCellCachesLock);
+	for (TPair<FString, TSharedPtr<FXFSceneCellCache, ESPMode::ThreadSafe>>& Pair : GXFSceneCellCaches)
+	{
+		Pair.Value->Save();
+	}
+	GXFSceneCellCaches.Empty();
+}
+
+void FXFSceneCellCache::Clear(const UWorld* World)
+{
+	if (!World)
+	{
+		return;
+	}
+	int64 TimeStamp = 0;
+	const FString PackageName = GetLevelPackageName(World, TimeStamp);
+
+	FScopeLock Lock(&GXFSceneCellCachesLock);
+	GXFSceneCellCaches.Remove(PackageName);
+	IFileManager::Get().Delete(*GetCachePath(PackageName), false, true, true);
+}
+
+
+FXFSceneCellCache::FXFSceneCellCache(const FString& InPath, int64 InLevelTimeStamp)
+	: Path(InPath)
+	, LevelTimeStamp(InLevelTimeStamp)
+{
+	Load();
+}
+
+FXFSceneCellCache::~FXFSceneCellCache()
+{
+	Unload();
+}
+
+bool FXFSceneCellCache::Load()
+{
+	Unload();
+	if (!IFileManager::Get().FileExists(*Path))
+	{
+		return false;
+	}
+
+	IPlatformFile& PlatformFile = FPlatformFileManager::Get().GetPlatformFile();
+#if ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION >= 3
+	FOpenMappedResult MappedResult = PlatformFile.OpenMappedEx(*Path);
+	if (MappedResult.HasValue())
+	{
+		MappedHandle = MappedResult.StealValue();
+	}
+#else
+	MappedHandle.Reset(PlatformFile.OpenMapped(*Path));
+#endif
+	int64 Size = 0;
+	if (MappedHandle.IsValid())
+	{
+		Size = MappedHandle->GetFileSize();
+		MappedRegion.Reset(MappedHandle->MapRegion(0, Size));
+	}
+	if (MappedRegion.IsValid())
+	{
+		Data = MappedRegion->GetMappedPtr();
+	}
+	else if (FFileHelper::LoadFileToArray(FileData, *Path))
+	{
+		// not every platform file can map, the cache is small enough to be read instead
+		MappedRegion.Reset();
+		MappedHandle.Reset();
+		Data = FileData.GetData();
+		Size = FileData.Num();
+	}
+	if (!Data || Size < (int64)sizeof(FXFSceneCellCacheHeader))
+	{
+		Unload();
+		return false;
+	}
+
+	FMemory::Memcpy(&Header, Data, sizeof(FXFSceneCellCacheHeader));
+	const int64 TableEnd = sizeof(FXFSceneCellCacheHeader) + (int64)Header.Capacity * sizeof(FXFSceneCellRecord);
+	const bool bIsValid =
+		Header.Magic == FXFSceneCellCacheHeader::MagicValue &&
+		Header.Version == FXFSceneCellCacheHeader::CurrentVersion &&
+		Header.HeaderSize == sizeof(FXFSceneCellCacheHeader) &&
+		Header.RecordSize == sizeof(FXFSceneCellRecord) &&
+		FMath::IsPowerOfTwo(Header.Capacity) &&
+		Header.NamesOffset >= (uint64)TableEnd && Header.NamesOffset <= (uint64)Size;
+	if (!bIsValid || Header.LevelTimeStamp != LevelTimeStamp)
+	{
+		UE_LOG(LogXF, Log, TEXT("Ignored the scene cell cache %s, %s."), *Path,
+			bIsValid ? TEXT("the level was saved after it") : TEXT("unknown format"));
+		Unload();
+		return false;
+	}
+
+	const ANSICHAR* Names = (const ANSICHAR*)(Data + Header.NamesOffset);
+	const ANSICHAR* NamesEnd = (const ANSICHAR*)(Data + Size);
+	MappedNames.Reserve(Header.NumNames);
+	for (uint32 Idx = 0; Idx < Header.NumNames && Names < NamesEnd; Idx++)
+	{
+		const int32 Len = FCStringAnsi::Strnlen(Names, NamesEnd - Names);
+		const FUTF8ToTCHAR Name(Names, Len);
+		MappedNames.Add(FString(Name.Length(), Name.Get()));
+		Names += Len + 1;
+	}
+	UE_LOG(LogXF, Log, TEXT("Loaded %d cached scene queries from %s."), Header.NumRecords, *Path);
+	return true;
+}
+
+void FXFSceneCellCache::Unload()
+{
+	// the region must be released before its file
+	MappedRegion.Reset();
+	MappedHandle.Reset();
+	FileData.Empty();
+	Data = nullptr;
+	Header = FXFSceneCellCacheHeader();
+	MappedNames.Empty();
+}
+
+const FXFSceneCellRecord* FXFSceneCellCache::FindMapped(const FXFSceneCellKey& Key) const
+{
+	if (!Data || Header.Capacity == 0)
+	{
+		return nullptr;
+	}
+	const FXFSceneCellRecord* Table = (const FXFSceneCellRecord*)(Data + sizeof(FXFSceneCellCacheHeader));
+	const uint32 Mask = Header.Capacity - 1;
+	for (uint32 Probe = 0, Slot = (uint32)Key.Hash64() & Mask; Probe < Header.Capacity; Probe++, Slot = (Slot + 1) & Mask)
+	{
+		const FXFSceneCellRecord& Record = Table[Slot];
+		if (Record.Kind == (uint8)EXFSceneCellQuery::None)
+		{
+			return nullptr;
+		}
+		if (Record.Kind == (uint8)Key.Kind && Record.X == Key.X && Record.Y == Key.Y && Record.Z == Key.Z &&
+			Record.P0 == Key.P0 && Record.P1 == Key.P1)
+		{
+			return &Record;
+		}
+	}
+	return nullptr;
+}
+
+bool FXFSceneCellCache::Find(const FXFSceneCellKey& Key, FXFSceneCellValue& OutValue) const
+{
+	if (const FXFSceneCellRecord* Record = FindMapped(Key))
+	{
+		OutValue.bIsHit = (Record->Flags & 1) != 0;
+		OutValue.bIsInside = (Record->Flags & 2) != 0;
+		OutValue.Location = FVector(Record->Location[0], Record->Location[1], Record->Location[2]);
+		OutValue.ActorName = MappedNames.IsValidIndex(Record->ActorIndex) ? MappedNames[Record->ActorIndex] : FString();
+		return true;
+	}
+
+	FReadScopeLock Lock(AddedLock);
+	if (const FXFSceneCellValue* Value = Added.Find(Key))
+	{
+		OutValue = *Value;
+		return true;
+	}
+	return false;
+}
+
+void FXFSceneCellCache::Add(const FXFSceneCellKey& Key, const FXFSceneCellValue& Value)
+{
+	FWriteScopeLock Lock(AddedLock);
+	Added.Add(Key, Value);
+}
+
+int32 FXFSceneCellCache::GetNumAdded() const
+{
+	FReadScopeLock Lock(AddedLock);
+	return Added.Num();
+}
+
+bool FXFSceneCellCache::Save()
+{
+	check(IsInGameThread());
+	FWriteScopeLock Lock(AddedLock);
+	if (Added.Num() == 0)
+	{
+		return true;
+	}
+
+	TArray<FString> Names;
+	TMap<FString, int32> NameToIndex;
+	auto GetNameIndex = [&Names, &NameToIndex](const FString& Name) -> int32
+	{
+		if (Name.IsEmpty())
+		{
+			return -1;
+		}
+		if (const int32* Index = NameToIndex.Find(Name))
+		{
+			return *Index;
+		}
+		return NameToIndex.Add(Name, Names.Add(Name));
+	};
+
+	// the mapped records, and the new ones
+	TArray<FXFSceneCellRecord> Records;
+	Records.Reserve(Header.NumRecords + Added.Num());
+	if (Data)
+	{
+		const FXFSceneCellRecord* Table = (const FXFSceneCellRecord*)(Data + sizeof(FXFSceneCellCacheHeader));
+		for (uint32 Slot = 0; Slot < Header.Capacity; Slot++)
+		{
+			if (Table[Slot].Kind == (uint8)EXFSceneCellQuery::None) continue;
+			FXFSceneCellRecord& Record = Records.Add_GetRef(Table[Slot]);
+			Record.ActorIndex = MappedNames.IsValidIndex(Record.ActorIndex) ? GetNameIndex(MappedNames[Record.ActorIndex]) : -1;
+		}
+	}
+	for (const TPair<FXFSceneCellKey, FXFSceneCellValue>& Pair : Added)
+	{
+		if (FindMapped(Pair.Key)) continue;
+		FXFSceneCellRecord& Record = Records.AddDefaulted_GetRef();
+		Record.Kind = (uint8)Pair.Key.Kind;
+		Record.Flags = (Pair.Value.bIsHit ? 1 : 0) | (Pair.Value.bIsInside ? 2 : 0);
+		Record.X = Pair.Key.X;
+		Record.Y = Pair.Key.Y;
+		Record.Z = Pair.Key.Z;
+		Record.P0 = Pair.Key.P0;
+		Record.P1 = Pair.Key.P1;
+		Record.Location[0] = Pair.Value.Location.X;
+		Record.Location[1] = Pair.Value.Location.Y;
+		Record.Location[2] = Pair.Value.Location.Z;
+		Record.ActorIndex = GetNameIndex(Pair.Value.ActorName);
+	}
+
+	// at most half full, so the probes stay short
+	FXFSceneCellCacheHeader NewHeader;
+	NewHeader.RecordSize = sizeof(FXFSceneCellRecord);
+	NewHeader.Capacity = FMath::RoundUpToPowerOfTwo(FMath::Max(Records.Num() * 2, 1024));
+	NewHeader.NumRecords = Records.Num();
+	NewHeader.NamesOffset = sizeof(FXFSceneCellCacheHeader) + (uint64)NewHeader.Capacity * sizeof(FXFSceneCellRecord);
+	NewHeader.NumNames = Names.Num();
+	NewHeader.LevelTimeStamp = LevelTimeStamp;
+
+	TArray<FXFSceneCellRecord> Table;
+	Table.SetNumZeroed(NewHeader.Capacity);
+	const uint32 Mask = NewHeader.Capacity - 1;
+	for (const FXFSceneCellRecord& Record : Records)
+	{
+		FXFSceneCellKey Key;
+		Key.Kind = (EXFSceneCellQuery)Record.Kind;
+		Key.X = Record.X;
+		Key.Y = Record.Y;
+		Key.Z = Record.Z;
+		Key.P0 = Record.P0;
+		Key.P1 = Record.P1;
+		uint32 Slot = (uint32)Key.Hash64() & Mask;
+		while (Table[Slot].Kind != (uint8)EXFSceneCellQuery::None)
+		{
+			Slot = (Slot + 1) & Mask;
+		}
+		Table[Slot] = Record;
+	}
+
+	// write next to the file and swap, the mapped file is still in use until then
+	const FString TempPath = Path + TEXT(".tmp");
+	{
+		TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*TempPath));
+		if (!Writer.IsValid())
+		{
+			UE_LOG(LogXF, Error, TEXT("Failed to save the scene cell cache to %s."), *TempPath);
+			return false;
+		}
+		Writer->Serialize(&NewHeader, sizeof(NewHeader));
+		Writer->Serialize(Table.GetData(), (int64)Table.Num() * sizeof(FXFSceneCellRecord));
+		for (const FString& Name : Names)
+		{
+			FTCHARToUTF8 Utf8(*Name);
+			Writer->Serialize((void*)Utf8.Get(), Utf8.Length());
+			uint8 Terminator = 0;
+			Writer->Serialize(&Terminator, 1);
+		}
+		if (!Writer->Close())
+		{
+			UE_LOG(LogXF, Error, TEXT("Failed to save the scene cell cache to %s."), *TempPath);
+			return false;
+		}
+	}
+
+	Unload();
+	if (!IFileManager::Get().Move(*Path, *TempPath, true, true))
+	{
+		UE_LOG(LogXF, Error, TEXT("Failed to replace the scene cell cache %s."), *Path);
+		Load();
+		return false;
+	}
+	Added.Empty();
+	Load();
+	return true;
+}
@@ -0,0 +1,204 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "XF_SharedFrameRing.h"
+#include "XF_BlueprintFunctionLibrary.h"
+#include "HAL/PlatformProcess.h"
+
+
+static constexpr uint64 EntryTableSize = FXFSharedFrameRing::MaxEntries * sizeof(FXFSharedFrameEntry);
+
+FXFSharedFrameRing::~FXFSharedFrameRing()
+{
+	Close();
+}
+
+FString FXFSharedFrameRing::NormalizeName(const FString& InName)
+{
+	// the engine adds the prefix of the platform itself
+	FString Normalized = InName.TrimStartAndEnd();
+	for (const TCHAR* Prefix : { TEXT("Global\\"), TEXT("Local\\"), TEXT("/") })
+	{
+		Normalized.RemoveFromStart(Prefix);
+	}
+	return Normalized;
+}
+
+FString FXFSharedFrameRing::GetPlatformName(const FString& InName)
+{
+	// matches FPlatformMemory::MapNamedSharedMemoryRegion
+#if PLATFORM_WINDOWS
+	return TEXT("Global\\") + NormalizeName(InName);
+#else
+	return TEXT("/") + NormalizeName(InName);
+#endif
+}
+
+bool FXFSharedFrameRing::Open(const FString& InName, int32 InSlotCount, int64 InSlotSize)
+{
+	Close();
+	const FString RegionName = NormalizeName(InName);
+
+	const uint32 SlotCount = FMath::Max(InSlotCount, 1);
+	const uint64 SlotSize = Align((uint64)FMath::Max<int64>(InSlotSize, EntryTableSize + 64), 4096);
+	const uint32 HeaderSize = Align(sizeof(FXFSharedFrameRingHeader) + SlotCount * sizeof(FXFSharedFrameSlotInfo), 4096);
+	const uint64 TotalSize = HeaderSize + SlotCount * SlotSize;
+
+	Region = FPlatformMemory::MapNamedSharedMemoryRegion(RegionName, true,
+		FPlatformMemory::ESharedMemoryAccess::Read | FPlatformMemory::ESharedMemoryAccess::Write, TotalSize);
+	if (!Region)
+	{
+		UE_LOG(LogXF, Error, TEXT("Failed to create the shared memory region %s of %llu bytes"), *GetPlatformName(RegionName), TotalSize);
+		return false;
+	}
+	Name = GetPlatformName(RegionName);
+	Sequence = 0;
+	CurrentSlot = INDEX_NONE;
+	bClientStalled = false;
+	NumDroppedFrames = 0;
+
+	FMemory::Memzero(Region->GetAddress(), HeaderSize);
+	FXFSharedFrameRingHeader* Header = new (Region->GetAddress()) FXFSharedFrameRingHeader();
+	Header->HeaderSize = HeaderSize;
+	Header->SlotCount = SlotCount;
+	Header->SlotSize = SlotSize;
+	for (uint32 SlotIdx = 0; SlotIdx < SlotCount; SlotIdx++)
+	{
+		new (GetSlotInfo(SlotIdx)) FXFSharedFrameSlotInfo();
+	}
+	UE_LOG(LogXF, Log, TEXT("Streaming frames to the shared memory region %s (%u slots of %llu MB)"), *Name, SlotCount, SlotSize >> 20);
+	return true;
+}
+
+void FXFSharedFrameRing::Close()
+{
+	if (!Region) return;
+
+	FPlatformMisc::MemoryBarrier();
+	GetHeader()->Status = 1;
+	// the client keeps its own mapping open, the region goes away once every mapping is closed
+	FPlatformMemory::UnmapNamedSharedMemoryRegion(Region);
+	Region = nullptr;
+	CurrentSlot = INDEX_NONE;
+}
+
+FXFSharedFrameRingHeader* FXFSharedFrameRing::GetHeader() const
+{
+	return (FXFSharedFrameRingHeader*)Region->GetAddress();
+}
+
+FXFSharedFrameSlotInfo* FXFSharedFrameRing::GetSlotInfo(int32 SlotIdx) const
+{
+	return (FXFSharedFrameSlotInfo*)((uint8*)Region->GetAddress() + sizeof(FXFSharedFrameRingHeader)) + SlotIdx;
+}
+
+uint8* FXFSharedFrameRing::GetSlot(int32 SlotIdx) const
+{
+	const FXFSharedFrameRingHeader* Header = GetHeader();
+	return (uint8*)Region->GetAddress() + Header->HeaderSize + SlotIdx * Header->SlotSize;
+}
+
+bool FXFSharedFrameRing::BeginFrame(int32 FrameNumber, int32 ShotIndex, bool bDropWhenFull, float MaxWaitSeconds)
+{
+	if (!Region) return false;
+	check(CurrentSlot == INDEX_NONE);
+
+	FXFSharedFrameRingHeader* Header = GetHeader();
+	const uint64 NextSequence = Sequence + 1;
+
+	// the slot still holds frame NextSequence - SlotCount, wait for the client to release it
+	if (!bDropWhenFull && NextSequence > Header->SlotCount)
+	{
+		const uint64 Required = NextSequence - Header->SlotCount;
+		if (bClientStalled)
+		{
+			// don't stall every frame on a client which stopped reading, drop until it catches up
+			if (Header->ReadSequence < Required)
+			{
+				NumDroppedFrames++;
+				return false;
+			}
+			UE_LOG(LogXF, Log, TEXT("Shared memory client of %s caught up, %d frames dropped"), *Name, NumDroppedFrames);
+			bClientStalled = false;
+			NumDroppedFrames = 0;
+		}
+
+		const double StartTime = FPlatformTime::Seconds();
+		float PollSeconds = 0.0001f;
+		while (Header->ReadSequence < Required)
+		{
+			if (FPlatformTime::Seconds() - StartTime > MaxWaitSeconds)
+			{
+				UE_LOG(LogXF, Warning, TEXT("Shared memory client of %s is %llu frames behind after %.1fs, dropping the frames from %d until it catches up"),
+					*Name, NextSequence - 1 - Header->ReadSequence, MaxWaitSeconds, FrameNumber);
+				bClientStalled = true;
+				NumDroppedFrames = 1;
+				return false;
+			}
+			FPlatformProcess::Sleep(PollSeconds);
+			PollSeconds = FMath::Min(PollSeconds * 2.f, MaxPollSeconds);
+		}
+	}
+
+	Sequence = NextSequence;
+	CurrentSlot = (Sequence - 1) % Header->SlotCount;
+	CurrentUsedBytes = Align(EntryTableSize, 64);
+	CurrentNumEntries = 0;
+
+	FXFSharedFrameSlotInfo* SlotInfo = GetSlotInfo(CurrentSlot);
+	SlotInfo->Sequence = 0;
+	FPlatformMisc::MemoryBarrier();
+	SlotInfo->FrameNumber = FrameNumber;
+	SlotInfo->ShotIndex = ShotIndex;
+	FMemory::Memzero(GetSlot(CurrentSlot), EntryTableSize);
+	return true;
+}
+
+bool FXFSharedFrameRing::AddEntry(const FString& EntryName, EXFSharedDataType DataType, TArrayView<const uint32> Shape, const void* Data, int64 NumBytes)
+{
+	if (CurrentSlot == INDEX_NONE) return false;
+
+	const FXFSharedFrameRingHeader* Header = GetHeader();
+	const uint64 Offset = Align(CurrentUsedBytes, 64);
+	if (CurrentNumEntries >= MaxEntries || Offset + NumBytes > Header->SlotSize)
+	{
+		if (!bWarnedSlotSize)
+		{
+			UE_LOG(LogXF, Warning, TEXT("%s doesn't fit in the %llu MB slots of %s, increase the slot size"), *EntryName, Header->SlotSize >> 20, *Name);
+			bWarnedSlotSize = true;
+		}
+		return false;
+	}
+
+	uint8* Slot = GetSlot(CurrentSlot);
+	FXFSharedFrameEntry& Entry = ((FXFSharedFrameEntry*)Slot)[CurrentNumEntries];
+	FCStringAnsi::Strncpy(Entry.Name, TCHAR_TO_UTF8(*EntryName), FXFSharedFrameEntry::MaxNameLength);
+	Entry.DataType = (uint32)DataType;
+	Entry.NumDims = FMath::Min(Shape.Num(), (int32)FXFSharedFrameEntry::MaxDims);
+	for (uint32 Dim = 0; Dim < Entry.NumDims; Dim++)
+	{
+		Entry.Shape[Dim] = Shape[Dim];
+	}
+	Entry.Offset = Offset;
+	Entry.NumBytes = NumBytes;
+	FMemory::Memcpy(Slot + Offset, Data, NumBytes);
+
+	CurrentUsedBytes = Offset + NumBytes;
+	CurrentNumEntries++;
+	return true;
+}
+
+void FXFSharedFrameRing::EndFrame()
+{
+	if (CurrentSlot == INDEX_NONE) return;
+
+	FXFSharedFrameSlotInfo* SlotInfo = GetSlotInfo(CurrentSlot);
+	SlotInfo->NumEntries = CurrentNumEntries;
+	SlotInfo->UsedBytes = CurrentUsedBytes;
+	// the data of the slot is visible before its sequence, the sequence before WriteSequence
+	FPlatformMisc::MemoryBarrier();
+	SlotInfo->Sequence = Sequence;
+	FPlatformMisc::MemoryBarrier();
+	GetHeader()->WriteSequence = Sequence;
+	CurrentSlot = INDEX_NONE;
+}
@@ -0,0 +1,236 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "XF_SkinnedVertexReadback.h"
+#include "XF_Stats.h"
+#include "XF_BlueprintFunctionLibrary.h"
+#include "Components/SkeletalMeshComponent.h"
+#include "Rendering/SkeletalMeshRenderData.h"
+#include "HAL/PlatformProcess.h"
+#include "HAL/PlatformTime.h"
+#include "RenderingThread.h"
+
+#if XF_WITH_SKIN_CACHE_READBACK
+#include "GPUSkinCache.h"
+#include "SkeletalRenderPublic.h"
+#include "RHIGPUReadback.h"
+#include "RenderGraphBuilder.h"
+#include "RenderGraphUtils.h"
+#endif
+
+
+struct FXFSkinnedVertexReadback::FRequest
+{
+	enum EState : int32
+	{
+		Waiting = 0,
+		Ready,
+		Failed
+	};
+
+#if XF_WITH_SKIN_CACHE_READBACK
+	/** Created, read and released on the render thread. */
+	TUniquePtr<FRHIGPUBufferReadback> Readback;
+#endif
+	/** Filled on the render thread when the readback is ready. */
+	TArray<FXFVector3f> LocalPositions;
+
+	FTransform ComponentTransform;
+	int32 LODIndex = 0;
+	int32 NumVertices = 0;
+	FString MeshName;
+	FOnReadbackComplete OnComplete;
+	TAtomic<int32> State { Waiting };
+};
+
+
+FXFSkinnedVertexReadback::~FXFSkinnedVertexReadback()
+{
+#if XF_WITH_SKIN_CACHE_READBACK
+	// the staging buffers must be released on the render thread
+	for (TSharedPtr<FRequest, ESPMode::ThreadSafe>& Request : Pending)
+	{
+		ENQUEUE_RENDER_COMMAND(XFSkinnedVertexReadbackRelease)(
+			[Request](FRHICommandListImmediate& RHICmdList)
+			{
+				Request->Readback.Reset();
+			});
+	}
+#endif
+	Pending.Empty();
+}
+
+bool FXFSkinnedVertexReadback::IsSupported(USkeletalMeshComponent* Comp, int32 LODIndex)
+{
+#if XF_WITH_SKIN_CACHE_READBACK
+	if (!Comp || !Comp->IsValidLowLevel() || !GEnableGPUSkinCache)
+	{
+		return false;
+	}
+	FSkeletalMeshObject* MeshObject = Comp->MeshObject;
+	if (!MeshObject || !MeshObject->IsGPUSkinMesh())
+	{
+		return false;
+	}
+	FSkeletalMeshRenderData* RenderData = Comp->GetSkeletalMeshRenderData();
+	if (!RenderData || !RenderData->LODRenderData.IsValidIndex(LODIndex))
+	{
+		return false;
+	}
+	// the skin cache only holds the LOD being rendered
+	return Comp->GetPredictedLODLevel() == LODIndex;
+#else
+	return false;
+#endif
+}
+
+bool FXFSkinnedVertexReadback::Request(USkeletalMeshComponent* Comp, int32 LODIndex, FOnReadbackComplete&& OnComplete)
+{
+	XF_SCOPE_STAGE(Skinning);
+#if XF_WITH_SKIN_CACHE_READBACK
+	check(IsInGameThread());
+	if (!IsSupported(Comp, LODIndex))
+	{
+		return false;
+	}
+
+	TSharedPtr<FRequest, ESPMode::ThreadSafe> Request = MakeShared<FRequest, ESPMode::ThreadSafe>();
+	Request->ComponentTransform = Comp->GetComponentTransform();
+	Request->LODIndex = LODIndex;
+	Request->NumVertices = Comp->GetSkeletalMeshRenderData()->LODRenderData[LODIndex].GetNumVertices();
+	Request->MeshName = Comp->GetOwner()->GetFName().ToString();
+	Request->OnComplete = MoveTemp(OnComplete);
+
+	FSkeletalMeshObject* MeshObject = Comp->MeshObject;
+	ENQUEUE_RENDER_COMMAND(XFSkinnedVertexReadbackRequest)(
+		[MeshObject, Request](FRHICommandListImmediate& RHICmdList)
+		{
+			FRDGBuilder GraphBuilder(RHICmdList);
+
+			// every section of a LOD is skinned into the same position buffer, at its base vertex
+			FRDGBufferRef PositionBuffer = nullptr;
+			FCachedGeometry CachedGeometry;
+			if (MeshObject->GetCachedGeometry(GraphBuilder, CachedGeometry))
+			{
+				for (const FCachedGeometry::Section& Section : CachedGeometry.Sections)
+				{
+					FRDGBufferRef SectionBuffer = Section.RDGPositionBuffer ? Section.RDGPositionBuffer->GetParent() : nullptr;
+					if (!SectionBuffer || (int32)Section.LODIndex != Request->LODIndex || (PositionBuffer && SectionBuffer != PositionBuffer))
+					{
+						PositionBuffer = nullptr;
+						break;
+					}
+					PositionBuffer = SectionBuffer;
+				}
+			}
+
+			const uint32 NumBytes = Request->NumVertices * 3 * sizeof(float);
+			if (PositionBuffer && PositionBuffer->Desc.GetSize() >= NumBytes)
+			{
+				Request->Readback = MakeUnique<FRHIGPUBufferReadback>(TEXT("XFSkinnedVertexReadback"));
+				AddEnqueueCopyPass(GraphBuilder, Request->Readback.Get(), PositionBuffer, NumBytes);
+			}
+			else
+			{
+				Request->State = FRequest::Failed;
+			}
+			GraphBuilder.Execute();
+		});
+
+	Pending.Add(MoveTemp(Request));
+	return true;
+#else
+	return false;
+#endif
+}
+
+int32 FXFSkinnedVertexReadback::Poll()
+{
+	XF_SCOPE_STAGE(Skinning);
+	check(IsInGameThread());
+	if (Pending.Num() == 0)
+	{
+		return 0;
+	}
+
+	// strictly head-first, the frames of a mesh must reach the output in order (the deltas of the vertex encoding)
+	int32 NumDone = 0;
+	for (; NumDone < Pending.Num(); NumDone++)
+	{
+		TSharedPtr<FRequest, ESPMode::ThreadSafe>& Request = Pending[NumDone];
+		const int32 State = Request->State;
+		if (State == FRequest::Waiting)
+		{
+			break;
+		}
+
+		TArray<FVector> VertexPositions;
+		if (State == FRequest::Ready)
+		{
+			UXF_BlueprintFunctionLibrary::TransformPositions(Request->ComponentTransform, Request->LocalPositions, VertexPositions);
+		}
+		else
+		{
+			// the pose of the frame is gone, the frame is dropped rather than written with another pose
+			UE_LOG(LogXF, Error, TEXT("Failed to read back the skinned vertices of %s from the GPU skin cache, dropping the frame."), *Request->MeshName);
+		}
+		Request->OnComplete(MoveTemp(VertexPositions));
+	}
+	Pending.RemoveAt(0, NumDone);
+
+#if XF_WITH_SKIN_CACHE_READBACK
+	if (Pending.Num() > 0)
+	{
+		ENQUEUE_RENDER_COMMAND(XFSkinnedVertexReadbackPoll)(
+			[Requests = Pending](FRHICommandListImmediate& RHICmdList)
+			{
+				for (const TSharedPtr<FRequest, ESPMode::ThreadSafe>& Request : Requests)
+				{
+					if (Request->State != FRequest::Waiting || !Request->Readback.IsValid() || !Request->Readback->IsReady())
+					{
+						continue;
+					}
+					const uint32 NumBytes = Request->NumVertices * 3 * sizeof(float);
+					Request->LocalPositions.SetNumUninitialized(Request->NumVertices);
+					const void* Data = Request->Readback->Lock(NumBytes);
+					FMemory::Memcpy(Request->LocalPositions.GetData(), Data, NumBytes);
+					Request->Readback->Unlock();
+					Request->Readback.Reset();
+					Request->State = FRequest::Ready;
+				}
+			});
+	}
+#endif
+	return Pending.Num();
+}
+
+void FXFSkinnedVertexReadback::Drain(double TimeoutSeconds)
+{
+	check(IsInGameThread());
+	const double StartTime = FPlatformTime::Seconds();
+	while (Poll() > 0)
+	{
+		if (FPlatformTime::Seconds() - StartTime > TimeoutSeconds)
+		{
+			UE_LOG(LogXF, Error, TEXT("Timed out waiting for %d skinned vertex readbacks, dropping them."), Pending.Num());
+			for (TSharedPtr<FRequest, ESPMode::ThreadSafe>& Request : Pending)
+			{
+				Request->OnComplete(TArray<FVector>());
+			}
+#if XF_WITH_SKIN_CACHE_READBACK
+			for (TSharedPtr<FRequest, ESPMode::ThreadSafe>& Request : Pending)
+			{
+				ENQUEUE_RENDER_COMMAND(XFSkinnedVertexReadbackRelease)(
+					[Request](FRHICommandListImmediate& RHICmdList)
+					{
+						Request->Readback.Reset();
+					});
+			}
+#endif
+			Pending.Empty();
+			return;
+		}
+		FlushRenderingCommands();
+		FPlatformProcess::Sleep(0.001f);
+	}
+}
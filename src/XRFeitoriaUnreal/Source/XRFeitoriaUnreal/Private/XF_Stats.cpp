@@ -0,0 +1,234 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "XF_Stats.h"
+#include "XF_AsyncWriteQueue.h"
+#include "XF_BlueprintFunctionLibrary.h"
+#include "MoviePipelineRenderShardSetting.h"
+#include "MoviePipeline.h"
+#include "MoviePipelineOutputSetting.h"
+#include "MoviePipelineMasterConfig.h"
+#include "MoviePipelineQueue.h"
+#include "MovieRenderPipelineDataTypes.h"
+#include "Interfaces/IPluginManager.h"
+#include "Misc/EngineVersion.h"
+#include "Misc/Paths.h"
+#include "Dom/JsonObject.h"
+#include "Serialization/JsonWriter.h"
+#include "Serialization/JsonSerializer.h"
+
+
+DEFINE_STAT(STAT_XF_ResolveBindings);
+DEFINE_STAT(STAT_XF_VertexExtraction);
+DEFINE_STAT(STAT_XF_Skinning);
+DEFINE_STAT(STAT_XF_Skeleton);
+DEFINE_STAT(STAT_XF_Encoding);
+DEFINE_STAT(STAT_XF_Projection);
+DEFINE_STAT(STAT_XF_Occlusion);
+DEFINE_STAT(STAT_XF_PathResolution);
+DEFINE_STAT(STAT_XF_FileWrite);
+DEFINE_STAT(STAT_XF_ImageWrite);
+DEFINE_STAT(STAT_XF_QueueStall);
+DEFINE_STAT(STAT_XF_SceneSweep);
+DEFINE_STAT(STAT_XF_WriteQueueDepth);
+DEFINE_STAT(STAT_XF_FilesCreated);
+DEFINE_STAT(STAT_XF_BytesWritten);
+
+static TAtomic<uint64> GXFStageCycles[(int32)EXFStage::Num];
+static TAtomic<uint64> GXFStageCalls[(int32)EXFStage::Num];
+static TAtomic<int64> GXFBytesWritten { 0 };
+static TAtomic<int64> GXFFilesCreated { 0 };
+static TAtomic<int32> GXFMaxQueueDepth { 0 };
+
+static thread_local uint8 GXFStageDepth[(int32)EXFStage::Num];
+
+bool FXFStats::EnterStage(EXFStage Stage)
+{
+	return GXFStageDepth[(int32)Stage]++ == 0;
+}
+
+void FXFStats::ExitStage(EXFStage Stage)
+{
+	GXFStageDepth[(int32)Stage]--;
+}
+
+void FXFStats::AddStageTime(EXFStage Stage, uint64 Cycles)
+{
+	GXFStageCycles[(int32)Stage] += Cycles;
+	GXFStageCalls[(int32)Stage]++;
+}
+
+void FXFStats::AddFileWrite(int64 NumBytes, bool bCreated)
+{
+	GXFBytesWritten += NumBytes;
+	INC_MEMORY_STAT_BY(STAT_XF_BytesWritten, NumBytes);
+	if (bCreated)
+	{
+		GXFFilesCreated++;
+		INC_DWORD_STAT(STAT_XF_FilesCreated);
+	}
+}
+
+void FXFStats::SetQueueDepth(int32 Depth)
+{
+	SET_DWORD_STAT(STAT_XF_WriteQueueDepth, Depth);
+	int32 MaxDepth = GXFMaxQueueDepth.Load();
+	while (Depth > MaxDepth && !GXFMaxQueueDepth.CompareExchange(MaxDepth, Depth)) {}
+}
+
+FXFStatsSnapshot FXFStats::Capture()
+{
+	FXFStatsSnapshot Snapshot;
+	for (int32 Idx = 0; Idx < (int32)EXFStage::Num; Idx++)
+	{
+		Snapshot.StageCycles[Idx] = GXFStageCycles[Idx].Load();
+		Snapshot.StageCalls[Idx] = GXFStageCalls[Idx].Load();
+	}
+	Snapshot.BytesWritten = GXFBytesWritten.Load();
+	Snapshot.FilesCreated = GXFFilesCreated.Load();
+	Snapshot.MaxQueueDepth = GXFMaxQueueDepth.Load();
+	return Snapshot;
+}
+
+void FXFStats::ResetMaxQueueDepth()
+{
+	GXFMaxQueueDepth = 0;
+}
+
+const TCHAR* FXFStats::GetStageName(EXFStage Stage)
+{
+	static const TCHAR* Names[] = {
+		TEXT("resolve_bindings"),
+		TEXT("vertex_extraction"),
+		TEXT("skinning"),
+		TEXT("skeleton"),
+		TEXT("encoding"),
+		TEXT("projection"),
+		TEXT("occlusion"),
+		TEXT("path_resolution"),
+		TEXT("file_write"),
+		TEXT("image_write"),
+		TEXT("queue_stall"),
+		TEXT("scene_sweep"),
+	};
+	static_assert(UE_ARRAY_COUNT(Names) == (int32)EXFStage::Num, "A name for each stage");
+	return Names[(int32)Stage];
+}
+
+
+static TMap<TWeakObjectPtr<UMoviePipeline>, TSharedRef<FXFShotStatsRecorder>> GXFShotStatsRecorders;
+
+TSharedRef<FXFShotStatsRecorder> FXFShotStatsRecorder::Get(UMoviePipeline* InPipeline)
+{
+	check(IsInGameThread());
+	check(InPipeline);
+
+	// drop the recorders of the finished pipelines
+	for (auto It = GXFShotStatsRecorders.CreateIterator(); It; ++It)
+	{
+		if (!It->Key.IsValid()) It.RemoveCurrent();
+	}
+
+	if (const TSharedRef<FXFShotStatsRecorder>* Recorder = GXFShotStatsRecorders.Find(InPipeline))
+	{
+		return *Recorder;
+	}
+	TSharedRef<FXFShotStatsRecorder> Recorder = MakeShared<FXFShotStatsRecorder>();
+	Recorder->Pipeline = InPipeline;
+	GXFShotStatsRecorders.Add(InPipeline, Recorder);
+	return Recorder;
+}
+
+void FXFShotStatsRecorder::RegisterOutput(const UObject* Output)
+{
+	Outputs.Add(Output);
+}
+
+void FXFShotStatsRecorder::BeginFrame(const FMoviePipelineFrameOutputState& OutputState)
+{
+	check(IsInGameThread());
+	FShotStats* Shot = Shots.Find(OutputState.ShotIndex);
+	if (!Shot)
+	{
+		Shot = &Shots.Add(OutputState.ShotIndex);
+		FXFStats::ResetMaxQueueDepth();
+		Shot->Start = FXFStats::Capture();
+		Shot->StartSeconds = FPlatformTime::Seconds();
+	}
+	Shot->OutputFrames.Add(OutputState.OutputFrameNumber);
+}
+
+void FXFShotStatsRecorder::FinishShot(const UObject* Output, int32 ShotIndex)
+{
+	check(IsInGameThread());
+	FShotStats* Shot = Shots.Find(ShotIndex);
+	if (!Shot) return;
+
+	Shot->FinishedOutputs.Add(Output);
+	if (Shot->FinishedOutputs.Num() < Outputs.Num()) return;
+
+	FShotStats FinishedShot = MoveTemp(*Shot);
+	Shots.Remove(ShotIndex);
+	WriteSummary(ShotIndex, MoveTemp(FinishedShot));
+}
+
+void FXFShotStatsRecorder::WriteSummary(int32 ShotIndex, FShotStats&& Shot)
+{
+	UMoviePipeline* MoviePipeline = Pipeline.Get();
+	if (!MoviePipeline || !MoviePipeline->GetActiveShotList().IsValidIndex(ShotIndex)) return;
+
+	const UMoviePipelineExecutorShot* ExecutorShot = MoviePipeline->GetActiveShotList()[ShotIndex];
+	FString ShotName = ExecutorShot->OuterName;
+	if (!ExecutorShot->InnerName.IsEmpty() && ExecutorShot->InnerName != ExecutorShot->OuterName)
+	{
+		ShotName += TEXT("_") + ExecutorShot->InnerName;
+	}
+	const UMoviePipelineOutputSetting* OutputSettings = MoviePipeline->GetPipelineMasterConfig()->FindSetting<UMoviePipelineOutputSetting>();
+	check(OutputSettings);
+	// the asset name of the job, the target sequence of the pipeline is a transient copy
+	const FString SequenceName = MoviePipeline->GetCurrentJob()->Sequence.GetAssetName();
+	const FString ShardSuffix = UMoviePipelineRenderShardSetting::GetContainerSuffix(MoviePipeline);
+	const FString Path = OutputSettings->OutputDirectory.Path / FPaths::MakeValidFileName(SequenceName)
+		/ TEXT("stats") / FPaths::MakeValidFileName(ShotName) + ShardSuffix + TEXT(".json");
+
+	TSharedRef<FJsonObject> Root = MakeShared<FJsonObject>();
+	Root->SetNumberField(TEXT("version"), 1);
+	TSharedPtr<IPlugin> Plugin = IPluginManager::Get().FindPlugin(TEXT("XRFeitoriaUnreal"));
+	Root->SetStringField(TEXT("plugin_version"), Plugin.IsValid() ? Plugin->GetDescriptor().VersionName : FString());
+	Root->SetStringField(TEXT("engine_version"), FEngineVersion::Current().ToString());
+	Root->SetStringField(TEXT("sequence"), SequenceName);
+	Root->SetStringField(TEXT("shot"), ShotName);
+	Root->SetStringField(TEXT("shard"), ShardSuffix);
+	Root->SetNumberField(TEXT("frames"), Shot.OutputFrames.Num());
+
+	// after the writes of the shot, the queue runs them in order. The json objects aren't thread safe, moved to the task
+	FXFAsyncWriteQueue::Get().Enqueue([Root = MoveTemp(Root), Path, Start = Shot.Start, StartSeconds = Shot.StartSeconds]()
+	{
+		const FXFStatsSnapshot End = FXFStats::Capture();
+		const double NumFrames = FMath::Max(Root->GetNumberField(TEXT("frames")), 1.0);
+		Root->SetNumberField(TEXT("wall_seconds"), FPlatformTime::Seconds() - StartSeconds);
+
+		TSharedRef<FJsonObject> Stages = MakeShared<FJsonObject>();
+		for (int32 Idx = 0; Idx < (int32)EXFStage::Num; Idx++)
+		{
+			const uint64 Calls = End.StageCalls[Idx] - Start.StageCalls[Idx];
+			if (Calls == 0) continue;
+			const double TotalMs = FPlatformTime::ToMilliseconds64(End.StageCycles[Idx] - Start.StageCycles[Idx]);
+			TSharedRef<FJsonObject> Stage = MakeShared<FJsonObject>();
+			Stage->SetNumberField(TEXT("calls"), (double)Calls);
+			Stage->SetNumberField(TEXT("total_ms"), TotalMs);
+			Stage->SetNumberField(TEXT("ms_per_frame"), TotalMs / NumFrames);
+			Stages->SetObjectField(FXFStats::GetStageName((EXFStage)Idx), Stage);
+		}
+		Root->SetObjectField(TEXT("stages"), Stages);
+		Root->SetNumberField(TEXT("bytes_written"), (double)(End.BytesWritten - Start.BytesWritten));
+		Root->SetNumberField(TEXT("files_created"), (double)(End.FilesCreated - Start.FilesCreated));
+		Root->SetNumberField(TEXT("max_write_queue_depth"), End.MaxQueueDepth);
+
+		FString Json;
+		const TSharedRef<TJsonWriter<>> Writer = TJsonWriterFactory<>::Create(&Json);
+		if (!FJsonSerializer::Serialize(Root, Writer)) return false;
+		const FTCHARToUTF8 Utf8(*Json);
+		return UXF_BlueprintFunctionLibrary::SaveBytesToFileAtomic(Utf8.Get(), Utf8.Length(), Path);
+	});
+}
@@ -0,0 +1,149 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "XF_VertexEncoding.h"
+#include "XF_Stats.h"
+#include "Math/Float16.h"
+
+
+static constexpr int32 MaxQuantizedValue = 65535;
+
+template<typename ValueType>
+static ValueType* InitFrame(const FXFVertexFrameHeader& Header, int32 NumValues, TArray<uint8>& OutFrame)
+{
+	OutFrame.SetNumUninitialized(sizeof(FXFVertexFrameHeader) + NumValues * sizeof(ValueType));
+	FMemory::Memcpy(OutFrame.GetData(), &Header, sizeof(FXFVertexFrameHeader));
+	return (ValueType*)(OutFrame.GetData() + sizeof(FXFVertexFrameHeader));
+}
+
+int32 FXFVertexEncoder::GetMaxFrameSize(int32 NumVertices, EMeshVertexEncoding Encoding)
+{
+	switch (Encoding)
+	{
+	case EMeshVertexEncoding::Float16:
+	case EMeshVertexEncoding::Fixed16:
+		return sizeof(FXFVertexFrameHeader) + NumVertices * 3 * sizeof(uint16);
+	default:
+		return NumVertices * 3 * sizeof(float);
+	}
+}
+
+void FXFVertexEncoder::Encode(TArrayView<const FVector> Positions, int32 FrameNumber, TArray<uint8>& OutFrame)
+{
+	XF_SCOPE_STAGE(Encoding);
+	FXFVertexFrameHeader Header;
+	Header.Encoding = (uint8)Settings.Encoding;
+	Header.NumVertices = Positions.Num();
+
+	switch (Settings.Encoding)
+	{
+	case EMeshVertexEncoding::Float16:
+	{
+		// float16 keeps 11 bits, offsets from the center of the actor instead of world positions far from the origin
+		const FVector Center = Positions.Num() > 0 ? FBox(Positions.GetData(), Positions.Num()).GetCenter() : FVector::ZeroVector;
+		for (int32 Axis = 0; Axis < 3; Axis++)
+		{
+			Header.Origin[Axis] = Center[Axis];
+		}
+		FFloat16* Out = InitFrame<FFloat16>(Header, Positions.Num() * 3, OutFrame);
+		for (const FVector& Position : Positions)
+		{
+			const FVector Offset = Position - Center;
+			*Out++ = FFloat16((float)Offset.X);
+			*Out++ = FFloat16((float)Offset.Y);
+			*Out++ = FFloat16((float)Offset.Z);
+		}
+		break;
+	}
+	case EMeshVertexEncoding::Fixed16:
+	{
+		const bool bIsKeyframeDue = Settings.KeyframeInterval <= 1 || FramesSinceKeyframe + 1 >= Settings.KeyframeInterval;
+		if (bIsKeyframeDue || Quantized.Num() != Positions.Num() * 3 || !EncodeDelta(Positions, Header, OutFrame))
+		{
+			EncodeKeyframe(Positions, Header, OutFrame);
+			FramesSinceKeyframe = 0;
+		}
+		else
+		{
+			FramesSinceKeyframe++;
+		}
+		break;
+	}
+	default:
+	{
+		// no header, same as SaveVectorArrayToByteFile
+		OutFrame.SetNumUninitialized(Positions.Num() * 3 * sizeof(float));
+		float* Out = (float*)OutFrame.GetData();
+		for (const FVector& Position : Positions)
+		{
+			*Out++ = Position.X;
+			*Out++ = Position.Y;
+			*Out++ = Position.Z;
+		}
+		break;
+	}
+	}
+	PreviousFrame = FrameNumber;
+}
+
+void FXFVertexEncoder::EncodeKeyframe(TArrayView<const FVector> Positions, FXFVertexFrameHeader& Header, TArray<uint8>& OutFrame)
+{
+	// the bounds of the actor at the keyframe, grown by the margin for the next frames
+	const FBox Bounds = FBox(Positions.GetData(), Positions.Num()).ExpandBy(Settings.QuantizationMargin);
+	Origin = Bounds.Min;
+	// the finest step covering the bounds, unless a coarser one is asked for (larger deltas fit in int8)
+	const float MinStep = FMath::Max(Settings.QuantizationStep, KINDA_SMALL_NUMBER);
+	Step = (Bounds.GetSize() / MaxQuantizedValue).ComponentMax(FVector(MinStep));
+
+	Header.bIsDelta = 0;
+	Header.ReferenceFrame = -1;
+	for (int32 Axis = 0; Axis < 3; Axis++)
+	{
+		Header.Origin[Axis] = Origin[Axis];
+		Header.Step[Axis] = Step[Axis];
+	}
+
+	Quantized.SetNumUninitialized(Positions.Num() * 3);
+	for (int32 Idx = 0; Idx < Positions.Num(); Idx++)
+	{
+		for (int32 Axis = 0; Axis < 3; Axis++)
+		{
+			const int32 Value = FMath::RoundToInt((Positions[Idx][Axis] - Origin[Axis]) / Step[Axis]);
+			Quantized[Idx * 3 + Axis] = (uint16)FMath::Clamp(Value, 0, MaxQuantizedValue);
+		}
+	}
+	uint16* Out = InitFrame<uint16>(Header, Quantized.Num(), OutFrame);
+	FMemory::Memcpy(Out, Quantized.GetData(), Quantized.Num() * sizeof(uint16));
+}
+
+bool FXFVertexEncoder::EncodeDelta(TArrayView<const FVector> Positions, FXFVertexFrameHeader& Header, TArray<uint8>& OutFrame)
+{
+	Header.bIsDelta = 1;
+	Header.ReferenceFrame = PreviousFrame;
+	for (int32 Axis = 0; Axis < 3; Axis++)
+	{
+		Header.Origin[Axis] = Origin[Axis];
+		Header.Step[Axis] = Step[Axis];
+	}
+
+	TArray<uint16> Next;
+	Next.SetNumUninitialized(Quantized.Num());
+	int8* Out = InitFrame<int8>(Header, Quantized.Num(), OutFrame);
+	for (int32 Idx = 0; Idx < Positions.Num(); Idx++)
+	{
+		for (int32 Axis = 0; Axis < 3; Axis++)
+		{
+			const int32 Value = FMath::RoundToInt((Positions[Idx][Axis] - Origin[Axis]) / Step[Axis]);
+			const int32 Delta = Value - Quantized[Idx * 3 + Axis];
+			if (Value < 0 || Value > MaxQuantizedValue || Delta < -127 || Delta > 127)
+			{
+				// left the bounds of the keyframe, or moved too much for a delta
+				return false;
+			}
+			Out[Idx * 3 + Axis] = (int8)Delta;
+			Next[Idx * 3 + Axis] = (uint16)Value;
+		}
+	}
+	Quantized = MoveTemp(Next);
+	return true;
+}
@@ -7,6 +7,9 @@
 #include "Settings/EditorProjectSettings.h"
 #include "CustomMoviePipelineOutput.h"
 #include "CustomMoviePipelineDeferredPass.h"
+#include "XF_AsyncWriteQueue.h"
+#include "XF_MaterialPreloader.h"
+#include "XF_SceneCellCache.h"
 
 #define LOCTEXT_NAMESPACE "FXRFeitoriaGearModule"
 
@@ -52,6 +55,9 @@ void FXRFeitoriaUnrealModule::ShutdownModule()
 {
 	// This function may be called during shutdown to clean up your module.  For modules that support dynamic reloading,
 	// we call this function before unloading the module.
+	FXFAsyncWriteQueue::Shutdown();
+	FXFSceneCellCache::SaveAll();
+	FXFMaterialPreloader::Release();
 }
 
 #undef LOCTEXT_NAMESPACE
@@ -24,6 +24,14 @@ enum class ECustomPPMType : uint8
 };
 
 
+class UPostProcessComponent;
+
+/**
+ * Sets the stencil values of the segmented actors and previews the annotations in the viewport.
+ * Doesn't tick: the stencil values are assigned when its properties are edited, by AssignStencilValues, or on BeginPlay
+ * with bSignStencilValueOnBeginPlay,
+ * and the preview material is swapped when PreviewAnnotationType is edited.
+ */
 UCLASS()
 class XRFEITORIAUNREAL_API AAnnotator : public AActor
 {
@@ -38,6 +46,13 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Annotations|Stencil Value",
 		meta = (EditCondition = "bManualSignStencilValue", EditConditionHides))
 		TArray<AActor*> SegmentObjects;
+	/**
+	 * Assign the stencil values again on BeginPlay (PIE and renders). Off by default, it overwrites the stencil values
+	 * set per actor, e.g. by the python API.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Annotations|Stencil Value",
+		meta = (EditCondition = "bSignStencilValue", EditConditionHides))
+		bool bSignStencilValueOnBeginPlay = false;
 
 
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Annotations")
@@ -47,16 +62,42 @@ public:
 		meta = (EditCondition = "PreviewAnnotationType == ECustomPPMType::Custom", EditConditionHides))
 		UMaterialInterface* CustomPostprocessMaterial;
 
+	/** Unbound post process of the preview, the material of PreviewAnnotationType. Editor only, disabled in game worlds. */
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = "Annotations")
+		UPostProcessComponent* PreviewPostProcess;
+
 public:
 	// Sets default values for this actor's properties
 	AAnnotator();
 
+	/**
+	 * Enable custom depth and set the stencil values of the meshes of the actors in one pass,
+	 * FirstStencilValue for the first actor, then one more for each. Custom depth stencils are 8 bit, the actors
+	 * after the 255th are skipped.
+	 * @param Actors: the actors to segment, every actor with a mesh in the level (sorted by name) when empty
+	 * @return the actor of each stencil value
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Annotations|Stencil Value",
+		meta = (WorldContext = "WorldContext"))
+		static TMap<int32, AActor*> AssignStencilValues(
+			const UObject* WorldContext,
+			const TArray<AActor*>& Actors,
+			int32 FirstStencilValue = 1,
+			bool bReceivesDecals = false);
+
+	/** AssignStencilValues of SegmentObjects with bManualSignStencilValue, else of every mesh in the level. */
+	UFUNCTION(BlueprintCallable, CallInEditor, Category = "Annotations|Stencil Value")
+		TMap<int32, AActor*> SignStencilValues();
+
+	/** Set the material of PreviewAnnotationType to the preview post process. */
+	UFUNCTION(BlueprintCallable, Category = "Annotations")
+		void UpdatePreviewAnnotation();
+
 protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
-
-public:
-	// Called every frame
-	virtual void Tick(float DeltaTime) override;
+#if WITH_EDITOR
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+#endif
 
 };
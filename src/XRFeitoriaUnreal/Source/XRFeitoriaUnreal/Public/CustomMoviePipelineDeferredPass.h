@@ -4,6 +4,7 @@
 
 #include "CoreMinimal.h"
 #include "MoviePipelineDeferredPasses.h"
+#include "CustomMoviePipelineOutput.h"
 #include "CustomMoviePipelineDeferredPass.generated.h"
 
 /**
@@ -14,6 +15,15 @@ class XRFEITORIAUNREAL_API UCustomMoviePipelineDeferredPass : public UMoviePipel
 {
 	GENERATED_BODY()
 
+public:
+	/**
+	 * A render pass of the material, without loading it: the material starts loading in the background
+	 * (see FXFMaterialPreloader), for the jobs queued before the render.
+	 * @param MaterialPath: package (/Game/PPM_depth) or object (/Game/PPM_depth.PPM_depth) path of the material
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Movie Render Pipeline")
+	static FCustomMoviePipelineRenderPass MakeRenderPass(const FString& MaterialPath, const FString& RenderPassName, ECustomImageFormat Extension);
+
 protected:
 	virtual void SetupImpl(const MoviePipeline::FMoviePipelineRenderPassInitSettings& InPassInitSettings) override;
 #if WITH_EDITOR
@@ -74,6 +74,12 @@ THIRD_PARTY_INCLUDES_END
 #include "MoviePipelineImageSequenceOutput.h"
 #include "CustomMoviePipelineOutput.generated.h"
 
+class FXFSceneBindingRegistry;
+class FXFOutputPathCache;
+class FXFResumeManifest;
+class FXFShotStatsRecorder;
+class FXFChunkedFileWriter;
+
 
 UENUM(BlueprintType)
 enum class ECustomImageFormat : uint8
@@ -85,7 +91,43 @@ enum class ECustomImageFormat : uint8
 	/** Windows Bitmap. */
 	BMP,
 	/** OpenEXR (HDR) image file format. */
-	EXR
+	EXR,
+	/** One OpenEXR file per frame, with every pass of this format as a layer. */
+	MultiLayerEXR
+};
+
+UENUM(BlueprintType)
+enum class ECustomEXRPrecision : uint8
+{
+	/** 16-bit float channels. */
+	Half = 0,
+	/** 32-bit float channels. */
+	Float
+};
+
+UENUM(BlueprintType)
+enum class ECustomEXRCompression : uint8
+{
+	None = 0,
+	/** Lossless, zlib on blocks of 16 scanlines. */
+	ZIP,
+	/** Lossless, wavelet based, good for noisy images. */
+	PIZ,
+	/** Lossy, DCT based, small files for the color passes. */
+	DWAA
+};
+
+UENUM(BlueprintType)
+enum class ECustomPassEncoding : uint8
+{
+	/** Written as rendered, in the format of Extension. */
+	Default = 0,
+	/** Mask colors mapped back to stencil values (index in mask_colors.json), single-channel 8-bit PNG. */
+	Stencil8,
+	/** Same as Stencil8, as a single-channel 16-bit PNG. */
+	Stencil16,
+	/** R channel only, as a single-channel (Y) half float EXR. */
+	DepthHalf
 };
 
 USTRUCT(BlueprintType)
@@ -107,10 +149,130 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Render Pass")
 	ECustomImageFormat Extension;
 
+	/**
+	 * Passed as is to the image wrapper of the engine, see EImageCompressionQuality.
+	 * JPEG: quality, 1 to 100, 0 for the default (85).
+	 * PNG (and the stencil masks), EXR: 1 (Uncompressed) writes the image uncompressed,
+	 * any other value uses the default compression of the format, there's no zlib level.
+	 * BMP: ignored.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Render Pass", meta = (ClampMin = 0, ClampMax = 100))
+	int32 CompressionQuality = 100;
+
+	/** Compact encoding of annotation passes, overrides Extension. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Render Pass")
+	ECustomPassEncoding Encoding = ECustomPassEncoding::Default;
+
+	/** Precision of the channels of this pass, when written as a layer of a MultiLayerEXR. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Render Pass")
+	ECustomEXRPrecision EXRPrecision = ECustomEXRPrecision::Half;
+
 	FString SPassName;
 
 };
 
+#if WITH_UNREALEXR
+/**
+ * Writes several passes of a frame as the layers of one OpenEXR file, channels named {layer}.R/G/B/A.
+ * Every layer must have the same size.
+ */
+class XRFEITORIAUNREAL_API FCustomMultiLayerEXRWriteTask : public IImageWriteTaskBase
+{
+public:
+	struct FLayer
+	{
+		/** Empty for the channels of a single layer file. */
+		FString Name;
+		TUniquePtr<FImagePixelData> PixelData;
+		ECustomEXRPrecision Precision = ECustomEXRPrecision::Half;
+		/** RGBA, or R only (written as Y). */
+		int32 NumChannels = 4;
+	};
+
+	FString Filename;
+	ECustomEXRCompression Compression = ECustomEXRCompression::ZIP;
+	TArray<FLayer> Layers;
+
+	virtual bool RunTask() override;
+	virtual void OnAbandoned() override {}
+};
+#endif // WITH_UNREALEXR
+
+/** Encode time and size of the files written for each render pass, filled on the image write threads. */
+class XRFEITORIAUNREAL_API FCustomEncodeStats
+{
+public:
+	struct FPassStats
+	{
+		int32 NumFiles = 0;
+		double EncodeSeconds = 0.0;
+		int64 NumBytes = 0;
+	};
+
+	void Add(const FString& PassName, double EncodeSeconds, int64 NumBytes);
+	TMap<FString, FPassStats> GetStats() const;
+	void Reset();
+
+private:
+	mutable FCriticalSection CriticalSection;
+	TMap<FString, FPassStats> Stats;
+};
+
+/** Writes a mask pass as a single-channel PNG of the stencil value of each pixel. Unknown colors are 0. */
+class XRFEITORIAUNREAL_API FCustomStencilImageWriteTask : public IImageWriteTaskBase
+{
+public:
+	FString Filename;
+	TUniquePtr<FImagePixelData> PixelData;
+	TSharedPtr<const TMap<FColor, uint8>, ESPMode::ThreadSafe> MaskColorToStencil;
+	/** 8 or 16 */
+	int32 BitDepth = 8;
+	int32 CompressionQuality = 0;
+	/** For float pixel data, same as the quantization of the 8-bit mask images. */
+	bool bConvertToSrgb = true;
+
+	virtual bool RunTask() override;
+	virtual void OnAbandoned() override {}
+};
+
+/**
+ * Quantizes the pixel data to 8 bits on the image write thread, then runs the write task.
+ * The pixel preprocessors of the task (e.g. burn in compositing) see the quantized data, same as when quantized on the game thread.
+ */
+class XRFEITORIAUNREAL_API FCustomQuantizeImageWriteTask : public IImageWriteTaskBase
+{
+public:
+	FCustomQuantizeImageWriteTask(TUniquePtr<FImageWriteTask>&& InTask, TUniquePtr<FImagePixelData>&& InSourcePixelData, bool bInConvertToSrgb)
+		: Task(MoveTemp(InTask)), SourcePixelData(MoveTemp(InSourcePixelData)), bConvertToSrgb(bInConvertToSrgb)
+	{}
+
+	virtual bool RunTask() override;
+	virtual void OnAbandoned() override { Task->OnAbandoned(); }
+
+private:
+	TUniquePtr<FImageWriteTask> Task;
+	TUniquePtr<FImagePixelData> SourcePixelData;
+	bool bConvertToSrgb = true;
+};
+
+/** Runs an image write task, and records how long it took to encode and write. */
+class XRFEITORIAUNREAL_API FCustomTimedImageWriteTask : public IImageWriteTaskBase
+{
+public:
+	FCustomTimedImageWriteTask(TUniquePtr<IImageWriteTaskBase>&& InTask, const FString& InPassName, const FString& InFilename, const TSharedRef<FCustomEncodeStats, ESPMode::ThreadSafe>& InStats)
+		: Task(MoveTemp(InTask)), PassName(InPassName), Filename(InFilename), Stats(InStats)
+	{}
+
+	virtual bool RunTask() override;
+	virtual void OnAbandoned() override { Task->OnAbandoned(); }
+
+private:
+	TUniquePtr<IImageWriteTaskBase> Task;
+	FString PassName;
+	FString Filename;
+	TSharedRef<FCustomEncodeStats, ESPMode::ThreadSafe> Stats;
+};
+
 /**
  *
  */
@@ -129,6 +291,13 @@ public:
 	}
 	virtual void SetupForPipelineImpl(UMoviePipeline* InPipeline);
 	virtual void OnReceiveImageDataImpl(FMoviePipelineMergerOutputFrame* InMergedOutputFrame) override;
+	virtual void BeginFinalizeImpl() override;
+	virtual void TeardownForPipelineImpl(UMoviePipeline* InPipeline) override;
+#if ENGINE_MAJOR_VERSION == 5
+	virtual void OnShotFinishedImpl(const UMoviePipelineExecutorShot* InShot, const bool bFlushToDisk) override;
+#else
+	virtual void OnShotFinishedImpl(const UMoviePipelineExecutorShot* InShot) override;
+#endif
 
 public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RenderPasses|RGB")
@@ -140,22 +309,77 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RenderPasses|RGB")
 		ECustomImageFormat Extension_RGB = ECustomImageFormat::PNG;
 
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RenderPasses|RGB")
+		ECustomEXRPrecision EXRPrecision_RGB = ECustomEXRPrecision::Half;
+
+	/** Compression of the RGB pass, see FCustomMoviePipelineRenderPass::CompressionQuality. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RenderPasses|RGB", meta = (ClampMin = 0, ClampMax = 100))
+		int32 CompressionQuality_RGB = 100;
+
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RenderPasses|Additional")
 		TArray<FCustomMoviePipelineRenderPass> AdditionalRenderPasses;
 
+	/** {render_pass} of the file holding the MultiLayerEXR passes of a frame. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RenderPasses|MultiLayerEXR")
+		FString RenderPassName_MultiLayerEXR = "layers";
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RenderPasses|MultiLayerEXR")
+		ECustomEXRCompression MultiLayerEXRCompression = ECustomEXRCompression::ZIP;
+
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RenderPasses|Camera")
 		FString DirectoryActorInfo = "actor_infos";
 
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RenderPasses|Camera")
 		FString DirectoryCameraInfo = "camera_params";
 
+	/**
+	 * Also save the camera parameters of every frame, for animated cameras.
+	 * They are written each frame to DirectoryCameraInfo/{camera_name}.xfc (a chunked shot file, see XF_ChunkedFile.h).
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "RenderPasses|Camera")
+		bool bSaveCameraInfoPerFrame = false;
+
+	/** Skip the frames the resume manifest of the shot lists as complete, written by a previous render. See XF_ResumeManifest.h. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Resume")
+		bool bSkipCompletedFrames = false;
+
+public:
+	/** Location, rotation (roll, pitch, yaw), FOV and resolution of the camera. */
+	static TArray<float> GetCameraInfo(ACameraActor* Camera, const FIntPoint& Resolution);
+
 private:
 	FString GetOutputPath(FString PassName, FString Ext, const FMoviePipelineFrameOutputState* InOutputState);
+	/** Register a write of the background write queue as an output future of the pipeline. */
+	void SaveInfoAsync(TFuture<bool>&& Future, const FString& PassName, const FString& FilePath, const FMoviePipelineFrameOutputState* InOutputState);
+	/** Write the stencil value of an actor on the background write queue, atomically, see SaveBytesToFileAtomic. */
+	TFuture<bool> EnqueueActorInfo(float StencilValue, const FString& Path);
+	/** Register a write of the frame as an output future of the pipeline, and in the resume manifest. */
+	void AddFrameOutputFuture(TFuture<bool>&& Future, const MoviePipeline::FMoviePipelineOutputFutureData& OutputData, const FMoviePipelineFrameOutputState* InOutputState);
+	/** Create the directories of the camera parameters and actor infos on the write queue, ahead of their writes. */
+	void PrecreateOutputDirectories(const FMoviePipelineFrameOutputState* InOutputState);
+	/** Write the camera parameters of this frame into the shot files of the cameras, on the write queue. */
+	void RecordCameraInfo(const FIntPoint& Resolution, const FMoviePipelineFrameOutputState* InOutputState);
+	/** Close the shot files of the cameras after their queued records, at the end of the shot. */
+	void CloseCameraRecords();
 
 private:
-	TArray<FSequencerBoundObjects> boundObjects;
-	TArray<ACameraActor*> Cameras;
-	TArray<UStaticMeshComponent*> StaticMeshComponents;
-	TArray<USkeletalMeshComponent*> SkeletalMeshComponents;
+	/** Cameras and meshes of the sequence, see FXFSceneBindingRegistry. */
+	TSharedPtr<FXFSceneBindingRegistry> SceneBindings;
+	/** Output directory / file name format of the output setting, resolved by PathCache. */
+	FString OutputFormatString;
+	TSharedPtr<FXFOutputPathCache> PathCache;
+	TSharedPtr<FXFResumeManifest, ESPMode::ThreadSafe> ResumeManifest;
+	/** Per-shot timings, bytes and files, see XF_Stats.h. */
+	TSharedPtr<FXFShotStatsRecorder> ShotStats;
+	/** Suffix of the camera records of a shard and the offset of the frame numbers of a shard or resumed render, see UMoviePipelineRenderShardSetting. */
+	FString ContainerSuffix;
+	int32 OutputFrameOffset = 0;
 	bool bIsFirstFrame = true;
+	/** Loaded in SetupForPipelineImpl when a pass uses a stencil encoding. */
+	TSharedPtr<const TMap<FColor, uint8>, ESPMode::ThreadSafe> MaskColorToStencil;
+	/** Whether this is the last output of the pipeline, see SetupForPipelineImpl. */
+	bool bMovePixelData = false;
+	TSharedRef<FCustomEncodeStats, ESPMode::ThreadSafe> EncodeStats = MakeShared<FCustomEncodeStats, ESPMode::ThreadSafe>();
+	/** Shot files of the cameras, keyed by path. */
+	TMap<FString, TSharedPtr<FXFChunkedFileWriter>> CameraRecords;
 };
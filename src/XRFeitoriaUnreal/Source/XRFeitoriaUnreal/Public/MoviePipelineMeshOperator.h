@@ -25,16 +25,123 @@
 #include "LevelSequence.h"
 #include "Components/StaticMeshComponent.h"
 #include "Components/SkeletalMeshComponent.h"
+#include "XF_BlueprintFunctionLibrary.h"
+#include "XF_OcclusionQuery.h"
+#include "XF_MeshProjection.h"
+#include "XF_VertexEncoding.h"
 
 #include "CoreMinimal.h"
 #include "MoviePipelineOutputBase.h"
 #include "MovieRenderPipelineDataTypes.h"
 #include "MoviePipelineMeshOperator.generated.h"
 
+class FXFChunkedFileWriter;
+class FXFSkinnedVertexReadback;
+class FXFAsyncOcclusionQuery;
+class FXFSceneBindingRegistry;
+class FXFOutputPathCache;
+class FXFResumeManifest;
+class FXFShotStatsRecorder;
+class ACameraActor;
+
 /**
  *
  */
 
+UENUM(BlueprintType)
+enum class EMeshOperatorOutputMode : uint8
+{
+	/** One .dat file per mesh per frame. */
+	PerFrameFile = 0,
+	/** One preallocated chunked file (.xfc) per mesh per shot, with a frame index and fixed-stride records. */
+	ShotContainer
+};
+
+UENUM(BlueprintType)
+enum class EMeshOcclusionMethod : uint8
+{
+	/** Trace a line from every camera to every point, on the physics scene. */
+	LineTrace = 0,
+	/**
+	 * Project the points into the camera of the frame and compare them with its depth and mask passes,
+	 * which must be enabled in CustomMoviePipelineOutput. Points outside of the image are OutOfView.
+	 */
+	DepthBuffer
+};
+
+/** Bone indices of a skeletal mesh component, looked up once by name. */
+struct FXFSkeletonBones
+{
+	TArray<int32> BoneIndices;
+	TArray<FName> BoneNames;
+};
+
+/**
+ * Subset and encoding of the exported vertices. The defaults export every vertex as raw float32.
+ * Encoded frames start with a header, see XF_VertexEncoding.h, decoded by `xrfeitoria/utils/vertex_encoding.py`.
+ */
+USTRUCT(BlueprintType)
+struct XRFEITORIAUNREAL_API FMeshVertexExportOption
+{
+	GENERATED_BODY()
+
+public:
+	/** Export every SampleRate-th vertex, like SampleRate of DetectOcclusionMesh. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Vertex Export", meta = (ClampMin = 1))
+		int32 SampleRate = 1;
+	/** Export these vertices only (e.g. landmarks), in this order. Overrides SampleRate. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Vertex Export")
+		TArray<int32> VertexIndices;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Vertex Export")
+		EMeshVertexEncoding Encoding = EMeshVertexEncoding::Float32;
+	/** Fixed16 only: a keyframe every KeyframeInterval frames, the frames in between are int8 deltas of the previous frame. 0 for keyframes only. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Vertex Export", meta = (ClampMin = 0))
+		int32 KeyframeInterval = 0;
+	/** Fixed16 only: margin (cm) around the bounds of the actor at the keyframe. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Vertex Export", meta = (ClampMin = 0))
+		float QuantizationMargin = 50.f;
+	/** Fixed16 only: min quantization step (cm), 0 for the finest step covering the bounds. A coarser step keeps faster motion in the deltas. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Vertex Export", meta = (ClampMin = 0))
+		float QuantizationStep = 0.f;
+
+	bool IsSubset() const { return VertexIndices.Num() > 0 || SampleRate > 1; }
+
+	FXFVertexEncodingSettings GetEncodingSettings() const
+	{
+		FXFVertexEncodingSettings Settings;
+		Settings.Encoding = Encoding;
+		Settings.KeyframeInterval = KeyframeInterval;
+		Settings.QuantizationMargin = QuantizationMargin;
+		Settings.QuantizationStep = QuantizationStep;
+		return Settings;
+	}
+
+	/** Keep the exported vertices of Vertices, in place. Out of range indices are skipped. */
+	template<typename VectorType>
+	void SelectVertices(TArray<VectorType>& Vertices) const
+	{
+		if (!IsSubset()) return;
+		TArray<VectorType> Selected;
+		if (VertexIndices.Num() > 0)
+		{
+			Selected.Reserve(VertexIndices.Num());
+			for (const int32 Idx : VertexIndices)
+			{
+				if (Vertices.IsValidIndex(Idx)) Selected.Add(Vertices[Idx]);
+			}
+		}
+		else
+		{
+			Selected.Reserve(FMath::DivideAndRoundUp(Vertices.Num(), SampleRate));
+			for (int32 Idx = 0; Idx < Vertices.Num(); Idx += SampleRate)
+			{
+				Selected.Add(Vertices[Idx]);
+			}
+		}
+		Vertices = MoveTemp(Selected);
+	}
+};
+
 USTRUCT(BlueprintType)
 struct XRFEITORIAUNREAL_API FMeshOperatorOption
 {
@@ -45,14 +152,32 @@ public:
 		bool bEnabled = true;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
 		bool bSaveVerticesPosition = true;
-	//UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
-	//	bool bSaveOcclusionResult = true;
-	//UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
-	//	bool bSaveOcclusionRate = true;
+	/** Save the EOcclusion (uint8) of every vertex from every camera, traced asynchronously. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
+		bool bSaveOcclusionResult = false;
+	/** Save the non / self / inter occlusion rates of the vertices from every camera. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
+		bool bSaveOcclusionRate = false;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
 		FString DirectoryVertices = "vertices";
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
+		FString DirectoryOcclusion = "occlusion";
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
+		FString DirectoryOcclusionRate = "occlusion_rate";
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
 		int32 LODIndex = 0;
+	/**
+	 * For meshes that only move rigidly: save the local vertices once to DirectoryVertices/{actor}/local.bin,
+	 * and a 4x4 local-to-world matrix (row-major, translation in the last row) per frame instead of the world vertices.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
+		bool bSaveRigidTransform = false;
+	/**
+	 * Subset and encoding of the vertices. With bSaveRigidTransform only the subset applies,
+	 * local.bin is always saved as raw float32 (num_vertices x 3, local space).
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
+		FMeshVertexExportOption VertexExport = FMeshVertexExportOption();
 };
 
 
@@ -68,16 +193,69 @@ public:
 		bool bSaveVerticesPosition = true;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
 		bool bSaveSkeletonPosition = true;
-	//UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
-	//	bool bSaveOcclusionResult = true;
-	//UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
-	//	bool bSaveOcclusionRate = true;
+	/** Save the world space rotation of every bone as a quaternion (x, y, z, w), read along with the positions. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
+		bool bSaveSkeletonRotation = false;
+	/** Save the EOcclusion (uint8) of every bone from every camera, traced asynchronously. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
+		bool bSaveOcclusionResult = false;
+	/** Save the non / self / inter occlusion rates of the bones from every camera. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
+		bool bSaveOcclusionRate = false;
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
 		FString DirectoryVertices = "vertices";
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
+		FString DirectoryOcclusion = "occlusion";
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
+		FString DirectoryOcclusionRate = "occlusion_rate";
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
 		FString DirectorySkeleton = "skeleton";
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
+		FString DirectorySkeletonRotation = "skeleton_rotation";
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
 		int32 LODIndex = 0;
+	/**
+	 * Read the skinned vertices back from the GPU skin cache instead of skinning them on the CPU (UE 5.1+, needs r.SkinCache.CompileShaders=1).
+	 * Meshes that are not in the skin cache, or not rendered at LODIndex, fall back to CPU skinning.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
+		bool bUseGPUSkinCache = false;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Occlusion Checker")
+		FMeshVertexExportOption VertexExport = FMeshVertexExportOption();
+};
+
+/**
+ * 2D keypoints and bounding boxes of the meshes projected into every camera, with the same pinhole model as the camera parameters.
+ * For detection datasets they replace reading the vertices back to project them. Files are written like the vertices, see OutputMode:
+ * - DirectoryKeypoints2D/{camera_name}/{actor_name}: (u, v, EXFKeypointFlag) per bone of the skeletal meshes
+ * - DirectoryBoundingBox2D/{camera_name}/{actor_name}: x_min, y_min, x_max, y_max (clipped to the image), ratio of the points inside the image
+ * - DirectoryBoundingBox3D/{actor_name}: x_min, y_min, z_min, x_max, y_max, z_max in world space
+ */
+USTRUCT(BlueprintType)
+struct XRFEITORIAUNREAL_API FMeshProjectionOption
+{
+	GENERATED_BODY()
+
+public:
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Projection")
+		bool bEnabled = false;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Projection")
+		bool bSaveKeypoints2D = true;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Projection")
+		bool bSaveBoundingBox2D = true;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Projection")
+		bool bSaveBoundingBox3D = true;
+	/** Bound the vertices (at the LODIndex of the mesh option) of the skeletal meshes, instead of their bones. Static meshes always use their vertices. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Projection")
+		bool bUseVerticesForBoundingBox = true;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Projection")
+		FString DirectoryKeypoints2D = "keypoints2d";
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Projection")
+		FString DirectoryBoundingBox2D = "bbox2d";
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Projection")
+		FString DirectoryBoundingBox3D = "bbox3d";
+
+	bool NeedsBoundingBox() const { return bEnabled && (bSaveBoundingBox2D || bSaveBoundingBox3D); }
 };
 
 UCLASS(Blueprintable)
@@ -91,18 +269,109 @@ public:
 	virtual void SetupForPipelineImpl(UMoviePipeline* InPipeline);
 	virtual void OnReceiveImageDataImpl(FMoviePipelineMergerOutputFrame* InMergedOutputFrame) override;
 	virtual void BeginExportImpl() override;
+	virtual void BeginFinalizeImpl() override;
+	virtual bool HasFinishedProcessingImpl() override;
+#if ENGINE_MAJOR_VERSION == 5
+	virtual void OnShotFinishedImpl(const UMoviePipelineExecutorShot* InShot, const bool bFlushToDisk) override;
+#else
+	virtual void OnShotFinishedImpl(const UMoviePipelineExecutorShot* InShot) override;
+#endif
 private:
 	FString GetOutputPath(FString PassName, FString Ext, const FMoviePipelineFrameOutputState* InOutputState);
+	/**
+	 * Save the positions of a mesh for this frame as float32, either to its own .dat file or into the shot container, according to OutputMode.
+	 * The array is moved to the background write queue, and the write is registered as an output future of the pipeline.
+	 */
+	void SaveMeshData(TArray<FVector>&& Positions, const FString& Directory, const FString& MeshName, const FMoviePipelineFrameOutputState* InOutputState);
+	/** Same as above, encoded by the vertex encoder of the file sequence unless the encoding is raw float32. */
+	void SaveMeshData(TArray<FVector>&& Positions, const FXFVertexEncodingSettings& Encoding, const FString& Directory, const FString& MeshName, const FMoviePipelineFrameOutputState* InOutputState);
+	/** Same as above, for records of ElementComponents floats per element. */
+	void SaveMeshData(TArray<float>&& FloatArray, int32 ElementComponents, const FString& Directory, const FString& MeshName, const FMoviePipelineFrameOutputState* InOutputState);
+	/** Find or create the container of the shot for the mesh file at FramePath. */
+	TSharedPtr<FXFChunkedFileWriter> GetShotContainer(const FString& FramePath, int32 ElementComponents, const FMoviePipelineFrameOutputState* InOutputState);
+	void CloseShotContainers();
+	/** Trace the occlusion of the points from every camera, the results are saved once the traces are done. */
+	void RequestOcclusion(TArray<FVector>&& Points, bool bSaveOcclusionResult, bool bSaveOcclusionRate, const FString& DirectoryOcclusion, const FString& DirectoryOcclusionRate,
+		UPrimitiveComponent* Comp, const FString& MeshName, const FMoviePipelineFrameOutputState* InOutputState);
+	void SaveOcclusion(FXFOcclusionResult&& Result, bool bSaveOcclusionResult, bool bSaveOcclusionRate, const FString& DirectoryOcclusion, const FString& DirectoryOcclusionRate,
+		const FString& CameraName, const FString& MeshName, const FMoviePipelineFrameOutputState* InOutputState);
+	/** Find the depth and mask passes of the frame and the camera they were rendered from. */
+	bool SetupDepthOcclusionView(FMoviePipelineMergerOutputFrame* InMergedOutputFrame);
+	/**
+	 * Save the keypoints and bounding boxes of ProjectionOption, from the points of the mesh for this frame.
+	 * Projections are the cameras of the frame, CameraProjections or a copy for a readback saved later.
+	 */
+	void SaveProjection(TArrayView<const FXFCameraProjection> Projections, TArrayView<const FVector> Keypoints, TArrayView<const FVector> BoxPoints,
+		bool bSaveBoundingBoxes, const FString& MeshName, const FMoviePipelineFrameOutputState* InOutputState);
+	/** Create the directories the enabled options write into during the shot, ahead of the first write. */
+	void PrecreateOutputDirectories(const FMoviePipelineFrameOutputState* InOutputState);
+	/** Register a write of the frame as an output future of the pipeline, and in the resume manifest. */
+	void AddFrameOutputFuture(TFuture<bool>&& Future, const MoviePipeline::FMoviePipelineOutputFutureData& OutputData, const FMoviePipelineFrameOutputState* InOutputState);
+
+public:
+	/** Number of mesh writes waiting in the background write queue. */
+	UFUNCTION(BlueprintPure, Category = "Mesh Operator")
+		int32 GetWriteQueueDepth() const;
 
 public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Mesh Operator")
 		FMeshOperatorOption StaticMeshOperatorOption = FMeshOperatorOption();
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Mesh Operator")
 		FSkeletalMeshOperatorOption SkeletalMeshOperatorOption = FSkeletalMeshOperatorOption();
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Mesh Operator")
+		FMeshProjectionOption ProjectionOption = FMeshProjectionOption();
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Mesh Operator")
+		EMeshOperatorOutputMode OutputMode = EMeshOperatorOutputMode::PerFrameFile;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Mesh Operator")
+		EMeshOcclusionMethod OcclusionMethod = EMeshOcclusionMethod::LineTrace;
+	/** Render pass names (RenderPassName in CustomMoviePipelineOutput) of the depth and mask, for the DepthBuffer occlusion. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Mesh Operator")
+		FString DepthPassName = "depth";
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Mesh Operator")
+		FString MaskPassName = "mask";
+	/** Size of one unit of the depth pass in cm, 1 when the depth material outputs the scene depth. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Mesh Operator")
+		float DepthUnitInCm = 1.f;
+	/** Points less than this distance (cm) behind the scene depth are still visible, like MeshThickness of the line traces. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Mesh Operator")
+		float DepthTolerance = 5.f;
+	/** Skip the frames the resume manifest of the shot lists as complete, written by a previous render. See XF_ResumeManifest.h. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Mesh Operator")
+		bool bSkipCompletedFrames = false;
 
 private:
-	TArray<FSequencerBoundObjects> boundObjects;
-	TArray<UStaticMeshComponent*> StaticMeshComponents;
-	TArray<USkeletalMeshComponent*> SkeletalMeshComponents;
+	/** Cameras and meshes of the sequence, see FXFSceneBindingRegistry. */
+	TSharedPtr<FXFSceneBindingRegistry> SceneBindings;
+	/** Output directory / file name format of the output setting, resolved by PathCache. */
+	FString OutputFormatString;
+	TSharedPtr<FXFOutputPathCache> PathCache;
+	TSharedPtr<FXFResumeManifest, ESPMode::ThreadSafe> ResumeManifest;
+	/** Per-shot timings, bytes and files, see XF_Stats.h. */
+	TSharedPtr<FXFShotStatsRecorder> ShotStats;
+	/** Suffix of the containers and offset of their frame numbers when the pipeline renders a shard, see UMoviePipelineRenderShardSetting. */
+	FString ContainerSuffix;
+	int32 OutputFrameOffset = 0;
+	/** Output resolution, for the projections. */
+	FIntPoint OutputResolution = FIntPoint(1920, 1080);
+	/** Projection of each camera of SceneBindings for the current frame, only valid during OnReceiveImageDataImpl. */
+	TArray<FXFCameraProjection> CameraProjections;
+	/** Bones of the skeletal meshes, in the order of BoneName.txt, built once in SetupForPipelineImpl. */
+	TMap<USkeletalMeshComponent*, FXFSkeletonBones> SkeletonBones;
+	/** Local vertices of the static meshes, built once in SetupForPipelineImpl. */
+	TMap<UStaticMeshComponent*, TArray<FXFVector3f>> StaticMeshLocalVertices;
+	/** The exported subset of StaticMeshLocalVertices, only when StaticMeshOperatorOption.VertexExport selects a subset. */
+	TMap<UStaticMeshComponent*, TArray<FXFVector3f>> StaticMeshExportVertices;
+	/** Keyed by the directory of the frame files, or the path of the shot container. Reset with the shot containers. */
+	TMap<FString, TSharedPtr<FXFVertexEncoder>> VertexEncoders;
+	TMap<FString, TSharedPtr<FXFChunkedFileWriter>> ShotContainers;
+	TSharedPtr<FXFSkinnedVertexReadback> SkinnedVertexReadback;
+	TSharedPtr<FXFAsyncOcclusionQuery> OcclusionQuery;
+	/** Only valid during OnReceiveImageDataImpl, points to the pixel data of the frame. */
+	FXFDepthOcclusionView DepthOcclusionView;
+	ACameraActor* DepthOcclusionCamera = nullptr;
+	TMap<FColor, uint8> MaskColorToStencil;
+	bool bWarnedDepthOcclusion = false;
 	bool bIsFirstFrame = true;
+	/** Shot whose output directories were created by PrecreateOutputDirectories. */
+	int32 PrecreatedShotIndex = INDEX_NONE;
 };
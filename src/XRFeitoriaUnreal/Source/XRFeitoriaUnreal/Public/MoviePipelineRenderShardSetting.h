@@ -0,0 +1,46 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "MoviePipelineSetting.h"
+#include "MoviePipelineRenderShardSetting.generated.h"
+
+class UMoviePipeline;
+
+/**
+ * One slice of the playback range of a sequence rendered across several machines, see shard_index / shard_count of the render job.
+ *
+ * The slice itself is the custom playback range of the output setting, set by the python side.
+ * With this setting the outputs write one container per shard ({actor_name}_shard{index}of{count}.xfc), merged afterwards
+ * by `xrfeitoria.utils.chunked_file.merge_shards`, and the per-shot metadata is written so that any shard may write it.
+ */
+UCLASS(Blueprintable)
+class XRFEITORIAUNREAL_API UMoviePipelineRenderShardSetting : public UMoviePipelineSetting
+{
+	GENERATED_BODY()
+
+public:
+#if WITH_EDITOR
+	virtual FText GetDisplayText() const override { return NSLOCTEXT("MovieRenderPipeline", "RenderShardSetting_DisplayText", "Render Shard"); }
+#endif
+	virtual bool IsValidOnShots() const override { return false; }
+
+	/** The shard setting of the pipeline, null when it renders the whole sequence. */
+	static const UMoviePipelineRenderShardSetting* Find(UMoviePipeline* Pipeline);
+	/** Suffix of the shot containers of the pipeline, empty when it isn't sharded. */
+	static FString GetContainerSuffix(UMoviePipeline* Pipeline);
+	/**
+	 * Number of output frames between the start of the sequence and the first frame of the pipeline, when it renders
+	 * a custom playback range. Added to the frame numbers of the containers, so they're the same as the ones of a whole render.
+	 */
+	static int32 GetOutputFrameOffset(UMoviePipeline* Pipeline);
+
+	bool IsSharded() const { return ShardCount > 1; }
+
+public:
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Render Shard", meta = (ClampMin = 0))
+		int32 ShardIndex = 0;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Render Shard", meta = (ClampMin = 1))
+		int32 ShardCount = 1;
+};
@@ -0,0 +1,89 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "MoviePipelineOutputBase.h"
+#include "MovieRenderPipelineDataTypes.h"
+#include "XF_SharedFrameRing.h"
+#include "MoviePipelineSharedMemoryOutput.generated.h"
+
+class FXFSceneBindingRegistry;
+class USkeletalMeshComponent;
+
+/**
+ * Publish the render passes, camera parameters, bones and vertices of every frame into a shared memory ring,
+ * read by `xrfeitoria.utils.shared_memory.SharedFrameReader` while the render is running, without going through the disk.
+ * Works next to CustomMoviePipelineOutput and MoviePipelineMeshOperator, or on its own.
+ *
+ * Each frame is a set of named arrays:
+ *   {render_pass_name}      (H, W, 4), uint8 BGRA / float16 RGBA / float32 RGBA, as rendered
+ *   camera/{camera_name}    (9,) float32, same as camera_params of CustomMoviePipelineOutput
+ *   skeleton/{actor_name}   (bones, 3) float32, same order as BoneName.txt of MoviePipelineMeshOperator
+ *   vertices/{actor_name}   (verts, 3) float32
+ */
+UCLASS(Blueprintable)
+class XRFEITORIAUNREAL_API UMoviePipelineSharedMemoryOutput : public UMoviePipelineOutputBase
+{
+	GENERATED_BODY()
+
+public:
+#if WITH_EDITOR
+	virtual FText GetDisplayText() const override { return NSLOCTEXT("MovieRenderPipeline", "SharedMemoryOutput_DisplayText", "Shared Memory Output"); }
+#endif
+	virtual void SetupForPipelineImpl(UMoviePipeline* InPipeline);
+	virtual void OnReceiveImageDataImpl(FMoviePipelineMergerOutputFrame* InMergedOutputFrame) override;
+	virtual void BeginFinalizeImpl() override;
+	virtual void TeardownForPipelineImpl(UMoviePipeline* InPipeline) override;
+
+private:
+	void AddPixelData(const FString& EntryName, const FImagePixelData* PixelData);
+	void AddVectors(const FString& EntryName, TArrayView<const FVector> Vectors);
+
+public:
+	/**
+	 * Name of the shared memory region, passed to SharedFrameReader as is.
+	 * The region is "Global\{Name}" on Windows and "/{Name}" elsewhere, a prefix given in the name is stripped.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Shared Memory")
+		FString SharedMemoryName = "xrfeitoria_frames";
+	/** Number of frames the client may hold onto before the render waits for it (or drops frames). */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Shared Memory", meta = (ClampMin = 1))
+		int32 SlotCount = 4;
+	/** Size of one frame in MB, every array of the frame must fit in it. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Shared Memory", meta = (ClampMin = 1))
+		int32 SlotSizeMB = 64;
+	/** Overwrite the oldest frame when the client is behind, rather than waiting for it. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Shared Memory")
+		bool bDropWhenFull = false;
+	/**
+	 * Max time (seconds) to wait for the client to release a slot, the frame is dropped after that.
+	 * The render (game thread) stalls while waiting. After a timeout the frames are dropped without waiting
+	 * until the client catches up, 0 never waits.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Shared Memory", meta = (ClampMin = 0))
+		float MaxWaitSeconds = 10.f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Shared Memory|Content")
+		bool bPublishRenderPasses = true;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Shared Memory|Content")
+		bool bPublishCameras = true;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Shared Memory|Content")
+		bool bPublishSkeletons = true;
+	/** Skinned on the CPU every frame, costly for large meshes. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Shared Memory|Content")
+		bool bPublishVertices = false;
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Shared Memory|Content")
+		int32 LODIndex = 0;
+
+private:
+	FXFSharedFrameRing Ring;
+	/** Cameras and meshes of the sequence, see FXFSceneBindingRegistry. */
+	TSharedPtr<FXFSceneBindingRegistry> SceneBindings;
+	/** RenderPassName of CustomMoviePipelineOutput by pass identifier, the name of the arrays of the render passes. */
+	TMap<FString, FString> RenderPassNames;
+	TMap<USkeletalMeshComponent*, TArray<int32>> SkeletonBoneIndices;
+	FIntPoint OutputResolution = FIntPoint(1920, 1080);
+	/** Scratch buffer of the float32 arrays. */
+	TArray<float> FloatBuffer;
+};
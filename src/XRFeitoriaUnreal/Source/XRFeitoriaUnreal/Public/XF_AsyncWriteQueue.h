@@ -0,0 +1,72 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/Future.h"
+#include "Containers/Queue.h"
+#include "HAL/Event.h"
+#include "HAL/Runnable.h"
+#include "HAL/ThreadSafeCounter.h"
+#include "Templates/Atomic.h"
+
+class FRunnableThread;
+
+/**
+ * Bounded background writer for the non-image outputs (vertices, skeleton, camera and actor infos).
+ *
+ * Tasks run in order on a single worker thread, so several writes to one file never race.
+ * When MaxQueueDepth tasks are pending, Enqueue blocks the caller until the worker catches up,
+ * which bounds the memory held by the queued buffers. The depth of the shared queue is the console variable xf.WriteQueueDepth.
+ */
+class XRFEITORIAUNREAL_API FXFAsyncWriteQueue : public FRunnable
+{
+public:
+	/** The queue shared by all the outputs of the plugin. */
+	static FXFAsyncWriteQueue& Get();
+	/** Flush and destroy the shared queue, called on module shutdown. */
+	static void Shutdown();
+
+	explicit FXFAsyncWriteQueue(int32 InMaxQueueDepth = 64);
+	virtual ~FXFAsyncWriteQueue();
+
+	/** Run the task on the worker thread. The returned future is fulfilled with the result of the task. */
+	TFuture<bool> Enqueue(TUniqueFunction<bool()>&& Task);
+
+	/** Take ownership of the float array and write it to Path. */
+	TFuture<bool> EnqueueFloatArray(TArray<float>&& FloatArray, const FString& Path);
+	TFuture<bool> EnqueueFloat(float Value, const FString& Path);
+	/** Take ownership of the vectors and write them to Path as float32. */
+	TFuture<bool> EnqueueVectorArray(TArray<FVector>&& Vectors, const FString& Path);
+
+	/** Block until every task enqueued before this call has run. */
+	void Flush();
+
+	int32 GetQueueDepth() const { return PendingCount.GetValue(); }
+	int32 GetMaxQueueDepth() const { return MaxQueueDepth; }
+	void SetMaxQueueDepth(int32 InMaxQueueDepth) { MaxQueueDepth = FMath::Max(InMaxQueueDepth, 1); }
+	/** Total time (seconds) callers have been blocked by a full queue. */
+	double GetStallSeconds() const { return StallSeconds; }
+
+	//~ Begin FRunnable Interface
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+	//~ End FRunnable Interface
+
+private:
+	struct FWriteItem
+	{
+		TUniqueFunction<bool()> Task;
+		TPromise<bool> Promise;
+	};
+
+	TQueue<TUniquePtr<FWriteItem>, EQueueMode::Mpsc> Items;
+	FThreadSafeCounter PendingCount;
+	int32 MaxQueueDepth;
+	double StallSeconds = 0.0;
+
+	FEvent* WorkEvent = nullptr;
+	FEvent* DoneEvent = nullptr;
+	FRunnableThread* Thread = nullptr;
+	TAtomic<bool> bStopping { false };
+};
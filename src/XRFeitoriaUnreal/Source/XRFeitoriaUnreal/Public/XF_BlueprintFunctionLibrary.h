@@ -14,6 +14,12 @@
 
 DECLARE_LOG_CATEGORY_EXTERN(LogXF, Log, All);
 
+#if ENGINE_MAJOR_VERSION == 5
+using FXFVector3f = FVector3f;
+#else
+using FXFVector3f = FVector;  // FVector is float32 already
+#endif
+
 /**
  *
  */
@@ -23,7 +29,39 @@ enum class EOcclusion : uint8
 {
 	NonOcclusion = 0,
 	SelfOcclusion = 1,
-	InterOcclusion = 2
+	InterOcclusion = 2,
+	/** Outside of the camera image, only set by the depth buffer occlusion. */
+	OutOfView = 3
+};
+
+/** A cell of the grid scanned by ScanSceneGrid, where the box sweep (or TestInside) hit something. */
+USTRUCT(BlueprintType)
+struct XRFEITORIAUNREAL_API FXFGridScanCell
+{
+	GENERATED_BODY()
+
+	/** Hit location, lowered by BoxHalfSize, same as the z of the HitBoxes file. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Grid Scan")
+		FVector Location = FVector::ZeroVector;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Grid Scan")
+		FString ActorName;
+
+	/** The cell is inside a model (hit by TestInside). */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Grid Scan")
+		bool bIsInside = false;
+
+	/** Nothing blocks the line from the cell to the origin of the scan (to any of them, for the multi-start scan). */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Grid Scan")
+		bool bIsVisible = false;
+
+	/** Multi-start scan only: the starts whose region holds this cell. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Grid Scan")
+		TArray<int32> StartIndices;
+
+	/** Multi-start scan only: the starts that see this cell. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Grid Scan")
+		TArray<int32> VisibleStartIndices;
 };
 
 UCLASS()
@@ -37,7 +75,38 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "XF_BPLibrary")
 		static bool SaveFloatToByteFile(float f, FString Path);
 	UFUNCTION(BlueprintCallable, Category = "XF_BPLibrary")
-		static bool SaveFloatArrayToByteFile(TArray<float> FloatArray, FString Path);
+		static bool SaveFloatArrayToByteFile(const TArray<float>& FloatArray, FString Path);
+
+	/**
+	 * CreateDirectoryTree, skipped for the directories this run has already created. Thread safe.
+	 * On network filesystems each CreateDirectoryTree is several round-trips, and the outputs write many files per directory.
+	 */
+	static bool EnsureDirectoryTree(const FString& Directory);
+	/** Forget the created directories, at the start of a render (they may have been deleted since). */
+	static void ResetDirectoryCache();
+	/** Create the directories on the background write queue, before the writes into them. Game thread only. */
+	static void PrecreateDirectoryTrees(TSet<FString>&& Directories);
+	/** Write the bytes to Path in one write, creating its directory through EnsureDirectoryTree. */
+	static bool SaveBytesToFile(const void* Data, int64 NumBytes, const FString& Path);
+	/** SaveBytesToFile to a temporary file renamed over Path, so readers never see it half written, e.g. a file several render nodes write. */
+	static bool SaveBytesToFileAtomic(const void* Data, int64 NumBytes, const FString& Path);
+
+	/** Write the floats to Path in one contiguous write. */
+	static bool SaveFloatArrayViewToByteFile(TArrayView<const float> FloatArray, const FString& Path);
+	/** Write the vectors to Path as float32 [x, y, z, ...], converting the components in small chunks when FVector is double. */
+	static bool SaveVectorArrayToByteFile(TArrayView<const FVector> Vectors, const FString& Path);
+	/** Write the float32 vectors to Path in one contiguous write. */
+	static bool SaveFloat3ArrayToByteFile(TArrayView<const FXFVector3f> Vectors, const FString& Path);
+
+	/**
+	 * Transform local positions by Transform and append them to WorldPositions.
+	 * The transform is converted to a matrix once, and large arrays are split into chunks run with ParallelFor.
+	 */
+	static void TransformPositions(const FTransform& Transform, TArrayView<const FXFVector3f> LocalPositions, TArray<FVector>& WorldPositions);
+#if ENGINE_MAJOR_VERSION == 5
+	/** Same as above, with float32 output ready to be written to a .dat file (FVector is float32 already in UE4). */
+	static void TransformPositions(const FTransform& Transform, TArrayView<const FXFVector3f> LocalPositions, TArray<FXFVector3f>& WorldPositions);
+#endif
 	UFUNCTION(BlueprintCallable, Category = "XF_BPLibrary")
 		static void EmptyPostProcessMaterial(UPostProcessComponent* postprocessComponent);
 	UFUNCTION(BlueprintCallable, Category = "XF_BPLibrary")
@@ -54,10 +123,21 @@ public:
 	UFUNCTION(BlueprintPure, Category = "XF_BPLibrary")
 		static bool GetStaticMeshVertexLocations(UStaticMeshComponent* Comp, int32 LodIndex, TArray<FVector>& VertexPositions);
 
+	/** Takes in an Static Mesh Component and return the float32 locations of all the vertices in Local Space. They don't change during a render, so they can be cached. */
+	static bool GetStaticMeshLocalVertexLocations(UStaticMeshComponent* Comp, int32 LodIndex, TArray<FXFVector3f>& LocalPositions);
+
 	/** Takes in an Skeletal Mesh Component and return an array of Vectors of all of the current bone locations and an array of corresponding bone name in each index. Locations are in World Space. Returns: false if the operation could not occur. */
 	UFUNCTION(BlueprintPure, Category = "XF_BPLibrary")
 		static bool GetSkeletalMeshBoneLocations(USkeletalMeshComponent* Comp, TArray<FVector>& BoneLocations, TArray<FName>& BoneNames);
 
+	/** Indices and names of all the bones of the skeletal mesh, in the order of GetBoneNames. Only changes with the mesh, so it can be cached per component. */
+	static bool GetSkeletalMeshBoneIndices(USkeletalMeshComponent* Comp, TArray<int32>& BoneIndices, TArray<FName>& BoneNames);
+	/**
+	 * World space locations (and rotations, when OutBoneRotations is given) of the bones, read in one pass from the component space transforms.
+	 * Same values as GetBoneLocation / GetBoneQuaternion, without the name lookup and the transform composition per bone.
+	 */
+	static bool GetSkeletalMeshBoneTransforms(USkeletalMeshComponent* Comp, TArrayView<const int32> BoneIndices, TArray<FVector>& OutBoneLocations, TArray<FQuat>* OutBoneRotations = nullptr);
+
 	/** Takes in an Skeletal Mesh Component and return an array of Vectors of all the vertices locations. Locations are in World Space. Returns: false if the operation could not occur. */
 	UFUNCTION(BlueprintPure, Category = "XF_BPLibrary")
 		static bool GetSkeletalMeshVertexLocationsByLODIndex(USkeletalMeshComponent* Comp, int32 LODIndex, TArray<FVector>& VertexPositions);
@@ -90,9 +170,33 @@ public:
 		static EOcclusion GetOcclusionFromHitResult(FHitResult HitResult, FName MeshName, int MeshThickness, bool bIsIsHit);
 
 
+	/**
+	Trace a line from CameraLocation to every point, with ParallelFor over the physics scene,
+	and write the occlusion of each point to Occlusion (same size as Points).
+	**/
+	static void TraceOcclusion(
+		UWorld* World,
+		const FVector& CameraLocation,
+		TArrayView<const FVector> Points,
+		FName MeshName,
+		float MeshThickness,
+		TArrayView<EOcclusion> Occlusion
+	);
+
+	/** Load the mask color of each stencil value from `Content/Python/data/mask_colors.json`, the same table the python side uses. */
+	static bool LoadMaskColors(TArray<FColor>& MaskColors);
+
+	/** Ratio of each occlusion type among the points. */
+	static void ComputeOcclusionRates(
+		TArrayView<const EOcclusion> Occlusion,
+		float& non_occlusion_rate,
+		float& self_occlusion_rate,
+		float& inter_occlusion_rate
+	);
+
 	UFUNCTION(BlueprintCallable, Category = "XF_BPLibrary")
 		static bool DetectInterOcclusionVertices(
-			TArray<FVector> Vertices,
+			const TArray<FVector>& Vertices,
 			ACameraActor* Camera,
 			FName MeshName,
 			TArray<EOcclusion>& VerticesOcclusion,
@@ -141,6 +245,12 @@ public:
 			TArray<FVector>& Centers);
 
 
+	/**
+	 * Walk the four quadrants around StartPoint row by row, in BoxHalfSize steps within the X/Y extents,
+	 * and save the cells that hit something to PathToSaveResults (the HitBoxes file).
+	 * A row ends after three misses, a quadrant after two rows without hits (three from the start). The rows are traced in parallel batches.
+	 * Unlike ScanSceneGrid, the areas beyond the early stop aren't scanned.
+	 */
 	UFUNCTION(BlueprintCallable, Category = "XF_BPLibrary",
 		meta = (AdvancedDisplay = 5, WorldContext = "WorldContext"))
 		static void DivideSceneViaBoxTrace(
@@ -157,18 +267,109 @@ public:
 			FString PathToSaveResults = TEXT("../HitBoxes.txt"),
 			bool VisualizeBoxes = false);
 
+	/**
+	 * Scan the cells of a grid of BoxHalfSize steps around Origin, within the X/Y extents (relative to Origin).
+	 * Every cell sweeps a box from Origin.Z down to HitEndZ, and the cells are traced in parallel batches.
+	 * The cells that hit something are returned in grid order.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "XF_BPLibrary",
+		meta = (AdvancedDisplay = 8, WorldContext = "WorldContext"))
+		static void ScanSceneGrid(
+			const UObject* WorldContext,
+			TArray<FXFGridScanCell>& Cells,
+			FVector Origin = FVector(0, 0, 2000),
+			int BoxHalfSize = 20,
+			float MaxXExtend = 1500,
+			float MinXExtend = -1500,
+			float MaxYExtend = 1500,
+			float MinYExtend = -1500,
+			float HitEndZ = -2000);
+
+	/** Same as ScanSceneGrid, handing the hit cells of each batch to OnBatch instead of keeping them all. */
+	static void ScanSceneGridBatched(
+		const UObject* WorldContext,
+		TFunctionRef<void(TArray<FXFGridScanCell>&& BatchCells)> OnBatch,
+		FVector Origin,
+		int BoxHalfSize,
+		float MaxXExtend,
+		float MinXExtend,
+		float MaxYExtend,
+		float MinYExtend,
+		float HitEndZ);
+
+	/**
+	 * Scan the regions around several start points at once (same arguments as DivideSceneViaBoxTraceBatch).
+	 * The cells are on a world aligned grid, so the overlapping regions of starts sweeping the same Z range
+	 * are traced only once, and every cell is tagged with the starts it belongs to.
+	 * The separate regions are traced concurrently, in the same parallel batches, and returned in the order of their starts.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "XF_BPLibrary",
+		meta = (AdvancedDisplay = 3, WorldContext = "WorldContext"))
+		static void ScanSceneGridMultiStart(
+			const UObject* WorldContext,
+			TArray<FXFGridScanCell>& Cells,
+			const TArray<FVector>& StartPoints,
+			int BoxHalfSize = 20,
+			float MaxXExtend = 1500,
+			float MinXExtend = -1500,
+			float MaxYExtend = 1500,
+			float MinYExtend = -1500,
+			float ZExtend = 2000);
+
+	/** Same as ScanSceneGridMultiStart, handing the hit cells of each batch to OnBatch. */
+	static void ScanSceneGridMultiStartBatched(
+		const UObject* WorldContext,
+		TFunctionRef<void(TArray<FXFGridScanCell>&& BatchCells)> OnBatch,
+		const TArray<FVector>& StartPoints,
+		int BoxHalfSize,
+		float MaxXExtend,
+		float MinXExtend,
+		float MaxYExtend,
+		float MinYExtend,
+		float ZExtend);
+
 	UFUNCTION(BlueprintPure, Category = "XF_BPLibrary",
 		meta = (WorldContext = "WorldContext"))
 		static bool TestInside(
 			const UObject* WorldContext, const FVector LocStart,
 			const float Extend, FHitResult& UpHitResult);
 
+	/** TestInside, looked up in the scene cell cache first (see EnableSceneCellCache). */
+	UFUNCTION(BlueprintCallable, Category = "XF_BPLibrary",
+		meta = (WorldContext = "WorldContext"))
+		static bool TestInsideCached(
+			const UObject* WorldContext, const FVector LocStart,
+			const float Extend, FVector& HitLocation, FString& ActorName);
+
+	/**
+	 * Keep the results of the grid scans, TestInsideCached and GetCameraVisualCenterLocation of each level
+	 * in Saved/XRFeitoria/SceneCellCache, and look them up before tracing.
+	 * The cache of a level is dropped when the level is saved again, but not when it's edited in memory.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "XF_BPLibrary")
+		static void EnableSceneCellCache(bool bEnable = true);
+
+	/** Save the new results of the scene cell cache of the level. The grid scans save it when they finish. */
+	UFUNCTION(BlueprintCallable, Category = "XF_BPLibrary",
+		meta = (WorldContext = "WorldContext"))
+		static void SaveSceneCellCache(const UObject* WorldContext);
+
+	/** Delete the scene cell cache of the level. */
+	UFUNCTION(BlueprintCallable, Category = "XF_BPLibrary",
+		meta = (WorldContext = "WorldContext"))
+		static void ClearSceneCellCache(const UObject* WorldContext);
+
 	UFUNCTION(BlueprintCallable, Category = "XF_BPLibrary",
 		meta = (WorldContext = "WorldContext"))
 		static bool TestVisible(
 			const UObject* WorldContext, const FVector TestLoc,
 			const FVector CamLoc, FHitResult& OutHitResult);
 
+	/**
+	 * DivideSceneViaBoxTrace around each start point, saved to PathToSaveResults with the index of the start appended.
+	 * With MergeOverlappingStarts, all the starts are scanned together (see ScanSceneGridMultiStart): the files
+	 * have the same rows, but the cells are on a world aligned grid instead of a grid centered on each start.
+	 */
 	UFUNCTION(BlueprintCallable, Category = "XF_BPLibrary",
 		meta = (AdvancedDisplay = 4, WorldContext = "WorldContext"))
 		static void DivideSceneViaBoxTraceBatch(
@@ -182,7 +383,8 @@ public:
 			float MinYExtend = -1500,
 			float ZExtend = 2000,
 			FString PathToSaveResults = TEXT("../HitBoxes.txt"),
-			bool VisualizeBoxes = false);
+			bool VisualizeBoxes = false,
+			bool MergeOverlappingStarts = false);
 
 	UFUNCTION(BlueprintCallable, Category = "XF_BPLibrary",
 		meta = (WorldContext = "WorldContext"))
@@ -0,0 +1,87 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/PlatformFilemanager.h"
+#include "GenericPlatform/GenericPlatformFile.h"
+
+/**
+ * Binary layout of a chunked shot file (little-endian):
+ *
+ *   [Header]       64 bytes, see FXFChunkedFileHeader
+ *   [Frame Index]  FrameCapacity * int32, output frame number of each slot (-1 if the slot is empty)
+ *   [Records]      FrameCapacity * RecordStride bytes, starting at DataOffset (64-byte aligned)
+ *
+ * Every record has the same size, so the records block can be memory-mapped
+ * as an array of shape (FrameCapacity, ElementCount, ElementComponents).
+ * Byte records (DataType 1) hold variable size frames, e.g. the encoded vertices of XF_VertexEncoding.h, padded to the stride.
+ * The matching reader lives in `xrfeitoria/utils/chunked_file.py`.
+ */
+struct FXFChunkedFileHeader
+{
+	static constexpr uint32 MagicValue = 0x46434658;  // "XFCF"
+	static constexpr uint32 CurrentVersion = 1;
+
+	uint32 Magic = MagicValue;
+	uint32 Version = CurrentVersion;
+	uint32 HeaderSize = sizeof(FXFChunkedFileHeader);
+	uint32 FrameCapacity = 0;
+	uint32 RecordStride = 0;
+	uint32 ElementCount = 0;
+	uint32 ElementComponents = 0;
+	uint32 DataType = 0;  // 0: float32, 1: uint8
+	uint64 IndexOffset = 0;
+	uint64 DataOffset = 0;
+	uint32 FramesWritten = 0;
+	/** Frame number of slot 0, to find the slots of a resumed render whose first slot is a later frame. */
+	int32 FirstFrameNumber = 0;
+	uint32 Reserved[2] = { 0, 0 };
+};
+static_assert(sizeof(FXFChunkedFileHeader) == 64, "FXFChunkedFileHeader must stay 64 bytes");
+
+
+/**
+ * Writer of a chunked shot file.
+ * The file is preallocated on the first record, so each frame is a seek and one write.
+ * With bKeepExisting (a resumed render), an existing file of the same layout is opened instead and keeps the records
+ * of the previous renders. The slots of the records are shifted by the frame number of slot 0 of the file.
+ */
+class XRFEITORIAUNREAL_API FXFChunkedFileWriter
+{
+public:
+	FXFChunkedFileWriter(const FString& InPath, int32 InFrameCapacity, int32 InElementComponents = 3, bool bInKeepExisting = false);
+	~FXFChunkedFileWriter();
+
+	/** Write one record into the slot of the frame. ElementCount is fixed by the first record. */
+	bool WriteRecord(int32 Slot, int32 FrameNumber, const float* Data, int32 NumFloats);
+	/** Write the vectors as a float32 record, converting them in small chunks when FVector is double. */
+	bool WriteRecord(int32 Slot, int32 FrameNumber, TArrayView<const FVector> Vectors);
+	/** Write a byte record of at most RecordStride bytes. RecordStride is fixed by the first record. */
+	bool WriteBytesRecord(int32 Slot, int32 FrameNumber, TArrayView<const uint8> Bytes, int32 RecordStride);
+
+	/** Update the header and close the file. */
+	void Close();
+
+	const FString& GetPath() const { return Path; }
+	bool IsOpen() const { return FileHandle.IsValid(); }
+
+private:
+	bool Open(uint32 RecordStride, uint32 DataType, int32 FirstFrameNumber);
+	/** Open the existing file of a previous render, false if there's none of the same layout. */
+	bool OpenExisting(uint32 RecordStride, uint32 DataType, int32 FirstFrameNumber);
+	/** Open the file on the first record, then check that the slot and the record size are valid. Slot is shifted to the slot in the file. */
+	bool PrepareRecord(int32& Slot, int32 FrameNumber, uint32 RecordStride, uint32 DataType);
+	bool WriteIndex(int32 Slot, int32 FrameNumber);
+
+private:
+	FString Path;
+	FXFChunkedFileHeader Header;
+	TUniquePtr<IFileHandle> FileHandle;
+	/** Mirror of the frame index of the file, so FramesWritten only counts the first write of each slot. */
+	TArray<int32> FrameIndex;
+	bool bKeepExisting = false;
+	/** Added to the slots of the records, the slot of the first frame of this render in an existing file. */
+	int32 SlotOffset = 0;
+	bool bFailed = false;
+};
@@ -0,0 +1,24 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/SoftObjectPath.h"
+
+/**
+ * Async preload of the post process materials of the custom render passes, requested when the jobs are queued.
+ *
+ * The loaded materials are kept referenced until Release, so the jobs of a session share them instead of
+ * loading them again for each job, and their shaders are compiled in the background while the queue is set up.
+ * UCustomMoviePipelineDeferredPass::SetupImpl waits for the pending loads of its passes. Game thread only.
+ */
+class XRFEITORIAUNREAL_API FXFMaterialPreloader
+{
+public:
+	/** Start loading the materials, the ones already loaded or pending are skipped. */
+	static void Preload(const TArray<FSoftObjectPath>& MaterialPaths);
+	/** Block until the pending loads of the materials have completed. */
+	static void WaitFor(const TArray<FSoftObjectPath>& MaterialPaths);
+	/** Drop the references to the preloaded materials, called on module shutdown. */
+	static void Release();
+};
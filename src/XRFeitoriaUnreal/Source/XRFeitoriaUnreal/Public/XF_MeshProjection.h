@@ -0,0 +1,62 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class ACameraActor;
+
+/** Flag of a projected keypoint, stored as a float next to its pixel coordinates. */
+enum class EXFKeypointFlag : uint8
+{
+	/** Behind the camera, the pixel coordinates are 0. */
+	BehindCamera = 0,
+	/** In front of the camera, projected outside of the image. */
+	OutsideImage = 1,
+	/** Projected inside the image. */
+	InsideImage = 2,
+};
+
+/**
+ * Pinhole projection of a camera, same model as the exported camera parameters (see CameraParameter.from_array of the python side)
+ * and FXFDepthOcclusionView: principal point at the image center, focal length from the horizontal field of view.
+ */
+struct XRFEITORIAUNREAL_API FXFCameraProjection
+{
+	FVector CameraLocation = FVector::ZeroVector;
+	FQuat WorldToCamera = FQuat::Identity;
+	FIntPoint Resolution = FIntPoint(1920, 1080);
+	double FocalLength = 960.;
+
+	FXFCameraProjection() = default;
+	FXFCameraProjection(const ACameraActor* Camera, const FIntPoint& InResolution);
+
+	/** Pixel coordinates of a world position, false when it's behind the camera. */
+	bool Project(const FVector& WorldPosition, FVector2D& OutPixel) const
+	{
+		// camera space of unreal: x forward, y right, z up
+		const FVector Local = WorldToCamera.RotateVector(WorldPosition - CameraLocation);
+		if (Local.X <= KINDA_SMALL_NUMBER) return false;
+		OutPixel.X = Resolution.X * 0.5 + FocalLength * Local.Y / Local.X;
+		OutPixel.Y = Resolution.Y * 0.5 - FocalLength * Local.Z / Local.X;
+		return true;
+	}
+
+	/** (u, v, EXFKeypointFlag) per keypoint. */
+	static constexpr int32 KeypointComponents = 3;
+	/** x_min, y_min, x_max, y_max (pixels, clipped to the image) and the ratio of the points projected inside the image. */
+	static constexpr int32 BoundingBox2DComponents = 5;
+	/** x_min, y_min, z_min, x_max, y_max, z_max in world space (cm). */
+	static constexpr int32 BoundingBox3DComponents = 6;
+
+	/** Append the pixel coordinates and flag of every point to OutRecords. */
+	void ProjectKeypoints(TArrayView<const FVector> Points, TArray<float>& OutRecords) const;
+	/**
+	 * Append the tight 2D box of the points in front of the camera to OutRecord, clipped to the image.
+	 * The box is all zeros when no point is projected inside the image.
+	 * Large arrays are split into chunks run with ParallelFor.
+	 */
+	void ComputeBoundingBox2D(TArrayView<const FVector> Points, TArray<float>& OutRecord) const;
+	/** Append the world space AABB of the points to OutRecord. */
+	static void ComputeBoundingBox3D(TArrayView<const FVector> Points, TArray<float>& OutRecord);
+};
@@ -0,0 +1,83 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "XF_BlueprintFunctionLibrary.h"
+
+class UWorld;
+struct FImagePixelData;
+
+/** Occlusion of every point of a mesh from one camera, with the rate of each occlusion type. */
+struct FXFOcclusionResult
+{
+	TArray<EOcclusion> Occlusion;
+	float NonOcclusionRate = 0.f;
+	float SelfOcclusionRate = 0.f;
+	float InterOcclusionRate = 0.f;
+};
+
+/**
+ * Batched occlusion queries on the async trace system of the world.
+ *
+ * Request() starts one AsyncLineTraceByChannel per point. The world runs them on worker threads during the frame,
+ * and the results arrive on the game thread at the start of the next frame. Poll() then hands the labels,
+ * as DetectInterOcclusionVertices computes them, to the callback of each finished request.
+ */
+class XRFEITORIAUNREAL_API FXFAsyncOcclusionQuery
+{
+public:
+	/** Called on the game thread when every point of the request has been traced. */
+	typedef TUniqueFunction<void(FXFOcclusionResult&& Result)> FOnOcclusionComplete;
+
+	~FXFAsyncOcclusionQuery();
+
+	/** Start tracing from CameraLocation to each point. MeshName is the FName of the actor owning the points. */
+	void Request(UWorld* World, const FVector& CameraLocation, TArray<FVector>&& Points, FName MeshName, float MeshThickness, FOnOcclusionComplete&& OnComplete);
+
+	/** Run the callbacks of the finished requests, and return the number of requests still pending. */
+	int32 Poll();
+
+	/** Finish every pending request now, tracing the points still waiting for results synchronously. */
+	void Drain();
+
+	int32 GetNumPending() const { return Pending.Num(); }
+
+private:
+	struct FRequest;
+	TArray<TSharedPtr<FRequest>> Pending;
+};
+
+
+/**
+ * Occlusion from the depth and mask passes already rendered for a frame.
+ *
+ * Every point is projected into the camera (same pinhole model as the exported camera parameters),
+ * and its depth is compared with the scene depth of its pixel. A point behind the scene depth is occluded by
+ * the mesh whose mask color covers the pixel: itself (SelfOcclusion) or another one (InterOcclusion).
+ * The cost is one projection and two pixel reads per point, whatever the complexity of the scene.
+ */
+struct XRFEITORIAUNREAL_API FXFDepthOcclusionView
+{
+	FVector CameraLocation = FVector::ZeroVector;
+	FRotator CameraRotation = FRotator::ZeroRotator;
+	/** Horizontal field of view, in degrees. */
+	float FOV = 90.f;
+
+	/** Scene depth in the R channel. */
+	const FImagePixelData* Depth = nullptr;
+	/** Mask colors, see UXF_BlueprintFunctionLibrary::LoadMaskColors. */
+	const FImagePixelData* Mask = nullptr;
+	/** Stencil value of each mask color. */
+	const TMap<FColor, uint8>* MaskColorToStencil = nullptr;
+
+	/** Size of one unit of the depth pass, in cm. */
+	float DepthUnitInCm = 1.f;
+	/** A point less than DepthTolerance (cm) behind the scene depth is still visible. */
+	float DepthTolerance = 5.f;
+
+	bool IsValid() const { return Depth && Mask && MaskColorToStencil; }
+
+	/** Write the occlusion of each point (same size as Points) of the mesh with this stencil value. */
+	void ComputeOcclusion(TArrayView<const FVector> Points, int32 StencilValue, TArrayView<EOcclusion> Occlusion) const;
+};
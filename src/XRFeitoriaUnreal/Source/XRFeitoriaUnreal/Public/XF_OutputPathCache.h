@@ -0,0 +1,67 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class UMoviePipeline;
+struct FMoviePipelineFrameOutputState;
+
+enum class EXFOutputPathFlags : uint8
+{
+	None = 0,
+	/** Resolve {camera_name} to an empty string. */
+	ClearCameraName = 1 << 0,
+	/** Replace the double slashes with single slashes. */
+	CollapseSlashes = 1 << 1,
+	/** Don't convert a relative path to a full path. */
+	KeepRelative = 1 << 2,
+};
+ENUM_CLASS_FLAGS(EXFOutputPathFlags);
+
+/**
+ * Output paths of the pipeline from path templates resolved once per shot.
+ *
+ * The format string is resolved by UMoviePipeline::ResolveFilenameFormatArguments with placeholders for
+ * {render_pass}, {ext} and the frame numbers, so a path is a few replacements of the template. The frame numbers
+ * are resolved once per frame and shared by every file of the frame. Each template is checked against a full
+ * resolve when it's built, formats the template can't reproduce (e.g. {camera_name}) are always fully resolved.
+ */
+class XRFEITORIAUNREAL_API FXFOutputPathCache
+{
+public:
+	explicit FXFOutputPathCache(UMoviePipeline* InPipeline) : Pipeline(InPipeline) {}
+
+	/** Same path as ResolveFilenameFormatArguments, made absolute unless KeepRelative is set. */
+	FString Resolve(
+		const FString& FormatString,
+		const FString& RenderPass,
+		const FString& Ext,
+		const FMoviePipelineFrameOutputState* InOutputState,
+		int32 FrameNumberOffset = 0,
+		EXFOutputPathFlags Flags = EXFOutputPathFlags::None);
+
+	void Reset();
+
+private:
+	FString ResolveFull(const FString& FormatString, const FString& RenderPass, const FString& Ext,
+		const FMoviePipelineFrameOutputState* InOutputState, int32 FrameNumberOffset, EXFOutputPathFlags Flags) const;
+	/** The frame number arguments of the frame, in the order of FrameTokens. */
+	const TArray<FString>& GetFrameArguments(const FMoviePipelineFrameOutputState* InOutputState, int32 FrameNumberOffset);
+
+private:
+	struct FTemplate
+	{
+		FString Path;
+		/** False when the template doesn't give the same path as a full resolve. */
+		bool bIsValid = false;
+	};
+
+	UMoviePipeline* Pipeline = nullptr;
+	int32 ShotIndex = INDEX_NONE;
+	/** Keyed by the format string and the options, for the current shot. */
+	TMap<FString, FTemplate> Templates;
+	int32 OutputFrameNumber = INDEX_NONE;
+	/** Keyed by the frame number offset, for the current frame. */
+	TMap<int32, TArray<FString>> FrameArguments;
+};
@@ -0,0 +1,91 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/Future.h"
+#include "UObject/WeakObjectPtr.h"
+
+class UMoviePipeline;
+struct FMoviePipelineFrameOutputState;
+
+/**
+ * Frames of each shot whose outputs are all written, so that a crashed render can resume where it stopped.
+ *
+ * The manifest of a shot is {OutputDirectory}/.xf_resume/{sequence_name}/{shot_name}[_shard{index}of{count}].json, {"frames": [source frame numbers]}.
+ * The outputs of the pipeline (CustomMoviePipelineOutput, MoviePipelineMeshOperator) share the manifest and register
+ * the writes of each frame with Track. A frame is complete once every output has moved past it and all of its writes
+ * succeeded. The manifest is rewritten on the write queue at the end of each shot, and every FlushFrameInterval
+ * complete frames or FlushIntervalSeconds meanwhile, to a temporary file renamed over the previous one, so it's never
+ * left half written by a crash. A crash loses at most the frames completed since the last rewrite.
+ * The outputs only use it with bSkipCompletedFrames, the renders without resume don't write a manifest.
+ * The shot files (.xfc) of a resumed shot are opened in place, they keep the records of the complete frames.
+ */
+class XRFEITORIAUNREAL_API FXFResumeManifest : public TSharedFromThis<FXFResumeManifest, ESPMode::ThreadSafe>
+{
+public:
+	/** The manifest of the pipeline, created by the first output asking for it. Game thread only. */
+	static TSharedRef<FXFResumeManifest, ESPMode::ThreadSafe> Get(UMoviePipeline* Pipeline);
+
+	/** Register an output whose writes count towards the completion of the frames, in SetupForPipelineImpl. */
+	void RegisterOutput(const UObject* Output);
+	/** The output starts the frame, the frames every output has moved past are sealed. Game thread only. */
+	void BeginFrame(const UObject* Output, const FMoviePipelineFrameOutputState& OutputState);
+	/** Whether the manifest of a previous render lists the frame as complete. Game thread only. */
+	bool IsFrameComplete(const FMoviePipelineFrameOutputState& OutputState);
+	/** Whether a previous render completed frames of the shot, whose shot files must be kept. Game thread only. */
+	bool IsResumingShot(int32 ShotIndex);
+
+	/** Register a write of the frame, done when the future is. */
+	TFuture<bool> Track(TFuture<bool>&& Future, const FMoviePipelineFrameOutputState& OutputState);
+	/** Register a write of the frame which isn't queued yet, e.g. waiting for a readback. Must be followed by EndWrite. */
+	void BeginWrite(const FMoviePipelineFrameOutputState& OutputState);
+	/** Thread safe. */
+	void EndWrite(int32 OutputFrameNumber, bool bSuccess);
+
+	/** Seal the frames of the shot and save its manifest, once every output has finished the shot. Game thread only. */
+	void FinishShot(int32 ShotIndex);
+	/** Save the manifests with newly completed frames. Game thread only. */
+	void Flush();
+
+	static constexpr int32 FlushFrameInterval = 50;
+	static constexpr double FlushIntervalSeconds = 10.0;
+
+private:
+	struct FFrameState
+	{
+		int32 ShotIndex = INDEX_NONE;
+		int32 SourceFrameNumber = 0;
+		int32 PendingWrites = 0;
+		bool bFailed = false;
+		bool bSealed = false;
+	};
+	struct FShotState
+	{
+		FString ManifestPath;
+		/** Complete frames, of the previous renders and of this one. */
+		TSet<int32> CompleteFrames;
+		/** Complete frames of the previous renders, the ones the outputs may skip. */
+		TSet<int32> ResumedFrames;
+		bool bDirty = false;
+	};
+
+	FShotState& FindOrLoadShot(int32 ShotIndex);
+	/** Flush once enough frames completed since the last one, or it's long enough ago. */
+	void FlushIfDue();
+	/** Move the frame to the complete frames of its shot when it's sealed and its writes are done, with Lock held. */
+	void TryComplete(int32 OutputFrameNumber);
+
+private:
+	TWeakObjectPtr<UMoviePipeline> Pipeline;
+	/** Output frame number of the frame each output is at. */
+	TMap<const UObject*, int32> OutputFrames;
+
+	FCriticalSection Lock;
+	/** Keyed by the output frame number, until the frame is complete. */
+	TMap<int32, FFrameState> Frames;
+	TMap<int32, FShotState> Shots;
+	/** Frames completed since the last Flush, with Lock held. */
+	int32 NumCompletedSinceFlush = 0;
+	double LastFlushTime = 0.0;
+};
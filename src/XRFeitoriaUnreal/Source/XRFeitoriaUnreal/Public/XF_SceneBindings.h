@@ -0,0 +1,47 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/WeakObjectPtr.h"
+
+class UMoviePipeline;
+class ACameraActor;
+class UPrimitiveComponent;
+class UStaticMeshComponent;
+class USkeletalMeshComponent;
+
+/**
+ * Cameras and meshes bound in the sequence of a pipeline, with the name each one is exported as.
+ *
+ * The bindings are resolved once per pipeline by the first output asking for them,
+ * the other outputs of the pipeline (CustomMoviePipelineOutput, MoviePipelineMeshOperator) share the result.
+ */
+class XRFEITORIAUNREAL_API FXFSceneBindingRegistry
+{
+public:
+	/** The registry of the pipeline, resolving the bindings of its target sequence on first use. Game thread only. */
+	static TSharedRef<FXFSceneBindingRegistry> Get(UMoviePipeline* Pipeline);
+
+	const TArray<ACameraActor*>& GetCameras() const { return Cameras; }
+	const TArray<UStaticMeshComponent*>& GetStaticMeshComponents() const { return StaticMeshComponents; }
+	const TArray<USkeletalMeshComponent*>& GetSkeletalMeshComponents() const { return SkeletalMeshComponents; }
+
+	/** Name of the camera or mesh component in the output directories, e.g. camera_params/{name}, actor_infos/{name}. */
+	const FString& GetExportName(const UObject* Object) const;
+
+	/** The label for the actors placed in the level, and the name for the ones spawned by the sequence. */
+	static FString MakeExportName(const ACameraActor* Camera);
+	static FString MakeExportName(const UPrimitiveComponent* Component);
+
+private:
+	void Resolve(UMoviePipeline* Pipeline);
+	void AddCamera(ACameraActor* Camera);
+	void AddComponent(UPrimitiveComponent* Component);
+
+private:
+	TArray<ACameraActor*> Cameras;
+	TArray<UStaticMeshComponent*> StaticMeshComponents;
+	TArray<USkeletalMeshComponent*> SkeletalMeshComponents;
+	TMap<const UObject*, FString> ExportNames;
+};
@@ -0,0 +1,156 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Misc/ScopeRWLock.h"
+
+class UWorld;
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+/**
+ * Binary layout of a scene cell cache file (little-endian):
+ *
+ *   [Header]   64 bytes, see FXFSceneCellCacheHeader
+ *   [Table]    Capacity * FXFSceneCellRecord, an open addressing hash table (Kind 0 is an empty slot)
+ *   [Names]    NumNames null terminated UTF-8 actor names, at NamesOffset
+ *
+ * The table is looked up in place from the memory-mapped file, new results are saved by rewriting the file.
+ */
+struct FXFSceneCellCacheHeader
+{
+	static constexpr uint32 MagicValue = 0x43534658;  // "XFSC"
+	static constexpr uint32 CurrentVersion = 1;
+
+	uint32 Magic = MagicValue;
+	uint32 Version = CurrentVersion;
+	uint32 HeaderSize = sizeof(FXFSceneCellCacheHeader);
+	uint32 RecordSize = 0;
+	uint32 Capacity = 0;  // power of two
+	uint32 NumRecords = 0;
+	uint64 NamesOffset = 0;
+	uint32 NumNames = 0;
+	uint32 Reserved0 = 0;
+	/** Time stamp (ticks) of the level file the results were traced in, the cache is dropped when it changes. */
+	int64 LevelTimeStamp = 0;
+	uint32 Reserved[4] = { 0, 0, 0, 0 };
+};
+static_assert(sizeof(FXFSceneCellCacheHeader) == 64, "FXFSceneCellCacheHeader must stay 64 bytes");
+
+/** Kind of scene query cached. */
+enum class EXFSceneCellQuery : uint8
+{
+	None = 0,
+	/** Box sweep down from a grid cell plus TestInside, see UXF_BlueprintFunctionLibrary::ScanSceneGrid. X, Y, Z: start, P0: end z, P1: box half size. */
+	Column = 1,
+	/** UXF_BlueprintFunctionLibrary::TestInside. X, Y, Z: location, P0: extend. */
+	Inside = 2,
+	/** Visibility line trace of the camera. X, Y, Z: camera location, P0, P1: pitch and yaw in 1/100 degree. */
+	CameraRay = 3,
+};
+
+/** A cached query, the positions are rounded to cm. */
+struct FXFSceneCellKey
+{
+	EXFSceneCellQuery Kind = EXFSceneCellQuery::None;
+	int32 X = 0;
+	int32 Y = 0;
+	int32 Z = 0;
+	int32 P0 = 0;
+	int32 P1 = 0;
+
+	bool operator==(const FXFSceneCellKey& Other) const
+	{
+		return Kind == Other.Kind && X == Other.X && Y == Other.Y && Z == Other.Z && P0 == Other.P0 && P1 == Other.P1;
+	}
+	friend uint32 GetTypeHash(const FXFSceneCellKey& Key) { return (uint32)Key.Hash64(); }
+	uint64 Hash64() const;
+
+	static FXFSceneCellKey Column(const FVector& Start, float HitEndZ, int32 BoxHalfSize);
+	static FXFSceneCellKey Inside(const FVector& Location, float Extend);
+	static FXFSceneCellKey CameraRay(const FVector& CameraLocation, const FRotator& CameraRotation);
+};
+
+/** Result of a cached query. */
+struct FXFSceneCellValue
+{
+	bool bIsHit = false;
+	/** Column only: the start is inside a model. */
+	bool bIsInside = false;
+	FVector Location = FVector::ZeroVector;
+	FString ActorName;
+};
+
+struct FXFSceneCellRecord
+{
+	uint8 Kind = 0;
+	uint8 Flags = 0;  // 1: hit, 2: inside
+	uint16 Padding = 0;
+	int32 X = 0;
+	int32 Y = 0;
+	int32 Z = 0;
+	int32 P0 = 0;
+	int32 P1 = 0;
+	float Location[3] = { 0.f, 0.f, 0.f };
+	int32 ActorIndex = -1;
+};
+static_assert(sizeof(FXFSceneCellRecord) == 40, "FXFSceneCellRecord must stay 40 bytes");
+
+
+/**
+ * Persistent cache of the scene queries of a level (grid scans, inside tests and camera rays).
+ *
+ * One file per level, under Saved/XRFeitoria/SceneCellCache. Find and Add are thread safe, so the
+ * grid scans can use the cache from their worker threads. The queries are keyed by their positions
+ * rounded to cm (and the box size of the sweeps), so a later run asking for the same cells gets the
+ * results without tracing the level again.
+ */
+class XRFEITORIAUNREAL_API FXFSceneCellCache
+{
+public:
+	/** Off by default: the cache can't know when the level is edited without being saved. */
+	static void SetEnabled(bool bInEnabled);
+	static bool IsEnabled();
+
+	/** The cache of the level of the world, loaded on first use. Null when the cache is disabled. */
+	static TSharedPtr<FXFSceneCellCache, ESPMode::ThreadSafe> Get(const UWorld* World);
+	/** Save the new results of every loaded cache, called on module shutdown. */
+	static void SaveAll();
+	/** Delete the cache file of the level of the world. */
+	static void Clear(const UWorld* World);
+
+	FXFSceneCellCache(const FString& InPath, int64 InLevelTimeStamp);
+	~FXFSceneCellCache();
+
+	bool Find(const FXFSceneCellKey& Key, FXFSceneCellValue& OutValue) const;
+	void Add(const FXFSceneCellKey& Key, const FXFSceneCellValue& Value);
+
+	/** Rewrite the file with the new results. Game thread only. */
+	bool Save();
+
+	const FString& GetPath() const { return Path; }
+	int32 GetNumMapped() const { return Header.NumRecords; }
+	int32 GetNumAdded() const;
+
+private:
+	bool Load();
+	void Unload();
+	const FXFSceneCellRecord* FindMapped(const FXFSceneCellKey& Key) const;
+
+private:
+	FString Path;
+	int64 LevelTimeStamp = 0;
+
+	/** The file, mapped, or read into FileData when the platform file can't map it. */
+	TUniquePtr<IMappedFileHandle> MappedHandle;
+	TUniquePtr<IMappedFileRegion> MappedRegion;
+	TArray64<uint8> FileData;
+	const uint8* Data = nullptr;
+	FXFSceneCellCacheHeader Header;
+	TArray<FString> MappedNames;
+
+	/** Results added since the file was loaded. */
+	mutable FRWLock AddedLock;
+	TMap<FXFSceneCellKey, FXFSceneCellValue> Added;
+};
@@ -0,0 +1,131 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/PlatformMemory.h"
+
+/**
+ * Binary layout of the shared memory ring of frames (little-endian):
+ *
+ *   [Header]      64 bytes, see FXFSharedFrameRingHeader
+ *   [Slot Infos]  SlotCount * FXFSharedFrameSlotInfo
+ *   [Slots]       SlotCount * SlotSize bytes, starting at HeaderSize (4096-byte aligned)
+ *
+ * A slot starts with MaxEntries FXFSharedFrameEntry describing its arrays, followed by the data of the arrays (64-byte aligned).
+ * Frame N (1-based sequence) is written in slot (N - 1) % SlotCount. The writer sets the sequence of the slot to 0 while
+ * writing, then to N, then publishes N as WriteSequence. The client writes the last sequence it's done with as ReadSequence,
+ * the writer doesn't overwrite a slot the client hasn't released (unless it's told to drop frames).
+ * The matching reader lives in `xrfeitoria/utils/shared_memory.py`.
+ */
+struct FXFSharedFrameRingHeader
+{
+	static constexpr uint32 MagicValue = 0x4D534658;  // "XFSM"
+	static constexpr uint32 CurrentVersion = 1;
+
+	uint32 Magic = MagicValue;
+	uint32 Version = CurrentVersion;
+	uint32 HeaderSize = 0;
+	uint32 SlotCount = 0;
+	uint64 SlotSize = 0;
+	/** Sequence of the last published frame, 0 before the first one. */
+	volatile uint64 WriteSequence = 0;
+	/** Written by the client, sequence of the last frame it has released. */
+	volatile uint64 ReadSequence = 0;
+	/** 0 while rendering, 1 once the render has finished. */
+	volatile uint32 Status = 0;
+	uint32 Reserved[5] = { 0, 0, 0, 0, 0 };
+};
+static_assert(sizeof(FXFSharedFrameRingHeader) == 64, "FXFSharedFrameRingHeader must stay 64 bytes");
+
+struct FXFSharedFrameSlotInfo
+{
+	/** Sequence of the frame in the slot, 0 while it's written. */
+	volatile uint64 Sequence = 0;
+	int32 FrameNumber = -1;
+	int32 ShotIndex = -1;
+	uint32 NumEntries = 0;
+	uint32 Reserved = 0;
+	uint64 UsedBytes = 0;
+};
+static_assert(sizeof(FXFSharedFrameSlotInfo) == 32, "FXFSharedFrameSlotInfo must stay 32 bytes");
+
+enum class EXFSharedDataType : uint32
+{
+	UInt8 = 0,
+	Float16 = 1,
+	Float32 = 2,
+	Int32 = 3,
+};
+
+struct FXFSharedFrameEntry
+{
+	static constexpr int32 MaxNameLength = 56;
+	static constexpr int32 MaxDims = 4;
+
+	/** Null terminated UTF-8, e.g. "rgb", "camera/{camera_name}", "skeleton/{actor_name}". */
+	ANSICHAR Name[MaxNameLength] = {};
+	uint32 DataType = 0;  // EXFSharedDataType
+	uint32 NumDims = 0;
+	uint32 Shape[MaxDims] = { 0, 0, 0, 0 };
+	/** Offset of the data from the start of the slot. */
+	uint64 Offset = 0;
+	uint64 NumBytes = 0;
+};
+static_assert(sizeof(FXFSharedFrameEntry) == 96, "FXFSharedFrameEntry must stay 96 bytes");
+
+
+/** Writer of the shared memory ring. Game thread only. */
+class XRFEITORIAUNREAL_API FXFSharedFrameRing
+{
+public:
+	static constexpr int32 MaxEntries = 32;
+	/** Longest sleep between two polls of the client while waiting for a slot. */
+	static constexpr float MaxPollSeconds = 0.01f;
+
+	~FXFSharedFrameRing();
+
+	/**
+	 * Create the named region. The name is platform independent (a "Global\" or "/" prefix is stripped),
+	 * the engine maps it as "Global\{Name}" on Windows and "/{Name}" elsewhere, which the client opens from the same name.
+	 */
+	bool Open(const FString& InName, int32 InSlotCount, int64 InSlotSize);
+	/** The platform independent name of the region, without the prefix of the platform. */
+	static FString NormalizeName(const FString& InName);
+	/** The name of the region for the platform, e.g. "Global\xrfeitoria_frames" on Windows. */
+	static FString GetPlatformName(const FString& InName);
+	/** Mark the render as finished and unmap the region. */
+	void Close();
+	bool IsOpen() const { return Region != nullptr; }
+
+	/**
+	 * Start the next frame. When the client hasn't released the slot yet, overwrite it right away when bDropWhenFull,
+	 * or wait for it up to MaxWaitSeconds. The wait stalls the game thread, polling with a growing sleep (up to MaxPollSeconds).
+	 * Once a wait times out, the following frames are dropped without waiting until the client catches up,
+	 * so a client which stopped reading costs one MaxWaitSeconds stall rather than one per frame.
+	 * Returns false when the frame is skipped.
+	 */
+	bool BeginFrame(int32 FrameNumber, int32 ShotIndex, bool bDropWhenFull, float MaxWaitSeconds);
+	/** Copy an array into the current frame. Returns false when the slot or the entry table is full. */
+	bool AddEntry(const FString& EntryName, EXFSharedDataType DataType, TArrayView<const uint32> Shape, const void* Data, int64 NumBytes);
+	/** Publish the current frame to the client. */
+	void EndFrame();
+
+private:
+	FXFSharedFrameRingHeader* GetHeader() const;
+	FXFSharedFrameSlotInfo* GetSlotInfo(int32 SlotIdx) const;
+	uint8* GetSlot(int32 SlotIdx) const;
+
+private:
+	FString Name;
+	FPlatformMemory::FSharedMemoryRegion* Region = nullptr;
+	uint64 Sequence = 0;
+	/** Slot of the frame between BeginFrame and EndFrame, INDEX_NONE otherwise. */
+	int32 CurrentSlot = INDEX_NONE;
+	uint64 CurrentUsedBytes = 0;
+	uint32 CurrentNumEntries = 0;
+	bool bWarnedSlotSize = false;
+	/** A wait for the client timed out, the frames are dropped until it catches up. */
+	bool bClientStalled = false;
+	int32 NumDroppedFrames = 0;
+};
@@ -0,0 +1,45 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class USkeletalMeshComponent;
+
+// FCachedGeometry exposes the skin cache buffers to RDG since 5.1
+#define XF_WITH_SKIN_CACHE_READBACK (ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION >= 1)
+
+/**
+ * Reads the skinned vertex positions of skeletal meshes back from the GPU skin cache,
+ * instead of skinning them again on the CPU.
+ *
+ * Request() copies the position buffer of the skin cache into a staging buffer on the render thread,
+ * and the positions are handed to the callback by a later Poll(), once the GPU has finished the copy (usually one frame later).
+ * The skin cache must be enabled (r.SkinCache.CompileShaders=1), otherwise Request() returns false and the caller should skin on the CPU.
+ */
+class XRFEITORIAUNREAL_API FXFSkinnedVertexReadback
+{
+public:
+	/** Called on the game thread with the world space positions of the vertices, empty when the readback failed. */
+	typedef TUniqueFunction<void(TArray<FVector>&& VertexPositions)> FOnReadbackComplete;
+
+	~FXFSkinnedVertexReadback();
+
+	/** Whether the vertices of the LOD of this component can be read back from the skin cache this frame. */
+	static bool IsSupported(USkeletalMeshComponent* Comp, int32 LODIndex);
+
+	/** Queue a readback of the current skinned positions. Returns false when the mesh is not in the skin cache. */
+	bool Request(USkeletalMeshComponent* Comp, int32 LODIndex, FOnReadbackComplete&& OnComplete);
+
+	/** Run the callbacks of the finished readbacks in request order, and return the number of readbacks still pending. */
+	int32 Poll();
+
+	/** Block until every pending readback has finished, or the timeout is reached. */
+	void Drain(double TimeoutSeconds = 5.0);
+
+	int32 GetNumPending() const { return Pending.Num(); }
+
+private:
+	struct FRequest;
+	TArray<TSharedPtr<FRequest, ESPMode::ThreadSafe>> Pending;
+};
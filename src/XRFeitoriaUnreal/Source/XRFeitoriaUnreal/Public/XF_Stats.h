@@ -0,0 +1,140 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Stats/Stats.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+#include "UObject/WeakObjectPtr.h"
+
+class UMoviePipeline;
+struct FMoviePipelineFrameOutputState;
+
+DECLARE_STATS_GROUP(TEXT("XRFeitoria"), STATGROUP_XF, STATCAT_Advanced);
+
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Resolve Bindings"), STAT_XF_ResolveBindings, STATGROUP_XF, XRFEITORIAUNREAL_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Vertex Extraction"), STAT_XF_VertexExtraction, STATGROUP_XF, XRFEITORIAUNREAL_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Skinning Readback"), STAT_XF_Skinning, STATGROUP_XF, XRFEITORIAUNREAL_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Skeleton"), STAT_XF_Skeleton, STATGROUP_XF, XRFEITORIAUNREAL_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Vertex Encoding"), STAT_XF_Encoding, STATGROUP_XF, XRFEITORIAUNREAL_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Projection"), STAT_XF_Projection, STATGROUP_XF, XRFEITORIAUNREAL_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Occlusion"), STAT_XF_Occlusion, STATGROUP_XF, XRFEITORIAUNREAL_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Path Resolution"), STAT_XF_PathResolution, STATGROUP_XF, XRFEITORIAUNREAL_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("File Write"), STAT_XF_FileWrite, STATGROUP_XF, XRFEITORIAUNREAL_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Image Write"), STAT_XF_ImageWrite, STATGROUP_XF, XRFEITORIAUNREAL_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Write Queue Stall"), STAT_XF_QueueStall, STATGROUP_XF, XRFEITORIAUNREAL_API);
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Scene Sweep"), STAT_XF_SceneSweep, STATGROUP_XF, XRFEITORIAUNREAL_API);
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Write Queue Depth"), STAT_XF_WriteQueueDepth, STATGROUP_XF, XRFEITORIAUNREAL_API);
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Files Created"), STAT_XF_FilesCreated, STATGROUP_XF, XRFEITORIAUNREAL_API);
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Bytes Written"), STAT_XF_BytesWritten, STATGROUP_XF, XRFEITORIAUNREAL_API);
+
+/** Stages of the outputs timed for the shot summaries, one per cycle stat above. */
+enum class EXFStage : uint8
+{
+	ResolveBindings,
+	VertexExtraction,
+	Skinning,
+	Skeleton,
+	Encoding,
+	Projection,
+	Occlusion,
+	PathResolution,
+	FileWrite,
+	ImageWrite,
+	QueueStall,
+	SceneSweep,
+	Num
+};
+
+/** Totals of the stages since the start of the process, see FXFStats::Capture. */
+struct FXFStatsSnapshot
+{
+	uint64 StageCycles[(int32)EXFStage::Num] = {};
+	uint64 StageCalls[(int32)EXFStage::Num] = {};
+	int64 BytesWritten = 0;
+	int64 FilesCreated = 0;
+	int32 MaxQueueDepth = 0;
+};
+
+/**
+ * Process wide counters of the stages, for the shot summaries. The stat group is for `stat XRFeitoria` and
+ * Unreal Insights, these are the same timings accumulated over a shot. Thread safe.
+ */
+class XRFEITORIAUNREAL_API FXFStats
+{
+public:
+	static void AddStageTime(EXFStage Stage, uint64 Cycles);
+	/** Whether the scope is the outermost one of the stage on this thread, the nested ones aren't counted twice. */
+	static bool EnterStage(EXFStage Stage);
+	static void ExitStage(EXFStage Stage);
+	/** A file written by the outputs, bCreated when it's opened for the first time. */
+	static void AddFileWrite(int64 NumBytes, bool bCreated);
+	static void SetQueueDepth(int32 Depth);
+	static FXFStatsSnapshot Capture();
+	/** Reset the peak queue depth of the snapshots. */
+	static void ResetMaxQueueDepth();
+	static const TCHAR* GetStageName(EXFStage Stage);
+};
+
+/** Adds the time of the scope to the counters of the stage, unless it's nested in another scope of the stage. */
+class FXFStageScope
+{
+public:
+	explicit FXFStageScope(EXFStage InStage)
+		: Stage(InStage), bOutermost(FXFStats::EnterStage(InStage)), StartCycles(FPlatformTime::Cycles64())
+	{}
+	~FXFStageScope()
+	{
+		FXFStats::ExitStage(Stage);
+		if (bOutermost) FXFStats::AddStageTime(Stage, FPlatformTime::Cycles64() - StartCycles);
+	}
+
+private:
+	EXFStage Stage;
+	bool bOutermost;
+	uint64 StartCycles;
+};
+
+/** Time the scope as the stage, in `stat XRFeitoria`, Unreal Insights (cpu channel) and the shot summaries. */
+#define XF_SCOPE_STAGE(Stage) \
+	SCOPE_CYCLE_COUNTER(STAT_XF_##Stage); \
+	TRACE_CPUPROFILER_EVENT_SCOPE(XF_##Stage); \
+	FXFStageScope PREPROCESSOR_JOIN(XFStageScope_, __LINE__)(EXFStage::Stage)
+
+/**
+ * Summary of each shot of the pipeline, written to {OutputDirectory}/{sequence_name}/stats/{shot_name}[_shard{index}of{count}].json:
+ * time per stage (total and per frame), bytes written and files created, peak write queue depth,
+ * along with the plugin and engine versions, to compare the throughput of the plugin versions on real jobs.
+ *
+ * The outputs of the pipeline share it like FXFResumeManifest. The summary is written on the write queue once
+ * every registered output has finished the shot, after the writes of the shot.
+ */
+class XRFEITORIAUNREAL_API FXFShotStatsRecorder
+{
+public:
+	/** The recorder of the pipeline, created by the first output asking for it. Game thread only. */
+	static TSharedRef<FXFShotStatsRecorder> Get(UMoviePipeline* Pipeline);
+
+	/** Register an output which must finish the shots before their summary, in SetupForPipelineImpl. */
+	void RegisterOutput(const UObject* Output);
+	/** The output receives a frame, the first frame of a shot starts its summary. Game thread only. */
+	void BeginFrame(const FMoviePipelineFrameOutputState& OutputState);
+	/** The output has finished the shot, its summary is written once every output has. Game thread only. */
+	void FinishShot(const UObject* Output, int32 ShotIndex);
+
+private:
+	struct FShotStats
+	{
+		FXFStatsSnapshot Start;
+		double StartSeconds = 0.0;
+		TSet<int32> OutputFrames;
+		TSet<const UObject*> FinishedOutputs;
+	};
+
+	void WriteSummary(int32 ShotIndex, FShotStats&& Shot);
+
+private:
+	TWeakObjectPtr<UMoviePipeline> Pipeline;
+	TSet<const UObject*> Outputs;
+	TMap<int32, FShotStats> Shots;
+};
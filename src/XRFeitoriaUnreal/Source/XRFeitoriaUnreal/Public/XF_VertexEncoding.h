@@ -0,0 +1,85 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "XF_VertexEncoding.generated.h"
+
+UENUM(BlueprintType)
+enum class EMeshVertexEncoding : uint8
+{
+	/** float32 per component, the raw .dat files without a header. */
+	Float32 = 0,
+	/** float16 per component, the offsets from the center of the bounds of the actor in the frame. */
+	Float16,
+	/** uint16 per component, quantized in the bounds of the actor at the keyframe. Needed for the delta frames. */
+	Fixed16
+};
+
+/**
+ * Binary layout of an encoded vertex frame (little-endian), a .dat file or a record of a chunked shot file:
+ *
+ *   [Header]   40 bytes, see FXFVertexFrameHeader
+ *   [Payload]  NumVertices * 3 components:
+ *              Float16: float16 (Origin + Value), Fixed16 keyframe: uint16 (Origin + Value * Step),
+ *              Fixed16 delta frame: int8, added to the uint16 values of ReferenceFrame
+ *
+ * The matching decoder lives in `xrfeitoria/utils/vertex_encoding.py`.
+ */
+struct FXFVertexFrameHeader
+{
+	static constexpr uint32 MagicValue = 0x45564658;  // "XFVE"
+
+	uint32 Magic = MagicValue;
+	uint8 Encoding = 0;  // EMeshVertexEncoding
+	uint8 bIsDelta = 0;
+	uint16 Reserved = 0;
+	uint32 NumVertices = 0;
+	/** Output frame number of the frame the deltas apply to, -1 for a keyframe. */
+	int32 ReferenceFrame = -1;
+	float Origin[3] = { 0.f, 0.f, 0.f };
+	float Step[3] = { 0.f, 0.f, 0.f };
+};
+static_assert(sizeof(FXFVertexFrameHeader) == 40, "FXFVertexFrameHeader must stay 40 bytes");
+
+struct FXFVertexEncodingSettings
+{
+	EMeshVertexEncoding Encoding = EMeshVertexEncoding::Float32;
+	/** A keyframe every KeyframeInterval frames, the others are deltas. 0 or 1 for keyframes only. */
+	int32 KeyframeInterval = 0;
+	/** Margin (cm) around the bounds of the keyframe, room for the motion of the delta frames. */
+	float QuantizationMargin = 50.f;
+	/** Min quantization step (cm). A delta frame moves each component by at most 127 steps, a coarser step keeps more frames as deltas. */
+	float QuantizationStep = 0.f;
+
+	/** Whether the frames are the raw float32 vertices. */
+	bool IsRaw() const { return Encoding == EMeshVertexEncoding::Float32; }
+};
+
+/**
+ * Encoder of the vertex frames of one mesh, keeping the previous frame for the deltas.
+ * Frames must be encoded in output order. A frame whose motion doesn't fit in int8 deltas is written as a keyframe.
+ */
+class XRFEITORIAUNREAL_API FXFVertexEncoder
+{
+public:
+	explicit FXFVertexEncoder(const FXFVertexEncodingSettings& InSettings) : Settings(InSettings) {}
+
+	void Encode(TArrayView<const FVector> Positions, int32 FrameNumber, TArray<uint8>& OutFrame);
+
+	/** Size of the largest frame of NumVertices, the stride of the records in a chunked shot file. */
+	static int32 GetMaxFrameSize(int32 NumVertices, EMeshVertexEncoding Encoding);
+
+private:
+	void EncodeKeyframe(TArrayView<const FVector> Positions, FXFVertexFrameHeader& Header, TArray<uint8>& OutFrame);
+	bool EncodeDelta(TArrayView<const FVector> Positions, FXFVertexFrameHeader& Header, TArray<uint8>& OutFrame);
+
+private:
+	FXFVertexEncodingSettings Settings;
+	int32 FramesSinceKeyframe = 0;
+	int32 PreviousFrame = INDEX_NONE;
+	/** Quantized values of the previous frame, the base of the next delta. */
+	TArray<uint16> Quantized;
+	FVector Origin = FVector::ZeroVector;
+	FVector Step = FVector::OneVector;
+};
@@ -40,6 +40,8 @@ public class XRFeitoriaUnreal : ModuleRules
 				"MovieRenderPipelineRenderPasses",
 				"MovieRenderPipelineEditor",
 				"MeshDescription",
+				"Json", // For mask colors
+				"Projects", // For plugin content dir
 
 				"MovieScene",
 				"MovieSceneTools",
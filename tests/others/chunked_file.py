@@ -0,0 +1,105 @@
+"""Round trip of :mod:`xrfeitoria.utils.chunked_file` against files written to the layout of
+``FXFChunkedFileHeader`` (``XF_ChunkedFile.h``), without the renderer.
+Run by ``python -m tests.others.chunked_file``.
+"""
+
+import struct
+import tempfile
+from pathlib import Path
+
+import numpy as np
+
+from xrfeitoria.utils.chunked_file import MAGIC, load_chunked_file, merge_shards, read_chunked_header
+
+HEADER_SIZE = 64
+DATA_ALIGNMENT = 64
+
+
+def write_chunked_file(path: Path, frames, records: np.ndarray, frame_capacity: int) -> None:
+    """``FXFChunkedFileWriter`` of float32 records, the slots after the records are left empty."""
+    _, element_count, element_components = records.shape
+    record_stride = element_count * element_components * 4
+    index_offset = HEADER_SIZE
+    data_offset = -(-(index_offset + frame_capacity * 4) // DATA_ALIGNMENT) * DATA_ALIGNMENT
+    header = struct.pack(
+        '<8IQQIi2I',
+        MAGIC,
+        1,  # version
+        HEADER_SIZE,
+        frame_capacity,
+        record_stride,
+        element_count,
+        element_components,
+        0,  # float32
+        index_offset,
+        data_offset,
+        len(frames),
+        frames[0],
+        0,
+        0,
+    )
+    index = np.full(frame_capacity, -1, '<i4')
+    index[: len(frames)] = frames
+    data = np.zeros((frame_capacity, element_count, element_components), '<f4')
+    data[: len(records)] = records
+    with path.open('wb') as f:
+        f.write(header)
+        f.seek(index_offset)
+        f.write(index.tobytes())
+        f.seek(data_offset)
+        f.write(data.tobytes())
+
+
+def test_load():
+    with tempfile.TemporaryDirectory() as folder:
+        file = Path(folder) / 'SMPL-XL.xfc'
+        records = np.random.rand(3, 55, 3).astype(np.float32)
+        write_chunked_file(file, [10, 11, 12], records, frame_capacity=5)
+
+        header = read_chunked_header(file)
+        assert (header.frame_capacity, header.element_count, header.element_components) == (5, 55, 3)
+        assert header.frames_written == 3
+
+        frames, data = load_chunked_file(file, mmap=False)
+        np.testing.assert_array_equal(frames, [10, 11, 12])
+        np.testing.assert_array_equal(data, records)
+
+        frames, data = load_chunked_file(file, mmap=False, valid_only=False)
+        np.testing.assert_array_equal(frames, [10, 11, 12, -1, -1])
+        assert data.shape == (5, 55, 3)
+
+
+def test_merge_shards():
+    with tempfile.TemporaryDirectory() as folder:
+        records = np.random.rand(4, 2, 16).astype(np.float32)
+        # frames 0 and 2 in the first shard, 1 and 3 in the second
+        write_chunked_file(Path(folder) / 'Camera_shard000of002.xfc', [0, 2], records[[0, 2]], frame_capacity=2)
+        write_chunked_file(Path(folder) / 'Camera_shard001of002.xfc', [1, 3], records[[1, 3]], frame_capacity=3)
+
+        merged = merge_shards(folder)
+        assert [file.name for file in merged] == ['Camera.xfc']
+        assert sorted(file.name for file in Path(folder).iterdir()) == ['Camera.xfc']
+
+        frames, data = load_chunked_file(merged[0], mmap=False)
+        np.testing.assert_array_equal(frames, [0, 1, 2, 3])
+        np.testing.assert_array_equal(data, records)
+        assert read_chunked_header(merged[0]).frames_written == 4
+
+
+def test_not_chunked():
+    with tempfile.TemporaryDirectory() as folder:
+        file = Path(folder) / 'raw.dat'
+        file.write_bytes(np.zeros(48, np.float32).tobytes())
+        try:
+            read_chunked_header(file)
+        except ValueError:
+            pass
+        else:
+            raise AssertionError('read the header of a raw file')
+
+
+if __name__ == '__main__':
+    test_load()
+    test_merge_shards()
+    test_not_chunked()
+    print('chunked_file: ok')
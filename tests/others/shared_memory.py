@@ -0,0 +1,108 @@
+"""Round trip of :mod:`xrfeitoria.utils.shared_memory` against a ring written to the layout of
+``XF_SharedFrameRing.h``, without the renderer. Run by ``python -m tests.others.shared_memory``.
+"""
+
+import struct
+import uuid
+from multiprocessing import shared_memory
+
+import numpy as np
+
+from xrfeitoria.utils.shared_memory import SharedFrameReader, get_region_name
+
+# sizes of the static_asserts of XF_SharedFrameRing.h
+HEADER_SIZE = 64
+SLOT_INFO_SIZE = 32
+ENTRY_SIZE = 96
+MAX_ENTRIES = 32
+DATA_TYPE_FLOAT32 = 2
+
+
+def align(value: int, alignment: int) -> int:
+    return (value + alignment - 1) // alignment * alignment
+
+
+class RingWriter:
+    """The writer of ``FXFSharedFrameRing``, packed with struct."""
+
+    def __init__(self, name: str, slot_count: int = 2, slot_size: int = 1 << 16) -> None:
+        self.slot_count = slot_count
+        self.slot_size = align(slot_size, 4096)
+        self.header_size = align(HEADER_SIZE + slot_count * SLOT_INFO_SIZE, 4096)
+        self.shm = shared_memory.SharedMemory(
+            name=get_region_name(name), create=True, size=self.header_size + slot_count * self.slot_size
+        )
+        self.sequence = 0
+        header = (0x4D534658, 1, self.header_size, slot_count, self.slot_size, 0, 0, 0, *[0] * 5)
+        struct.pack_into('<4IQQQI5I', self.shm.buf, 0, *header)
+
+    def write_frame(self, frame_number: int, arrays: dict) -> None:
+        self.sequence += 1
+        slot = (self.sequence - 1) % self.slot_count
+        slot_start = self.header_size + slot * self.slot_size
+        slot_info = HEADER_SIZE + slot * SLOT_INFO_SIZE
+        struct.pack_into('<Q', self.shm.buf, slot_info, 0)
+
+        used = align(MAX_ENTRIES * ENTRY_SIZE, 64)
+        for idx, (name, array) in enumerate(arrays.items()):
+            data = np.ascontiguousarray(array, dtype=np.float32).tobytes()
+            offset = align(used, 64)
+            shape = list(array.shape) + [0] * (4 - array.ndim)
+            entry = (name.encode('utf-8'), DATA_TYPE_FLOAT32, array.ndim, *shape, offset, len(data))
+            struct.pack_into('<56s2I4I2Q', self.shm.buf, slot_start + idx * ENTRY_SIZE, *entry)
+            self.shm.buf[slot_start + offset : slot_start + offset + len(data)] = data
+            used = offset + len(data)
+
+        struct.pack_into('<Qii2IQ', self.shm.buf, slot_info, self.sequence, frame_number, 0, len(arrays), 0, used)
+        # WriteSequence
+        struct.pack_into('<Q', self.shm.buf, 24, self.sequence)
+
+    @property
+    def read_sequence(self) -> int:
+        return struct.unpack_from('<Q', self.shm.buf, 32)[0]
+
+    def finish(self) -> None:
+        struct.pack_into('<I', self.shm.buf, 40, 1)
+
+    def close(self) -> None:
+        self.shm.close()
+        self.shm.unlink()
+
+
+def test_region_name():
+    assert get_region_name('xrfeitoria_frames', platform='win32') == 'Global\\xrfeitoria_frames'
+    assert get_region_name('Global\\xrfeitoria_frames', platform='win32') == 'Global\\xrfeitoria_frames'
+    assert get_region_name('xrfeitoria_frames', platform='linux') == 'xrfeitoria_frames'
+    assert get_region_name('/xrfeitoria_frames', platform='linux') == 'xrfeitoria_frames'
+    assert get_region_name('Global\\xrfeitoria_frames', platform='darwin') == 'xrfeitoria_frames'
+
+
+def test_read_frames():
+    name = f'xf_test_{uuid.uuid4().hex[:8]}'
+    writer = RingWriter(name)
+    try:
+        camera = np.arange(12, dtype=np.float32).reshape(4, 3)
+        skeleton = np.random.rand(55, 3).astype(np.float32)
+        writer.write_frame(0, {'camera/Camera': camera, 'skeleton/SMPL-XL': skeleton})
+        writer.write_frame(1, {'camera/Camera': camera + 1})
+        writer.finish()
+
+        # the reader is given the name of the render job, with or without the prefix
+        with SharedFrameReader(name, timeout=1.0) as reader:
+            frames = []
+            for frame in reader:
+                frames.append(frame)
+            assert [frame.frame_number for frame in frames] == [0, 1]
+            np.testing.assert_array_equal(frames[0]['camera/Camera'], camera)
+            np.testing.assert_array_equal(frames[0]['skeleton/SMPL-XL'], skeleton)
+            np.testing.assert_array_equal(frames[1]['camera/Camera'], camera + 1)
+            assert 'skeleton/SMPL-XL' not in frames[1]
+            assert writer.read_sequence == 2
+    finally:
+        writer.close()
+
+
+if __name__ == '__main__':
+    test_region_name()
+    test_read_frames()
+    print('shared_memory: ok')
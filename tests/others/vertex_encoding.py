@@ -0,0 +1,95 @@
+"""Round trip of :mod:`xrfeitoria.utils.vertex_encoding` against frames written to the layout of
+``FXFVertexFrameHeader`` (``XF_VertexEncoding.h``), without the renderer.
+Run by ``python -m tests.others.vertex_encoding``.
+"""
+
+import struct
+
+import numpy as np
+
+from xrfeitoria.utils.vertex_encoding import (
+    ENCODING_FIXED16,
+    ENCODING_FLOAT16,
+    MAGIC,
+    decode_vertex_frames,
+    is_encoded_frame,
+)
+
+MAX_QUANTIZED_VALUE = 65535
+
+
+def pack_header(encoding: int, num_vertices: int, origin, step=(0, 0, 0), is_delta=0, reference_frame=-1) -> bytes:
+    return struct.pack('<IBBHIi3f3f', MAGIC, encoding, is_delta, 0, num_vertices, reference_frame, *origin, *step)
+
+
+def encode_float16(positions: np.ndarray) -> bytes:
+    """``FXFVertexEncoder::Encode`` of Float16, offsets from the center of the bounds."""
+    center = (positions.min(axis=0) + positions.max(axis=0)) / 2
+    offsets = (positions - center).astype('<f2')
+    return pack_header(ENCODING_FLOAT16, len(positions), center) + offsets.tobytes()
+
+
+def encode_fixed16(frames: np.ndarray, margin: float = 50.0):
+    """``FXFVertexEncoder::EncodeKeyframe`` of the first frame, ``EncodeDelta`` of the others."""
+    origin = frames[0].min(axis=0) - margin
+    step = (frames[0].max(axis=0) + margin - origin) / MAX_QUANTIZED_VALUE
+    quantized = np.round((frames[0] - origin) / step).astype(np.int32)
+    encoded = [pack_header(ENCODING_FIXED16, len(frames[0]), origin, step) + quantized.astype('<u2').tobytes()]
+    for frame_number, positions in enumerate(frames[1:]):
+        values = np.round((positions - origin) / step).astype(np.int32)
+        deltas = values - quantized
+        assert np.abs(deltas).max() <= 127, 'moved too much for a delta frame'
+        header = pack_header(ENCODING_FIXED16, len(positions), origin, step, is_delta=1, reference_frame=frame_number)
+        encoded.append(header + deltas.astype(np.int8).tobytes())
+        quantized = values
+    return encoded, step
+
+
+def test_float16():
+    positions = (np.random.rand(100, 3) * 20 + np.array([5000.0, -3000.0, 100.0])).astype(np.float32)
+    frame = encode_float16(positions)
+    assert is_encoded_frame(frame)
+    # the records of a chunked file are padded to the stride
+    decoded = decode_vertex_frames([frame, frame + bytes(64)])
+    assert decoded.shape == (2, 100, 3)
+    # float16 offsets of at most 10 cm
+    np.testing.assert_allclose(decoded[0], positions, atol=0.01)
+    np.testing.assert_array_equal(decoded[0], decoded[1])
+
+
+def test_fixed16():
+    start = np.random.rand(50, 3).astype(np.float32) * 100
+    frames = np.stack([start + np.float32(0.05) * i for i in range(5)])
+    encoded, step = encode_fixed16(frames)
+    assert all(is_encoded_frame(frame) for frame in encoded)
+    decoded = decode_vertex_frames(encoded)
+    assert decoded.shape == frames.shape
+    np.testing.assert_allclose(decoded, frames, atol=float(step.max()))
+
+    # a delta frame needs the frame before it
+    try:
+        decode_vertex_frames(encoded[1:])
+    except ValueError:
+        pass
+    else:
+        raise AssertionError('decoded a delta frame without its keyframe')
+
+
+def test_raw_float32():
+    # the first float has the bytes of the magic, the rest isn't a valid header
+    first = np.frombuffer(struct.pack('<I', MAGIC), np.float32)[0]
+    positions = np.array([[first, 1.5, -2.0], [3.0, 4.0, 5.0], [6.0, 7.0, 8.0], [9.0, 10.0, 11.0]], np.float32)
+    frame = positions.tobytes()
+    assert not is_encoded_frame(frame)
+    np.testing.assert_array_equal(decode_vertex_frames([frame])[0], positions)
+
+    # a header with a truncated payload is read as float32 as well
+    truncated = encode_float16(np.random.rand(100, 3).astype(np.float32))[:-12]
+    assert not is_encoded_frame(truncated)
+
+
+if __name__ == '__main__':
+    test_float16()
+    test_fixed16()
+    test_raw_float32()
+    print('vertex_encoding: ok')
@@ -0,0 +1,126 @@
+"""
+>>> python -m tests.unreal.benchmark [-b] [--passes 4] [--actors 8] [--frames 30]
+
+Benchmark of a full render: a short sequence with M skinned actors rendered with N annotation passes,
+vertices and skeleton exported. Writes the wall time of the render and the per shot stats of the plugin
+(``{seq}/stats/*.json``) to ``{output_path}/benchmark.json``.
+
+The hot paths of the plugin are benchmarked in the editor, see ``XRFeitoria.Benchmarks`` in ``tests/README.md``.
+"""
+import json
+import platform
+import time
+from pathlib import Path
+
+from xrfeitoria.data_structure.models import RenderPass
+from xrfeitoria.data_structure.models import SequenceTransformKey as SeqTransKey
+from xrfeitoria.factory import XRFeitoriaUnreal
+
+from ..config import assets_path
+from ..utils import __timer__, _init_unreal, setup_logger
+
+root = Path(__file__).parents[2].resolve()
+# output_path = '~/xrfeitoria/output/tests/unreal/{file_name}'
+output_path = root / 'output' / Path(__file__).relative_to(root).with_suffix('')
+seq_name = 'seq_benchmark'
+
+kc_fbx = assets_path['koupen_chan']
+annotation_passes = ['mask', 'depth', 'flow', 'normal', 'diffuse', 'basecolor', 'metallic', 'roughness', 'specular']
+
+
+def new_seq(xf_runner: XRFeitoriaUnreal, level_path: str, num_passes: int, num_actors: int, num_frames: int):
+    kc_path = xf_runner.utils.import_asset(path=kc_fbx)
+
+    with xf_runner.Sequence.new(level=level_path, seq_name=seq_name, seq_length=num_frames, replace=True) as seq:
+        seq.spawn_camera(location=(-8, 0, 2), rotation=(0, -10, 0), fov=90.0, camera_name='Camera')
+        for idx in range(num_actors):
+            location = (2 * (idx // 4), 2 * (idx % 4) - 3, 0)
+            seq.spawn_actor_with_keys(
+                actor_asset_path=kc_path,
+                transform_keys=[
+                    SeqTransKey(
+                        frame=0, location=location, rotation=(0, 0, 0), scale=(0.05, 0.05, 0.05), interpolation='AUTO'
+                    ),
+                    SeqTransKey(frame=num_frames, location=location, rotation=(0, 0, 360), interpolation='AUTO'),
+                ],
+                actor_name=f'KoupenChan_{idx}',
+                stencil_value=idx + 1,
+            )
+
+        seq.add_to_renderer(
+            output_path=output_path,
+            resolution=(1280, 720),
+            render_passes=[RenderPass('img', 'png')]
+            + [RenderPass(name, 'exr') for name in annotation_passes[:num_passes]],
+            export_vertices=True,
+            export_skeleton=True,
+        )
+
+
+def benchmark(
+    debug: bool = False, background: bool = False, num_passes: int = 4, num_actors: int = 8, num_frames: int = 30
+):
+    logger = setup_logger(debug=debug)
+    with _init_unreal(background=background) as xf_runner:
+        xf_runner.Renderer.clear()
+
+        default_level = '/Game/Levels/Default'
+        level_template = '/Game/Levels/Playground'
+        level_benchmark = '/Game/Levels/BenchmarkTest'
+
+        xf_runner.utils.open_level(default_level)
+        xf_runner.utils.duplicate_asset(level_template, level_benchmark, replace=True)
+
+        with __timer__(f"create seq '{seq_name}'"):
+            new_seq(xf_runner, level_benchmark, num_passes=num_passes, num_actors=num_actors, num_frames=num_frames)
+        with __timer__('render jobs'):
+            start_time = time.perf_counter()
+            xf_runner.Renderer.render_jobs()
+            render_seconds = time.perf_counter() - start_time
+
+    stats = {}
+    for stats_file in sorted((output_path / seq_name / 'stats').glob('*.json')):
+        stats[stats_file.stem] = json.loads(stats_file.read_text())
+    if not stats:
+        logger.warning('No stats of the shots found, the plugin may be older than the stats summaries')
+
+    results = {
+        'name': 'render',
+        'date': time.strftime('%Y-%m-%dT%H:%M:%S'),
+        'platform': platform.platform(),
+        'params': {
+            'passes': num_passes,
+            'actors': num_actors,
+            'frames': num_frames,
+            'resolution': [1280, 720],
+        },
+        'render_seconds': render_seconds,
+        'seconds_per_frame': render_seconds / num_frames,
+        'shots': stats,
+    }
+    results_path = output_path / 'benchmark.json'
+    results_path.parent.mkdir(parents=True, exist_ok=True)
+    results_path.write_text(json.dumps(results, indent=2))
+
+    logger.info(f'Rendered {num_frames} frames in {render_seconds:.2f}s ({render_seconds / num_frames:.3f}s per frame)')
+    logger.info(f'🎉 [bold green]benchmark results saved to {results_path}')
+
+
+if __name__ == '__main__':
+    import argparse
+
+    args = argparse.ArgumentParser()
+    args.add_argument('--debug', action='store_true')
+    args.add_argument('--background', '-b', action='store_true')
+    args.add_argument('--passes', type=int, default=4, help=f'annotation passes, up to {len(annotation_passes)}')
+    args.add_argument('--actors', type=int, default=8, help='skinned actors')
+    args.add_argument('--frames', type=int, default=30)
+    args = args.parse_args()
+
+    benchmark(
+        debug=args.debug,
+        background=args.background,
+        num_passes=args.passes,
+        num_actors=args.actors,
+        num_frames=args.frames,
+    )
@@ -138,6 +138,20 @@ class CameraParameter(PinholeCameraParameter):
         # read camera parameters
         with open(file, 'rb') as f:
             dat = np.frombuffer(f.read(), np.float32).reshape(9)
+        return cls.from_array(dat)
+
+    @classmethod
+    def from_array(cls, dat: 'np.ndarray') -> 'CameraParameter':
+        """Construct a camera parameter data structure from the 9 floats dumped by
+        unreal: location (3), rotation (roll, pitch, yaw), fov and image size (2).
+
+        Args:
+            dat (np.ndarray): Camera parameters of shape (9,).
+
+        Returns:
+            CameraParameter: An instance of CameraParameter class.
+        """
+        dat = np.asarray(dat, np.float32).reshape(9)
         location = dat[:3]
         rotation = dat[3:6]
         camera_fov = dat[6]
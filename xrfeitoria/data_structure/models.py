@@ -250,6 +250,23 @@ class RenderJobUnreal(BaseModel):
     )
     export_vertices: bool = Field(default=False, description='Whether to export vertices of the render job.')
     export_skeleton: bool = Field(default=False, description='Whether to export skeleton of the render job.')
+    shared_memory_name: Optional[str] = Field(
+        default=None,
+        description=(
+            'Name of the shared memory region to stream the frames into while rendering, '
+            'read by :class:`~xrfeitoria.utils.shared_memory.SharedFrameReader`. None to disable.'
+        ),
+    )
+    resume: bool = Field(
+        default=False,
+        description='Whether to skip the frames a previous render of the job has completed, e.g. after a crash.',
+    )
+    shard_index: int = Field(default=0, ge=0, description='Index of the slice of the playback range rendered by the job.')
+    shard_count: int = Field(
+        default=1,
+        ge=1,
+        description='Number of slices of the playback range, rendered by separate jobs whose outputs are merged afterwards.',
+    )
 
     class Config:
         use_enum_values = True
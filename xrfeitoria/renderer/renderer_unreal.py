@@ -1,4 +1,5 @@
 import json
+import re
 import shutil
 import socket
 from pathlib import Path
@@ -43,6 +44,10 @@ class RendererUnreal(RendererBase):
         anti_aliasing: 'Optional[RenderJob.AntiAliasSetting]' = None,
         export_vertices: bool = False,
         export_skeleton: bool = False,
+        shared_memory_name: Optional[str] = None,
+        resume: bool = False,
+        shard_index: int = 0,
+        shard_count: int = 1,
     ) -> None:
         """Add a rendering job to the renderer queue.
 
@@ -58,6 +63,14 @@ class RendererUnreal(RendererBase):
             anti_aliasing (Optional[RenderJob.AntiAliasSetting], optional): Anti aliasing setting. Defaults to None.
             export_vertices (bool, optional): Whether to export vertices. Defaults to False.
             export_skeleton (bool, optional): Whether to export skeleton. Defaults to False.
+            shared_memory_name (Optional[str], optional): Stream the frames into this shared memory region while rendering,
+                read them with :class:`~xrfeitoria.utils.shared_memory.SharedFrameReader`. Defaults to None.
+            resume (bool, optional): Skip the frames completed by a previous render of the same job,
+                listed in the manifests of ``{output_path}/.xf_resume``. Defaults to False.
+            shard_index (int, optional): Index of the slice of the playback range to render, see ``shard_count``. Defaults to 0.
+            shard_count (int, optional): Split the playback range in this many slices rendered by separate jobs, e.g. on
+                several machines. Merge their outputs with :meth:`~xrfeitoria.renderer.renderer_unreal.RendererUnreal.merge_shards`
+                once every shard is rendered. Defaults to 1.
 
         Note:
             The motion blur is turned off by default. If you want to turn it on, please set ``r.MotionBlurQuality`` to a non-zero value in ``console_variables``.
@@ -80,6 +93,10 @@ class RendererUnreal(RendererBase):
             anti_aliasing=anti_aliasing,
             export_vertices=export_vertices,
             export_skeleton=export_skeleton,
+            shared_memory_name=shared_memory_name,
+            resume=resume,
+            shard_index=shard_index,
+            shard_count=shard_count,
         )
         cls._add_job_in_engine(job.model_dump(mode='json'))
         cls.render_queue.append(job)
@@ -99,7 +116,7 @@ class RendererUnreal(RendererBase):
 
     @classmethod
     @render_status
-    def render_jobs(cls) -> None:
+    def render_jobs(cls, camera_json_per_frame: bool = False) -> None:
         """Render all jobs in the renderer queue.
 
         This method starts the rendering process by setting up a socket connection with
@@ -113,6 +130,11 @@ class RendererUnreal(RendererBase):
         actor_infos.
 
         Also, this method will clear the render queue after rendering.
+
+        Args:
+            camera_json_per_frame (bool, optional): Also write the per-frame camera parameters as
+                ``camera_params/{camera_name}/{frame_number}.json``, the layout of the previous versions.
+                Defaults to False, only ``camera_params/{camera_name}.npz`` is written.
         """
         if len(cls.render_queue) == 0:
             logger.warning(
@@ -161,13 +183,65 @@ class RendererUnreal(RendererBase):
         server.close()
 
         # post process, including: convert cam params.
-        cls._post_process()
+        cls._post_process(camera_json_per_frame=camera_json_per_frame)
 
         # clear render queue
         cls.clear()
 
     @classmethod
-    def _post_process(cls) -> None:
+    def merge_shards(
+        cls, output_path: PathLike, sequence_name: str, export_vertices: bool = True, camera_json_per_frame: bool = False
+    ) -> None:
+        """Merge the outputs of the shards of a sequence (``shard_count`` of
+        :meth:`add_job`), once every shard is rendered, and convert them like the
+        outputs of a whole render.
+
+        Args:
+            output_path (PathLike): Output path of the jobs of the shards.
+            sequence_name (str): Name of the sequence.
+            export_vertices (bool, optional): Whether the jobs exported vertices. Defaults to True.
+            camera_json_per_frame (bool, optional): Also write the per-frame camera parameters as json files,
+                see :meth:`render_jobs`. Defaults to False.
+        """
+        from ..utils.chunked_file import merge_shards  # isort:skip
+
+        seq_path = Path(output_path).resolve() / sequence_name
+        # every output folder of the sequence may hold shard files, not only camera_params and vertices
+        shard_folders = sorted({file.parent for file in seq_path.glob('**/*_shard*of*.xfc')})
+        for folder in shard_folders:
+            merged = merge_shards(folder)
+            if merged:
+                logger.info(f'Merged the shards of {len(merged)} files in "{folder.as_posix()}"')
+        cls._convert_outputs(seq_path, export_vertices=export_vertices, camera_json_per_frame=camera_json_per_frame)
+
+    @classmethod
+    def _post_process(cls, camera_json_per_frame: bool = False) -> None:
+        for job in cls.render_queue:
+            seq_name = job.sequence_path.split('/')[-1]
+            if job.shard_count > 1:
+                # the outputs of the other shards may not be rendered yet
+                logger.info(
+                    f'Rendered shard {job.shard_index + 1}/{job.shard_count} of "{seq_name}", '
+                    'convert the outputs with `RendererUnreal.merge_shards` once every shard is rendered'
+                )
+                continue
+            cls._convert_outputs(
+                Path(job.output_path).resolve() / seq_name,
+                export_vertices=job.export_vertices,
+                camera_json_per_frame=camera_json_per_frame,
+            )
+
+    @classmethod
+    def _convert_outputs(cls, seq_path: Path, export_vertices: bool, camera_json_per_frame: bool = False) -> None:
+        """Convert the outputs of a sequence written by the engine, see
+        :meth:`_post_process`.
+
+        Args:
+            seq_path (Path): Output folder of the sequence, ``{output_path}/{sequence_name}``.
+            export_vertices (bool): Whether the job exported vertices.
+            camera_json_per_frame (bool, optional): Also write the per-frame camera parameters as json files,
+                see :meth:`render_jobs`. Defaults to False.
+        """
         import numpy as np  # isort:skip
         from ..camera.camera_parameter import CameraParameter  # isort:skip
 
@@ -181,6 +255,34 @@ class RendererUnreal(RendererBase):
             cam_param.dump(camera_file.with_suffix('.json').as_posix())
             camera_file.unlink()
 
+        def convert_camera_container(container_file: Path) -> None:
+            """Convert per-frame camera parameters from a chunked shot file `.xfc` to one
+            `{camera_name}.npz` of all the frames, with the arrays ``frame_numbers`` (frame,),
+            ``K`` (frame, 3, 3), ``R`` (frame, 3, 3) and ``T`` (frame, 3), camera to world in opencv convention.
+            Also to `{camera_name}/{frame_number}.json` with `camera_json_per_frame`.
+
+            Args:
+                container_file (Path): Path to the chunked file of a camera.
+            """
+            from ..utils.chunked_file import load_chunked_file  # isort:skip
+
+            frames, cam_infos = load_chunked_file(container_file, mmap=False)
+            cam_params = [CameraParameter.from_array(cam_info) for cam_info in cam_infos]
+            if cam_params:
+                np.savez_compressed(
+                    container_file.with_suffix('.npz'),
+                    frame_numbers=np.asarray(frames, np.int32),
+                    K=np.stack([cam_param.intrinsic33() for cam_param in cam_params]).astype(np.float32),
+                    R=np.stack([cam_param.extrinsic_r for cam_param in cam_params]).astype(np.float32),
+                    T=np.stack([cam_param.extrinsic_t for cam_param in cam_params]).astype(np.float32),
+                )
+            if camera_json_per_frame:
+                camera_folder = container_file.with_suffix('')
+                camera_folder.mkdir(exist_ok=True)
+                for frame, cam_param in zip(frames, cam_params):
+                    cam_param.dump((camera_folder / f'{int(frame):04d}.json').as_posix())
+            container_file.unlink()
+
         def convert_vertices(folder: Path) -> None:
             """Convert vertices from `.bin` to `.npz`. Merge all vertices files into one
             `.npz` file.
@@ -190,23 +292,83 @@ class RendererUnreal(RendererBase):
             """
             # Get all vertices files in the folder and sort them
             vertices_files = sorted(folder.glob('*.dat'))
-            # Read all vertices files into a list
-            vertices = [
-                np.frombuffer(vertices_file.read_bytes(), np.float32).reshape(-1, 3) for vertices_file in vertices_files
-            ]
-            if not vertices:
+            local_vertices_file = folder / 'local.bin'
+            if local_vertices_file.exists():
+                # Rigid mesh, each file is a 4x4 local-to-world matrix
+                matrices = [
+                    np.frombuffer(vertices_file.read_bytes(), np.float32).reshape(4, 4)
+                    for vertices_file in vertices_files
+                ]
+                if matrices:
+                    vertices = apply_rigid_transforms(local_vertices_file, np.stack(matrices))
+                    save_vertices(vertices, folder.with_suffix('.npz'))
+                # Remove the folder, local vertices of shot containers have been used already
+                shutil.rmtree(folder)
+                return
+
+            if not vertices_files:
                 return
+            from ..utils.vertex_encoding import decode_vertex_frames  # isort:skip
+
+            # Decode all vertices files into one array with shape (frame, verts, 3), raw float32 files have no header
+            vertices = decode_vertex_frames(vertices_file.read_bytes() for vertices_file in vertices_files)
+            save_vertices(vertices, folder.with_suffix('.npz'))
+            # Remove the folder
+            shutil.rmtree(folder)
+
+        def convert_vertices_container(container_file: Path) -> None:
+            """Convert vertices from a chunked shot file `.xfc` to `.npz`.
+
+            Args:
+                container_file (Path): Path to the chunked file of an actor.
+            """
+            from ..utils.chunked_file import load_chunked_file  # isort:skip
+
+            _, vertices = load_chunked_file(container_file, mmap=False)
+            if len(vertices) == 0:
+                return
+            if vertices.dtype == np.uint8:
+                # Byte records, the encoded frames of `VertexExport`
+                from ..utils.vertex_encoding import decode_vertex_frames  # isort:skip
+
+                vertices = decode_vertex_frames(vertices)
+            if vertices.shape[-1] == 16:
+                # Rigid mesh, each record is a 4x4 local-to-world matrix,
+                # local vertices are in `{actor_name}/local.bin` (without the `_shot{idx}` suffix)
+                actor_name = re.sub(r'_shot\d{3}$', '', container_file.stem)
+                local_vertices_file = container_file.parent / actor_name / 'local.bin'
+                vertices = apply_rigid_transforms(local_vertices_file, vertices.reshape(-1, 4, 4))
+            save_vertices(vertices, container_file.with_suffix('.npz'))
+            container_file.unlink()
+
+        def apply_rigid_transforms(local_vertices_file: Path, matrices: 'np.ndarray') -> 'np.ndarray':
+            """Transform the local vertices of a rigid mesh by the matrix of each frame.
+
+            Args:
+                local_vertices_file (Path): Path to the local vertices of the mesh, float32 (verts, 3).
+                matrices (np.ndarray): Local-to-world matrices of shape (frame, 4, 4), row-major,
+                    with the translation in the last row (unreal convention).
+
+            Returns:
+                np.ndarray: Vertices in world space of shape (frame, verts, 3).
+            """
+            local_vertices = np.frombuffer(local_vertices_file.read_bytes(), np.float32).reshape(-1, 3)
+            # row vectors: v' = v @ M[:3, :3] + M[3, :3]
+            return np.einsum('vi,fij->fvj', local_vertices, matrices[:, :3, :3]) + matrices[:, None, 3, :3]
 
-            # Stack all vertices into one array with shape (frame, verts, 3)
-            vertices = np.stack(vertices)
+        def save_vertices(vertices: 'np.ndarray', npz_file: Path) -> None:
+            """Save vertices of shape (frame, verts, 3) to `.npz` in opencv convention.
+
+            Args:
+                vertices (np.ndarray): Vertices in unreal convention, unit: cm.
+                npz_file (Path): Path to the `.npz` file.
+            """
             # Convert convention from unreal to opencv, [x, y, z] -> [y, -z, x]
             vertices = np.stack([vertices[:, :, 1], -vertices[:, :, 2], vertices[:, :, 0]], axis=-1)
             vertices /= 100  # convert from cm to m
 
             # Save the vertices in a compressed `.npz` file
-            np.savez_compressed(folder.with_suffix('.npz'), verts=vertices, faces=None)
-            # Remove the folder
-            shutil.rmtree(folder)
+            np.savez_compressed(npz_file, verts=vertices, faces=None)
 
         def convert_actor_infos(folder: Path) -> None:
             """Convert stencil value from `.dat` to `.json`.
@@ -234,25 +396,31 @@ class RendererUnreal(RendererBase):
             # Remove the folder
             shutil.rmtree(folder)
 
-        for job in cls.render_queue:
-            seq_name = job.sequence_path.split('/')[-1]
-            seq_path = Path(job.output_path).resolve() / seq_name
-
-            # 1. convert camera parameters from `.bat` to `.json` with xrprimer
-            # glob camera files in {seq_path}/{cam_param_dir}/*
-            camera_files = sorted(seq_path.glob(f'{RenderOutputEnumUnreal.camera_params.value}/*.dat'))
-            for camera_file in camera_files:
-                convert_camera(camera_file)
-
-            # 2. convert actor infos from `.dat` to `.json`
-            convert_actor_infos(folder=seq_path / RenderOutputEnumUnreal.actor_infos.value)
-
-            # 3. convert vertices from `.bin` to `.npz`
-            if job.export_vertices:
-                # glob actors in {seq_path}/vertices/*
-                actor_folders = sorted(seq_path.glob(f'{RenderOutputEnumUnreal.vertices.value}/*'))
-                for actor_folder in actor_folders:
+        # 1. convert camera parameters from `.bat` to `.json` with xrprimer
+        # glob camera files in {seq_path}/{cam_param_dir}/*
+        camera_files = sorted(seq_path.glob(f'{RenderOutputEnumUnreal.camera_params.value}/*.dat'))
+        for camera_file in camera_files:
+            convert_camera(camera_file)
+        # per-frame camera parameters, saved when `bSaveCameraInfoPerFrame` is enabled
+        camera_containers = sorted(seq_path.glob(f'{RenderOutputEnumUnreal.camera_params.value}/*.xfc'))
+        for camera_container in camera_containers:
+            convert_camera_container(camera_container)
+
+        # 2. convert actor infos from `.dat` to `.json`
+        convert_actor_infos(folder=seq_path / RenderOutputEnumUnreal.actor_infos.value)
+
+        # 3. convert vertices from `.bin` to `.npz`
+        if export_vertices:
+            # glob actors in {seq_path}/vertices/*
+            # shot containers first, they may need the local vertices in the actor folders
+            actor_folders = sorted(
+                seq_path.glob(f'{RenderOutputEnumUnreal.vertices.value}/*'), key=lambda p: (p.is_dir(), p.name)
+            )
+            for actor_folder in actor_folders:
+                if actor_folder.is_dir():
                     convert_vertices(actor_folder)
+                elif actor_folder.suffix == '.xfc':
+                    convert_vertices_container(actor_folder)
 
     @staticmethod
     def _add_job_in_engine(job: 'Dict[str, Any]') -> None:
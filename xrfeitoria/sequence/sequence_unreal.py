@@ -45,6 +45,10 @@ class SequenceUnreal(SequenceBase):
         anti_aliasing: 'Optional[RenderJobUnreal.AntiAliasSetting]' = None,
         export_vertices: bool = False,
         export_skeleton: bool = False,
+        shared_memory_name: Optional[str] = None,
+        resume: bool = False,
+        shard_index: int = 0,
+        shard_count: int = 1,
     ) -> None:
         """Add the sequence to the renderer's job queue. Can only be called after the
         sequence is instantiated using
@@ -63,6 +67,14 @@ class SequenceUnreal(SequenceBase):
                 The anti-aliasing settings for the render job. Defaults to None.
             export_vertices (bool, optional): Whether to export vertices. Defaults to False.
             export_skeleton (bool, optional): Whether to export the skeleton. Defaults to False.
+            shared_memory_name (Optional[str], optional): Stream the frames into this shared memory region while rendering,
+                read them with :class:`~xrfeitoria.utils.shared_memory.SharedFrameReader`. Defaults to None.
+            resume (bool, optional): Skip the frames completed by a previous render of the same job,
+                listed in the manifests of ``{output_path}/.xf_resume``. Defaults to False.
+            shard_index (int, optional): Index of the slice of the playback range to render, see ``shard_count``. Defaults to 0.
+            shard_count (int, optional): Split the playback range in this many slices rendered by separate jobs, e.g. on
+                several machines. Merge their outputs with :meth:`~xrfeitoria.renderer.renderer_unreal.RendererUnreal.merge_shards`
+                once every shard is rendered. Defaults to 1.
 
         Examples:
             >>> import xrfeitoria as xf
@@ -91,6 +103,10 @@ class SequenceUnreal(SequenceBase):
             anti_aliasing=anti_aliasing,
             export_vertices=export_vertices,
             export_skeleton=export_skeleton,
+            shared_memory_name=shared_memory_name,
+            resume=resume,
+            shard_index=shard_index,
+            shard_count=shard_count,
         )
         logger.info(
             f'[cyan]Added[/cyan] sequence "{cls.name}" to [bold]`Renderer`[/bold] '
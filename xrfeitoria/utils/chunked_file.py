@@ -0,0 +1,192 @@
+"""Reader of the chunked shot files (``.xfc``) exported by the XRFeitoriaUnreal
+plugin.
+
+A chunked file holds every frame of a shot for one actor, with the layout:
+
+- header (64 bytes)
+- frame index, ``int32[frame_capacity]``, the frame number of each slot (-1 if empty)
+- records, ``float32[frame_capacity, element_count, element_components]``, 64-byte aligned,
+  or ``uint8`` for the byte records of encoded vertex frames (see :mod:`xrfeitoria.utils.vertex_encoding`)
+
+A sequence rendered in shards (``shard_count`` of the render job) has one file per shard,
+``{name}_shard{index}of{count}.xfc``, merged by :func:`merge_shards`.
+"""
+
+import os
+import re
+from pathlib import Path
+from typing import Dict, List, NamedTuple, Sequence, Tuple
+
+import numpy as np
+
+from ..data_structure.constants import PathLike
+
+__all__ = ['ChunkedFileHeader', 'read_chunked_header', 'load_chunked_file', 'merge_chunked_files', 'merge_shards']
+
+MAGIC = 0x46434658  # "XFCF"
+HEADER_DTYPE = np.dtype(
+    [
+        ('magic', '<u4'),
+        ('version', '<u4'),
+        ('header_size', '<u4'),
+        ('frame_capacity', '<u4'),
+        ('record_stride', '<u4'),
+        ('element_count', '<u4'),
+        ('element_components', '<u4'),
+        ('data_type', '<u4'),
+        ('index_offset', '<u8'),
+        ('data_offset', '<u8'),
+        ('frames_written', '<u4'),
+        ('first_frame_number', '<i4'),
+        ('reserved', '<u4', (2,)),
+    ]
+)
+DATA_TYPES = {0: np.float32, 1: np.uint8}
+DATA_ALIGNMENT = 64
+SHARD_PATTERN = re.compile(r'(?P<name>.*)_shard(?P<index>\d{3})of(?P<count>\d{3})')
+
+
+class ChunkedFileHeader(NamedTuple):
+    """Header of a chunked file."""
+
+    version: int
+    frame_capacity: int
+    element_count: int
+    element_components: int
+    dtype: np.dtype
+    index_offset: int
+    data_offset: int
+    frames_written: int
+
+
+def read_chunked_header(file: PathLike) -> ChunkedFileHeader:
+    """Read the header of a chunked file.
+
+    Args:
+        file (PathLike): Path to the ``.xfc`` file.
+
+    Returns:
+        ChunkedFileHeader: The parsed header.
+    """
+    header = np.fromfile(file, dtype=HEADER_DTYPE, count=1)
+    if header.size == 0 or header['magic'][0] != MAGIC:
+        raise ValueError(f'{file} is not a valid chunked file')
+    header = header[0]
+    return ChunkedFileHeader(
+        version=int(header['version']),
+        frame_capacity=int(header['frame_capacity']),
+        element_count=int(header['element_count']),
+        element_components=int(header['element_components']),
+        dtype=np.dtype(DATA_TYPES[int(header['data_type'])]),
+        index_offset=int(header['index_offset']),
+        data_offset=int(header['data_offset']),
+        frames_written=int(header['frames_written']),
+    )
+
+
+def load_chunked_file(file: PathLike, mmap: bool = True, valid_only: bool = True):
+    """Load a chunked file as numpy arrays.
+
+    Args:
+        file (PathLike): Path to the ``.xfc`` file.
+        mmap (bool, optional): Whether to memory-map the records instead of reading them. Defaults to True.
+        valid_only (bool, optional): Whether to drop the empty slots. This makes a copy of the records
+            when some slots are empty. Defaults to True.
+
+    Returns:
+        Tuple[np.ndarray, np.ndarray]: ``frames`` of shape (N,) and ``data`` of shape
+            (N, element_count, element_components).
+    """
+    header = read_chunked_header(file)
+    frames = np.fromfile(file, dtype='<i4', count=header.frame_capacity, offset=header.index_offset)
+    shape = (header.frame_capacity, header.element_count, header.element_components)
+    if mmap:
+        data = np.memmap(file, dtype=header.dtype, mode='r', offset=header.data_offset, shape=shape)
+    else:
+        count = int(np.prod(shape))
+        data = np.fromfile(file, dtype=header.dtype, count=count, offset=header.data_offset).reshape(shape)
+
+    if valid_only:
+        valid = frames >= 0
+        if not valid.all():
+            return frames[valid], data[valid]
+    return frames, data
+
+
+def merge_chunked_files(files: Sequence[PathLike], output: PathLike) -> None:
+    """Merge chunked files of the same layout into one, e.g. the shards of a shot. The
+    records are sorted by frame number, the empty slots are dropped.
+
+    Args:
+        files (Sequence[PathLike]): Paths to the ``.xfc`` files to merge.
+        output (PathLike): Path to the merged ``.xfc`` file, written to a temporary file first,
+            so it may be one of `files`.
+
+    Raises:
+        ValueError: The files have different layouts.
+    """
+    headers = [read_chunked_header(file) for file in files]
+    layout = (headers[0].element_count, headers[0].element_components, headers[0].dtype)
+    for file, header in zip(files, headers):
+        if (header.element_count, header.element_components, header.dtype) != layout:
+            raise ValueError(f'{file} has a different layout than {files[0]}')
+
+    loaded = [load_chunked_file(file, mmap=False) for file in files]
+    frames = np.concatenate([frames for frames, _ in loaded])
+    data = np.concatenate([data for _, data in loaded])
+    order = np.argsort(frames, kind='stable')
+    frames, data = frames[order].astype('<i4'), np.ascontiguousarray(data[order])
+
+    # same version and record stride as the parts, the offsets of the new capacity
+    header = np.fromfile(files[0], dtype=HEADER_DTYPE, count=1)
+    index_offset = int(header['header_size'][0])
+    data_offset = -(-(index_offset + frames.nbytes) // DATA_ALIGNMENT) * DATA_ALIGNMENT
+    header['frame_capacity'] = len(frames)
+    header['index_offset'] = index_offset
+    header['data_offset'] = data_offset
+    header['frames_written'] = len(frames)
+    header['first_frame_number'] = frames[0] if len(frames) > 0 else 0
+
+    output = Path(output)
+    temp_output = output.with_name(f'{output.name}.tmp')
+    with temp_output.open('wb') as f:
+        f.write(header.tobytes())
+        f.seek(index_offset)
+        f.write(frames.tobytes())
+        f.seek(data_offset)
+        f.write(data.tobytes())
+    os.replace(temp_output, output)
+
+
+def merge_shards(folder: PathLike, allow_missing: bool = False) -> List[Path]:
+    """Merge the files of the shards ``{name}_shard{index}of{count}.xfc`` of a folder
+    into ``{name}.xfc``, and delete them.
+
+    Args:
+        folder (PathLike): Folder of the chunked files, e.g. ``{sequence_name}/camera_params``.
+        allow_missing (bool, optional): Merge the shards found when some are missing, e.g. the empty
+            shards of a sequence with fewer frames than shards. Defaults to False.
+
+    Raises:
+        FileNotFoundError: Some shards are missing, and `allow_missing` is False.
+
+    Returns:
+        List[Path]: The merged files.
+    """
+    shards: Dict[Tuple[str, int], Dict[int, Path]] = {}
+    for file in sorted(Path(folder).glob('*.xfc')):
+        match = SHARD_PATTERN.fullmatch(file.stem)
+        if match:
+            shards.setdefault((match['name'], int(match['count'])), {})[int(match['index'])] = file
+
+    merged = []
+    for (name, count), parts in shards.items():
+        missing = sorted(set(range(count)) - set(parts))
+        if missing and not allow_missing:
+            raise FileNotFoundError(f'Shards {missing} of {name} are missing in {folder}, are they rendered?')
+        output = Path(folder) / f'{name}.xfc'
+        merge_chunked_files([parts[index] for index in sorted(parts)], output)
+        for part in parts.values():
+            part.unlink()
+        merged.append(output)
+    return merged
@@ -0,0 +1,271 @@
+"""Reader of the frames streamed by the ``MoviePipelineSharedMemoryOutput`` of the
+XRFeitoriaUnreal plugin, enabled by ``shared_memory_name`` of the render job.
+
+The shared memory region is a ring of slots, one frame per slot, with the layout:
+
+- header (64 bytes), with the sequence of the last written frame and of the last released one
+- slot infos, ``slot_count * 32 bytes``, the sequence, frame number and shot index of each slot
+- slots, ``slot_count * slot_size`` bytes from ``header_size``: an entry table describing the arrays
+  of the frame (name, dtype, shape, offset), followed by the arrays
+
+The region is created by the engine as ``Global\\{name}`` on Windows and ``/{name}`` elsewhere,
+:func:`get_region_name` gives the name to open for ``shared_memory_name``, a prefix given in it is stripped
+on both sides.
+
+The renderer waits for a slot to be released before writing into it again, unless it drops frames
+when the ring is full (after a wait times out, it drops the frames until the reader catches up).
+The arrays of a frame are copied out of the ring by default, and checked against the sequence of the slot
+once copied, so a frame overwritten while being read is skipped instead of torn.
+With ``copy=False`` they are numpy views of the shared memory, valid until the frame is released,
+and only safe when the renderer doesn't drop frames.
+
+Examples:
+    >>> from xrfeitoria.utils.shared_memory import SharedFrameReader
+    >>> with SharedFrameReader('xrfeitoria_frames') as reader:
+    ...     for frame in reader:
+    ...         rgb = frame['rgb']  # (H, W, 4) uint8, BGRA
+    ...         armature = frame['skeleton/SMPL-XL']  # (bones, 3) float32
+"""
+
+import sys
+import time
+from multiprocessing import shared_memory
+from typing import Dict, Iterator, Optional
+
+import numpy as np
+
+__all__ = ['SharedFrame', 'SharedFrameReader', 'get_region_name']
+
+MAGIC = 0x4D534658  # "XFSM"
+HEADER_DTYPE = np.dtype(
+    [
+        ('magic', '<u4'),
+        ('version', '<u4'),
+        ('header_size', '<u4'),
+        ('slot_count', '<u4'),
+        ('slot_size', '<u8'),
+        ('write_sequence', '<u8'),
+        ('read_sequence', '<u8'),
+        ('status', '<u4'),
+        ('reserved', '<u4', (5,)),
+    ]
+)
+SLOT_INFO_DTYPE = np.dtype(
+    [
+        ('sequence', '<u8'),
+        ('frame_number', '<i4'),
+        ('shot_index', '<i4'),
+        ('num_entries', '<u4'),
+        ('reserved', '<u4'),
+        ('used_bytes', '<u8'),
+    ]
+)
+ENTRY_DTYPE = np.dtype(
+    [
+        ('name', 'S56'),
+        ('data_type', '<u4'),
+        ('num_dims', '<u4'),
+        ('shape', '<u4', (4,)),
+        ('offset', '<u8'),
+        ('num_bytes', '<u8'),
+    ]
+)
+MAX_ENTRIES = 32
+DATA_TYPES = {0: np.uint8, 1: np.float16, 2: np.float32, 3: np.int32}
+STATUS_FINISHED = 1
+REGION_PREFIXES = ('Global\\', 'Local\\', '/')
+
+
+def get_region_name(name: str, platform: Optional[str] = None) -> str:
+    """Name of the region created by the renderer for ``shared_memory_name``, to open with
+    :class:`multiprocessing.shared_memory.SharedMemory`. Matches ``FXFSharedFrameRing::NormalizeName``.
+
+    Args:
+        name (str): ``shared_memory_name`` of the render job, with or without the prefix of the platform.
+        platform (Optional[str], optional): ``sys.platform`` of the renderer. Defaults to the current one.
+
+    Returns:
+        str: ``Global\\{name}`` on Windows, ``{name}`` elsewhere (``SharedMemory`` adds the leading slash).
+    """
+    name = name.strip()
+    for prefix in REGION_PREFIXES:
+        if name.startswith(prefix):
+            name = name[len(prefix) :]
+    if (platform or sys.platform) == 'win32':
+        return 'Global\\' + name
+    return name
+
+
+class SharedFrame:
+    """A frame of the ring. With ``copy=False`` of the reader, the arrays are views of
+    the shared memory, copy them to keep them after :meth:`SharedFrameReader.release`."""
+
+    def __init__(self, sequence: int, frame_number: int, shot_index: int, arrays: Dict[str, np.ndarray]) -> None:
+        self.sequence = sequence
+        self.frame_number = frame_number
+        self.shot_index = shot_index
+        self.arrays = arrays
+
+    def __getitem__(self, name: str) -> np.ndarray:
+        return self.arrays[name]
+
+    def __contains__(self, name: str) -> bool:
+        return name in self.arrays
+
+    def keys(self):
+        return self.arrays.keys()
+
+    def __repr__(self) -> str:
+        return f'SharedFrame(frame_number={self.frame_number}, shot_index={self.shot_index}, arrays={list(self.arrays)})'
+
+
+class SharedFrameReader:
+    """Map the shared memory ring and read the frames in order."""
+
+    def __init__(self, name: str = 'xrfeitoria_frames', timeout: float = 60.0, copy: bool = True) -> None:
+        """Open the ring, waiting for the renderer to create it.
+
+        Args:
+            name (str, optional): ``shared_memory_name`` of the render job. Defaults to 'xrfeitoria_frames'.
+            timeout (float, optional): Max time (seconds) to wait for the render to start. Defaults to 60.
+            copy (bool, optional): Copy the arrays out of the ring. Without copying they're views of the
+                shared memory, which a renderer dropping frames may overwrite while they're used. Defaults to True.
+
+        Raises:
+            TimeoutError: The region doesn't exist after `timeout`.
+            ValueError: The region isn't a ring of frames.
+        """
+        self._current: Optional[SharedFrame] = None
+        self.copy = copy
+        region_name = get_region_name(name)
+        start = time.monotonic()
+        while True:
+            try:
+                self._shm = shared_memory.SharedMemory(name=region_name, create=False)
+                break
+            except FileNotFoundError:
+                if time.monotonic() - start > timeout:
+                    raise TimeoutError(f'Shared memory "{region_name}" not found, is the render running?')
+                time.sleep(0.1)
+        self._untrack(self._shm)
+
+        self._buffer = np.frombuffer(self._shm.buf, np.uint8)
+        self._header = self._buffer[: HEADER_DTYPE.itemsize].view(HEADER_DTYPE)
+        if int(self._header['magic'][0]) != MAGIC:
+            self.close()
+            raise ValueError(f'Shared memory "{name}" is not a ring of frames')
+        self.slot_count = int(self._header['slot_count'][0])
+        self.slot_size = int(self._header['slot_size'][0])
+        self._header_size = int(self._header['header_size'][0])
+        slot_info_end = HEADER_DTYPE.itemsize + self.slot_count * SLOT_INFO_DTYPE.itemsize
+        self._slot_infos = self._buffer[HEADER_DTYPE.itemsize : slot_info_end].view(SLOT_INFO_DTYPE)
+
+        # the frames written before the reader started are read as well, as long as they're still in the ring
+        self._last_sequence = int(self._header['read_sequence'][0])
+
+    @staticmethod
+    def _untrack(shm: shared_memory.SharedMemory) -> None:
+        # the region belongs to the renderer, the resource tracker must not unlink it when this process exits
+        try:
+            from multiprocessing import resource_tracker
+
+            resource_tracker.unregister(shm._name, 'shared_memory')
+        except Exception:
+            pass
+
+    @property
+    def write_sequence(self) -> int:
+        return int(self._header['write_sequence'][0])
+
+    @property
+    def is_finished(self) -> bool:
+        """Whether the render has finished, the frames still in the ring can be read."""
+        return int(self._header['status'][0]) == STATUS_FINISHED
+
+    def read(self, timeout: Optional[float] = None) -> Optional[SharedFrame]:
+        """Wait for the next frame. The previous frame is released.
+
+        Args:
+            timeout (Optional[float], optional): Max time (seconds) to wait, None to wait until the render finishes.
+
+        Returns:
+            Optional[SharedFrame]: None when the render has finished and every frame is read, or on timeout.
+        """
+        self.release()
+        start = time.monotonic()
+        while True:
+            written = self.write_sequence
+            if written > self._last_sequence:
+                # frames overwritten by a renderer dropping frames are skipped
+                sequence = max(self._last_sequence + 1, written - self.slot_count + 1)
+                frame = self._read_slot(sequence)
+                if frame is not None:
+                    self._current = frame
+                    return frame
+                self._last_sequence = sequence
+                continue
+            if self.is_finished:
+                return None
+            if timeout is not None and time.monotonic() - start > timeout:
+                return None
+            time.sleep(0.0005)
+
+    def _read_slot(self, sequence: int) -> Optional[SharedFrame]:
+        slot = (sequence - 1) % self.slot_count
+        info = self._slot_infos[slot]
+        if int(info['sequence']) != sequence:
+            return None
+        frame_number = int(info['frame_number'])
+        shot_index = int(info['shot_index'])
+
+        slot_start = self._header_size + slot * self.slot_size
+        num_entries = min(int(info['num_entries']), MAX_ENTRIES)
+        entries = self._buffer[slot_start : slot_start + num_entries * ENTRY_DTYPE.itemsize].view(ENTRY_DTYPE)
+        arrays = {}
+        for entry in entries:
+            offset = slot_start + int(entry['offset'])
+            data = self._buffer[offset : offset + int(entry['num_bytes'])]
+            shape = tuple(int(dim) for dim in entry['shape'][: int(entry['num_dims'])])
+            array = data.view(DATA_TYPES[int(entry['data_type'])]).reshape(shape)
+            arrays[entry['name'].decode('utf-8')] = array.copy() if self.copy else array
+        # the renderer clears the sequence of the slot before writing into it again (a seqlock),
+        # the frame is torn if it changed while being read, skip it like a dropped frame
+        if int(self._slot_infos['sequence'][slot]) != sequence:
+            return None
+        return SharedFrame(
+            sequence=sequence,
+            frame_number=frame_number,
+            shot_index=shot_index,
+            arrays=arrays,
+        )
+
+    def release(self) -> None:
+        """Hand the slot of the current frame back to the renderer, its arrays are
+        invalid after that."""
+        if self._current is None:
+            return
+        self._last_sequence = self._current.sequence
+        self._header['read_sequence'] = self._last_sequence
+        self._current = None
+
+    def __iter__(self) -> Iterator[SharedFrame]:
+        while True:
+            frame = self.read()
+            if frame is None:
+                return
+            yield frame
+
+    def close(self) -> None:
+        """Release the current frame and unmap the region."""
+        if self._shm is None:
+            return
+        self.release()
+        self._header = self._slot_infos = self._buffer = None
+        self._shm.close()
+        self._shm = None
+
+    def __enter__(self) -> 'SharedFrameReader':
+        return self
+
+    def __exit__(self, *args) -> None:
+        self.close()
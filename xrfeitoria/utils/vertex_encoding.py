@@ -0,0 +1,127 @@
+"""Decoder of the encoded vertex frames exported by the XRFeitoriaUnreal plugin, see
+``VertexExport`` of the mesh operator options.
+
+An encoded frame (a ``.dat`` file, or a record of a chunked shot file) has the layout:
+
+- header (40 bytes)
+- payload of ``num_vertices * 3`` components:
+  ``float16`` offsets from ``origin`` (Float16), ``uint16`` quantized as ``origin + value * step`` (Fixed16 keyframe),
+  or ``int8`` deltas added to the values of the previous frame (Fixed16 delta frame)
+
+Raw float32 frames have no header. A frame is only decoded when the whole header is consistent
+(known encoding, zero reserved bytes, a payload of ``num_vertices``), so a raw frame whose first float
+happens to match the magic is still read as float32.
+"""
+
+from typing import Iterable, Optional, Union
+
+import numpy as np
+
+__all__ = ['is_encoded_frame', 'decode_vertex_frames']
+
+MAGIC = 0x45564658  # "XFVE"
+ENCODING_FLOAT16 = 1
+ENCODING_FIXED16 = 2
+HEADER_DTYPE = np.dtype(
+    [
+        ('magic', '<u4'),
+        ('encoding', 'u1'),
+        ('is_delta', 'u1'),
+        ('reserved', '<u2'),
+        ('num_vertices', '<u4'),
+        ('reference_frame', '<i4'),
+        ('origin', '<f4', (3,)),
+        ('step', '<f4', (3,)),
+    ]
+)
+
+BufferLike = Union[bytes, bytearray, memoryview, np.ndarray]
+
+
+def _as_bytes(frame: BufferLike) -> np.ndarray:
+    return np.frombuffer(frame, np.uint8) if not isinstance(frame, np.ndarray) else frame.reshape(-1).view(np.uint8)
+
+
+def _payload_size(header: np.void) -> Optional[int]:
+    """Size in bytes of the payload of the header, None when the header isn't one of
+    ``FXFVertexFrameHeader``."""
+    encoding = int(header['encoding'])
+    is_delta = int(header['is_delta'])
+    if int(header['magic']) != MAGIC or int(header['reserved']) != 0 or is_delta not in (0, 1):
+        return None
+    if not np.isfinite(header['origin']).all():
+        return None
+    count = int(header['num_vertices']) * 3
+    if encoding == ENCODING_FLOAT16:
+        # no delta frames, a keyframe of float16 offsets
+        if is_delta or int(header['reference_frame']) != -1:
+            return None
+        return count * 2
+    if encoding == ENCODING_FIXED16:
+        if not (header['step'] > 0).all():
+            return None
+        if not is_delta and int(header['reference_frame']) != -1:
+            return None
+        return count if is_delta else count * 2
+    return None
+
+
+def is_encoded_frame(frame: BufferLike) -> bool:
+    """Whether the frame is an encoded frame: a header of a known encoding,
+    followed by at least the payload of its ``num_vertices``.
+
+    Args:
+        frame (BufferLike): Bytes of the frame.
+
+    Returns:
+        bool: False for the raw float32 frames.
+    """
+    data = _as_bytes(frame)
+    if data.size < HEADER_DTYPE.itemsize:
+        return False
+    header = data[: HEADER_DTYPE.itemsize].view(HEADER_DTYPE)[0]
+    payload_size = _payload_size(header)
+    return payload_size is not None and data.size >= HEADER_DTYPE.itemsize + payload_size
+
+
+def decode_vertex_frames(frames: Iterable[BufferLike]) -> np.ndarray:
+    """Decode the frames of one mesh, in output order. A delta frame is applied to
+    the frame before it, so the sequence must start with a keyframe.
+
+    Args:
+        frames (Iterable[BufferLike]): Bytes of each frame, e.g. the ``.dat`` files sorted by frame number,
+            or the records of a chunked shot file. Padding after the payload is ignored.
+
+    Returns:
+        np.ndarray: Vertices of shape (frame, verts, 3), dtype=np.float32
+    """
+    vertices = []
+    quantized: Optional[np.ndarray] = None
+    for frame in frames:
+        data = _as_bytes(frame)
+        if not is_encoded_frame(data):
+            vertices.append(data.view(np.float32).reshape(-1, 3))
+            continue
+
+        header = data[: HEADER_DTYPE.itemsize].view(HEADER_DTYPE)[0]
+        count = int(header['num_vertices']) * 3
+        payload = data[HEADER_DTYPE.itemsize :]
+        encoding = int(header['encoding'])
+        if encoding == ENCODING_FLOAT16:
+            # offsets from the center of the frame, the origin is 0 in the frames of the previous versions
+            offsets = payload[: count * 2].view('<f2').astype(np.float32).reshape(-1, 3)
+            vertices.append(offsets + header['origin'])
+            continue
+
+        if header['is_delta']:
+            if quantized is None or quantized.size != count:
+                raise ValueError('Delta frame without the frame it applies to')
+            quantized = quantized + payload[:count].view(np.int8).astype(np.int32)
+        else:
+            quantized = payload[: count * 2].view('<u2').astype(np.int32)
+        positions = header['origin'] + quantized.reshape(-1, 3) * header['step']
+        vertices.append(positions.astype(np.float32))
+
+    if not vertices:
+        return np.zeros((0, 0, 3), np.float32)
+    return np.stack(vertices)
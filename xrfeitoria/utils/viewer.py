@@ -33,6 +33,9 @@ class ExrReader:
         if isinstance(exr_path, Path):
             exr_path = exr_path.as_posix()
         exr_mat = cv2.imread(exr_path, cv2.IMREAD_ANYCOLOR | cv2.IMREAD_ANYDEPTH)
+        if exr_mat.ndim == 2:
+            # single-channel (Y) exr, e.g. half float depth
+            exr_mat = np.repeat(exr_mat[..., None], 3, axis=-1)
         exr_mat = cv2.cvtColor(exr_mat, cv2.COLOR_BGR2RGB)
         self.exr_mat = exr_mat
 